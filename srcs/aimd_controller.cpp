@@ -0,0 +1,108 @@
+#include <time.h>
+#include <chrono>
+#include "aimd_controller.h"
+
+static int64_t nowNanos(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void AimdController::init(int min_limit, int max_limit, int start_limit, bool adapt)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (min_limit < 1)
+        min_limit = 1;
+    if (max_limit < min_limit)
+        max_limit = min_limit;
+    if (start_limit < min_limit)
+        start_limit = min_limit;
+    if (start_limit > max_limit)
+        start_limit = max_limit;
+    adaptive = adapt;
+    minLimit = adaptive ? min_limit : start_limit;
+    maxLimit = adaptive ? max_limit : start_limit;
+    limit = start_limit;
+    throughput = 0.0;
+    windowStart = nowNanos();
+    windowBytes = 0;
+    windowNanos = 0;
+    windowFiles = 0;
+    windowBacklog = false;
+    baseCost = 0.0;
+    settling = false;
+}
+
+void AimdController::record(uint64_t bytes, int64_t nanos, bool backlog)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    windowBytes += bytes;
+    windowNanos += nanos;
+    windowFiles++;
+    windowBacklog |= backlog;
+    int64_t now = nowNanos();
+    if (now - windowStart >= AIMD_WINDOW_MS * 1000000LL &&
+        windowFiles >= (uint64_t)(limit > AIMD_MIN_SAMPLES ? limit.load() : AIMD_MIN_SAMPLES))
+        adjust(now);
+}
+
+// Called with the mutex held
+void AimdController::adjust(int64_t now)
+{
+    throughput = windowBytes * 1e9 / (now - windowStart);
+    if (adaptive && windowBytes > 0) {
+        double cost = (double)windowNanos / windowBytes;
+        bool saturated = baseCost > 0.0 && cost > baseCost * AIMD_SATURATION;
+        if (baseCost == 0.0 || cost < baseCost)
+            baseCost = cost;
+        else
+            baseCost *= AIMD_BASELINE_DRIFT;
+
+        int cur = limit;
+        if (settling) {
+            settling = false;
+        } else if (saturated) {
+            int cut = (int)(cur * AIMD_DECREASE);
+            limit = cut > minLimit ? cut : minLimit.load();
+            settling = true;
+        } else if (windowBacklog && cur < maxLimit) {
+            // Only a stage with work waiting can show whether one more writer helps
+            limit = cur + 1;
+            grown.notify_all();
+        }
+    }
+    windowStart = now;
+    windowBytes = 0;
+    windowNanos = 0;
+    windowFiles = 0;
+    windowBacklog = false;
+}
+
+bool AimdController::admit(int index, int wait_ms)
+{
+    if (index < limit)
+        return true;
+    std::unique_lock<std::mutex> lock(mutex);
+    return grown.wait_for(lock, std::chrono::milliseconds(wait_ms), [this, index] { return index < limit; });
+}
+
+int AimdController::getLimit(void) const
+{
+    return limit;
+}
+
+int AimdController::getMin(void) const
+{
+    return minLimit;
+}
+
+int AimdController::getMax(void) const
+{
+    return maxLimit;
+}
+
+double AimdController::getThroughput(void) const
+{
+    return throughput;
+}
@@ -0,0 +1,59 @@
+#ifndef _AIMD_CONTROLLER_H
+#define _AIMD_CONTROLLER_H
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+#define AIMD_WINDOW_MS          500
+#define AIMD_MIN_SAMPLES        4
+// Write cost above this many times the baseline means the target is saturated
+#define AIMD_SATURATION         2.0
+#define AIMD_DECREASE           0.7
+// The baseline creeps up every window, so a change of target or file mix is learnt again
+#define AIMD_BASELINE_DRIFT     1.02
+
+/* Picks how many workers may write at once. Every finished file reports the
+ * time one worker spent per byte; that cost stays flat while the target has
+ * spare bandwidth and grows with every extra writer once it is saturated
+ * (a disk seeking between streams makes it grow faster). Once per window the
+ * limit grows by one while work is waiting and the cost stays near the best
+ * one seen, and is cut by AIMD_DECREASE as soon as the cost climbs above it.
+ */
+class AimdController
+{
+public:
+    // A fixed limit when not adaptive
+    void init(int min_limit, int max_limit, int start_limit, bool adaptive);
+    // One finished file: bytes moved in nanos by one worker, and whether more work was queued behind it
+    void record(uint64_t bytes, int64_t nanos, bool backlog);
+    // Waits at most wait_ms while worker `index' is above the limit, true once it may take work
+    bool admit(int index, int wait_ms);
+    int getLimit(void) const;
+    int getMin(void) const;
+    int getMax(void) const;
+    // Bytes per second over the last window
+    double getThroughput(void) const;
+
+private:
+    std::atomic<int> limit{1};
+    std::atomic<int> minLimit{1};
+    std::atomic<int> maxLimit{1};
+    std::atomic<double> throughput{0.0};
+    bool adaptive = false;
+
+    std::mutex mutex;
+    std::condition_variable grown;
+    int64_t windowStart = 0;
+    uint64_t windowBytes = 0;
+    int64_t windowNanos = 0;
+    uint64_t windowFiles = 0;
+    bool windowBacklog = false;
+    double baseCost = 0.0;      // lowest nanoseconds per byte of one worker
+    bool settling = false;      // the window after a cut still holds files of the old limit
+
+    void adjust(int64_t now);
+};
+
+#endif
@@ -0,0 +1,1464 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <deque>
+#include <list>
+#include <unordered_map>
+#include <vector>
+#include <string>
+#include "backup_engine.h"
+#include "media_meta.h"
+
+#define IO_BUF_LEN          (1024 * 1024)
+#define DIRECT_ALIGN        4096
+#define ADMIT_WAIT_MS       100
+#define URING_BUF_LEN       (256 * 1024)
+#define TMP_SUFFIX          ".warbler-part"
+#define MAX_NAME_RETRY      1000
+#define SCAN_CACHE_FILE     "scan.cache"
+#define CHUNK_STORE_DIR     "chunks"
+#define JOURNAL_FILE        "journal"
+#define GROUP_MTIME_SLACK   10          // seconds between the files of one shot
+
+static const char *photoExtensions[] = {
+    "jpg", "jpeg", "png", "heic", "heif", "tif", "tiff", "gif", "webp",
+    "cr2", "cr3", "nef", "arw", "dng", "raf", "orf", "rw2", "pef", "srw"
+};
+
+static const char *videoExtensions[] = {
+    "mp4", "mov", "m4v", "avi", "mts", "m2ts", "mkv", "3gp", "wmv", "mpg", "mpeg"
+};
+
+static const char *sidecarExtensions[] = {
+    "xmp", "aae", "thm"
+};
+
+// Photos that lead their group over a JPEG or HEIC of the same shot
+static const char *rawExtensions[] = {
+    "cr2", "cr3", "nef", "arw", "dng", "raf", "orf", "rw2", "pef", "srw"
+};
+
+MediaType mediaTypeFromPath(const char *path)
+{
+    const char *dot = strrchr(path, '.');
+    if (dot == nullptr || strchr(dot, '/') != nullptr)
+        return MEDIA_NONE;
+    dot++;
+    for (const char *ext : photoExtensions)
+        if (strcasecmp(dot, ext) == 0)
+            return MEDIA_PHOTO;
+    for (const char *ext : videoExtensions)
+        if (strcasecmp(dot, ext) == 0)
+            return MEDIA_VIDEO;
+    for (const char *ext : sidecarExtensions)
+        if (strcasecmp(dot, ext) == 0)
+            return MEDIA_SIDECAR;
+    return MEDIA_NONE;
+}
+
+bool isDirectory(const char *path, bool writable)
+{
+    struct stat st;
+    if (path[0] == '\0' || stat(path, &st) != 0 || !S_ISDIR(st.st_mode))
+        return false;
+    return !writable || access(path, W_OK) == 0;
+}
+
+bool isRegularFile(const char *path)
+{
+    struct stat st;
+    return path[0] != '\0' && stat(path, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+uint64_t filesProcessed(const BackupTotals &totals)
+{
+    return totals.get(STAT_FILES_VERIFIED) + totals.get(STAT_FILES_DUPLICATE) + totals.get(STAT_FILES_FAILED);
+}
+
+static std::vector<uint8_t> &ioBuffer(void)
+{
+    // Each worker thread reuses one buffer for the whole run
+    static thread_local std::vector<uint8_t> buf(IO_BUF_LEN);
+    return buf;
+}
+
+static int64_t nowNanos(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static uint8_t *directBuffer(void)
+{
+    // O_DIRECT wants the buffer aligned to the logical block size of the file system
+    static thread_local std::vector<uint8_t> buf(IO_BUF_LEN + DIRECT_ALIGN);
+    uintptr_t p = reinterpret_cast<uintptr_t>(buf.data());
+    return reinterpret_cast<uint8_t *>((p + DIRECT_ALIGN - 1) & ~(uintptr_t)(DIRECT_ALIGN - 1));
+}
+
+/* The page cache still holds what was just written, reading through it would
+ * only check our own memory. O_DIRECT makes the data come from the NAS; where
+ * it is refused the cached pages, clean after the fsync, are dropped instead.
+ */
+static bool readBack(const char *path, HashAlgo algo, uint8_t *digest)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC | O_DIRECT);
+    if (fd < 0 && errno == EINVAL)
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "Open %s failed: %s\n", path, strerror(errno));
+        return false;
+    }
+    if (!(fcntl(fd, F_GETFL) & O_DIRECT))
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+
+    uint8_t *buf = directBuffer();
+    Hasher hasher;
+    hasher.init(algo);
+    bool ok = true;
+    for (;;) {
+        ssize_t n = read(fd, buf, IO_BUF_LEN);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && errno == EINVAL && (fcntl(fd, F_GETFL) & O_DIRECT)) {
+            // Some file systems only say no to O_DIRECT on the first read
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            continue;
+        }
+        if (n < 0) {
+            fprintf(stderr, "Read %s failed: %s\n", path, strerror(errno));
+            ok = false;
+            break;
+        }
+        if (n == 0)
+            break;
+        hasher.update(buf, n);
+    }
+    close(fd);
+    if (ok)
+        hasher.final(digest);
+    return ok;
+}
+
+static bool makeParentDirs(const std::string &path)
+{
+    for (size_t pos = path.find('/', 1); pos != std::string::npos; pos = path.find('/', pos + 1)) {
+        std::string dir = path.substr(0, pos);
+        if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+            fprintf(stderr, "Create directory %s failed: %s\n", dir.c_str(), strerror(errno));
+            return false;
+        }
+    }
+    return true;
+}
+
+// Keep the capture time visible on the NAS side
+static void setMtime(int fd, int64_t mtime)
+{
+    struct timespec times[2];
+    times[0].tv_sec = mtime / 1000000000;
+    times[0].tv_nsec = mtime % 1000000000;
+    times[1] = times[0];
+    futimens(fd, times);
+}
+
+// Without a hash list files are still deduplicated within the run, by SHA-256
+static bool listAlgorithm(const std::string &path, HashAlgo *algo)
+{
+    *algo = path.empty() ? HASH_ALGO_SHA256 : HashIndex::detectAlgorithm(path.c_str());
+    if (*algo == HASH_ALGO_NONE) {
+        fprintf(stderr, "Hash file %s holds no SHA-256 or XXH3 digest.\n", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+void BackupStats::add(StatCounter counter, uint64_t n)
+{
+    workers[slot()].value[counter].fetch_add(n, std::memory_order_relaxed);
+}
+
+std::atomic<uint64_t> &BackupStats::local(StatCounter counter)
+{
+    return workers[slot()].value[counter];
+}
+
+void BackupStats::sum(uint64_t totals[STAT_COUNT]) const
+{
+    for (int c = 0; c < STAT_COUNT; c++)
+        totals[c] = 0;
+    for (const auto &worker : workers)
+        for (int c = 0; c < STAT_COUNT; c++)
+            totals[c] += worker.value[c].load(std::memory_order_relaxed);
+}
+
+static unsigned latencyBucket(int64_t nanos)
+{
+    uint64_t us = nanos > 0 ? (uint64_t)nanos / 1000 : 0;
+    if (us < 4)
+        return (unsigned)us;
+    unsigned e = 63 - __builtin_clzll(us);
+    unsigned b = 4 + (e - 2) * 4 + (unsigned)((us >> (e - 2)) & 3);
+    return std::min(b, (unsigned)LATENCY_BUCKETS - 1);
+}
+
+// First microsecond past the bucket
+static double latencyBucketEnd(unsigned b)
+{
+    if (b < 4)
+        return b + 1;
+    unsigned e = (b - 4) / 4 + 2;
+    return (double)((4 + (b - 4) % 4 + 1) * (1ULL << (e - 2)));
+}
+
+uint64_t StageLatency::count(void) const
+{
+    uint64_t n = 0;
+    for (uint64_t v : bucket)
+        n += v;
+    return n;
+}
+
+double StageLatency::percentile(double p) const
+{
+    uint64_t n = count();
+    if (n == 0)
+        return 0.0;
+    uint64_t rank = (uint64_t)(p * (n - 1)) + 1;
+    uint64_t seen = 0;
+    for (unsigned b = 0; b < LATENCY_BUCKETS; b++) {
+        seen += bucket[b];
+        if (seen >= rank)
+            return latencyBucketEnd(b);
+    }
+    return latencyBucketEnd(LATENCY_BUCKETS - 1);
+}
+
+void BackupStats::addLatency(PipelineStage stage, int64_t nanos)
+{
+    workers[slot()].latency[stage][latencyBucket(nanos)].fetch_add(1, std::memory_order_relaxed);
+}
+
+void BackupStats::sumLatency(StageLatency latency[STAGE_COUNT]) const
+{
+    for (int s = 0; s < STAGE_COUNT; s++)
+        for (unsigned b = 0; b < LATENCY_BUCKETS; b++)
+            latency[s].bucket[b] = 0;
+    for (const auto &worker : workers)
+        for (int s = 0; s < STAGE_COUNT; s++)
+            for (unsigned b = 0; b < LATENCY_BUCKETS; b++)
+                latency[s].bucket[b] += worker.latency[s][b].load(std::memory_order_relaxed);
+}
+
+void BackupStats::reset(void)
+{
+    for (auto &worker : workers) {
+        for (auto &v : worker.value)
+            v = 0;
+        for (auto &stage : worker.latency)
+            for (auto &v : stage)
+                v = 0;
+    }
+    scanRate = 0.0;
+    scanDone = false;
+    nextSlot = 0;
+    generation++;
+}
+
+/* More threads than slots only share a slot, which costs contention but
+ * never a count, the adds are atomic either way.
+ */
+unsigned BackupStats::slot(void)
+{
+    static thread_local const BackupStats *owner = nullptr;
+    static thread_local unsigned owner_generation = 0;
+    static thread_local unsigned index = 0;
+
+    unsigned gen = generation.load(std::memory_order_relaxed);
+    if (owner != this || owner_generation != gen) {
+        owner = this;
+        owner_generation = gen;
+        index = nextSlot++ % STATS_WORKER_SLOTS;
+    }
+    return index;
+}
+
+BackupEngine::~BackupEngine()
+{
+    cancel();
+    joinThreads();
+}
+
+bool BackupEngine::start(const BackupConfig &cfg)
+{
+    if (getState() == BACKUP_RUNNING) {
+        fprintf(stderr, "Backup is already running.\n");
+        return false;
+    }
+    joinThreads();
+
+    struct stat st;
+    if (stat(cfg.importDir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "Import directory %s is not a directory.\n", cfg.importDir.c_str());
+        return false;
+    }
+    if (stat(cfg.outputDir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "Output directory %s is not a directory.\n", cfg.outputDir.c_str());
+        return false;
+    }
+
+    if (!listAlgorithm(cfg.photoHashFile, &photoAlgo) || !listAlgorithm(cfg.videoHashFile, &videoAlgo))
+        return false;
+    hashSelectKernels();
+
+    config = cfg;
+    while (config.importDir.size() > 1 && config.importDir.back() == '/')
+        config.importDir.pop_back();
+    while (config.outputDir.size() > 1 && config.outputDir.back() == '/')
+        config.outputDir.pop_back();
+    if (config.hashWorkers < 1)
+        config.hashWorkers = 1;
+    if (config.copyWorkers < 1)
+        config.copyWorkers = 1;
+    if (config.copyWorkersMin < 1)
+        config.copyWorkersMin = 1;
+    if (config.copyWorkersMax < config.copyWorkersMin)
+        config.copyWorkersMax = config.copyWorkersMin;
+    if (config.verifyWorkers < 1)
+        config.verifyWorkers = 1;
+    if (config.scanWorkers < 1)
+        config.scanWorkers = 1;
+    if (config.ioQueueDepth < 1)
+        config.ioQueueDepth = 1;
+    if (config.ioBackend == IO_BACKEND_URING && !IoRing::supported()) {
+        fprintf(stderr, "io_uring is not available, using the thread pool.\n");
+        config.ioBackend = IO_BACKEND_THREADS;
+    }
+
+    std::string state_dir = config.outputDir + "/" STATE_DIR;
+    if (mkdir(state_dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Create directory %s failed: %s\n", state_dir.c_str(), strerror(errno));
+        return false;
+    }
+    if (config.chunkVideos && !chunkStore.open(state_dir + "/" CHUNK_STORE_DIR))
+        return false;
+    if (!journal.open(state_dir + "/" JOURNAL_FILE))
+        return false;
+    closeHashLists();
+    listFailed = false;
+    if (config.updateHashLists) {
+        openHashList(config.photoHashFile, &photoListFd);
+        // A single list may serve both media types, append through one descriptor
+        if (config.videoHashFile == config.photoHashFile)
+            videoListFd = photoListFd;
+        else
+            openHashList(config.videoHashFile, &videoListFd);
+    }
+    photoListRun = config.updateHashLists && HashIndex::isIndexFile(config.photoHashFile.c_str());
+    videoListRun = config.updateHashLists && HashIndex::isIndexFile(config.videoHashFile.c_str());
+
+    stats.reset();
+    seenDigests.clear();
+    // Whatever earlier runs copied is on the NAS now, even when it was renamed or moved on the card since
+    journal.forEach([this](const std::string &, const JournalRecord &record) {
+        if (record.kind != JOURNAL_COPIED)
+            return;
+        std::string key(1, (char)record.algorithm);
+        key.append(reinterpret_cast<const char *>(record.digest), hashDigestLen((HashAlgo)record.algorithm));
+        seenDigests.insert(std::move(key));
+    });
+    if (journal.size() > 0)
+        fprintf(stdout, "Journal: %lu files finished by earlier runs.\n", (unsigned long)journal.size());
+    indexesChecked = false;
+    cancelled = false;
+    verifyCount = 0;
+    partCount = 0;
+    for (auto q : { &hashQueue, &dedupQueue, &copyQueue, &verifyQueue }) {
+        q->reset();
+        q->setCapacity(config.queueCapacity);
+    }
+    state = BACKUP_RUNNING;
+
+    // Converting a text hash list can take a while the first time, never do it on the UI thread
+    indexesLoaded = std::async(std::launch::async, &BackupEngine::loadIndexes, this).share();
+    // Stages are started from the tail so that every consumer exists before its producer
+    spawnStage(STAGE_VERIFY, config.verifyWorkers, &verifyQueue, nullptr, &verifyWorkersLive, &BackupEngine::verifyStage);
+    if (config.ioBackend == IO_BACKEND_URING) {
+        copyControl.init(config.copyWorkersMin, config.ioQueueDepth, config.ioQueueDepth, config.adaptiveCopy);
+        copyWorkersLive = config.copyWorkers;
+        for (int i = 0; i < config.copyWorkers; i++)
+            threads.emplace_back(&BackupEngine::uringCopyWorker, this);
+    } else {
+        // Every worker the controller may ask for exists from the start, those above the limit stay parked
+        copyControl.init(config.copyWorkersMin, config.copyWorkersMax, config.copyWorkers, config.adaptiveCopy);
+        int workers = copyControl.getMax();
+        copyWorkersLive = workers;
+        for (int i = 0; i < workers; i++)
+            threads.emplace_back(&BackupEngine::copyWorker, this, i);
+    }
+    // The dedup set is not shared, so this stage has exactly one worker
+    spawnStage(STAGE_DEDUP, 1, &dedupQueue, &copyQueue, &dedupWorkersLive, &BackupEngine::dedupStage);
+    spawnStage(STAGE_HASH, config.hashWorkers, &hashQueue, &dedupQueue, &hashWorkersLive, &BackupEngine::hashStage);
+    threads.emplace_back(&BackupEngine::scanWorker, this);
+
+    fprintf(stdout, "Backup started: %s -> %s\n", config.importDir.c_str(), config.outputDir.c_str());
+    return true;
+}
+
+void BackupEngine::cancel(void)
+{
+    if (getState() != BACKUP_RUNNING)
+        return;
+    cancelled = true;
+    hashQueue.close();
+    dedupQueue.close();
+    copyQueue.close();
+    verifyQueue.close();
+}
+
+void BackupEngine::wait(void)
+{
+    joinThreads();
+}
+
+void BackupEngine::joinThreads(void)
+{
+    for (auto &t : threads)
+        if (t.joinable())
+            t.join();
+    threads.clear();
+}
+
+BackupState BackupEngine::getState(void)
+{
+    return static_cast<BackupState>(state.load());
+}
+
+void BackupEngine::getTotals(BackupTotals *totals)
+{
+    stats.sum(totals->value);
+    totals->hashQueued = hashQueue.size();
+    totals->dedupQueued = dedupQueue.size();
+    totals->copyQueued = copyQueue.size();
+    totals->verifyQueued = verifyQueue.size();
+    totals->copyLimit = copyControl.getLimit();
+    totals->copyLimitMin = copyControl.getMin();
+    totals->copyLimitMax = copyControl.getMax();
+    totals->scanRate = stats.scanRate;
+    totals->scanDone = stats.scanDone;
+}
+
+void BackupEngine::getLatency(StageLatency latency[STAGE_COUNT])
+{
+    stats.sumLatency(latency);
+}
+
+void BackupEngine::spawnStage(PipelineStage stage, int workers, BoundedQueue<BackupItem> *in,
+            BoundedQueue<BackupItem> *out, std::atomic<int> *live, StageFn fn)
+{
+    *live = workers;
+    for (int i = 0; i < workers; i++)
+        threads.emplace_back(&BackupEngine::runStage, this, stage, in, out, live, fn);
+}
+
+void BackupEngine::runStage(PipelineStage stage, BoundedQueue<BackupItem> *in, BoundedQueue<BackupItem> *out,
+            std::atomic<int> *live, StageFn fn)
+{
+    BackupItem item;
+
+    while (in->pop(item)) {
+        if (cancelled)
+            break;
+        // Dropped items count too, finding a duplicate or a failure is the stage's work as well
+        int64_t start = nowNanos();
+        bool ok = (this->*fn)(item);
+        stats.addLatency(stage, nowNanos() - start);
+        if (!ok)
+            continue;
+        if (out != nullptr && !out->push(std::move(item)))
+            break;
+    }
+    finishStage(out, live);
+}
+
+void BackupEngine::finishStage(BoundedQueue<BackupItem> *out, std::atomic<int> *live)
+{
+    // The last worker out tells the next stage that no more items will come
+    if (--(*live) == 0) {
+        // No hash worker reads the scan cache any more, merge this run's digests into it
+        if (live == &hashWorkersLive)
+            scanCache.save();
+        if (out != nullptr) {
+            out->close();
+        } else {
+            uint64_t totals[STAT_COUNT];
+            stats.sum(totals);
+            // Nothing appends any more, make the tails of the lists and the journal durable before reporting the end
+            bool lists_written = closeHashLists();
+            journal.close();
+            /* Every file is on the NAS and in the lists, an old record must not
+             * skip one whose copy is deleted later. With a list short of this
+             * run's digests the journal is what keeps the next run from
+             * copying the files again.
+             */
+            if (lists_written && !cancelled && totals[STAT_FILES_FAILED] == 0)
+                journal.reset();
+            // A merge left running would be cancelled when the engine goes away, it finishes with the run
+            if (indexesLoaded.valid())
+                indexesLoaded.wait();
+            if (!cancelled) {
+                if (photoIndex.isMerging() || videoIndex.isMerging())
+                    fprintf(stdout, "Merging hash index runs, the backup is done once they are written...\n");
+                photoIndex.waitMerge();
+                videoIndex.waitMerge();
+            }
+            state = cancelled ? BACKUP_CANCELLED : BACKUP_FINISHED;
+            fprintf(stdout, "Backup %s: %lu copied, %lu duplicates, %lu resumed, %lu failed.\n",
+                    cancelled ? "cancelled" : "finished",
+                    (unsigned long)totals[STAT_FILES_VERIFIED],
+                    (unsigned long)totals[STAT_FILES_DUPLICATE],
+                    (unsigned long)totals[STAT_FILES_RESUMED],
+                    (unsigned long)totals[STAT_FILES_FAILED]);
+        }
+    }
+}
+
+bool BackupEngine::loadIndex(HashIndex &index, const std::string &path, HashAlgo algo)
+{
+    index.close();
+    if (path.empty())
+        return true;
+    if (!index.open(path.c_str()))
+        return false;
+    if (index.getAlgorithm() != algo) {
+        fprintf(stderr, "Hash index %s does not hold %s digests.\n", path.c_str(), hashAlgoName(algo));
+        index.close();
+        return false;
+    }
+    fprintf(stdout, "Hash index %s: %lu %s digests.\n",
+            path.c_str(), (unsigned long)index.size(), hashAlgoName(algo));
+    return true;
+}
+
+bool BackupEngine::loadIndexes(void)
+{
+    // Two indexes of one file would merge its runs over each other
+    sharedIndex = !config.photoHashFile.empty() && config.videoHashFile == config.photoHashFile;
+    if (sharedIndex) {
+        videoIndex.close();
+        return loadIndex(photoIndex, config.photoHashFile, photoAlgo);
+    }
+    return loadIndex(photoIndex, config.photoHashFile, photoAlgo) &&
+           loadIndex(videoIndex, config.videoHashFile, videoAlgo);
+}
+
+static bool isMediaName(const char *name)
+{
+    return mediaTypeFromPath(name) != MEDIA_NONE;
+}
+
+static bool isRawName(const char *name)
+{
+    const char *dot = strrchr(name, '.');
+    if (dot == nullptr)
+        return false;
+    for (const char *ext : rawExtensions)
+        if (strcasecmp(dot + 1, ext) == 0)
+            return true;
+    return false;
+}
+
+static const char *baseName(const std::string &path)
+{
+    size_t slash = path.rfind('/');
+    return path.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+}
+
+// "IMG_0001.CR3", "img_0001.jpg" and "IMG_0001.CR3.xmp" all share the key "img_0001"
+static std::string groupKey(const BackupItem &item)
+{
+    std::string key = baseName(item.relPath);
+    for (char &c : key)
+        c = tolower((unsigned char)c);
+    key.resize(key.rfind('.'));
+    if (item.type == MEDIA_SIDECAR && mediaTypeFromPath(key.c_str()) != MEDIA_NONE)
+        key.resize(key.rfind('.'));
+    return key;
+}
+
+// The file that leads a group: the raw before a developed photo, a photo before its video, sidecars last
+static int groupRank(const BackupItem &item)
+{
+    switch (item.type) {
+    case MEDIA_PHOTO:
+        return isRawName(baseName(item.relPath)) ? 0 : 1;
+    case MEDIA_VIDEO:
+        return 2;
+    default:
+        return 3;
+    }
+}
+
+/* Moves the companions of every group of one directory into the file that
+ * leads it, the order of the leads is kept. Returns the number of companions.
+ */
+static size_t groupCompanions(std::vector<BackupItem> &items)
+{
+    std::unordered_map<std::string, std::vector<size_t>> stems;
+    for (size_t i = 0; i < items.size(); i++)
+        stems[groupKey(items[i])].push_back(i);
+
+    std::vector<bool> taken(items.size(), false);
+    size_t grouped = 0;
+    for (auto &stem : stems) {
+        std::vector<size_t> &members = stem.second;
+        if (members.size() < 2)
+            continue;
+        std::stable_sort(members.begin(), members.end(), [&items](size_t a, size_t b) {
+            int rank_a = groupRank(items[a]), rank_b = groupRank(items[b]);
+            return rank_a != rank_b ? rank_a < rank_b : items[a].mtime < items[b].mtime;
+        });
+        BackupItem &lead = items[members[0]];
+        for (size_t k = 1; k < members.size(); k++) {
+            BackupItem &member = items[members[k]];
+            // Two shots that only share a name, after the camera counter wrapped, stay apart
+            if (member.type != MEDIA_SIDECAR && llabs(member.mtime - lead.mtime) > GROUP_MTIME_SLACK * 1000000000LL)
+                continue;
+            lead.companions.push_back(std::move(member));
+            taken[members[k]] = true;
+            grouped++;
+        }
+    }
+
+    size_t out = 0;
+    for (size_t i = 0; i < items.size(); i++) {
+        if (taken[i])
+            continue;
+        if (out != i)
+            items[out] = std::move(items[i]);
+        out++;
+    }
+    items.resize(out);
+    return grouped;
+}
+
+// The lead first, then its companions
+static std::vector<BackupItem *> groupMembers(BackupItem &item)
+{
+    std::vector<BackupItem *> members;
+    members.reserve(1 + item.companions.size());
+    members.push_back(&item);
+    for (BackupItem &companion : item.companions)
+        members.push_back(&companion);
+    return members;
+}
+
+static uint64_t groupBytes(const BackupItem &item)
+{
+    uint64_t bytes = item.size;
+    for (const BackupItem &companion : item.companions)
+        bytes += companion.size;
+    return bytes;
+}
+
+void BackupEngine::scanWorker(void)
+{
+    DirWalkerOptions options;
+    options.threads = config.scanWorkers;
+    options.ioQueueDepth = config.ioBackend == IO_BACKEND_URING ? config.ioQueueDepth : 0;
+    options.excludeDir = config.outputDir;
+    options.nameFilter = isMediaName;
+
+    scanCache.load(config.outputDir + "/" STATE_DIR "/" SCAN_CACHE_FILE);
+
+    // Companions are always in the same directory, so a directory is grouped as a whole
+    DirWalker walker;
+    walker.walkDirectories(config.importDir, options, [this, &walker](const WalkEntry *entries, size_t count) {
+        if (cancelled)
+            return false;
+        std::vector<BackupItem> items;
+        items.reserve(count);
+        for (size_t i = 0; i < count; i++) {
+            const WalkEntry &entry = entries[i];
+            stats.add(STAT_FILES_SCANNED);
+            stats.add(STAT_BYTES_SCANNED, entry.size);
+            JournalRecord record;
+            if (journal.lookup(entry.relPath, entry.size, entry.mtime, &record)) {
+                stats.add(STAT_FILES_RESUMED);
+                continue;
+            }
+            items.emplace_back();
+            BackupItem &item = items.back();
+            item.type = mediaTypeFromPath(entry.name);
+            item.algo = item.type == MEDIA_VIDEO ? videoAlgo : photoAlgo;
+            item.relPath = entry.relPath;
+            item.srcPath = config.importDir + "/" + entry.relPath;
+            item.size = entry.size;
+            item.mtime = entry.mtime;
+            item.ctime = entry.ctime;
+            item.dev = entry.dev;
+            item.inode = entry.inode;
+        }
+        stats.scanRate = walker.getFileRate();
+        if (config.groupCompanions)
+            stats.add(STAT_FILES_GROUPED, groupCompanions(items));
+        for (BackupItem &item : items)
+            if (!hashQueue.push(std::move(item)))
+                return false;
+        return true;
+    });
+    stats.scanRate = walker.getFileRate();
+    fprintf(stdout, "Scanned %lu files in %lu directories, %.0f files/s.\n",
+            (unsigned long)walker.getFiles(), (unsigned long)walker.getDirectories(), walker.getFileRate());
+    stats.scanDone = true;
+    hashQueue.close();
+}
+
+// The first read doubles as the head the capture time is parsed from, when capture_time is given
+bool BackupEngine::hashFile(const char *path, HashAlgo algo, uint8_t *digest, int64_t *capture_time)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "Open %s failed: %s\n", path, strerror(errno));
+        return false;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    std::vector<uint8_t> &buf = ioBuffer();
+    Hasher hasher;
+    hasher.init(algo);
+    bool ok = true;
+    for (;;) {
+        ssize_t n = read(fd, buf.data(), buf.size());
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "Read %s failed: %s\n", path, strerror(errno));
+            ok = false;
+            break;
+        }
+        if (n == 0)
+            break;
+        if (capture_time != nullptr) {
+            if (!mediaCaptureTime(fd, buf.data(), n, capture_time))
+                *capture_time = 0;
+            capture_time = nullptr;
+        }
+        hasher.update(buf.data(), n);
+        stats.add(STAT_BYTES_HASHED, n);
+        if (cancelled) {
+            ok = false;
+            break;
+        }
+    }
+    close(fd);
+    if (ok)
+        hasher.final(digest);
+    return ok;
+}
+
+// For a file the scan cache spares from hashing only the head is read
+void BackupEngine::readCaptureTime(BackupItem &item)
+{
+    int fd = open(item.srcPath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+    std::vector<uint8_t> &buf = ioBuffer();
+    ssize_t n = pread(fd, buf.data(), MEDIA_META_HEAD_LEN, 0);
+    if (n <= 0 || !mediaCaptureTime(fd, buf.data(), n, &item.captureTime))
+        item.captureTime = 0;
+    close(fd);
+}
+
+bool BackupEngine::hashMember(BackupItem &item)
+{
+    bool dated = config.layout == OUTPUT_LAYOUT_DATE;
+    if (scanCache.lookup(item.dev, item.inode, item.size, item.mtime, item.ctime, item.algo, item.digest, &item.captureTime)) {
+        if (dated && item.captureTime == 0) {
+            readCaptureTime(item);
+            if (item.captureTime != 0)
+                scanCache.update(item.dev, item.inode, item.size, item.mtime, item.ctime, item.algo, item.digest,
+                                 item.captureTime);
+        }
+        stats.add(STAT_FILES_CACHED);
+        stats.add(STAT_FILES_HASHED);
+        return true;
+    }
+    if (!hashFile(item.srcPath.c_str(), item.algo, item.digest, dated ? &item.captureTime : nullptr))
+        return false;
+    scanCache.update(item.dev, item.inode, item.size, item.mtime, item.ctime, item.algo, item.digest, item.captureTime);
+    stats.add(STAT_FILES_HASHED);
+    return true;
+}
+
+bool BackupEngine::hashStage(BackupItem &item)
+{
+    for (BackupItem *member : groupMembers(item)) {
+        if (!hashMember(*member)) {
+            discardGroup(item);
+            return false;
+        }
+    }
+    if (config.layout == OUTPUT_LAYOUT_DATE) {
+        // A shot lands on one day, taken from the first of its files that knows when it was taken
+        int64_t capture_time = 0;
+        for (BackupItem *member : groupMembers(item))
+            if (capture_time == 0)
+                capture_time = member->captureTime;
+        if (capture_time == 0)
+            capture_time = mediaWallClock(item.mtime / 1000000000);
+        for (BackupItem *member : groupMembers(item))
+            member->captureTime = capture_time;
+    }
+    return true;
+}
+
+bool BackupEngine::dedupStage(BackupItem &item)
+{
+    if (!indexesChecked) {
+        indexesChecked = true;
+        if (!indexesLoaded.get()) {
+            // Copying everything because the hash list is unreadable would flood the NAS
+            fprintf(stderr, "Loading hash indexes failed, cancel the backup.\n");
+            cancel();
+            return false;
+        }
+    }
+
+    // The lead decides for the whole group, its companions were backed up with it or not at all
+    const HashIndex &index = item.type == MEDIA_VIDEO && !sharedIndex ? videoIndex : photoIndex;
+    std::string key(1, (char)item.algo);
+    key.append(reinterpret_cast<const char *>(item.digest), hashDigestLen(item.algo));
+    stats.add(STAT_INDEX_LOOKUPS);
+    if (index.contains(item.digest) || !seenDigests.insert(key).second) {
+        // Except for sidecars, which are edited long after the shot, a changed one goes on by itself
+        std::vector<BackupItem> sidecars;
+        for (BackupItem *member : groupMembers(item)) {
+            if (member != &item && member->type == MEDIA_SIDECAR && isNewSidecar(*member)) {
+                sidecars.push_back(std::move(*member));
+                continue;
+            }
+            journal.append(JOURNAL_DUPLICATE, member->relPath, member->size, member->mtime, member->algo,
+                           member->digest);
+            stats.add(STAT_FILES_DUPLICATE);
+        }
+        for (BackupItem &sidecar : sidecars)
+            if (!copyQueue.push(std::move(sidecar)))
+                break;
+        return false;
+    }
+    for (BackupItem &companion : item.companions) {
+        key.assign(1, (char)companion.algo);
+        key.append(reinterpret_cast<const char *>(companion.digest), hashDigestLen(companion.algo));
+        seenDigests.insert(key);
+    }
+    return true;
+}
+
+/* Sidecars of a group only reach the hash lists since they are looked up on
+ * their own, an unchanged one backed up before that is recognised by its copy
+ * at its place on the NAS and added to the lists then.
+ */
+bool BackupEngine::isNewSidecar(BackupItem &item)
+{
+    std::string key(1, (char)item.algo);
+    key.append(reinterpret_cast<const char *>(item.digest), hashDigestLen(item.algo));
+    stats.add(STAT_INDEX_LOOKUPS);
+    if (photoIndex.contains(item.digest) || !seenDigests.insert(key).second)
+        return false;
+
+    std::string path = destinationPath(item);
+    uint8_t digest[HASH_DIGEST_MAX_LEN];
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0 || (uint64_t)st.st_size != item.size ||
+        !hashFile(path.c_str(), item.algo, digest, nullptr) ||
+        memcmp(digest, item.digest, hashDigestLen(item.algo)) != 0)
+        return true;
+    item.dstPath = path;
+    appendHashList(item);
+    return false;
+}
+
+bool BackupEngine::isChunked(const BackupItem &item) const
+{
+    return config.chunkVideos && item.type == MEDIA_VIDEO;
+}
+
+// Where the file lands on the NAS unless that name is taken
+std::string BackupEngine::destinationPath(const BackupItem &item) const
+{
+    std::string rel_path = item.relPath;
+    if (config.layout == OUTPUT_LAYOUT_DATE) {
+        time_t t = (time_t)item.captureTime;
+        struct tm tm;
+        gmtime_r(&t, &tm);
+        char day[32];
+        snprintf(day, sizeof(day), "%04d/%02d/%02d/", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday);
+        rel_path = std::string(day) + baseName(item.relPath);
+    }
+    // A chunked video is represented by its manifest in the output tree
+    return config.outputDir + "/" + rel_path + (isChunked(item) ? MANIFEST_SUFFIX : "");
+}
+
+bool BackupEngine::prepareCopy(BackupItem &item)
+{
+    std::string part;
+    // Files from different card folders meet in one day, their part files must not
+    if (config.layout == OUTPUT_LAYOUT_DATE)
+        part = "." + std::to_string(partCount++);
+    item.dstPath = destinationPath(item);
+    item.tmpPath = item.dstPath + part + TMP_SUFFIX;
+    return makeParentDirs(item.tmpPath);
+}
+
+bool BackupEngine::copyMember(BackupItem &item)
+{
+    if (!prepareCopy(item))
+        return false;
+
+    int in = open(item.srcPath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        fprintf(stderr, "Open %s failed: %s\n", item.srcPath.c_str(), strerror(errno));
+        return false;
+    }
+    posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    Hasher hasher;
+    Hasher *stream = nullptr;
+    if (config.hashWhileCopying) {
+        hasher.init(item.algo);
+        stream = &hasher;
+    }
+
+    if (isChunked(item)) {
+        ChunkResult result;
+        bool ok = chunkStore.storeFile(in, item.tmpPath.c_str(), &result, stream, &cancelled);
+        close(in);
+        stats.add(STAT_BYTES_COPIED, result.bytes);
+        stats.add(STAT_CHUNKS, result.chunks);
+        stats.add(STAT_CHUNKS_NEW, result.newChunks);
+        stats.add(STAT_CHUNK_BYTES, result.bytes);
+        stats.add(STAT_CHUNK_BYTES_NEW, result.newBytes);
+        stats.add(STAT_CHUNK_NANOS, result.cdcNanos);
+        if (!ok) {
+            if (!cancelled)
+                fprintf(stderr, "Chunk %s failed: %s\n", item.srcPath.c_str(), strerror(errno));
+            unlink(item.tmpPath.c_str());
+            return false;
+        }
+        item.copyMethod = COPY_METHOD_CHUNKED;
+        if (stream != nullptr) {
+            hasher.final(item.copyDigest);
+            item.streamHashed = true;
+        }
+        stats.add(STAT_FILES_COPIED);
+        stats.add((StatCounter)(STAT_COPY_METHOD + item.copyMethod));
+        return true;
+    }
+
+    int out = open(item.tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out < 0) {
+        fprintf(stderr, "Create %s failed: %s\n", item.tmpPath.c_str(), strerror(errno));
+        close(in);
+        return false;
+    }
+
+    std::vector<uint8_t> &buf = ioBuffer();
+    item.copyMethod = copyFileData(in, out, item.size, buf.data(), buf.size(), stream,
+                                   &stats.local(STAT_BYTES_COPIED), &cancelled);
+    bool ok = item.copyMethod != COPY_METHOD_NONE;
+    if (ok) {
+        setMtime(out, item.mtime);
+        ok = fsync(out) == 0;
+    }
+    close(in);
+    close(out);
+
+    if (!ok) {
+        if (!cancelled)
+            fprintf(stderr, "Copy %s to %s failed: %s\n",
+                    item.srcPath.c_str(), item.tmpPath.c_str(), strerror(errno));
+        unlink(item.tmpPath.c_str());
+        return false;
+    }
+    if (stream != nullptr) {
+        hasher.final(item.copyDigest);
+        item.streamHashed = true;
+    }
+    stats.add(STAT_FILES_COPIED);
+    stats.add((StatCounter)(STAT_COPY_METHOD + item.copyMethod));
+    return true;
+}
+
+bool BackupEngine::copyStage(BackupItem &item)
+{
+    for (BackupItem *member : groupMembers(item)) {
+        if (!copyMember(*member)) {
+            discardGroup(item);
+            return false;
+        }
+    }
+    return true;
+}
+
+// A group is backed up whole or not at all, what was already written of it goes
+void BackupEngine::discardGroup(BackupItem &item)
+{
+    for (BackupItem *member : groupMembers(item)) {
+        if (!member->tmpPath.empty())
+            unlink(member->tmpPath.c_str());
+        stats.add(STAT_FILES_FAILED);
+    }
+}
+
+void BackupEngine::copyWorker(int index)
+{
+    BackupItem item;
+
+    for (;;) {
+        if (!copyControl.admit(index, ADMIT_WAIT_MS)) {
+            if (cancelled || copyQueue.drained())
+                break;
+            continue;
+        }
+        if (!copyQueue.pop(item) || cancelled)
+            break;
+        int64_t start = nowNanos();
+        bool ok = copyStage(item);
+        int64_t nanos = nowNanos() - start;
+        stats.addLatency(STAGE_COPY, nanos);
+        if (!ok)
+            continue;
+        copyControl.record(groupBytes(item), nanos, copyQueue.size() > 0);
+        if (!verifyQueue.push(std::move(item)))
+            break;
+    }
+    finishStage(&verifyQueue, &copyWorkersLive);
+}
+
+/* One file in flight on the io_uring copy path. A slot has at most one
+ * operation queued at any time, the completion of one step queues the next:
+ * open source -> create part file -> read / write chunks -> fsync.
+ */
+enum UringCopyOp {
+    URING_OPEN_SRC = 0,
+    URING_OPEN_DST,
+    URING_READ,
+    URING_WRITE,
+    URING_FSYNC
+};
+
+// A group whose files are spread over the slots, it moves on once the last of them is done
+struct UringGroup {
+    BackupItem item;
+    size_t pending = 0;
+    bool failed = false;
+    int64_t startNanos = 0;
+};
+
+struct BackupEngine::UringCopySlot {
+    BackupItem *item = nullptr;
+    UringGroup *group = nullptr;
+    uint64_t index = 0;         // user_data of every operation of this slot
+    bool busy = false;
+    bool failed = false;
+    UringCopyOp op = URING_OPEN_SRC;
+    int in = -1;
+    int out = -1;
+    uint64_t offset = 0;
+    uint32_t chunkLen = 0;
+    uint32_t chunkDone = 0;
+    std::vector<uint8_t> buf;
+    Hasher hasher;              // reads complete in file order, one at a time
+};
+
+void BackupEngine::uringCopyWorker(void)
+{
+    IoRing ring;
+    if (!ring.init(config.ioQueueDepth)) {
+        fprintf(stderr, "io_uring setup failed: %s, copying with the thread pool.\n", strerror(errno));
+        runStage(STAGE_COPY, &copyQueue, &verifyQueue, &copyWorkersLive, &BackupEngine::copyStage);
+        return;
+    }
+
+    std::vector<UringCopySlot> slots(ring.getEntries());
+    std::list<UringGroup> groups;
+    std::deque<std::pair<UringGroup *, BackupItem *>> waiting;
+    auto finish_group = [this, &groups](UringGroup *group) {
+        // From taking the group off the queue to its last fsync, waits for a free slot included
+        int64_t nanos = nowNanos() - group->startNanos;
+        stats.addLatency(STAGE_COPY, nanos);
+        if (group->failed) {
+            discardGroup(group->item);
+        } else {
+            copyControl.record(groupBytes(group->item), nanos, copyQueue.size() > 0);
+            verifyQueue.push(std::move(group->item));
+        }
+        groups.remove_if([group](const UringGroup &g) { return &g == group; });
+    };
+
+    size_t in_flight = 0;
+    bool input_done = false;
+    for (;;) {
+        // Fill free slots up to the controller's limit, blocking on the queue only when nothing is pending
+        size_t limit = copyControl.getLimit();
+        for (size_t i = 0; i < slots.size() && in_flight < limit && !cancelled; i++) {
+            UringCopySlot &slot = slots[i];
+            if (slot.busy)
+                continue;
+            while (waiting.empty() && !input_done) {
+                BackupItem item;
+                bool got = in_flight == 0 ? copyQueue.pop(item) : copyQueue.tryPop(item);
+                if (!got) {
+                    input_done = in_flight == 0;
+                    break;
+                }
+                groups.emplace_back();
+                UringGroup &group = groups.back();
+                group.item = std::move(item);
+                group.startNanos = nowNanos();
+                for (BackupItem *member : groupMembers(group.item)) {
+                    // Chunking is CPU bound and has its own store writes, it stays synchronous
+                    if (isChunked(*member))
+                        group.failed |= !copyMember(*member);
+                    else if (!prepareCopy(*member))
+                        group.failed = true;
+                    else
+                        waiting.emplace_back(&group, member), group.pending++;
+                }
+                if (group.pending == 0)
+                    finish_group(&group);
+            }
+            if (waiting.empty())
+                break;
+            slot.group = waiting.front().first;
+            slot.item = waiting.front().second;
+            waiting.pop_front();
+            if (slot.buf.empty())
+                slot.buf.resize(URING_BUF_LEN);
+            slot.index = i;
+            slot.busy = true;
+            slot.failed = false;
+            slot.op = URING_OPEN_SRC;
+            slot.in = slot.out = -1;
+            slot.offset = 0;
+            if (config.hashWhileCopying)
+                slot.hasher.init(slot.item->algo);
+            ring.prepOpenat(AT_FDCWD, slot.item->srcPath.c_str(), O_RDONLY | O_CLOEXEC, 0, i);
+            in_flight++;
+        }
+        if (in_flight == 0) {
+            if ((input_done && waiting.empty()) || cancelled)
+                break;
+            continue;
+        }
+
+        if (ring.submit(1) < 0 && errno != EAGAIN && errno != EBUSY) {
+            fprintf(stderr, "io_uring submit failed: %s\n", strerror(errno));
+            cancel();
+            break;
+        }
+        uint64_t index;
+        int32_t res;
+        while (ring.popCompletion(&index, &res)) {
+            UringCopySlot &slot = slots[index];
+            if (uringCopyStep(ring, slot, res))
+                continue;
+            slot.busy = false;
+            in_flight--;
+            slot.group->failed |= slot.failed;
+            if (--slot.group->pending == 0)
+                finish_group(slot.group);
+        }
+    }
+    // Groups cut short by a cancel never reach verify
+    while (!groups.empty()) {
+        groups.front().failed = true;
+        finish_group(&groups.front());
+    }
+    finishStage(&verifyQueue, &copyWorkersLive);
+}
+
+// Handles the completion of the slot's current operation and queues the next one, false once the file is done
+bool BackupEngine::uringCopyStep(IoRing &ring, UringCopySlot &slot, int32_t res)
+{
+    BackupItem &item = *slot.item;
+    if (res < 0) {
+        uringCopyDone(slot, -res);
+        return false;
+    }
+    if (cancelled) {
+        uringCopyDone(slot, ECANCELED);
+        return false;
+    }
+
+    switch (slot.op) {
+    case URING_OPEN_SRC:
+        slot.in = res;
+        slot.op = URING_OPEN_DST;
+        ring.prepOpenat(AT_FDCWD, item.tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644, slot.index);
+        return true;
+    case URING_OPEN_DST:
+        slot.out = res;
+        break;
+    case URING_READ:
+        if (res == 0) {
+            // The source shrank since it was scanned
+            uringCopyDone(slot, EIO);
+            return false;
+        }
+        slot.chunkLen = res;
+        slot.chunkDone = 0;
+        if (config.hashWhileCopying)
+            slot.hasher.update(slot.buf.data(), res);
+        slot.op = URING_WRITE;
+        ring.prepWrite(slot.out, slot.buf.data(), slot.chunkLen, slot.offset, slot.index);
+        return true;
+    case URING_WRITE:
+        slot.chunkDone += res;
+        stats.add(STAT_BYTES_COPIED, res);
+        if (slot.chunkDone < slot.chunkLen) {
+            ring.prepWrite(slot.out, slot.buf.data() + slot.chunkDone, slot.chunkLen - slot.chunkDone,
+                           slot.offset + slot.chunkDone, slot.index);
+            return true;
+        }
+        slot.offset += slot.chunkLen;
+        break;
+    case URING_FSYNC:
+        uringCopyDone(slot, 0);
+        return false;
+    }
+
+    // Both files are open and every chunk so far is written: read the next one or make it durable
+    if (slot.offset < item.size) {
+        uint64_t left = item.size - slot.offset;
+        slot.op = URING_READ;
+        ring.prepRead(slot.in, slot.buf.data(), left < slot.buf.size() ? left : slot.buf.size(),
+                      slot.offset, slot.index);
+        return true;
+    }
+    setMtime(slot.out, item.mtime);
+    slot.op = URING_FSYNC;
+    ring.prepFsync(slot.out, slot.index);
+    return true;
+}
+
+void BackupEngine::uringCopyDone(UringCopySlot &slot, int err)
+{
+    BackupItem &item = *slot.item;
+    if (slot.in >= 0)
+        close(slot.in);
+    if (slot.out >= 0)
+        close(slot.out);
+    slot.in = slot.out = -1;
+
+    if (err != 0) {
+        if (!cancelled)
+            fprintf(stderr, "Copy %s to %s failed: %s\n", item.srcPath.c_str(), item.tmpPath.c_str(), strerror(err));
+        if (slot.op != URING_OPEN_SRC)
+            unlink(item.tmpPath.c_str());
+        slot.failed = true;
+        return;
+    }
+    item.copyMethod = COPY_METHOD_IO_URING;
+    if (config.hashWhileCopying) {
+        slot.hasher.final(item.copyDigest);
+        item.streamHashed = true;
+    }
+    stats.add(STAT_FILES_COPIED);
+    stats.add((StatCounter)(STAT_COPY_METHOD + item.copyMethod));
+}
+
+bool BackupEngine::verifyMember(BackupItem &item)
+{
+    uint32_t digest_len = hashDigestLen(item.algo);
+    // A streamed digest that differs means the source changed or was misread after it was hashed
+    bool ok = !item.streamHashed || memcmp(item.copyDigest, item.digest, digest_len) == 0;
+
+    // What was sent is known to be right, a sample read back checks what the NAS stored
+    bool read_back = !item.streamHashed ||
+                     (config.verifySampleRate > 0 && verifyCount++ % config.verifySampleRate == 0);
+    if (ok && read_back) {
+        uint8_t digest[HASH_DIGEST_MAX_LEN];
+        if (item.copyMethod == COPY_METHOD_CHUNKED) {
+            // Rebuild the file from its manifest, every chunk is checked against its id on the way
+            Hasher hasher;
+            hasher.init(item.algo);
+            ok = chunkStore.restore(item.tmpPath.c_str(), -1, &hasher);
+            if (ok)
+                hasher.final(digest);
+        } else {
+            ok = readBack(item.tmpPath.c_str(), item.algo, digest);
+        }
+        ok = ok && memcmp(digest, item.digest, digest_len) == 0;
+        stats.add(STAT_FILES_READ_BACK);
+    }
+    if (!ok && !cancelled)
+        fprintf(stderr, "Verify %s failed, the copy does not match the source.\n", item.tmpPath.c_str());
+    return ok;
+}
+
+// "a.jpg" -> "a (n).jpg", while "a.CR3.xmp" and "clip.mov.wbm" become "a (n).CR3.xmp" and "clip (n).mov.wbm"
+static std::string numberedPath(const std::string &path, int n)
+{
+    if (n == 0)
+        return path;
+    size_t slash = path.rfind('/');
+    size_t name = slash == std::string::npos ? 0 : slash + 1;
+    size_t dot = path.rfind('.');
+    if (dot == std::string::npos || dot <= name)
+        return path + " (" + std::to_string(n) + ")";
+    size_t inner = path.rfind('.', dot - 1);
+    if (inner != std::string::npos && inner > name && mediaTypeFromPath(path.substr(0, dot).c_str()) != MEDIA_NONE)
+        dot = inner;
+    return path.substr(0, dot) + " (" + std::to_string(n) + ")" + path.substr(dot);
+}
+
+/* link() refuses to replace an existing file, which makes picking a free
+ * name race-free between the verify workers: "a.jpg", "a (1).jpg", ...
+ * A group takes the first number that is free for all of its files, so a
+ * raw, its JPEG and its sidecar keep matching names.
+ */
+bool BackupEngine::linkGroup(BackupItem &item)
+{
+    std::vector<BackupItem *> members = groupMembers(item);
+    for (int n = 0; n < MAX_NAME_RETRY; n++) {
+        size_t linked = 0;
+        int err = 0;
+        for (; linked < members.size(); linked++) {
+            BackupItem &member = *members[linked];
+            std::string dst = numberedPath(member.dstPath, n);
+            if (link(member.tmpPath.c_str(), dst.c_str()) != 0) {
+                err = errno;
+                if (err != EEXIST)
+                    fprintf(stderr, "Link %s to %s failed: %s\n", member.tmpPath.c_str(), dst.c_str(), strerror(err));
+                break;
+            }
+        }
+        if (linked == members.size()) {
+            for (BackupItem *member : members) {
+                unlink(member->tmpPath.c_str());
+                member->dstPath = numberedPath(member->dstPath, n);
+            }
+            return true;
+        }
+        // Only names this group took itself are given back
+        for (size_t k = 0; k < linked; k++)
+            unlink(numberedPath(members[k]->dstPath, n).c_str());
+        if (err != EEXIST)
+            return false;
+    }
+    return false;
+}
+
+bool BackupEngine::verifyStage(BackupItem &item)
+{
+    std::vector<BackupItem *> members = groupMembers(item);
+    for (BackupItem *member : members) {
+        if (!verifyMember(*member)) {
+            discardGroup(item);
+            return false;
+        }
+    }
+    if (!linkGroup(item)) {
+        discardGroup(item);
+        return false;
+    }
+
+    for (BackupItem *member : members) {
+        // Sidecars too, an unchanged one must not go again next to its shot
+        appendHashList(*member);
+        journal.append(JOURNAL_COPIED, member->relPath, member->size, member->mtime, member->algo, member->digest);
+        stats.add(STAT_FILES_VERIFIED);
+    }
+    return true;
+}
+
+// Binary indexes and missing lists are left alone, the backup itself does not depend on the append
+bool BackupEngine::openHashList(const std::string &path, int *fd)
+{
+    *fd = -1;
+    if (path.empty() || HashIndex::isIndexFile(path.c_str()))
+        return false;
+    int list = open(path.c_str(), O_RDWR | O_APPEND | O_CLOEXEC);
+    if (list < 0) {
+        fprintf(stderr, "Open hash list %s for appending failed: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+    // Never glue the first new line onto an unterminated last one
+    struct stat st;
+    char last = '\n';
+    if (fstat(list, &st) == 0 && st.st_size > 0 && pread(list, &last, 1, st.st_size - 1) == 1 &&
+        last != '\n' && write(list, "\n", 1) != 1) {
+        fprintf(stderr, "Write hash list %s failed: %s\n", path.c_str(), strerror(errno));
+        close(list);
+        return false;
+    }
+    *fd = list;
+    return true;
+}
+
+void BackupEngine::appendHashList(const BackupItem &item)
+{
+    bool video = item.type == MEDIA_VIDEO;
+    if (video ? videoListRun : photoListRun) {
+        // A list shared by both media types gets one run
+        std::vector<uint8_t> &digests = video && config.videoHashFile != config.photoHashFile ?
+                                        videoRunDigests : photoRunDigests;
+        std::lock_guard<std::mutex> lock(listMutex);
+        digests.insert(digests.end(), item.digest, item.digest + hashDigestLen(item.algo));
+        return;
+    }
+    int fd = video ? videoListFd : photoListFd;
+    if (fd < 0)
+        return;
+    std::string line = HashIndex::textListLine(item.algo, item.digest,
+                                               item.dstPath.substr(config.outputDir.size() + 1));
+    // One write per line, O_APPEND keeps the lines whole
+    std::lock_guard<std::mutex> lock(listMutex);
+    if (write(fd, line.data(), line.size()) != (ssize_t)line.size()) {
+        fprintf(stderr, "Append %s to hash list failed: %s\n", item.dstPath.c_str(), strerror(errno));
+        listFailed = true;
+    }
+}
+
+// False when a digest of this run may be missing from a list
+bool BackupEngine::closeHashLists(void)
+{
+    bool ok = !listFailed;
+    if (!photoRunDigests.empty() && !HashIndex::appendRun(config.photoHashFile.c_str(), photoAlgo, photoRunDigests)) {
+        fprintf(stderr, "Adding %lu digests to %s failed.\n",
+                (unsigned long)(photoRunDigests.size() / hashDigestLen(photoAlgo)), config.photoHashFile.c_str());
+        ok = false;
+    }
+    if (!videoRunDigests.empty() && !HashIndex::appendRun(config.videoHashFile.c_str(), videoAlgo, videoRunDigests)) {
+        fprintf(stderr, "Adding %lu digests to %s failed.\n",
+                (unsigned long)(videoRunDigests.size() / hashDigestLen(videoAlgo)), config.videoHashFile.c_str());
+        ok = false;
+    }
+    photoRunDigests.clear();
+    videoRunDigests.clear();
+    int fds[2] = { photoListFd, videoListFd != photoListFd ? videoListFd : -1 };
+    const std::string *paths[2] = { &config.photoHashFile, &config.videoHashFile };
+    for (int i = 0; i < 2; i++) {
+        if (fds[i] < 0)
+            continue;
+        if (fsync(fds[i]) != 0) {
+            fprintf(stderr, "Sync hash list %s failed: %s\n", paths[i]->c_str(), strerror(errno));
+            ok = false;
+        }
+        close(fds[i]);
+    }
+    photoListFd = videoListFd = -1;
+    return ok;
+}
@@ -0,0 +1,318 @@
+#ifndef _BACKUP_ENGINE_H
+#define _BACKUP_ENGINE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <future>
+#include <mutex>
+#include <unordered_set>
+#include "bounded_queue.h"
+#include "aimd_controller.h"
+#include "chunk_store.h"
+#include "dir_walker.h"
+#include "file_copy.h"
+#include "hash_index.h"
+#include "io_ring.h"
+#include "journal.h"
+#include "scan_cache.h"
+#include "hasher.h"
+
+// Under the output directory, the engine and the thumbnailer keep their state there
+#define STATE_DIR           ".warbler"
+
+enum MediaType {
+    MEDIA_NONE = 0,
+    MEDIA_PHOTO,
+    MEDIA_VIDEO,
+    MEDIA_SIDECAR               // edits and metadata next to a photo, .xmp / .aae / .thm
+};
+
+enum BackupState {
+    BACKUP_IDLE = 0,
+    BACKUP_RUNNING,
+    BACKUP_FINISHED,
+    BACKUP_CANCELLED
+};
+
+enum IoBackend {
+    IO_BACKEND_THREADS = 0,     // one blocking syscall at a time per worker
+    IO_BACKEND_URING            // statx, open, read and write batched through io_uring
+};
+
+enum OutputLayout {
+    OUTPUT_LAYOUT_MIRROR = 0,   // the directories of the import tree
+    OUTPUT_LAYOUT_DATE          // YYYY/MM/DD of the capture time, from EXIF / mvhd or else the mtime
+};
+
+struct BackupConfig {
+    std::string importDir;
+    std::string outputDir;
+    std::string photoHashFile;
+    std::string videoHashFile;
+    int scanWorkers = 4;
+    int hashWorkers = 2;
+    int copyWorkers = 2;
+    /* Writers to the output directory are adjusted between these bounds
+     * from the measured write cost, copyWorkers is where they start. With
+     * io_uring the limit is the number of files in flight per ring, it starts
+     * at the queue depth and may shrink down to copyWorkersMin.
+     */
+    bool adaptiveCopy = true;
+    int copyWorkersMin = 1;
+    int copyWorkersMax = 8;
+    int verifyWorkers = 1;
+    size_t queueCapacity = 1024;
+    // Falls back to the threads when the kernel has no usable io_uring
+    IoBackend ioBackend = IO_BACKEND_THREADS;
+    unsigned ioQueueDepth = 32;
+    // Store videos as content defined chunks plus a manifest, so a trimmed clip only adds its new chunks
+    bool chunkVideos = false;
+    // Hash the data on its way to the NAS instead of reading every copy back
+    bool hashWhileCopying = true;
+    // Also read one streamed copy in N back from the NAS, 0 never
+    unsigned verifySampleRate = 32;
+    // Append the digest of every verified copy to the text hash list of its media type
+    bool updateHashLists = true;
+    // Back up RAW+JPEG pairs, Live Photos and sidecars of one shot as one unit
+    bool groupCompanions = true;
+    OutputLayout layout = OUTPUT_LAYOUT_MIRROR;
+};
+
+struct BackupItem {
+    std::string srcPath;
+    std::string relPath;        // relative to the import directory
+    std::string dstPath;        // final path under the output directory
+    std::string tmpPath;        // where the copy lives until it is verified
+    MediaType type = MEDIA_NONE;
+    HashAlgo algo = HASH_ALGO_NONE;
+    uint64_t size = 0;
+    int64_t mtime = 0;          // in ns
+    int64_t ctime = 0;          // in ns
+    int64_t captureTime = 0;    // wall clock seconds, see media_meta.h, 0 unknown
+    uint64_t dev = 0;
+    uint64_t inode = 0;
+    CopyMethod copyMethod = COPY_METHOD_NONE;
+    bool streamHashed = false;  // copyDigest holds the digest of what was written
+    uint8_t digest[HASH_DIGEST_MAX_LEN];
+    uint8_t copyDigest[HASH_DIGEST_MAX_LEN];
+    /* Files that travel with this one: the JPEG of a RAW, the MOV of a Live
+     * Photo, sidecars. The group is looked up by this file's digest alone
+     * and is copied, verified and named as a whole.
+     */
+    std::vector<BackupItem> companions;
+};
+
+#define STATS_WORKER_SLOTS  32
+
+enum StatCounter {
+    STAT_FILES_SCANNED = 0,
+    STAT_BYTES_SCANNED,
+    STAT_FILES_HASHED,
+    STAT_BYTES_HASHED,
+    STAT_FILES_CACHED,          // digest taken from the scan cache, not read
+    STAT_FILES_DUPLICATE,
+    STAT_FILES_COPIED,
+    STAT_BYTES_COPIED,
+    STAT_FILES_VERIFIED,
+    STAT_FILES_FAILED,
+    STAT_FILES_RESUMED,         // finished by an earlier run, found in the journal
+    STAT_FILES_READ_BACK,       // copies read back from the NAS to verify them
+    STAT_FILES_GROUPED,         // companions, travelling in the group of another file
+    STAT_INDEX_LOOKUPS,
+    STAT_CHUNKS,
+    STAT_CHUNKS_NEW,
+    STAT_CHUNK_BYTES,
+    STAT_CHUNK_BYTES_NEW,
+    STAT_CHUNK_NANOS,           // spent finding cut points, for the chunking throughput
+    STAT_COPY_METHOD,           // COPY_METHOD_COUNT counters, the path each copied file took
+    STAT_COUNT = STAT_COPY_METHOD + COPY_METHOD_COUNT
+};
+
+// Stages whose time per item is measured, the scanner hands out files faster than it could be timed
+enum PipelineStage {
+    STAGE_HASH = 0,
+    STAGE_DEDUP,
+    STAGE_COPY,
+    STAGE_VERIFY,
+    STAGE_COUNT
+};
+
+/* Time an item spent in a stage, log-linear in microseconds: below 4 us one
+ * bucket per microsecond, above that 4 buckets per power of two, so any
+ * percentile read back is within 25 % of the truth. The last bucket holds
+ * everything from about an hour up.
+ */
+#define LATENCY_BUCKETS     128
+
+struct StageLatency {
+    uint64_t bucket[LATENCY_BUCKETS];
+
+    uint64_t count(void) const;
+    // Upper bound of the bucket holding the p-th fraction of the items, in microseconds
+    double percentile(double p) const;
+};
+
+// One worker's counters, alone on their cache lines so that counting never bounces a line between cores
+struct alignas(64) WorkerCounters {
+    std::atomic<uint64_t> value[STAT_COUNT];
+    std::atomic<uint64_t> latency[STAGE_COUNT][LATENCY_BUCKETS];
+};
+
+/* Written by the workers, read by the render loop without any lock. Each
+ * thread counts into its own slot, taken the first time it counts in a
+ * run; readers sum the slots.
+ */
+struct BackupStats {
+    WorkerCounters workers[STATS_WORKER_SLOTS];
+    std::atomic<double> scanRate{0.0};         // files per second found by the walker
+    std::atomic<bool> scanDone{false};
+
+    void add(StatCounter counter, uint64_t n = 1);
+    // The calling thread's own counter, for code that counts through a pointer
+    std::atomic<uint64_t> &local(StatCounter counter);
+    void sum(uint64_t totals[STAT_COUNT]) const;
+    void addLatency(PipelineStage stage, int64_t nanos);
+    void sumLatency(StageLatency latency[STAGE_COUNT]) const;
+    void reset(void);
+
+private:
+    std::atomic<unsigned> generation{0};
+    std::atomic<unsigned> nextSlot{0};
+
+    unsigned slot(void);
+};
+
+// Everything the progress panel shows, aggregated once per frame
+struct BackupTotals {
+    uint64_t value[STAT_COUNT];
+    size_t hashQueued;
+    size_t dedupQueued;
+    size_t copyQueued;
+    size_t verifyQueued;
+    int copyLimit;              // writers, or files in flight per ring, the controller allows now
+    int copyLimitMin;
+    int copyLimitMax;
+    double scanRate;
+    bool scanDone;
+
+    uint64_t get(StatCounter counter) const
+    {
+        return value[counter];
+    }
+};
+
+// Files the run worked on, resumed ones cost nothing and would only inflate the rate
+uint64_t filesProcessed(const BackupTotals &totals);
+
+MediaType mediaTypeFromPath(const char *path);
+// False for an empty path, writable also requires write access
+bool isDirectory(const char *path, bool writable);
+bool isRegularFile(const char *path);
+
+/* Backup pipeline: scan -> hash -> dedup -> copy -> verify
+ * Every stage owns its threads and talks to the next one through a bounded
+ * queue, so a slow NAS write only fills the copy queue and never blocks the
+ * hashing of files that are still being read from the import directory.
+ */
+class BackupEngine
+{
+public:
+    ~BackupEngine();
+
+    bool start(const BackupConfig &config);
+    void cancel(void);
+    void wait(void);
+    BackupState getState(void);
+    // Lock free, cheap enough to call every frame
+    void getTotals(BackupTotals *totals);
+    // Lock free too, but reads every histogram of every worker, for reports rather than frames
+    void getLatency(StageLatency latency[STAGE_COUNT]);
+
+private:
+    typedef bool (BackupEngine::*StageFn)(BackupItem &item);
+    struct UringCopySlot;
+
+    BackupConfig config;
+    BackupStats stats;
+    std::atomic<int> state{BACKUP_IDLE};
+    std::atomic<bool> cancelled{false};
+
+    BoundedQueue<BackupItem> hashQueue;
+    BoundedQueue<BackupItem> dedupQueue;
+    BoundedQueue<BackupItem> copyQueue;
+    BoundedQueue<BackupItem> verifyQueue;
+    std::atomic<int> hashWorkersLive{0};
+    std::atomic<int> dedupWorkersLive{0};
+    std::atomic<int> copyWorkersLive{0};
+    std::atomic<int> verifyWorkersLive{0};
+    std::vector<std::thread> threads;
+
+    // Each hash list dictates the digest its media type is hashed with
+    HashAlgo photoAlgo = HASH_ALGO_SHA256;
+    HashAlgo videoAlgo = HASH_ALGO_SHA256;
+    // Mapped in the background, the dedup worker waits for them on its first item
+    HashIndex photoIndex;
+    HashIndex videoIndex;
+    // One list for both media types is opened once, as photoIndex
+    bool sharedIndex = false;
+    std::shared_future<bool> indexesLoaded;
+    // Loaded by the scanner before the first item, saved once the last hash worker is out
+    ScanCache scanCache;
+    ChunkStore chunkStore;
+    // Replayed before the scan starts, only appended to while the backup runs
+    Journal journal;
+    // Text hash lists that verified copies are appended to, -1 when not updated
+    int photoListFd = -1;
+    int videoListFd = -1;
+    // Binary indexes collect the digests of verified copies instead, written as one new run at the end
+    bool photoListRun = false;
+    bool videoListRun = false;
+    std::vector<uint8_t> photoRunDigests;
+    std::vector<uint8_t> videoRunDigests;
+    std::mutex listMutex;
+    bool listFailed = false;    // a line was not appended, under listMutex
+    std::atomic<uint64_t> verifyCount{0};
+    std::atomic<uint64_t> partCount{0};
+    AimdController copyControl;
+
+    // Only touched by the single dedup worker
+    bool indexesChecked = false;
+    std::unordered_set<std::string> seenDigests;
+
+    void spawnStage(PipelineStage stage, int workers, BoundedQueue<BackupItem> *in,
+            BoundedQueue<BackupItem> *out, std::atomic<int> *live, StageFn fn);
+    void runStage(PipelineStage stage, BoundedQueue<BackupItem> *in, BoundedQueue<BackupItem> *out,
+            std::atomic<int> *live, StageFn fn);
+    void finishStage(BoundedQueue<BackupItem> *out, std::atomic<int> *live);
+    bool loadIndexes(void);
+    bool loadIndex(HashIndex &index, const std::string &path, HashAlgo algo);
+    void scanWorker(void);
+    bool hashFile(const char *path, HashAlgo algo, uint8_t *digest, int64_t *capture_time);
+    void readCaptureTime(BackupItem &item);
+    bool hashMember(BackupItem &item);
+    bool hashStage(BackupItem &item);
+    bool dedupStage(BackupItem &item);
+    bool isNewSidecar(BackupItem &item);
+    bool isChunked(const BackupItem &item) const;
+    std::string destinationPath(const BackupItem &item) const;
+    bool prepareCopy(BackupItem &item);
+    bool copyMember(BackupItem &item);
+    bool copyStage(BackupItem &item);
+    void discardGroup(BackupItem &item);
+    void copyWorker(int index);
+    void uringCopyWorker(void);
+    bool uringCopyStep(IoRing &ring, UringCopySlot &slot, int32_t res);
+    void uringCopyDone(UringCopySlot &slot, int err);
+    bool verifyMember(BackupItem &item);
+    bool linkGroup(BackupItem &item);
+    bool verifyStage(BackupItem &item);
+    bool openHashList(const std::string &path, int *fd);
+    void appendHashList(const BackupItem &item);
+    bool closeHashLists(void);
+    void joinThreads(void);
+};
+
+#endif
@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "backup_engine.h"
+
+#define DEFAULT_FILES       600
+#define DEFAULT_SIZE_KB     1024
+#define ADAPT_MAX_WRITERS   16
+#define SAMPLE_US           20000
+
+/* A stand-in for the output target, applied to every write of the copy
+ * stage: each write waits `latencyMs' on its own (the round trip of a
+ * network mount, overlapped between writers), then its bytes go through one
+ * shared pipe of `mbPerSec'. `seekPenalty' shrinks the pipe for every extra
+ * writer, like disk heads moving between streams.
+ */
+struct Target {
+    const char *name;
+    double mbPerSec;
+    double latencyMs;
+    double seekPenalty;
+};
+
+static const Target targets[] = {
+    { "ssd", 400.0, 0.05, 0.0 },
+    { "hdd-raid", 150.0, 0.5, 0.15 },
+    { "nfs", 110.0, 20.0, 0.0 },
+};
+
+static const Target *target;
+static std::mutex pipeMutex;
+static double pipeBusyUntil;
+static std::atomic<int> writersActive;
+
+static double nowSeconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void sleepUntil(double t)
+{
+    double left = t - nowSeconds();
+    if (left > 0)
+        usleep((useconds_t)(left * 1e6));
+}
+
+static void throttleWrite(size_t len)
+{
+    int active = ++writersActive;
+    sleepUntil(nowSeconds() + target->latencyMs / 1000.0);
+
+    double bandwidth = target->mbPerSec * 1e6 / (1.0 + target->seekPenalty * (active - 1));
+    double done;
+    {
+        std::lock_guard<std::mutex> lock(pipeMutex);
+        double start = nowSeconds() > pipeBusyUntil ? nowSeconds() : pipeBusyUntil;
+        pipeBusyUntil = start + len / bandwidth;
+        done = pipeBusyUntil;
+    }
+    sleepUntil(done);
+    writersActive--;
+}
+
+static int removeEntry(const char *path, const struct stat *, int, struct FTW *)
+{
+    return remove(path);
+}
+
+static void removeTree(const std::string &path)
+{
+    nftw(path.c_str(), removeEntry, 64, FTW_DEPTH | FTW_PHYS);
+}
+
+static bool makeDataset(const std::string &root, int files, size_t size_kb)
+{
+    std::vector<uint8_t> buf(size_kb * 1024 * 3 / 2 + 1);
+    uint64_t x = 0x9E3779B97F4A7C15ULL;
+
+    for (int i = 0; i < files; i++) {
+        // Sizes spread between half and one and a half times the average, every file with its own content
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        size_t len = size_kb * 1024 / 2 + x % (size_kb * 1024 + 1);
+        for (size_t j = 0; j < len; j += 8) {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            memcpy(&buf[j], &x, len - j < 8 ? len - j : 8);
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "/IMG_%05d.JPG", i);
+        std::string path = root + name;
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0 || write(fd, buf.data(), len) != (ssize_t)len) {
+            fprintf(stderr, "Write %s failed: %s\n", path.c_str(), strerror(errno));
+            if (fd >= 0)
+                close(fd);
+            return false;
+        }
+        close(fd);
+    }
+    return true;
+}
+
+// writers == 0 lets the controller choose
+static bool runBackup(const std::string &src, const std::string &dst, int writers)
+{
+    removeTree(dst);
+    if (mkdir(dst.c_str(), 0755) != 0) {
+        fprintf(stderr, "Create %s failed: %s\n", dst.c_str(), strerror(errno));
+        return false;
+    }
+
+    BackupConfig config;
+    config.importDir = src;
+    config.outputDir = dst;
+    config.queueCapacity = 100000;
+    config.adaptiveCopy = writers == 0;
+    config.copyWorkers = writers == 0 ? 2 : writers;
+    config.copyWorkersMin = 1;
+    config.copyWorkersMax = writers == 0 ? ADAPT_MAX_WRITERS : writers;
+
+    BackupEngine engine;
+    pipeBusyUntil = 0.0;
+    double start = nowSeconds();
+    if (!engine.start(config))
+        return false;
+    BackupTotals totals;
+    double limit_sum = 0.0;
+    int samples = 0;
+    while (engine.getState() == BACKUP_RUNNING) {
+        engine.getTotals(&totals);
+        limit_sum += totals.copyLimit;
+        samples++;
+        usleep(SAMPLE_US);
+    }
+    engine.wait();
+    double secs = nowSeconds() - start;
+    engine.getTotals(&totals);
+
+    char mode[16];
+    snprintf(mode, sizeof(mode), writers == 0 ? "adaptive" : "fixed %d", writers);
+    fprintf(stdout, "%-9s %-10s %8.1f %10.1f %8d %8lu\n", target->name, mode,
+            totals.get(STAT_BYTES_COPIED) / secs / 1e6, samples > 0 ? limit_sum / samples : 0.0,
+            totals.copyLimit, (unsigned long)totals.get(STAT_FILES_FAILED));
+    removeTree(dst);
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <work dir> [files] [average KiB]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    std::string work = argv[1];
+    int files = argc > 2 ? atoi(argv[2]) : DEFAULT_FILES;
+    size_t size_kb = argc > 3 ? strtoul(argv[3], nullptr, 10) : DEFAULT_SIZE_KB;
+    if (files <= 0 || size_kb == 0) {
+        fprintf(stderr, "Usage: %s <work dir> [files] [average KiB]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    std::string src = work + "/bench-src";
+    std::string dst = work + "/bench-out";
+    removeTree(src);
+    if (mkdir(src.c_str(), 0755) != 0) {
+        fprintf(stderr, "Create %s failed: %s\n", src.c_str(), strerror(errno));
+        return EXIT_FAILURE;
+    }
+    fprintf(stdout, "Writing %d files of ~%zu KiB to %s\n", files, size_kb, src.c_str());
+    if (!makeDataset(src, files, size_kb))
+        return EXIT_FAILURE;
+    sync();
+
+    setCopyWriteHook(throttleWrite);
+    fprintf(stdout, "%-9s %-10s %8s %10s %8s %8s\n", "target", "writers", "MB/s", "mean", "final", "failed");
+    bool ok = true;
+    for (const Target &t : targets) {
+        target = &t;
+        for (int writers : { 1, 2, 4, 8, 0 })
+            ok = runBackup(src, dst, writers) && ok;
+    }
+    removeTree(src);
+    return ok ? 0 : EXIT_FAILURE;
+}
@@ -0,0 +1,330 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "backup_engine.h"
+
+#define DEFAULT_FILES       1000
+#define DEFAULT_SEED        1
+#define DEFAULT_DUP_PERCENT 10
+#define DEFAULT_DEPTH       2
+#define DEFAULT_PHOTO_KB    256
+#define DEFAULT_VIDEO_MB    4
+// One file in this many is a video
+#define VIDEO_EVERY         10
+// Subdirectories per directory level
+#define DIR_FANOUT          4
+// Spread of the log-normal file sizes, most land within a factor of 1.6 of the average
+#define SIZE_SIGMA          0.5
+#define WRITE_CHUNK         (1024 * 1024)
+#define POLL_US             1000
+
+#define USAGE "Usage: %s <work dir> [files] [seed] [duplicate %%] [depth] [photo KiB] [video MiB] [report.json]\n"
+
+struct Rng {
+    uint64_t x;
+
+    uint64_t next(void)
+    {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        return x;
+    }
+
+    double uniform(void)
+    {
+        return ((next() >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+    }
+
+    double normal(void)
+    {
+        return sqrt(-2.0 * log(uniform())) * cos(2.0 * M_PI * uniform());
+    }
+};
+
+// Everything a file's bytes are made from, a duplicate copies the whole of it
+struct FileSpec {
+    bool video;
+    uint64_t len;
+    uint64_t seed;
+};
+
+struct Dataset {
+    int files = 0;
+    int duplicates = 0;
+    int videos = 0;
+    uint64_t bytes = 0;
+};
+
+static const char *stageNames[STAGE_COUNT] = { "hash", "dedup", "copy", "verify" };
+
+static double nowSeconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int removeEntry(const char *path, const struct stat *, int, struct FTW *)
+{
+    return remove(path);
+}
+
+static void removeTree(const std::string &path)
+{
+    nftw(path.c_str(), removeEntry, 64, FTW_DEPTH | FTW_PHYS);
+}
+
+static uint64_t sizeOf(Rng &rng, uint64_t average)
+{
+    // Log-normal with the given mean
+    double len = average * exp(SIZE_SIGMA * rng.normal() - SIZE_SIGMA * SIZE_SIGMA / 2);
+    return std::max<uint64_t>(64, (uint64_t)len);
+}
+
+/* Just enough structure for the type to be told from the name and the
+ * header: a JPEG is SOI, random entropy data and EOI, an MP4 an ftyp box
+ * followed by one mdat box of random data.
+ */
+static bool writeFile(const std::string &path, const FileSpec &spec, std::vector<uint8_t> &buf)
+{
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Create %s failed: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+    Rng rng = { spec.seed | 1 };
+    bool ok = true;
+    for (uint64_t off = 0; off < spec.len && ok; off += buf.size()) {
+        size_t n = (size_t)std::min<uint64_t>(buf.size(), spec.len - off);
+        for (size_t j = 0; j < n; j += 8) {
+            uint64_t v = rng.next();
+            memcpy(&buf[j], &v, n - j < 8 ? n - j : 8);
+        }
+        if (off == 0 && !spec.video) {
+            buf[0] = 0xFF;
+            buf[1] = 0xD8;
+        } else if (off == 0 && n >= 32) {
+            static const uint8_t ftyp[24] = {
+                0, 0, 0, 24, 'f', 't', 'y', 'p', 'i', 's', 'o', 'm', 0, 0, 2, 0,
+                'i', 's', 'o', 'm', 'm', 'p', '4', '1'
+            };
+            memcpy(buf.data(), ftyp, sizeof(ftyp));
+            uint64_t mdat = spec.len - sizeof(ftyp);
+            uint8_t box[8] = { (uint8_t)(mdat >> 24), (uint8_t)(mdat >> 16), (uint8_t)(mdat >> 8), (uint8_t)mdat,
+                               'm', 'd', 'a', 't' };
+            memcpy(buf.data() + sizeof(ftyp), box, sizeof(box));
+        }
+        if (off + n == spec.len && !spec.video && n >= 2) {
+            buf[n - 2] = 0xFF;
+            buf[n - 1] = 0xD9;
+        }
+        ok = write(fd, buf.data(), n) == (ssize_t)n;
+    }
+    if (!ok)
+        fprintf(stderr, "Write %s failed: %s\n", path.c_str(), strerror(errno));
+    close(fd);
+    return ok;
+}
+
+/* Every choice comes from one generator seeded on the command line, so a
+ * seed always makes the same tree. Directories nest depth levels deep with
+ * DIR_FANOUT children each; a duplicate is the content of an earlier file
+ * under a new name in a random directory, what a card imported twice or a
+ * photo exported to another folder looks like.
+ */
+static bool makeDataset(const std::string &root, int files, uint64_t seed, int dup_percent, int depth,
+        uint64_t photo_len, uint64_t video_len, Dataset *dataset)
+{
+    Rng rng = { seed * 0x9E3779B97F4A7C15ULL + 1 };
+    std::vector<FileSpec> specs;
+    std::vector<uint8_t> buf(WRITE_CHUNK);
+    specs.reserve(files);
+
+    for (int i = 0; i < files; i++) {
+        FileSpec spec;
+        bool duplicate = !specs.empty() && (int)(rng.next() % 100) < dup_percent;
+        if (duplicate) {
+            spec = specs[rng.next() % specs.size()];
+            dataset->duplicates++;
+        } else {
+            spec.video = rng.next() % VIDEO_EVERY == 0;
+            spec.len = sizeOf(rng, spec.video ? video_len : photo_len);
+            spec.seed = rng.next();
+            specs.push_back(spec);
+        }
+
+        std::string dir = root;
+        for (int level = 0; level < depth; level++) {
+            dir += "/d" + std::to_string(rng.next() % DIR_FANOUT);
+            if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+                fprintf(stderr, "Create %s failed: %s\n", dir.c_str(), strerror(errno));
+                return false;
+            }
+        }
+        char name[32];
+        snprintf(name, sizeof(name), spec.video ? "/VID_%06d.MP4" : "/IMG_%06d.JPG", i);
+        if (!writeFile(dir + name, spec, buf))
+            return false;
+        dataset->files++;
+        dataset->videos += spec.video;
+        dataset->bytes += spec.len;
+    }
+    return true;
+}
+
+struct StageProgress {
+    StatCounter files;
+    StatCounter bytes;          // STAT_COUNT when the stage counts no bytes
+    uint64_t last;
+    double first;               // the poll before its count first moved, seconds from the start
+    double end;                 // when its count last moved
+};
+
+static void writeReport(FILE *f, uint64_t seed, int dup_percent, int depth, const Dataset &dataset,
+        double wall, const BackupTotals &totals, double scan_end, const StageProgress *progress,
+        const StageLatency *latency)
+{
+    fprintf(f, "{\n");
+    fprintf(f, "  \"seed\": %lu,\n", (unsigned long)seed);
+    fprintf(f, "  \"files\": %d,\n", dataset.files);
+    fprintf(f, "  \"videos\": %d,\n", dataset.videos);
+    fprintf(f, "  \"duplicates\": %d,\n", dataset.duplicates);
+    fprintf(f, "  \"duplicate_percent\": %d,\n", dup_percent);
+    fprintf(f, "  \"depth\": %d,\n", depth);
+    fprintf(f, "  \"bytes\": %lu,\n", (unsigned long)dataset.bytes);
+    fprintf(f, "  \"wall_seconds\": %.3f,\n", wall);
+    fprintf(f, "  \"failed\": %lu,\n", (unsigned long)totals.get(STAT_FILES_FAILED));
+    fprintf(f, "  \"stages\": {\n");
+    fprintf(f, "    \"scan\": { \"files\": %lu, \"seconds\": %.3f, \"files_per_second\": %.1f, \"mb_per_second\": %.1f },\n",
+            (unsigned long)totals.get(STAT_FILES_SCANNED), scan_end,
+            totals.get(STAT_FILES_SCANNED) / scan_end, totals.get(STAT_BYTES_SCANNED) / scan_end / 1e6);
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        const StageProgress &p = progress[s];
+        // Only the time the stage was busy, the stages overlap and the later ones start late
+        double active = p.end - p.first;
+        double secs = std::max(active, 1e-6);
+        fprintf(f, "    \"%s\": { \"files\": %lu, \"seconds\": %.3f, \"files_per_second\": %.1f, ", stageNames[s],
+                (unsigned long)totals.get(p.files), active, totals.get(p.files) / secs);
+        if (p.bytes != STAT_COUNT)
+            fprintf(f, "\"mb_per_second\": %.1f, ", totals.get(p.bytes) / secs / 1e6);
+        fprintf(f, "\"latency_us\": { \"count\": %lu, \"p50\": %.0f, \"p90\": %.0f, \"p99\": %.0f, \"p999\": %.0f, \"max\": %.0f } }%s\n",
+                (unsigned long)latency[s].count(), latency[s].percentile(0.5), latency[s].percentile(0.9),
+                latency[s].percentile(0.99), latency[s].percentile(0.999), latency[s].percentile(1.0),
+                s + 1 < STAGE_COUNT ? "," : "");
+    }
+    fprintf(f, "  }\n");
+    fprintf(f, "}\n");
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, USAGE, argv[0]);
+        return EXIT_FAILURE;
+    }
+    std::string work = argv[1];
+    int files = argc > 2 ? atoi(argv[2]) : DEFAULT_FILES;
+    uint64_t seed = argc > 3 ? strtoull(argv[3], nullptr, 10) : DEFAULT_SEED;
+    int dup_percent = argc > 4 ? atoi(argv[4]) : DEFAULT_DUP_PERCENT;
+    int depth = argc > 5 ? atoi(argv[5]) : DEFAULT_DEPTH;
+    uint64_t photo_kb = argc > 6 ? strtoull(argv[6], nullptr, 10) : DEFAULT_PHOTO_KB;
+    uint64_t video_mb = argc > 7 ? strtoull(argv[7], nullptr, 10) : DEFAULT_VIDEO_MB;
+    const char *report = argc > 8 ? argv[8] : nullptr;
+    if (files <= 0 || dup_percent < 0 || dup_percent > 100 || depth < 0 || photo_kb == 0 || video_mb == 0) {
+        fprintf(stderr, USAGE, argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    std::string src = work + "/bench-src";
+    std::string dst = work + "/bench-out";
+    removeTree(src);
+    removeTree(dst);
+    if (mkdir(src.c_str(), 0755) != 0 || mkdir(dst.c_str(), 0755) != 0) {
+        fprintf(stderr, "Create %s failed: %s\n", work.c_str(), strerror(errno));
+        return EXIT_FAILURE;
+    }
+    // The progress goes to stderr when the report takes stdout
+    FILE *log = report != nullptr ? stdout : stderr;
+    fprintf(log, "Writing %d files, %d%% duplicates, %d levels deep, seed %lu to %s\n", files, dup_percent,
+            depth, (unsigned long)seed, src.c_str());
+    Dataset dataset;
+    if (!makeDataset(src, files, seed, dup_percent, depth, photo_kb * 1024, video_mb * 1024 * 1024, &dataset))
+        return EXIT_FAILURE;
+    sync();
+
+    BackupConfig config;
+    config.importDir = src;
+    config.outputDir = dst;
+    // Hash lists stay empty, only duplicates within the tree are dropped
+    config.updateHashLists = false;
+
+    StageProgress progress[STAGE_COUNT] = {
+        { STAT_FILES_HASHED, STAT_BYTES_HASHED, 0, 0.0, 0.0 },
+        { STAT_INDEX_LOOKUPS, STAT_COUNT, 0, 0.0, 0.0 },
+        { STAT_FILES_COPIED, STAT_BYTES_COPIED, 0, 0.0, 0.0 },
+        { STAT_FILES_VERIFIED, STAT_COUNT, 0, 0.0, 0.0 },
+    };
+    BackupEngine engine;
+    BackupTotals totals;
+    double start = nowSeconds();
+    double scan_end = 0.0;
+    double polled = 0.0;
+    if (!engine.start(config))
+        return EXIT_FAILURE;
+    while (engine.getState() == BACKUP_RUNNING) {
+        engine.getTotals(&totals);
+        double now = nowSeconds() - start;
+        if (scan_end == 0.0 && totals.scanDone)
+            scan_end = now;
+        for (StageProgress &p : progress) {
+            if (totals.get(p.files) != p.last) {
+                // It moved somewhere since the previous poll
+                if (p.last == 0)
+                    p.first = polled;
+                p.last = totals.get(p.files);
+                p.end = now;
+            }
+        }
+        polled = now;
+        usleep(POLL_US);
+    }
+    engine.wait();
+    double wall = nowSeconds() - start;
+    engine.getTotals(&totals);
+    if (scan_end == 0.0)
+        scan_end = wall;
+    for (StageProgress &p : progress) {
+        if (totals.get(p.files) != p.last) {
+            if (p.last == 0)
+                p.first = polled;
+            p.end = wall;
+        }
+    }
+    static StageLatency latency[STAGE_COUNT];
+    engine.getLatency(latency);
+
+    FILE *f = report != nullptr ? fopen(report, "w") : stdout;
+    if (f == nullptr) {
+        fprintf(stderr, "Create %s failed: %s\n", report, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    writeReport(f, seed, dup_percent, depth, dataset, wall, totals, scan_end, progress, latency);
+    if (report != nullptr) {
+        fclose(f);
+        fprintf(log, "Report written to %s\n", report);
+    }
+    removeTree(src);
+    removeTree(dst);
+    return totals.get(STAT_FILES_FAILED) == 0 ? 0 : EXIT_FAILURE;
+}
@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include "chunk_store.h"
+
+#define DEFAULT_SIZE_MB     512
+#define TRIM_HEAD           (7 * 1024 * 1024 + 12345)
+#define TRIM_TAIL           (3 * 1024 * 1024 + 678)
+#define REMUX_HEADER_LEN    4096
+#define REMUX_EDIT_EVERY    (32 * 1024 * 1024)
+
+static double nowSeconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int removeEntry(const char *path, const struct stat *, int, struct FTW *)
+{
+    return remove(path);
+}
+
+static void removeTree(const std::string &path)
+{
+    nftw(path.c_str(), removeEntry, 64, FTW_DEPTH | FTW_PHYS);
+}
+
+static void fillRandom(uint8_t *data, size_t len, uint64_t seed)
+{
+    uint64_t x = seed;
+    for (size_t i = 0; i < len; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        data[i] = (uint8_t)x;
+    }
+}
+
+static bool writeFile(const std::string &path, const std::vector<uint8_t> &data)
+{
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0 || write(fd, data.data(), data.size()) != (ssize_t)data.size()) {
+        fprintf(stderr, "Write %s failed: %s\n", path.c_str(), strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return false;
+    }
+    close(fd);
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    size_t size_mb = argc > 1 ? strtoul(argv[1], nullptr, 10) : DEFAULT_SIZE_MB;
+    std::string work = argc > 2 ? argv[2] : "/tmp";
+    if (size_mb < 64) {
+        fprintf(stderr, "Usage: %s [clip size in MiB, at least 64] [work dir]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // The original clip, a trimmed copy and a re-muxed one with a new header and a few edits
+    std::vector<std::vector<uint8_t>> clips(3);
+    const char *names[] = { "original", "trimmed", "re-muxed" };
+    clips[0].resize(size_mb * 1024 * 1024);
+    fillRandom(clips[0].data(), clips[0].size(), 0x9E3779B97F4A7C15ULL);
+    clips[1].assign(clips[0].begin() + TRIM_HEAD, clips[0].end() - TRIM_TAIL);
+    clips[2].resize(REMUX_HEADER_LEN);
+    fillRandom(clips[2].data(), REMUX_HEADER_LEN, 42);
+    clips[2].insert(clips[2].end(), clips[0].begin(), clips[0].end());
+    for (size_t off = REMUX_EDIT_EVERY; off + 16 < clips[2].size(); off += REMUX_EDIT_EVERY)
+        fillRandom(clips[2].data() + off, 16, off);
+
+    std::string root = work + "/bench-cdc";
+    removeTree(root);
+    if (mkdir(root.c_str(), 0755) != 0) {
+        fprintf(stderr, "Create %s failed: %s\n", root.c_str(), strerror(errno));
+        return EXIT_FAILURE;
+    }
+    ChunkStore store;
+    if (!store.open(root + "/chunks"))
+        return EXIT_FAILURE;
+
+    fprintf(stdout, "Chunk sizes %d / %d / %d KiB (min / avg / max), store in %s\n",
+            CDC_MIN_SIZE / 1024, CDC_AVG_SIZE / 1024, CDC_MAX_SIZE / 1024, root.c_str());
+    fprintf(stdout, "%-9s %8s %7s %7s %9s %10s %10s %7s\n",
+            "clip", "MiB", "chunks", "new", "avg KiB", "cdc GB/s", "store MB/s", "dedup");
+    uint64_t total = 0, stored = 0;
+    bool ok = true;
+    for (size_t i = 0; i < clips.size(); i++) {
+        std::string src = root + "/" + names[i];
+        std::string manifest = src + MANIFEST_SUFFIX;
+        if (!writeFile(src, clips[i]))
+            return EXIT_FAILURE;
+
+        int fd = open(src.c_str(), O_RDONLY | O_CLOEXEC);
+        ChunkResult result;
+        double start = nowSeconds();
+        if (fd < 0 || !store.storeFile(fd, manifest.c_str(), &result, nullptr, nullptr)) {
+            fprintf(stderr, "Store %s failed.\n", src.c_str());
+            return EXIT_FAILURE;
+        }
+        double secs = nowSeconds() - start;
+        close(fd);
+        total += result.bytes;
+        stored += result.newBytes;
+        fprintf(stdout, "%-9s %8.1f %7lu %7lu %9.0f %10.2f %10.0f %6.2fx\n", names[i],
+                result.bytes / 1048576.0, (unsigned long)result.chunks, (unsigned long)result.newChunks,
+                result.bytes / 1024.0 / result.chunks, result.bytes / (result.cdcNanos * 1e-9) / 1e9,
+                result.bytes / secs / 1e6, (double)total / stored);
+
+        // The manifest has to give back exactly the clip
+        uint8_t expect[HASH_DIGEST_MAX_LEN], got[HASH_DIGEST_MAX_LEN];
+        Hasher hasher;
+        hasher.init(HASH_ALGO_SHA256);
+        hasher.update(clips[i].data(), clips[i].size());
+        hasher.final(expect);
+        hasher.init(HASH_ALGO_SHA256);
+        if (!store.restore(manifest.c_str(), -1, &hasher)) {
+            ok = false;
+            continue;
+        }
+        hasher.final(got);
+        if (memcmp(expect, got, SHA256_DIGEST_LEN) != 0) {
+            fprintf(stderr, "Restoring %s gave different data.\n", names[i]);
+            ok = false;
+        }
+    }
+    fprintf(stdout, "Total %.1f MiB stored as %.1f MiB, restore check %s\n",
+            total / 1048576.0, stored / 1048576.0, ok ? "passed" : "FAILED");
+
+    removeTree(root);
+    return ok ? 0 : EXIT_FAILURE;
+}
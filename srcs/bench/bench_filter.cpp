@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "hash_index.h"
+
+#define DEFAULT_ENTRIES     1000000
+#define DEFAULT_LOOKUPS     10000000
+
+static double nowSeconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t xorshift(uint64_t &x)
+{
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return x;
+}
+
+static void randomDigests(std::vector<uint8_t> &out, size_t count, uint64_t seed)
+{
+    out.resize(count * SHA256_DIGEST_LEN);
+    for (size_t i = 0; i < out.size(); i += 8) {
+        uint64_t v = xorshift(seed);
+        memcpy(out.data() + i, &v, 8);
+    }
+}
+
+// Lookups per second, the found count keeps the compiler from dropping the loop
+static double measure(const HashIndex &index, const std::vector<uint8_t> &digests, size_t lookups,
+        uint64_t *found)
+{
+    size_t count = digests.size() / SHA256_DIGEST_LEN;
+    uint64_t x = 0x2545F4914F6CDD1DULL;
+    *found = 0;
+    double start = nowSeconds();
+    for (size_t i = 0; i < lookups; i++)
+        *found += index.contains(digests.data() + (xorshift(x) % count) * SHA256_DIGEST_LEN);
+    return lookups / (nowSeconds() - start);
+}
+
+int main(int argc, char **argv)
+{
+    size_t entries = argc > 1 ? strtoul(argv[1], nullptr, 10) : DEFAULT_ENTRIES;
+    size_t lookups = argc > 2 ? strtoul(argv[2], nullptr, 10) : DEFAULT_LOOKUPS;
+    std::string work = argc > 3 ? argv[3] : "/tmp";
+    if (entries == 0 || lookups == 0) {
+        fprintf(stderr, "Usage: %s [entries] [lookups] [work dir]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    std::vector<uint8_t> present, absent;
+    randomDigests(present, entries, 0x9E3779B97F4A7C15ULL);
+    randomDigests(absent, entries, 0xD1B54A32D192ED03ULL);
+
+    std::string list = work + "/bench-filter.sha256";
+    FILE *fp = fopen(list.c_str(), "w");
+    if (fp == nullptr) {
+        fprintf(stderr, "Create %s failed.\n", list.c_str());
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < entries; i++) {
+        for (int j = 0; j < SHA256_DIGEST_LEN; j++)
+            fprintf(fp, "%02x", present[i * SHA256_DIGEST_LEN + j]);
+        fprintf(fp, "  IMG_%07zu.JPG\n", i);
+    }
+    fclose(fp);
+
+    HashIndex index;
+    double start = nowSeconds();
+    if (!index.open(list.c_str()))
+        return EXIT_FAILURE;
+    fprintf(stdout, "%zu entries: index and filter built in %.2f s\n", entries, nowSeconds() - start);
+    index.close();
+    start = nowSeconds();
+    if (!index.open(list.c_str()))
+        return EXIT_FAILURE;
+    fprintf(stdout, "Reopened from the cached files in %.3f s\n", nowSeconds() - start);
+
+    const XorFilter &filter = index.getFilter();
+    uint64_t false_positives = 0;
+    for (size_t i = 0; i < entries; i++)
+        false_positives += filter.contains(XorFilter::keyFromDigest(absent.data() + i * SHA256_DIGEST_LEN));
+    fprintf(stdout, "Filter: %.2f bits per entry, %.3f%% false positives\n",
+            filter.sizeInBytes() * 8.0 / entries, false_positives * 100.0 / entries);
+
+    fprintf(stdout, "%-8s %-8s %14s %10s\n", "lookups", "filter", "lookups/s", "found");
+    const char *kinds[] = { "hits", "misses" };
+    for (int kind = 0; kind < 2; kind++) {
+        const std::vector<uint8_t> &digests = kind == 0 ? present : absent;
+        for (int use = 1; use >= 0; use--) {
+            uint64_t found;
+            index.setUseFilter(use != 0);
+            double rate = measure(index, digests, lookups, &found);
+            fprintf(stdout, "%-8s %-8s %14.0f %10lu\n", kinds[kind], use ? "on" : "off", rate,
+                    (unsigned long)found);
+        }
+    }
+
+    // One backup's worth of new lines, only they are read, into a delta run
+    index.close();
+    std::vector<uint8_t> added;
+    size_t add = entries / 100 + 1;
+    randomDigests(added, add, 0x94D049BB133111EBULL);
+    fp = fopen(list.c_str(), "a");
+    if (fp == nullptr) {
+        fprintf(stderr, "Append to %s failed.\n", list.c_str());
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < add; i++) {
+        for (int j = 0; j < SHA256_DIGEST_LEN; j++)
+            fprintf(fp, "%02x", added[i * SHA256_DIGEST_LEN + j]);
+        fprintf(fp, "  NEW_%07zu.JPG\n", i);
+    }
+    fclose(fp);
+    start = nowSeconds();
+    if (!index.open(list.c_str()))
+        return EXIT_FAILURE;
+    fprintf(stdout, "Reopened after appending %zu lines in %.3f s, %zu delta runs\n",
+            add, nowSeconds() - start, index.getRunCount());
+
+    index.close();
+    unlink(list.c_str());
+    unlink((list + HASH_INDEX_SUFFIX).c_str());
+    unlink((list + HASH_INDEX_SUFFIX HASH_RUN_SUFFIX "1").c_str());
+    unlink((list + XOR_FILTER_SUFFIX).c_str());
+    return 0;
+}
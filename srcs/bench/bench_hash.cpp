@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include "hasher.h"
+
+#define DEFAULT_SIZE_MB     256
+#define DEFAULT_ROUNDS      5
+#define UPDATE_LEN          (1024 * 1024)
+
+static double nowSeconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Feeds the buffer in 1 MiB updates, the same way the engine hashes a file
+static double measure(HashAlgo algo, const std::vector<uint8_t> &buf, int rounds)
+{
+    double best = 0.0;
+    uint8_t digest[HASH_DIGEST_MAX_LEN];
+
+    for (int r = 0; r < rounds; r++) {
+        double start = nowSeconds();
+        Hasher hasher;
+        hasher.init(algo);
+        for (size_t off = 0; off < buf.size(); off += UPDATE_LEN) {
+            size_t n = buf.size() - off < UPDATE_LEN ? buf.size() - off : UPDATE_LEN;
+            hasher.update(buf.data() + off, n);
+        }
+        hasher.final(digest);
+        double gbps = buf.size() / (nowSeconds() - start) / 1e9;
+        if (gbps > best)
+            best = gbps;
+    }
+    return best;
+}
+
+int main(int argc, char **argv)
+{
+    size_t size_mb = argc > 1 ? strtoul(argv[1], nullptr, 10) : DEFAULT_SIZE_MB;
+    int rounds = argc > 2 ? atoi(argv[2]) : DEFAULT_ROUNDS;
+    if (size_mb == 0 || rounds <= 0) {
+        fprintf(stderr, "Usage: %s [size in MiB] [rounds]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    std::vector<uint8_t> buf(size_mb * 1024 * 1024);
+    uint64_t x = 0x9E3779B97F4A7C15ULL;
+    for (size_t i = 0; i < buf.size(); i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        buf[i] = (uint8_t)x;
+    }
+
+    fprintf(stdout, "Hashing %zu MiB, best of %d rounds, single thread\n", size_mb, rounds);
+    fprintf(stdout, "%-10s %-8s %10s\n", "algorithm", "kernel", "GB/s");
+
+    const Xxh3Kernel xxh3_kernels[] = {
+        XXH3_KERNEL_SCALAR, XXH3_KERNEL_SSE2, XXH3_KERNEL_AVX2, XXH3_KERNEL_AVX512
+    };
+    for (Xxh3Kernel kernel : xxh3_kernels) {
+        if (!xxh3SetKernel(kernel)) {
+            fprintf(stdout, "%-10s %-8s %10s\n", hashAlgoName(HASH_ALGO_XXH3), xxh3KernelName(kernel), "n/a");
+            continue;
+        }
+        fprintf(stdout, "%-10s %-8s %10.2f\n", hashAlgoName(HASH_ALGO_XXH3), xxh3KernelName(kernel),
+                measure(HASH_ALGO_XXH3, buf, rounds));
+    }
+
+    const Sha256Kernel sha256_kernels[] = { SHA256_KERNEL_SCALAR, SHA256_KERNEL_SHANI };
+    for (Sha256Kernel kernel : sha256_kernels) {
+        if (!sha256SetKernel(kernel)) {
+            fprintf(stdout, "%-10s %-8s %10s\n", hashAlgoName(HASH_ALGO_SHA256), sha256KernelName(kernel), "n/a");
+            continue;
+        }
+        fprintf(stdout, "%-10s %-8s %10.2f\n", hashAlgoName(HASH_ALGO_SHA256), sha256KernelName(kernel),
+                measure(HASH_ALGO_SHA256, buf, rounds));
+    }
+
+    xxh3SetKernel(XXH3_KERNEL_AUTO);
+    sha256SetKernel(SHA256_KERNEL_AUTO);
+    fprintf(stdout, "Runtime dispatch picks: XXH3 %s, SHA-256 %s\n",
+            xxh3KernelName(xxh3GetKernel()), sha256KernelName(sha256GetKernel()));
+    return 0;
+}
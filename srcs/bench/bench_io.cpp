@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include "backup_engine.h"
+
+#define DEFAULT_FILES       100000
+#define DEFAULT_SIZE_KB     16
+#define DEFAULT_QUEUE_DEPTH 32
+#define FILES_PER_DIR       1000
+
+static double nowSeconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int removeEntry(const char *path, const struct stat *, int, struct FTW *)
+{
+    return remove(path);
+}
+
+static void removeTree(const std::string &path)
+{
+    nftw(path.c_str(), removeEntry, 64, FTW_DEPTH | FTW_PHYS);
+}
+
+// Camera-like layout: DCIM/100WARBL/IMG_00001.JPG, every file with its own content
+static bool makeDataset(const std::string &root, int files, size_t size_kb)
+{
+    std::vector<uint8_t> buf(size_kb * 1024 * 3 / 2 + 4);
+    uint64_t x = 0x9E3779B97F4A7C15ULL;
+    std::string dir;
+
+    for (int i = 0; i < files; i++) {
+        if (i % FILES_PER_DIR == 0) {
+            dir = root + "/DCIM/" + std::to_string(100 + i / FILES_PER_DIR) + "WARBL";
+            mkdir((root + "/DCIM").c_str(), 0755);
+            if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+                fprintf(stderr, "Create %s failed: %s\n", dir.c_str(), strerror(errno));
+                return false;
+            }
+        }
+        // Sizes spread between half and one and a half times the average
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        size_t len = size_kb * 1024 / 2 + x % (size_kb * 1024 + 1);
+        buf[0] = 0xFF;
+        buf[1] = 0xD8;
+        for (size_t j = 2; j + 2 < len; j++) {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            buf[j] = (uint8_t)x;
+        }
+        buf[len - 2] = 0xFF;
+        buf[len - 1] = 0xD9;
+
+        char name[32];
+        snprintf(name, sizeof(name), "/IMG_%05d.JPG", i);
+        std::string path = dir + name;
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0 || write(fd, buf.data(), len) != (ssize_t)len) {
+            fprintf(stderr, "Write %s failed: %s\n", path.c_str(), strerror(errno));
+            if (fd >= 0)
+                close(fd);
+            return false;
+        }
+        close(fd);
+    }
+    return true;
+}
+
+static bool runBackup(const char *name, const std::string &src, const std::string &dst,
+        IoBackend backend, unsigned depth, int files)
+{
+    removeTree(dst);
+    if (mkdir(dst.c_str(), 0755) != 0) {
+        fprintf(stderr, "Create %s failed: %s\n", dst.c_str(), strerror(errno));
+        return false;
+    }
+
+    BackupConfig config;
+    config.importDir = src;
+    config.outputDir = dst;
+    config.ioBackend = backend;
+    config.ioQueueDepth = depth;
+    // Let the scanner run ahead so its own rate is visible
+    config.queueCapacity = files + 1;
+
+    BackupEngine engine;
+    double start = nowSeconds();
+    if (!engine.start(config))
+        return false;
+    double scan_end = 0.0;
+    while (engine.getState() == BACKUP_RUNNING) {
+        BackupTotals totals;
+        engine.getTotals(&totals);
+        if (scan_end == 0.0 && totals.scanDone)
+            scan_end = nowSeconds();
+        usleep(1000);
+    }
+    engine.wait();
+    double end = nowSeconds();
+    if (scan_end == 0.0)
+        scan_end = end;
+
+    BackupTotals totals;
+    engine.getTotals(&totals);
+    double scan_secs = scan_end - start;
+    double total_secs = end - start;
+    fprintf(stdout, "%-8s %10.0f %10.2f %10.0f %10.1f %8lu\n", name,
+            totals.get(STAT_FILES_SCANNED) / scan_secs, total_secs,
+            totals.get(STAT_FILES_VERIFIED) / total_secs, totals.get(STAT_BYTES_COPIED) / total_secs / 1e6,
+            (unsigned long)totals.get(STAT_FILES_FAILED));
+    removeTree(dst);
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <work dir> [files] [average KiB] [io_uring queue depth]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    std::string work = argv[1];
+    int files = argc > 2 ? atoi(argv[2]) : DEFAULT_FILES;
+    size_t size_kb = argc > 3 ? strtoul(argv[3], nullptr, 10) : DEFAULT_SIZE_KB;
+    unsigned depth = argc > 4 ? strtoul(argv[4], nullptr, 10) : DEFAULT_QUEUE_DEPTH;
+    if (files <= 0 || size_kb == 0 || depth == 0) {
+        fprintf(stderr, "Usage: %s <work dir> [files] [average KiB] [io_uring queue depth]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    std::string src = work + "/bench-src";
+    std::string dst = work + "/bench-out";
+    removeTree(src);
+    if (mkdir(src.c_str(), 0755) != 0) {
+        fprintf(stderr, "Create %s failed: %s\n", src.c_str(), strerror(errno));
+        return EXIT_FAILURE;
+    }
+    fprintf(stdout, "Writing %d files of ~%zu KiB to %s\n", files, size_kb, src.c_str());
+    if (!makeDataset(src, files, size_kb))
+        return EXIT_FAILURE;
+    // Both runs read a warm page cache, what is left is the cost of the syscalls and the writes
+    sync();
+
+    fprintf(stdout, "Backup into %s, io_uring queue depth %u\n", dst.c_str(), depth);
+    fprintf(stdout, "%-8s %10s %10s %10s %10s %8s\n", "backend", "scan f/s", "total s", "files/s", "MB/s", "failed");
+    bool ok = runBackup("threads", src, dst, IO_BACKEND_THREADS, depth, files);
+    if (!IoRing::supported())
+        fprintf(stdout, "%-8s %10s\n", "io_uring", "n/a");
+    else
+        ok = runBackup("io_uring", src, dst, IO_BACKEND_URING, depth, files) && ok;
+
+    removeTree(src);
+    return ok ? 0 : EXIT_FAILURE;
+}
@@ -0,0 +1,110 @@
+#ifndef _BOUNDED_QUEUE_H
+#define _BOUNDED_QUEUE_H
+
+#include <stddef.h>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+/* A blocking FIFO with a fixed capacity, used to connect the stages of the
+ * backup pipeline. A full queue blocks the producer, so a slow stage applies
+ * back pressure instead of letting the previous stage buffer the whole import.
+ * Once closed, push fails and pop drains what is left then fails.
+ */
+template <typename T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(size_t capacity = 1024) : capacity(capacity) {}
+
+    void setCapacity(size_t cap)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        capacity = cap;
+    }
+
+    bool push(T &&item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [this] { return closed || items.size() < capacity; });
+        if (closed)
+            return false;
+        items.push_back(std::move(item));
+        count.store(items.size(), std::memory_order_relaxed);
+        lock.unlock();
+        notEmpty.notify_one();
+        return true;
+    }
+
+    bool pop(T &item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [this] { return closed || !items.empty(); });
+        if (items.empty())
+            return false;
+        item = std::move(items.front());
+        items.pop_front();
+        count.store(items.size(), std::memory_order_relaxed);
+        lock.unlock();
+        notFull.notify_one();
+        return true;
+    }
+
+    // Never blocks, fails when nothing is queued right now
+    bool tryPop(T &item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (items.empty())
+            return false;
+        item = std::move(items.front());
+        items.pop_front();
+        count.store(items.size(), std::memory_order_relaxed);
+        lock.unlock();
+        notFull.notify_one();
+        return true;
+    }
+
+    void close(void)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+        notFull.notify_all();
+        notEmpty.notify_all();
+    }
+
+    // Drop everything queued and accept new items again
+    void reset(void)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        items.clear();
+        count = 0;
+        closed = false;
+    }
+
+    // Closed and empty, pop would fail right away
+    bool drained(void)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return closed && items.empty();
+    }
+
+    // Lock free, a snapshot for the progress display that may already be stale
+    size_t size(void) const
+    {
+        return count.load(std::memory_order_relaxed);
+    }
+
+private:
+    size_t capacity;
+    bool closed = false;
+    std::deque<T> items;
+    std::atomic<size_t> count{0};
+    std::mutex mutex;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+};
+
+#endif
@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <vector>
+#include "chunk_store.h"
+
+#define CHUNK_BUF_LEN       (2 * CDC_MAX_SIZE)
+
+static int64_t nowNanos(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static bool writeAll(int fd, const void *data, size_t len)
+{
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+// Reads up to len bytes, less only at the end of the file
+static ssize_t readFull(int fd, uint8_t *data, size_t len)
+{
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = read(fd, data + done, len - done);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (n == 0)
+            break;
+        done += n;
+    }
+    return done;
+}
+
+static std::vector<uint8_t> &chunkBuffer(void)
+{
+    // Each worker thread reuses one buffer for the whole run
+    static thread_local std::vector<uint8_t> buf(CHUNK_BUF_LEN);
+    return buf;
+}
+
+bool ChunkStore::open(const std::string &store_dir)
+{
+    dir = store_dir;
+    cdc.init();
+    if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Create chunk store %s failed: %s\n", dir.c_str(), strerror(errno));
+        dir.clear();
+        return false;
+    }
+    char sub[4];
+    for (int i = 0; i < 256; i++) {
+        snprintf(sub, sizeof(sub), "/%02x", i);
+        std::string path = dir + sub;
+        if (mkdir(path.c_str(), 0755) != 0 && errno != EEXIST) {
+            fprintf(stderr, "Create chunk store %s failed: %s\n", path.c_str(), strerror(errno));
+            dir.clear();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ChunkStore::isOpen(void) const
+{
+    return !dir.empty();
+}
+
+std::string ChunkStore::chunkPath(const uint8_t *id) const
+{
+    static const char hex[] = "0123456789abcdef";
+    char name[4 + SHA256_DIGEST_LEN * 2 + 1];
+    name[0] = '/';
+    name[1] = hex[id[0] >> 4];
+    name[2] = hex[id[0] & 0xf];
+    name[3] = '/';
+    for (int i = 0; i < SHA256_DIGEST_LEN; i++) {
+        name[4 + i * 2] = hex[id[i] >> 4];
+        name[4 + i * 2 + 1] = hex[id[i] & 0xf];
+    }
+    name[sizeof(name) - 1] = '\0';
+    return dir + name;
+}
+
+bool ChunkStore::storeChunk(const uint8_t *id, const uint8_t *data, size_t len, bool *created)
+{
+    std::string path = chunkPath(id);
+    *created = false;
+    if (access(path.c_str(), F_OK) == 0)
+        return true;
+
+    // link() does not replace, so of two threads storing the same chunk exactly one creates it
+    std::string tmp_path = path + ".tmp" + std::to_string((long)syscall(SYS_gettid));
+    int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Create chunk %s failed: %s\n", tmp_path.c_str(), strerror(errno));
+        return false;
+    }
+    bool ok = writeAll(fd, data, len) && fsync(fd) == 0;
+    close(fd);
+    if (ok && link(tmp_path.c_str(), path.c_str()) == 0)
+        *created = true;
+    else if (ok && errno != EEXIST)
+        ok = false;
+    if (!ok)
+        fprintf(stderr, "Write chunk %s failed: %s\n", path.c_str(), strerror(errno));
+    unlink(tmp_path.c_str());
+    return ok;
+}
+
+bool ChunkStore::storeFile(int fd, const char *manifest_path, ChunkResult *result, Hasher *hasher,
+        const std::atomic<bool> *cancelled)
+{
+    memset(result, 0, sizeof(*result));
+    std::vector<uint8_t> &buf = chunkBuffer();
+    std::vector<ManifestEntry> entries;
+    size_t avail = 0;
+    bool eof = false;
+
+    for (;;) {
+        // Keep at least one maximum chunk in the buffer, so every cut is a real one
+        if (!eof && avail < CDC_MAX_SIZE) {
+            ssize_t n = readFull(fd, buf.data() + avail, buf.size() - avail);
+            if (n < 0)
+                return false;
+            eof = avail + n < buf.size();
+            avail += n;
+        }
+        if (avail == 0)
+            break;
+        if (cancelled != nullptr && *cancelled) {
+            errno = ECANCELED;
+            return false;
+        }
+
+        size_t pos = 0;
+        while (pos < avail && (eof || avail - pos >= CDC_MAX_SIZE)) {
+            int64_t start = nowNanos();
+            size_t len = cdc.cut(buf.data() + pos, avail - pos);
+            result->cdcNanos += nowNanos() - start;
+
+            ManifestEntry entry;
+            memset(&entry, 0, sizeof(entry));
+            Sha256 sha;
+            sha.init();
+            sha.update(buf.data() + pos, len);
+            sha.final(entry.id);
+            entry.len = len;
+            if (hasher != nullptr)
+                hasher->update(buf.data() + pos, len);
+            bool created;
+            if (!storeChunk(entry.id, buf.data() + pos, len, &created))
+                return false;
+            entries.push_back(entry);
+            result->chunks++;
+            result->bytes += len;
+            if (created) {
+                result->newChunks++;
+                result->newBytes += len;
+            }
+            pos += len;
+        }
+        memmove(buf.data(), buf.data() + pos, avail - pos);
+        avail -= pos;
+    }
+
+    ManifestHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MANIFEST_MAGIC, sizeof(header.magic));
+    header.version = MANIFEST_VERSION;
+    header.fileSize = result->bytes;
+    header.count = entries.size();
+    int out = ::open(manifest_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out < 0) {
+        fprintf(stderr, "Create manifest %s failed: %s\n", manifest_path, strerror(errno));
+        return false;
+    }
+    bool ok = writeAll(out, &header, sizeof(header)) &&
+              writeAll(out, entries.data(), entries.size() * sizeof(ManifestEntry)) &&
+              fsync(out) == 0;
+    close(out);
+    if (!ok)
+        fprintf(stderr, "Write manifest %s failed: %s\n", manifest_path, strerror(errno));
+    return ok;
+}
+
+bool ChunkStore::restore(const char *manifest_path, int out_fd, Hasher *hasher)
+{
+    int fd = ::open(manifest_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "Open manifest %s failed: %s\n", manifest_path, strerror(errno));
+        return false;
+    }
+    ManifestHeader header;
+    struct stat st;
+    bool ok = readFull(fd, reinterpret_cast<uint8_t *>(&header), sizeof(header)) == sizeof(header) &&
+              memcmp(header.magic, MANIFEST_MAGIC, sizeof(header.magic)) == 0 &&
+              header.version == MANIFEST_VERSION;
+    // The count comes from disk, a torn or damaged manifest must not size the entries
+    ok = ok && fstat(fd, &st) == 0 && (uint64_t)st.st_size >= sizeof(header) &&
+         header.count == ((uint64_t)st.st_size - sizeof(header)) / sizeof(ManifestEntry) &&
+         ((uint64_t)st.st_size - sizeof(header)) % sizeof(ManifestEntry) == 0;
+    std::vector<ManifestEntry> entries;
+    if (ok) {
+        entries.resize(header.count);
+        size_t len = entries.size() * sizeof(ManifestEntry);
+        ok = readFull(fd, reinterpret_cast<uint8_t *>(entries.data()), len) == (ssize_t)len;
+    }
+    close(fd);
+    if (!ok) {
+        fprintf(stderr, "Manifest %s is not valid.\n", manifest_path);
+        return false;
+    }
+
+    std::vector<uint8_t> &buf = chunkBuffer();
+    uint64_t total = 0;
+    for (const auto &entry : entries) {
+        std::string path = chunkPath(entry.id);
+        if (entry.len > buf.size()) {
+            fprintf(stderr, "Chunk %s is too large.\n", path.c_str());
+            return false;
+        }
+        int chunk_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (chunk_fd < 0) {
+            fprintf(stderr, "Open chunk %s failed: %s\n", path.c_str(), strerror(errno));
+            return false;
+        }
+        ssize_t n = readFull(chunk_fd, buf.data(), entry.len);
+        close(chunk_fd);
+
+        uint8_t id[SHA256_DIGEST_LEN];
+        Sha256 sha;
+        sha.init();
+        if (n == (ssize_t)entry.len)
+            sha.update(buf.data(), n);
+        sha.final(id);
+        if (n != (ssize_t)entry.len || memcmp(id, entry.id, sizeof(id)) != 0) {
+            fprintf(stderr, "Chunk %s is damaged.\n", path.c_str());
+            return false;
+        }
+        if (out_fd >= 0 && !writeAll(out_fd, buf.data(), n)) {
+            fprintf(stderr, "Restore %s failed: %s\n", manifest_path, strerror(errno));
+            return false;
+        }
+        if (hasher != nullptr)
+            hasher->update(buf.data(), n);
+        total += n;
+    }
+    if (total != header.fileSize) {
+        fprintf(stderr, "Manifest %s does not add up to the file size.\n", manifest_path);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,70 @@
+#ifndef _CHUNK_STORE_H
+#define _CHUNK_STORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <atomic>
+#include "fastcdc.h"
+#include "hasher.h"
+#include "sha256.h"
+
+#define MANIFEST_MAGIC      "WBMANI1"
+#define MANIFEST_VERSION    1
+#define MANIFEST_SUFFIX     ".wbm"
+
+/* Manifest layout, all integers little endian:
+ *   header | count entries
+ * The file is the concatenation of the entries' chunks, in order. A chunk
+ * lives in <store>/<first byte in hex>/<SHA-256 in hex>.
+ */
+struct ManifestHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t fileSize;
+    uint64_t count;
+};
+
+struct ManifestEntry {
+    uint8_t id[SHA256_DIGEST_LEN];
+    uint32_t len;
+    uint32_t reserved;
+};
+
+struct ChunkResult {
+    uint64_t chunks;
+    uint64_t newChunks;
+    uint64_t bytes;
+    uint64_t newBytes;
+    int64_t cdcNanos;           // spent finding cut points only
+};
+
+/* A content addressed store of chunks. Storing a file writes only the chunks
+ * the store does not have yet, plus a manifest that lists all of them.
+ * Safe to use from several threads, a chunk that two threads write at the
+ * same time ends up once.
+ */
+class ChunkStore
+{
+public:
+    bool open(const std::string &dir);
+    bool isOpen(void) const;
+
+    // The file's own digest is fed to hasher as it is chunked, when one is given
+    bool storeFile(int fd, const char *manifest_path, ChunkResult *result, Hasher *hasher,
+            const std::atomic<bool> *cancelled);
+    /* Streams the file described by a manifest into out_fd and / or hasher,
+     * either may be left out. Fails when a chunk is missing or damaged.
+     */
+    bool restore(const char *manifest_path, int out_fd, Hasher *hasher);
+
+private:
+    std::string dir;
+    FastCdc cdc;
+
+    std::string chunkPath(const uint8_t *id) const;
+    bool storeChunk(const uint8_t *id, const uint8_t *data, size_t len, bool *created);
+};
+
+#endif
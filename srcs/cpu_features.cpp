@@ -0,0 +1,47 @@
+#include <stdint.h>
+#include "cpu_features.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+
+static uint64_t readXcr0(void)
+{
+    uint32_t eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((uint64_t)edx << 32) | eax;
+}
+
+static CpuFeatures detect(void)
+{
+    CpuFeatures f = {};
+    unsigned int eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return f;
+    f.sse42 = (ecx & bit_SSE4_2) != 0;
+    bool osxsave = (ecx & bit_OSXSAVE) != 0;
+    // The ymm/zmm registers are only usable when the OS saves them on context switch
+    uint64_t xcr0 = osxsave ? readXcr0() : 0;
+    bool os_avx = (xcr0 & 0x6) == 0x6;
+    bool os_avx512 = (xcr0 & 0xe6) == 0xe6;
+
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+        return f;
+    f.avx2 = os_avx && (ebx & bit_AVX2) != 0;
+    f.avx512 = os_avx512 && (ebx & bit_AVX512F) != 0 && (ebx & bit_AVX512BW) != 0;
+    f.shaNi = f.sse42 && (ebx & bit_SHA) != 0;
+    return f;
+}
+#else
+static CpuFeatures detect(void)
+{
+    CpuFeatures f = {};
+    return f;
+}
+#endif
+
+const CpuFeatures &cpuFeatures(void)
+{
+    static const CpuFeatures features = detect();
+    return features;
+}
@@ -0,0 +1,14 @@
+#ifndef _CPU_FEATURES_H
+#define _CPU_FEATURES_H
+
+struct CpuFeatures {
+    bool sse42;
+    bool avx2;
+    bool avx512;        // AVX-512 F + BW, with the OS saving the zmm state
+    bool shaNi;
+};
+
+// Detected once on first use, safe to call from any thread
+const CpuFeatures &cpuFeatures(void);
+
+#endif
@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <algorithm>
+#include "descriptor_allocator.h"
+
+bool DescriptorAllocator::init(VkDevice dev, const std::vector<VkDescriptorPoolSize> &per_set)
+{
+    device = dev;
+    perSet = per_set;
+    pools.clear();
+    poolOfSet.clear();
+    current = 0;
+    return addPool();
+}
+
+void DescriptorAllocator::destroy(void)
+{
+    for (auto &pool : pools)
+        vkDestroyDescriptorPool(device, pool.pool, nullptr);
+    pools.clear();
+    poolOfSet.clear();
+    current = 0;
+}
+
+bool DescriptorAllocator::addPool(void)
+{
+    VkResult ret = VK_SUCCESS;
+    uint32_t sets = pools.empty() ? DESCRIPTOR_POOL_SETS :
+                    std::min<uint32_t>(pools.back().capacity * 2, DESCRIPTOR_POOL_SETS_MAX);
+
+    std::vector<VkDescriptorPoolSize> poolSizes = perSet;
+    for (auto &size : poolSizes)
+        size.descriptorCount *= sets;
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+    poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+    poolInfo.pPoolSizes = poolSizes.data();
+    poolInfo.maxSets = sets;
+
+    Pool pool = { VK_NULL_HANDLE, sets, 0 };
+    ret = vkCreateDescriptorPool(device, &poolInfo, nullptr, &pool.pool);
+    if (ret != VK_SUCCESS) {
+        fprintf(stderr, "Creating descriptor pool failed: %d\n", ret);
+        return false;
+    }
+    pools.push_back(pool);
+    return true;
+}
+
+/* The pool that had room last time first, then any other that is not full,
+ * then a new one. A pool that is not full may still be fragmented, the
+ * driver's answer decides.
+ */
+VkDescriptorSet DescriptorAllocator::allocate(VkDescriptorSetLayout layout)
+{
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &layout;
+
+    size_t tried = 0, count = pools.size();
+    while (tried <= count) {
+        size_t i;
+        if (tried < count) {
+            i = (current + tried) % count;
+        } else {
+            if (!addPool())
+                return VK_NULL_HANDLE;
+            i = count;
+        }
+        tried++;
+        Pool &pool = pools[i];
+        if (pool.live == pool.capacity)
+            continue;
+
+        VkDescriptorSet set = VK_NULL_HANDLE;
+        allocInfo.descriptorPool = pool.pool;
+        VkResult ret = vkAllocateDescriptorSets(device, &allocInfo, &set);
+        if (ret == VK_ERROR_OUT_OF_POOL_MEMORY || ret == VK_ERROR_FRAGMENTED_POOL)
+            continue;
+        if (ret != VK_SUCCESS) {
+            fprintf(stderr, "Allocate descriptor set failed: %d\n", ret);
+            return VK_NULL_HANDLE;
+        }
+        pool.live++;
+        current = i;
+        poolOfSet[set] = i;
+        return set;
+    }
+    fprintf(stderr, "A new descriptor pool has no room for a set.\n");
+    return VK_NULL_HANDLE;
+}
+
+void DescriptorAllocator::free(VkDescriptorSet set)
+{
+    auto it = poolOfSet.find(set);
+    if (it == poolOfSet.end())
+        return;
+    Pool &pool = pools[it->second];
+    vkFreeDescriptorSets(device, pool.pool, 1, &set);
+    pool.live--;
+    poolOfSet.erase(it);
+}
+
+uint32_t DescriptorAllocator::getPoolCount(void) const
+{
+    return static_cast<uint32_t>(pools.size());
+}
+
+uint32_t DescriptorAllocator::getSetCount(void) const
+{
+    return static_cast<uint32_t>(poolOfSet.size());
+}
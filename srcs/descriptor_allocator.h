@@ -0,0 +1,46 @@
+#ifndef _DESCRIPTOR_ALLOCATOR_H
+#define _DESCRIPTOR_ALLOCATOR_H
+
+#include <stdint.h>
+#include <vector>
+#include <unordered_map>
+#include <vulkan/vulkan.h>
+
+// Sets of the first pool, every pool added holds twice as many as the last one up to the max
+#define DESCRIPTOR_POOL_SETS        64
+#define DESCRIPTOR_POOL_SETS_MAX    1024
+
+/* Descriptor sets out of a chain of pools that grows on demand, so the
+ * number of textures is not fixed when the device is created. Every set
+ * remembers its pool and can be freed on its own. All sets share one shape,
+ * the descriptors of a single set given to init().
+ * Not thread safe, it belongs to the render thread.
+ */
+class DescriptorAllocator
+{
+public:
+    bool init(VkDevice device, const std::vector<VkDescriptorPoolSize> &per_set);
+    // Destroys the pools, every set still allocated goes with them
+    void destroy(void);
+    VkDescriptorSet allocate(VkDescriptorSetLayout layout);
+    void free(VkDescriptorSet set);
+    uint32_t getPoolCount(void) const;
+    uint32_t getSetCount(void) const;
+
+private:
+    struct Pool {
+        VkDescriptorPool pool;
+        uint32_t capacity;
+        uint32_t live;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    std::vector<VkDescriptorPoolSize> perSet;
+    std::vector<Pool> pools;
+    size_t current = 0;         // the pool that last had room
+    std::unordered_map<VkDescriptorSet, size_t> poolOfSet;
+
+    bool addPool(void);
+};
+
+#endif
@@ -0,0 +1,251 @@
+#include <stdio.h>
+#include <algorithm>
+#include "device_allocator.h"
+
+#define BAD_MEMORY_TYPE     0xFFFFFFFF
+
+static VkDeviceSize roundUpPow2(VkDeviceSize v)
+{
+    VkDeviceSize p = 1;
+    while (p < v)
+        p <<= 1;
+    return p;
+}
+
+void DeviceAllocator::init(VkPhysicalDevice physical_device, VkDevice dev)
+{
+    VkPhysicalDeviceProperties properties;
+
+    device = dev;
+    vkGetPhysicalDeviceMemoryProperties(physical_device, &memoryProperties);
+    vkGetPhysicalDeviceProperties(physical_device, &properties);
+    minAlloc = std::max<VkDeviceSize>(DEVICE_MIN_ALLOC, properties.limits.bufferImageGranularity);
+    minAlloc = std::max<VkDeviceSize>(minAlloc, properties.limits.nonCoherentAtomSize);
+    minAlloc = std::min<VkDeviceSize>(roundUpPow2(minAlloc), DEVICE_BLOCK_SIZE);
+    maxOrder = 0;
+    while ((minAlloc << maxOrder) < DEVICE_BLOCK_SIZE)
+        maxOrder++;
+}
+
+void DeviceAllocator::destroy(void)
+{
+    for (auto &block : blocks)
+        vkFreeMemory(device, block->memory, nullptr);
+    for (auto &d : dedicated)
+        vkFreeMemory(device, d.first, nullptr);
+    blocks.clear();
+    blockByMemory.clear();
+    dedicated.clear();
+}
+
+uint32_t DeviceAllocator::findMemoryType(uint32_t type_filter, VkMemoryPropertyFlags properties) const
+{
+    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+        if ((type_filter & (1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+            return i;
+    return BAD_MEMORY_TYPE;
+}
+
+// Host visible memory is mapped right away, whatever the caller asked for
+bool DeviceAllocator::allocateMemory(uint32_t memory_type, VkDeviceSize size, VkDeviceMemory &memory, uint8_t **map)
+{
+    VkResult ret = VK_SUCCESS;
+
+    VkMemoryAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memory_type;
+    ret = vkAllocateMemory(device, &allocInfo, nullptr, &memory);
+    if (ret != VK_SUCCESS) {
+        fprintf(stderr, "Allocate device memory failed: %d\n", ret);
+        return false;
+    }
+    *map = nullptr;
+    if (memoryProperties.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        ret = vkMapMemory(device, memory, 0, size, 0, reinterpret_cast<void **>(map));
+        if (ret != VK_SUCCESS) {
+            fprintf(stderr, "Map device memory failed: %d\n", ret);
+            vkFreeMemory(device, memory, nullptr);
+            return false;
+        }
+    }
+    return true;
+}
+
+DeviceAllocator::Block *DeviceAllocator::addBlock(uint32_t memory_type)
+{
+    std::unique_ptr<Block> block(new Block());
+    if (!allocateMemory(memory_type, DEVICE_BLOCK_SIZE, block->memory, &block->map))
+        return nullptr;
+    block->memoryType = memory_type;
+    block->freeBytes = DEVICE_BLOCK_SIZE;
+    block->freeLists.resize(maxOrder + 1);
+    block->freeLists[maxOrder].insert(0);
+    Block *b = block.get();
+    blocks.push_back(std::move(block));
+    blockByMemory[b->memory] = b;
+    return b;
+}
+
+void DeviceAllocator::releaseBlock(Block *block)
+{
+    vkFreeMemory(device, block->memory, nullptr);
+    blockByMemory.erase(block->memory);
+    for (size_t i = 0; i < blocks.size(); i++) {
+        if (blocks[i].get() == block) {
+            blocks.erase(blocks.begin() + i);
+            break;
+        }
+    }
+}
+
+bool DeviceAllocator::allocateDedicated(uint32_t memory_type, const VkMemoryRequirements &requirements,
+                                        DeviceAllocation &allocation)
+{
+    if (!allocateMemory(memory_type, requirements.size, allocation.memory, &allocation.data))
+        return false;
+    allocation.offset = 0;
+    allocation.size = requirements.size;
+    dedicated[allocation.memory] = Dedicated{ requirements.size };
+    return true;
+}
+
+/* Best fit over the blocks of the memory type: the one whose smallest free
+ * piece that is large enough is the smallest, so large pieces stay whole.
+ * That piece is halved down to the order asked for, the upper halves going
+ * to the free lists; the lowest offset is taken first to keep blocks packed.
+ */
+bool DeviceAllocator::allocate(const VkMemoryRequirements &requirements, VkMemoryPropertyFlags properties,
+                               DeviceAllocation &allocation)
+{
+    allocation = DeviceAllocation{};
+    uint32_t memory_type = findMemoryType(requirements.memoryTypeBits, properties);
+    if (memory_type == BAD_MEMORY_TYPE) {
+        fprintf(stderr, "failed to find suitable memory type!\n");
+        return false;
+    }
+    VkDeviceSize piece = roundUpPow2(std::max({ requirements.size, requirements.alignment, minAlloc }));
+    if (piece > DEVICE_BLOCK_SIZE)
+        return allocateDedicated(memory_type, requirements, allocation);
+    uint32_t order = 0;
+    while ((minAlloc << order) < piece)
+        order++;
+
+    Block *best = nullptr;
+    uint32_t best_order = maxOrder + 1;
+    for (auto &block : blocks) {
+        if (block->memoryType != memory_type || block->freeBytes < piece)
+            continue;
+        for (uint32_t k = order; k < best_order; k++) {
+            if (!block->freeLists[k].empty()) {
+                best = block.get();
+                best_order = k;
+                break;
+            }
+        }
+        if (best_order == order)
+            break;
+    }
+    if (best == nullptr) {
+        best = addBlock(memory_type);
+        // Out of memory for a whole block, what is asked may still fit on its own
+        if (best == nullptr)
+            return allocateDedicated(memory_type, requirements, allocation);
+        best_order = maxOrder;
+    }
+
+    auto first = best->freeLists[best_order].begin();
+    VkDeviceSize offset = *first;
+    best->freeLists[best_order].erase(first);
+    for (uint32_t k = best_order; k > order; k--)
+        best->freeLists[k - 1].insert(offset + (minAlloc << (k - 1)));
+    best->pieces[offset] = Piece{ order, requirements.size };
+    best->freeBytes -= piece;
+
+    allocation.memory = best->memory;
+    allocation.offset = offset;
+    allocation.size = piece;
+    allocation.data = best->map != nullptr ? best->map + offset : nullptr;
+    return true;
+}
+
+void DeviceAllocator::free(DeviceAllocation &allocation)
+{
+    free(allocation.memory, allocation.offset);
+    allocation = DeviceAllocation{};
+}
+
+void DeviceAllocator::free(VkDeviceMemory memory, VkDeviceSize offset)
+{
+    if (memory == VK_NULL_HANDLE)
+        return;
+    auto d = dedicated.find(memory);
+    if (d != dedicated.end()) {
+        vkFreeMemory(device, memory, nullptr);
+        dedicated.erase(d);
+        return;
+    }
+    auto b = blockByMemory.find(memory);
+    if (b == blockByMemory.end()) {
+        fprintf(stderr, "Free of unknown device memory.\n");
+        return;
+    }
+    Block *block = b->second;
+    auto p = block->pieces.find(offset);
+    if (p == block->pieces.end()) {
+        fprintf(stderr, "Free of unknown device memory offset %lu.\n", (unsigned long)offset);
+        return;
+    }
+    uint32_t order = p->second.order;
+    block->pieces.erase(p);
+    block->freeBytes += minAlloc << order;
+
+    // Merge with the buddy for as long as it is free too
+    for (; order < maxOrder; order++) {
+        auto buddy = block->freeLists[order].find(offset ^ (minAlloc << order));
+        if (buddy == block->freeLists[order].end())
+            break;
+        offset = std::min(offset, *buddy);
+        block->freeLists[order].erase(buddy);
+    }
+    block->freeLists[order].insert(offset);
+
+    // One empty block of a type is kept for the next allocations, more go back to the driver
+    if (block->freeBytes != DEVICE_BLOCK_SIZE)
+        return;
+    for (auto &other : blocks) {
+        if (other.get() != block && other->memoryType == block->memoryType) {
+            releaseBlock(block);
+            return;
+        }
+    }
+}
+
+void DeviceAllocator::getStats(DeviceMemoryStats *stats) const
+{
+    VkDeviceSize largest_sum = 0;
+
+    *stats = DeviceMemoryStats{};
+    for (auto &block : blocks) {
+        stats->blocks++;
+        stats->blockBytes += DEVICE_BLOCK_SIZE;
+        stats->freeBytes += block->freeBytes;
+        stats->allocations += (uint32_t)block->pieces.size();
+        for (auto &p : block->pieces)
+            stats->requestedBytes += p.second.requested;
+        for (uint32_t k = maxOrder + 1; k > 0; k--) {
+            if (!block->freeLists[k - 1].empty()) {
+                stats->largestFree = std::max(stats->largestFree, minAlloc << (k - 1));
+                largest_sum += minAlloc << (k - 1);
+                break;
+            }
+        }
+    }
+    stats->usedBytes = stats->blockBytes - stats->freeBytes;
+    for (auto &d : dedicated) {
+        stats->dedicated++;
+        stats->dedicatedBytes += d.second.size;
+    }
+    if (stats->freeBytes > 0)
+        stats->fragmentation = 1.0 - (double)largest_sum / stats->freeBytes;
+}
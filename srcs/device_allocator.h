@@ -0,0 +1,94 @@
+#ifndef _DEVICE_ALLOCATOR_H
+#define _DEVICE_ALLOCATOR_H
+
+#include <stdint.h>
+#include <vector>
+#include <set>
+#include <memory>
+#include <unordered_map>
+#include <vulkan/vulkan.h>
+
+// Device memory is taken from the driver in blocks this large, a larger resource gets memory of its own
+#define DEVICE_BLOCK_SIZE       (64 * 1024 * 1024)
+// Smallest piece of a block, raised to bufferImageGranularity and nonCoherentAtomSize when those are larger
+#define DEVICE_MIN_ALLOC        4096
+
+struct DeviceAllocation {
+    VkDeviceMemory memory;
+    VkDeviceSize offset;
+    VkDeviceSize size;          // reserved for it, at least what was asked for
+    uint8_t *data;              // at offset, only for host visible memory, which stays mapped
+};
+
+struct DeviceMemoryStats {
+    uint32_t blocks;
+    uint32_t allocations;       // in the blocks
+    uint32_t dedicated;         // too large for a block
+    VkDeviceSize blockBytes;
+    VkDeviceSize usedBytes;     // of the blocks, every piece rounded up to a power of two
+    VkDeviceSize requestedBytes;// of the blocks as asked for, the rest of usedBytes is lost to rounding
+    VkDeviceSize freeBytes;
+    VkDeviceSize largestFree;   // the largest piece one allocation could still get without a new block
+    VkDeviceSize dedicatedBytes;
+    // Share of the free space outside the largest free piece of its block: 0 while every block has one, close to 1 for crumbs
+    double fragmentation;
+};
+
+/* Device memory for buffers and images without a vkAllocateMemory each:
+ * drivers cap the number of allocations (maxMemoryAllocationCount, 4096 on
+ * many) and every one of them is slow. Memory of each type comes in
+ * DEVICE_BLOCK_SIZE blocks split by a buddy allocator. A piece is a power of
+ * two placed at a multiple of its size, which meets any alignment a
+ * resource asks for, and merges back with its buddy once both are free.
+ * Pieces are never smaller than bufferImageGranularity, so a buffer and an
+ * optimal tiling image never share a page of it. Host visible blocks are
+ * mapped once for their whole life.
+ * Not thread safe, it belongs to the render thread.
+ */
+class DeviceAllocator
+{
+public:
+    void init(VkPhysicalDevice physical_device, VkDevice device);
+    // Releases the blocks, with whatever was still allocated in them
+    void destroy(void);
+    bool allocate(const VkMemoryRequirements &requirements, VkMemoryPropertyFlags properties,
+                  DeviceAllocation &allocation);
+    // Clears allocation, nothing happens for an empty one
+    void free(DeviceAllocation &allocation);
+    void free(VkDeviceMemory memory, VkDeviceSize offset);
+    void getStats(DeviceMemoryStats *stats) const;
+
+private:
+    struct Piece {
+        uint32_t order;         // minAlloc << order bytes
+        VkDeviceSize requested;
+    };
+    struct Block {
+        VkDeviceMemory memory;
+        uint32_t memoryType;
+        uint8_t *map;
+        VkDeviceSize freeBytes;
+        std::vector<std::set<VkDeviceSize>> freeLists;  // offsets of the free pieces of every order
+        std::unordered_map<VkDeviceSize, Piece> pieces; // allocated, by offset
+    };
+    struct Dedicated {
+        VkDeviceSize size;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    VkPhysicalDeviceMemoryProperties memoryProperties = {};
+    VkDeviceSize minAlloc = DEVICE_MIN_ALLOC;
+    uint32_t maxOrder = 0;      // a whole block
+    std::vector<std::unique_ptr<Block>> blocks;
+    std::unordered_map<VkDeviceMemory, Block *> blockByMemory;
+    std::unordered_map<VkDeviceMemory, Dedicated> dedicated;
+
+    uint32_t findMemoryType(uint32_t type_filter, VkMemoryPropertyFlags properties) const;
+    bool allocateMemory(uint32_t memory_type, VkDeviceSize size, VkDeviceMemory &memory, uint8_t **map);
+    Block *addBlock(uint32_t memory_type);
+    void releaseBlock(Block *block);
+    bool allocateDedicated(uint32_t memory_type, const VkMemoryRequirements &requirements,
+                           DeviceAllocation &allocation);
+};
+
+#endif
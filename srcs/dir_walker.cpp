@@ -0,0 +1,335 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "io_ring.h"
+#include "dir_walker.h"
+
+#define GETDENTS_BUF_LEN    (256 * 1024)
+#define STATX_WALK_MASK     (STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_MTIME | STATX_CTIME | STATX_INO)
+#define IDLE_SPINS          64
+#define IDLE_SLEEP_US       100
+
+// The kernel's record, glibc only exposes it from 2.30 on
+struct LinuxDirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+struct DirWalker::WorkDeque {
+    std::mutex mutex;
+    std::deque<std::string> dirs;
+};
+
+// Per thread buffers, reused for every directory the thread reads
+struct WalkScratch {
+    std::vector<uint8_t> buf;
+    std::vector<const char *> names;
+    std::vector<struct statx> results;
+    std::vector<char> found;
+    // Files of the current directory, only kept when they are reported per directory
+    std::deque<std::string> paths;
+    std::vector<WalkEntry> entries;
+};
+
+static int64_t nowNanos(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Fetches the metadata of a chunk of names. Without a ring it is one statx
+ * per entry, with one the ring is kept full and a single io_uring_enter
+ * submits a batch and reaps what has completed.
+ */
+static bool statxBatch(IoRing *ring, int dir_fd, WalkScratch &scratch)
+{
+    size_t count = scratch.names.size();
+    scratch.results.resize(count);
+    scratch.found.assign(count, 0);
+    if (ring == nullptr) {
+        for (size_t i = 0; i < count; i++)
+            scratch.found[i] = statx(dir_fd, scratch.names[i], AT_SYMLINK_NOFOLLOW, STATX_WALK_MASK,
+                                     &scratch.results[i]) == 0;
+        return true;
+    }
+
+    size_t next = 0, completed = 0;
+    while (completed < count) {
+        while (next < count &&
+               ring->prepStatx(dir_fd, scratch.names[next], AT_SYMLINK_NOFOLLOW, STATX_WALK_MASK,
+                               &scratch.results[next], next))
+            next++;
+        if (ring->submit(1) < 0 && errno != EAGAIN && errno != EBUSY) {
+            fprintf(stderr, "io_uring submit failed: %s\n", strerror(errno));
+            return false;
+        }
+        uint64_t index;
+        int32_t res;
+        while (ring->popCompletion(&index, &res)) {
+            scratch.found[index] = res == 0;
+            completed++;
+        }
+    }
+    return true;
+}
+
+bool DirWalker::walk(const std::string &root_path, const DirWalkerOptions &opts, FileCallback on_file)
+{
+    onFile = on_file;
+    onDirectory = nullptr;
+    return run(root_path, opts);
+}
+
+bool DirWalker::walkDirectories(const std::string &root_path, const DirWalkerOptions &opts,
+        DirectoryCallback on_directory)
+{
+    onFile = nullptr;
+    onDirectory = on_directory;
+    return run(root_path, opts);
+}
+
+bool DirWalker::run(const std::string &root_path, const DirWalkerOptions &opts)
+{
+    root = root_path;
+    options = opts;
+    if (options.threads < 1)
+        options.threads = 1;
+    stopped = false;
+    pendingDirs = 0;
+    files = 0;
+    directories = 0;
+    startNanos = nowNanos();
+    endNanos = 0;
+
+    struct stat st;
+    excluding = !options.excludeDir.empty() && stat(options.excludeDir.c_str(), &st) == 0;
+    excludeDev = excluding ? st.st_dev : 0;
+    excludeInode = excluding ? st.st_ino : 0;
+
+    rootFd = open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (rootFd < 0) {
+        fprintf(stderr, "Open directory %s failed: %s\n", root.c_str(), strerror(errno));
+        endNanos = nowNanos();
+        return false;
+    }
+
+    std::vector<WorkDeque> work(options.threads);
+    deques = work.data();
+    pushDirectory(0, std::string());
+    std::vector<std::thread> threads;
+    for (int i = 1; i < options.threads; i++)
+        threads.emplace_back(&DirWalker::worker, this, i);
+    worker(0);
+    for (auto &t : threads)
+        t.join();
+
+    deques = nullptr;
+    close(rootFd);
+    rootFd = -1;
+    endNanos = nowNanos();
+    return !stopped;
+}
+
+void DirWalker::stop(void)
+{
+    stopped = true;
+}
+
+uint64_t DirWalker::getFiles(void) const
+{
+    return files;
+}
+
+uint64_t DirWalker::getDirectories(void) const
+{
+    return directories;
+}
+
+double DirWalker::getFileRate(void) const
+{
+    int64_t end = endNanos != 0 ? endNanos.load() : nowNanos();
+    int64_t elapsed = end - startNanos;
+    return elapsed > 0 ? files * 1e9 / elapsed : 0.0;
+}
+
+void DirWalker::worker(int id)
+{
+    IoRing ring;
+    IoRing *statx_ring = nullptr;
+    if (options.ioQueueDepth > 0) {
+        if (ring.init(options.ioQueueDepth))
+            statx_ring = &ring;
+        else if (id == 0)
+            fprintf(stderr, "io_uring setup failed: %s, scanning without it.\n", strerror(errno));
+    }
+
+    WalkScratch scratch;
+    scratch.buf.resize(GETDENTS_BUF_LEN);
+    std::string rel;
+    int idle = 0;
+    while (!stopped) {
+        if (!nextDirectory(id, rel)) {
+            // Somebody is still reading a directory that may hand out more work
+            if (pendingDirs == 0)
+                break;
+            if (++idle < IDLE_SPINS)
+                std::this_thread::yield();
+            else
+                usleep(IDLE_SLEEP_US);
+            continue;
+        }
+        idle = 0;
+        if (!readDirectory(id, rel, scratch, statx_ring))
+            stopped = true;
+        directories++;
+        // Subdirectories were counted when pushed, so this never reaches zero early
+        pendingDirs--;
+    }
+}
+
+// Own work comes from the back, stolen work from the front of the other deques
+bool DirWalker::nextDirectory(int id, std::string &rel)
+{
+    {
+        WorkDeque &own = deques[id];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.dirs.empty()) {
+            rel = std::move(own.dirs.back());
+            own.dirs.pop_back();
+            return true;
+        }
+    }
+    for (int i = 1; i < options.threads; i++) {
+        WorkDeque &victim = deques[(id + i) % options.threads];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.dirs.empty()) {
+            rel = std::move(victim.dirs.front());
+            victim.dirs.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void DirWalker::pushDirectory(int id, std::string &&rel)
+{
+    pendingDirs++;
+    WorkDeque &own = deques[id];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    own.dirs.push_back(std::move(rel));
+}
+
+bool DirWalker::readDirectory(int id, const std::string &rel, WalkScratch &scratch, IoRing *ring)
+{
+    int fd = openat(rootFd, rel.empty() ? "." : rel.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "Open directory %s/%s failed: %s\n", root.c_str(), rel.c_str(), strerror(errno));
+        return true;
+    }
+    // Checked once open, subdirectories found through d_type were never stat'ed
+    struct stat st;
+    if (excluding && fstat(fd, &st) == 0 && st.st_dev == excludeDev && st.st_ino == excludeInode) {
+        close(fd);
+        return true;
+    }
+
+    bool ok = true;
+    std::string child;
+    scratch.paths.clear();
+    scratch.entries.clear();
+    while (ok && !stopped) {
+        long len = syscall(SYS_getdents64, fd, scratch.buf.data(), scratch.buf.size());
+        if (len < 0) {
+            fprintf(stderr, "Read directory %s/%s failed: %s\n", root.c_str(), rel.c_str(), strerror(errno));
+            break;
+        }
+        if (len == 0)
+            break;
+
+        // Subdirectories are published right away so idle threads can steal them
+        scratch.names.clear();
+        for (long off = 0; off < len;) {
+            const LinuxDirent64 *ent = reinterpret_cast<const LinuxDirent64 *>(scratch.buf.data() + off);
+            off += ent->d_reclen;
+            // Skip ".", ".." and hidden entries such as .thumbnails or our own state
+            if (ent->d_name[0] == '.')
+                continue;
+            if (ent->d_type == DT_DIR) {
+                child = rel.empty() ? std::string(ent->d_name) : rel + "/" + ent->d_name;
+                pushDirectory(id, std::move(child));
+                continue;
+            }
+            // Some file systems do not fill d_type, those entries need the statx to tell
+            if (ent->d_type != DT_REG && ent->d_type != DT_UNKNOWN)
+                continue;
+            if (ent->d_type == DT_REG && options.nameFilter != nullptr && !options.nameFilter(ent->d_name))
+                continue;
+            scratch.names.push_back(ent->d_name);
+        }
+
+        if (!statxBatch(ring, fd, scratch)) {
+            ok = false;
+            break;
+        }
+        for (size_t i = 0; i < scratch.names.size(); i++) {
+            if (!scratch.found[i])
+                continue;
+            const struct statx &stx = scratch.results[i];
+            const char *name = scratch.names[i];
+            child = rel.empty() ? std::string(name) : rel + "/" + name;
+            if (S_ISDIR(stx.stx_mode)) {
+                pushDirectory(id, std::move(child));
+                continue;
+            }
+            if (!S_ISREG(stx.stx_mode) || (options.nameFilter != nullptr && !options.nameFilter(name)))
+                continue;
+
+            WalkEntry entry;
+            entry.relPath = child.c_str();
+            entry.name = name;
+            entry.size = stx.stx_size;
+            entry.mtime = (int64_t)stx.stx_mtime.tv_sec * 1000000000 + stx.stx_mtime.tv_nsec;
+            entry.ctime = (int64_t)stx.stx_ctime.tv_sec * 1000000000 + stx.stx_ctime.tv_nsec;
+            entry.dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+            entry.inode = stx.stx_ino;
+            files++;
+            if (onDirectory) {
+                // The names live in the getdents buffer, which the next chunk overwrites
+                scratch.paths.push_back(std::move(child));
+                scratch.entries.push_back(entry);
+                continue;
+            }
+            if (!onFile(entry)) {
+                ok = false;
+                break;
+            }
+        }
+    }
+    close(fd);
+
+    if (ok && !stopped && !scratch.entries.empty()) {
+        for (size_t i = 0; i < scratch.entries.size(); i++) {
+            const char *path = scratch.paths[i].c_str();
+            const char *slash = strrchr(path, '/');
+            scratch.entries[i].relPath = path;
+            scratch.entries[i].name = slash != nullptr ? slash + 1 : path;
+        }
+        ok = onDirectory(scratch.entries.data(), scratch.entries.size());
+    }
+    return ok;
+}
@@ -0,0 +1,86 @@
+#ifndef _DIR_WALKER_H
+#define _DIR_WALKER_H
+
+#include <stdint.h>
+#include <string>
+#include <atomic>
+#include <functional>
+
+class IoRing;
+struct WalkScratch;
+
+// One regular file found by the walker, the strings are only valid during the callback
+struct WalkEntry {
+    const char *relPath;        // relative to the walked root
+    const char *name;
+    uint64_t size;
+    int64_t mtime;              // in ns
+    int64_t ctime;              // in ns, also moves when a write kept the mtime
+    uint64_t dev;
+    uint64_t inode;
+};
+
+struct DirWalkerOptions {
+    int threads = 4;
+    // Batch the statx calls through io_uring with this depth, 0 for plain syscalls
+    unsigned ioQueueDepth = 0;
+    // A directory that is never entered, found by device and inode however the path is spelled
+    std::string excludeDir;
+    // Files whose name is rejected are never stat'ed nor reported
+    bool (*nameFilter)(const char *name) = nullptr;
+};
+
+/* Walks a tree with several threads. Directories are read with getdents64
+ * into a large buffer. Every thread keeps its pending subdirectories on its
+ * own deque, working depth first from the back, while idle threads steal
+ * from the front of the others, where the biggest untouched subtrees are.
+ * Files are handed to the callback as soon as their directory chunk is
+ * stat'ed, concurrently from all threads. Hidden entries are skipped.
+ */
+class DirWalker
+{
+public:
+    typedef std::function<bool(const WalkEntry &entry)> FileCallback;
+    typedef std::function<bool(const WalkEntry *entries, size_t count)> DirectoryCallback;
+
+    // Blocks until the tree is done, or the callback returned false, or stop() was called
+    bool walk(const std::string &root, const DirWalkerOptions &options, FileCallback on_file);
+    /* The same walk, but the files of a directory are handed over together
+     * once the whole directory is read, for callers that relate the files of
+     * one directory to each other. Empty directories are not reported.
+     */
+    bool walkDirectories(const std::string &root, const DirWalkerOptions &options, DirectoryCallback on_directory);
+    void stop(void);
+
+    uint64_t getFiles(void) const;
+    uint64_t getDirectories(void) const;
+    // Files per second since walk() started
+    double getFileRate(void) const;
+
+private:
+    struct WorkDeque;
+
+    std::string root;
+    DirWalkerOptions options;
+    FileCallback onFile;
+    DirectoryCallback onDirectory;
+    int rootFd = -1;
+    bool excluding = false;
+    uint64_t excludeDev = 0;
+    uint64_t excludeInode = 0;
+    WorkDeque *deques = nullptr;
+    std::atomic<bool> stopped{false};
+    std::atomic<int64_t> pendingDirs{0};
+    std::atomic<uint64_t> files{0};
+    std::atomic<uint64_t> directories{0};
+    std::atomic<int64_t> startNanos{0};
+    std::atomic<int64_t> endNanos{0};
+
+    bool run(const std::string &root, const DirWalkerOptions &options);
+    void worker(int id);
+    bool nextDirectory(int id, std::string &rel);
+    void pushDirectory(int id, std::string &&rel);
+    bool readDirectory(int id, const std::string &rel, WalkScratch &scratch, IoRing *ring);
+};
+
+#endif
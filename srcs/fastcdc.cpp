@@ -0,0 +1,87 @@
+#include "fastcdc.h"
+
+// Bits between the normal and the small / large masks, level 2 of the paper
+#define CDC_NORMALIZATION   2
+
+struct GearTables {
+    uint64_t gear[256];
+    uint64_t gearShifted[256];     // gear << 1, for the first byte of a pair
+
+    GearTables()
+    {
+        // splitmix64, any fixed random table works but it must never change
+        uint64_t x = 0x5741524254455230ULL;
+        for (int i = 0; i < 256; i++) {
+            x += 0x9E3779B97F4A7C15ULL;
+            uint64_t z = x;
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            gear[i] = z ^ (z >> 31);
+            gearShifted[i] = gear[i] << 1;
+        }
+    }
+};
+
+static const GearTables tables;
+
+/* The low bits of the gear hash only see the last few bytes, the mask
+ * takes the top ones below bit 63 so that it still fits after the extra
+ * shift of the two byte step.
+ */
+static uint64_t topMask(int bits)
+{
+    return ((1ULL << bits) - 1) << (63 - bits);
+}
+
+bool FastCdc::init(uint32_t min, uint32_t avg, uint32_t max)
+{
+    if (avg == 0 || (avg & (avg - 1)) != 0 || min >= avg || avg >= max)
+        return false;
+    int bits = 0;
+    while ((1U << bits) < avg)
+        bits++;
+    minSize = min;
+    avgSize = avg;
+    maxSize = max;
+    maskS = topMask(bits + CDC_NORMALIZATION);
+    maskL = topMask(bits - CDC_NORMALIZATION);
+    return true;
+}
+
+/* Rolling two bytes per iteration: h' = (h << 1) + G[a] is checked as
+ * (h << 2) + (G[a] << 1) against the mask shifted by one, then
+ * h'' = that + G[b] is the exact hash after the second byte.
+ */
+static inline bool scanPairs(const uint8_t *data, size_t &i, size_t end, uint64_t &h, uint64_t mask)
+{
+    const uint64_t mask_shifted = mask << 1;
+    for (; i + 2 <= end; i += 2) {
+        h = (h << 2) + tables.gearShifted[data[i]];
+        if ((h & mask_shifted) == 0) {
+            i += 1;
+            return true;
+        }
+        h += tables.gear[data[i + 1]];
+        if ((h & mask) == 0) {
+            i += 2;
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t FastCdc::cut(const uint8_t *data, size_t len) const
+{
+    if (len <= minSize)
+        return len;
+    size_t end = len < maxSize ? len : maxSize;
+    size_t normal = avgSize < end ? avgSize : end;
+
+    uint64_t h = 0;
+    size_t i = minSize;
+    if (scanPairs(data, i, normal, h, maskS))
+        return i;
+    if (scanPairs(data, i, end, h, maskL))
+        return i;
+    return end;
+}
@@ -0,0 +1,31 @@
+#ifndef _FASTCDC_H
+#define _FASTCDC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CDC_MIN_SIZE        (256 * 1024)
+#define CDC_AVG_SIZE        (1024 * 1024)
+#define CDC_MAX_SIZE        (4 * 1024 * 1024)
+
+/* FastCDC content defined chunking (Xia et al., 2016 and 2020). The gear
+ * hash depends only on the last 64 bytes, so a cut point survives bytes
+ * being inserted or removed before it and a trimmed clip shares all but
+ * its edge chunks with the original. Cut points before minSize are
+ * skipped, a stricter mask is used below avgSize and a looser one above
+ * it (normalized chunking), and the hash rolls two bytes per iteration.
+ */
+struct FastCdc {
+    uint32_t minSize;
+    uint32_t avgSize;
+    uint32_t maxSize;
+    uint64_t maskS;
+    uint64_t maskL;
+
+    // avg must be a power of two, min < avg < max
+    bool init(uint32_t min = CDC_MIN_SIZE, uint32_t avg = CDC_AVG_SIZE, uint32_t max = CDC_MAX_SIZE);
+    // Length of the chunk that starts at data, len when no cut point is found before the end
+    size_t cut(const uint8_t *data, size_t len) const;
+};
+
+#endif
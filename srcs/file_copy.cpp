@@ -0,0 +1,175 @@
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/vfs.h>
+#include <linux/fs.h>
+#include "file_copy.h"
+
+#define BTRFS_SUPER_MAGIC   0x9123683E
+#define XFS_SUPER_MAGIC     0x58465342
+#define KERNEL_COPY_CHUNK   (64 * 1024 * 1024)
+
+const char *copyMethodName(CopyMethod method)
+{
+    switch (method) {
+    case COPY_METHOD_REFLINK:
+        return "reflink";
+    case COPY_METHOD_COPY_FILE_RANGE:
+        return "copy_file_range";
+    case COPY_METHOD_SENDFILE:
+        return "sendfile";
+    case COPY_METHOD_READ_WRITE:
+        return "read/write";
+    case COPY_METHOD_IO_URING:
+        return "io_uring";
+    case COPY_METHOD_CHUNKED:
+        return "chunked";
+    default:
+        return "none";
+    }
+}
+
+static CopyWriteHook writeHook = nullptr;
+
+void setCopyWriteHook(CopyWriteHook hook)
+{
+    writeHook = hook;
+}
+
+// Errors that mean "this path does not work here", not "the copy failed"
+static bool isUnsupported(int err)
+{
+    return err == EXDEV || err == ENOSYS || err == EOPNOTSUPP || err == ENOTSUP ||
+           err == EINVAL || err == ENOTTY || err == EPERM;
+}
+
+// Only btrfs and XFS can share extents, skip the ioctl everywhere else (NFS, SMB, ext4...)
+static bool reflinkPossible(int in_fd, int out_fd)
+{
+    struct statfs in_fs, out_fs;
+    if (fstatfs(in_fd, &in_fs) != 0 || fstatfs(out_fd, &out_fs) != 0)
+        return false;
+    if (in_fs.f_type != out_fs.f_type)
+        return false;
+    return in_fs.f_type == BTRFS_SUPER_MAGIC || in_fs.f_type == XFS_SUPER_MAGIC;
+}
+
+static bool copyReadWrite(int in_fd, int out_fd, uint64_t size, uint64_t *done, uint8_t *buf, size_t buf_len,
+        Hasher *hasher, std::atomic<uint64_t> *bytes_copied, const std::atomic<bool> *cancelled)
+{
+    while (*done < size) {
+        size_t want = size - *done < buf_len ? size - *done : buf_len;
+        ssize_t n = pread(in_fd, buf, want, *done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            if (n == 0)
+                errno = EIO;    // the source shrank under us
+            return false;
+        }
+        if (hasher != nullptr)
+            hasher->update(buf, n);
+        for (ssize_t off = 0; off < n;) {
+            ssize_t w = pwrite(out_fd, buf + off, n - off, *done + off);
+            if (w < 0) {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            off += w;
+            if (writeHook != nullptr)
+                writeHook(w);
+        }
+        *done += n;
+        if (bytes_copied != nullptr)
+            *bytes_copied += n;
+        if (cancelled != nullptr && *cancelled) {
+            errno = ECANCELED;
+            return false;
+        }
+    }
+    return true;
+}
+
+CopyMethod copyFileData(int in_fd, int out_fd, uint64_t size, uint8_t *buf, size_t buf_len,
+        Hasher *hasher, std::atomic<uint64_t> *bytes_copied, const std::atomic<bool> *cancelled)
+{
+    uint64_t done = 0;
+
+    if (hasher != nullptr) {
+        if (!copyReadWrite(in_fd, out_fd, size, &done, buf, buf_len, hasher, bytes_copied, cancelled))
+            return COPY_METHOD_NONE;
+        return COPY_METHOD_READ_WRITE;
+    }
+
+    if (reflinkPossible(in_fd, out_fd)) {
+        if (ioctl(out_fd, FICLONE, in_fd) == 0) {
+            if (bytes_copied != nullptr)
+                *bytes_copied += size;
+            return COPY_METHOD_REFLINK;
+        }
+        if (!isUnsupported(errno))
+            return COPY_METHOD_NONE;
+    }
+
+    // copy_file_range keeps the data in the kernel and lets NFS/SMB do a server-side copy
+    bool supported = true;
+    while (done < size) {
+        size_t want = size - done < KERNEL_COPY_CHUNK ? size - done : KERNEL_COPY_CHUNK;
+        loff_t in_off = done, out_off = done;
+        ssize_t n = copy_file_range(in_fd, &in_off, out_fd, &out_off, want, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && isUnsupported(errno)) {
+            supported = false;
+            break;
+        }
+        if (n <= 0) {
+            if (n == 0)
+                errno = EIO;
+            return COPY_METHOD_NONE;
+        }
+        done += n;
+        if (bytes_copied != nullptr)
+            *bytes_copied += n;
+        if (cancelled != nullptr && *cancelled) {
+            errno = ECANCELED;
+            return COPY_METHOD_NONE;
+        }
+    }
+    if (supported)
+        return COPY_METHOD_COPY_FILE_RANGE;
+
+    // sendfile writes at the current file offset of out_fd
+    supported = lseek(out_fd, done, SEEK_SET) == (off_t)done;
+    while (supported && done < size) {
+        size_t want = size - done < KERNEL_COPY_CHUNK ? size - done : KERNEL_COPY_CHUNK;
+        off_t in_off = done;
+        ssize_t n = sendfile(out_fd, in_fd, &in_off, want);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && isUnsupported(errno)) {
+            supported = false;
+            break;
+        }
+        if (n <= 0) {
+            if (n == 0)
+                errno = EIO;
+            return COPY_METHOD_NONE;
+        }
+        done += n;
+        if (bytes_copied != nullptr)
+            *bytes_copied += n;
+        if (cancelled != nullptr && *cancelled) {
+            errno = ECANCELED;
+            return COPY_METHOD_NONE;
+        }
+    }
+    if (supported)
+        return COPY_METHOD_SENDFILE;
+
+    if (!copyReadWrite(in_fd, out_fd, size, &done, buf, buf_len, nullptr, bytes_copied, cancelled))
+        return COPY_METHOD_NONE;
+    return COPY_METHOD_READ_WRITE;
+}
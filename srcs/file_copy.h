@@ -0,0 +1,40 @@
+#ifndef _FILE_COPY_H
+#define _FILE_COPY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include "hasher.h"
+
+enum CopyMethod {
+    COPY_METHOD_NONE = 0,
+    COPY_METHOD_REFLINK,
+    COPY_METHOD_COPY_FILE_RANGE,
+    COPY_METHOD_SENDFILE,
+    COPY_METHOD_READ_WRITE,
+    COPY_METHOD_IO_URING,       // batched reads and writes of the io_uring backend
+    COPY_METHOD_CHUNKED,        // new chunks into the chunk store, plus a manifest
+    COPY_METHOD_COUNT
+};
+
+const char *copyMethodName(CopyMethod method);
+
+/* Copies `size' bytes from the start of in_fd into the empty out_fd, trying
+ * the cheapest way first: FICLONE reflink (btrfs/XFS share the extents and
+ * no data moves), copy_file_range, sendfile and finally read/write through
+ * `buf'. A method that is not supported by the file systems hands over to
+ * the next one at the offset it reached. Returns the method that finished
+ * the copy, or COPY_METHOD_NONE with errno set.
+ * With a hasher the data has to pass through `buf' to be hashed on its way,
+ * so only read/write is used.
+ */
+CopyMethod copyFileData(int in_fd, int out_fd, uint64_t size, uint8_t *buf, size_t buf_len,
+        Hasher *hasher, std::atomic<uint64_t> *bytes_copied, const std::atomic<bool> *cancelled);
+
+/* Called after every write of the read/write path with its length, so a
+ * benchmark can stand in for a slow target. Not set in the application.
+ */
+typedef void (*CopyWriteHook)(size_t len);
+void setCopyWriteHook(CopyWriteHook hook);
+
+#endif
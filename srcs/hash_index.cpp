@@ -0,0 +1,786 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include "xxh3.h"
+#include "hash_index.h"
+
+#define XXH3_PREFIX             "XXH3_"
+#define FANOUT_BITS_MIN         8
+#define FANOUT_BITS_MAX         16
+#define FANOUT_BUCKET_TARGET    64
+#define WRITE_BUF_LEN           (1024 * 1024)
+
+struct SortedInput {
+    const uint8_t *digests;
+    uint64_t count;
+};
+
+static int hexValue(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+/* Parses the leading hex digest of a line in `sha256sum' or `xxhsum -H3'
+ * style: "<hex digest>  <file name>", the latter with an "XXH3_" prefix.
+ * Returns the digest length in bytes, 0 if the line has no digest.
+ */
+static size_t parseDigestLine(const char *line, uint8_t *out, size_t out_len)
+{
+    while (*line == ' ' || *line == '\t')
+        line++;
+    if (strncmp(line, XXH3_PREFIX, strlen(XXH3_PREFIX)) == 0)
+        line += strlen(XXH3_PREFIX);
+    size_t n = 0;
+    while (hexValue(line[n * 2]) >= 0 && hexValue(line[n * 2 + 1]) >= 0 && n < out_len) {
+        out[n] = (uint8_t)((hexValue(line[n * 2]) << 4) | hexValue(line[n * 2 + 1]));
+        n++;
+    }
+    char end = line[n * 2];
+    if (end != '\0' && end != ' ' && end != '\t' && end != '\r' && end != '\n')
+        return 0;
+    return n;
+}
+
+static uint32_t digestPrefix(const uint8_t *digest, uint32_t bits)
+{
+    uint32_t p = ((uint32_t)digest[0] << 24) | ((uint32_t)digest[1] << 16) |
+                 ((uint32_t)digest[2] << 8) | digest[3];
+    return p >> (32 - bits);
+}
+
+template <size_t N>
+static size_t sortUnique(std::vector<uint8_t> &digests)
+{
+    typedef std::array<uint8_t, N> Digest;
+    Digest *first = reinterpret_cast<Digest *>(digests.data());
+    Digest *last = first + digests.size() / N;
+    std::sort(first, last);
+    last = std::unique(first, last);
+    size_t count = last - first;
+    digests.resize(count * N);
+    return count;
+}
+
+static bool writeAll(int fd, const void *data, size_t len)
+{
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool pwriteAll(int fd, const void *data, size_t len, uint64_t off)
+{
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    while (len > 0) {
+        ssize_t n = pwrite(fd, p, len, off);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        p += n;
+        off += n;
+        len -= n;
+    }
+    return true;
+}
+
+static size_t sortUniqueDigests(std::vector<uint8_t> &digests, uint32_t digest_len)
+{
+    return digest_len == XXH3_DIGEST_LEN ? sortUnique<XXH3_DIGEST_LEN>(digests)
+                                         : sortUnique<SHA256_DIGEST_LEN>(digests);
+}
+
+// Aim for a few dozen digests per bucket, the table itself stays small
+static uint32_t fanoutBits(uint64_t count)
+{
+    uint32_t bits = FANOUT_BITS_MIN;
+    while (bits < FANOUT_BITS_MAX && (count >> bits) > FANOUT_BUCKET_TARGET)
+        bits++;
+    return bits;
+}
+
+/* Streams the union of sorted inputs into an index at path. Each input is
+ * sorted and unique, so a digest found in several of them comes out of the
+ * merge back to back and is written once. The digests go out first, the
+ * header and fan-out table once their counts are known; all of it into a
+ * temporary file that is synced and renamed over path, so a crash or a
+ * cancel leaves path as it was.
+ */
+static bool writeIndex(const std::string &path, HashAlgo algo, const std::vector<SortedInput> &inputs,
+                       uint64_t source_len, uint64_t source_check, const std::atomic<bool> *cancelled,
+                       uint64_t *written)
+{
+    uint32_t len = hashDigestLen(algo);
+    uint64_t upper = 0;
+    for (const SortedInput &input : inputs)
+        upper += input.count;
+    uint32_t bits = fanoutBits(upper);
+    std::vector<uint64_t> fanout(((size_t)1 << bits) + 1);
+
+    HashIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, HASH_INDEX_MAGIC, sizeof(header.magic));
+    header.version = HASH_INDEX_VERSION;
+    header.algorithm = algo;
+    header.digestLen = len;
+    header.fanoutBits = bits;
+    header.fanoutOffset = sizeof(header);
+    uint64_t fanout_end = header.fanoutOffset + fanout.size() * sizeof(uint64_t);
+    header.digestsOffset = (fanout_end + HASH_INDEX_ALIGN - 1) / HASH_INDEX_ALIGN * HASH_INDEX_ALIGN;
+    header.sourceLen = source_len;
+    header.sourceCheck = source_check;
+
+    // A name of its own, two writers of one target never share a temporary file
+    std::string tmp_path = path + ".tmp.XXXXXX";
+    int fd = mkostemp(&tmp_path[0], O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "Create hash index %s failed: %s\n", tmp_path.c_str(), strerror(errno));
+        return false;
+    }
+    fchmod(fd, 0644);
+
+    std::vector<uint8_t> buf;
+    buf.reserve(WRITE_BUF_LEN + len);
+    std::vector<uint64_t> pos(inputs.size(), 0);
+    const uint8_t *last = nullptr;
+    uint64_t count = 0;
+    uint32_t next_prefix = 0;
+    bool ok = lseek(fd, header.digestsOffset, SEEK_SET) == (off_t)header.digestsOffset;
+    while (ok) {
+        const uint8_t *min = nullptr;
+        size_t min_input = 0;
+        for (size_t i = 0; i < inputs.size(); i++) {
+            if (pos[i] == inputs[i].count)
+                continue;
+            const uint8_t *d = inputs[i].digests + pos[i] * len;
+            if (min == nullptr || memcmp(d, min, len) < 0) {
+                min = d;
+                min_input = i;
+            }
+        }
+        if (min == nullptr)
+            break;
+        pos[min_input]++;
+        if (last != nullptr && memcmp(last, min, len) == 0)
+            continue;
+        last = min;
+
+        uint32_t p = digestPrefix(min, bits);
+        while (next_prefix <= p)
+            fanout[next_prefix++] = count;
+        buf.insert(buf.end(), min, min + len);
+        count++;
+        if (buf.size() >= WRITE_BUF_LEN) {
+            ok = writeAll(fd, buf.data(), buf.size()) && !(cancelled != nullptr && *cancelled);
+            buf.clear();
+        }
+    }
+    while (next_prefix <= (1u << bits))
+        fanout[next_prefix++] = count;
+    header.count = count;
+
+    ok = ok && writeAll(fd, buf.data(), buf.size()) &&
+         pwriteAll(fd, &header, sizeof(header), 0) &&
+         pwriteAll(fd, fanout.data(), fanout.size() * sizeof(uint64_t), header.fanoutOffset) &&
+         ftruncate(fd, header.digestsOffset + count * len) == 0 &&
+         fsync(fd) == 0;
+    ::close(fd);
+    if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        if (!(cancelled != nullptr && *cancelled))
+            fprintf(stderr, "Write hash index %s failed: %s\n", path.c_str(), strerror(errno));
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    if (written != nullptr)
+        *written = count;
+    return true;
+}
+
+/* Reads the digests of a text list from byte from to the end, which is
+ * returned in end. digest_len is the length of the digests of the list, 0
+ * to take the first digest found; lines of any other length are skipped.
+ */
+static bool readTextList(const char *text_path, uint64_t from, std::vector<uint8_t> &digests,
+                         size_t *digest_len, uint64_t *end)
+{
+    FILE *fp = fopen(text_path, "r");
+    if (fp == nullptr) {
+        fprintf(stderr, "Open hash list %s failed: %s\n", text_path, strerror(errno));
+        return false;
+    }
+    if (from > 0 && fseeko(fp, from, SEEK_SET) != 0) {
+        fprintf(stderr, "Seek hash list %s failed: %s\n", text_path, strerror(errno));
+        fclose(fp);
+        return false;
+    }
+
+    uint8_t digest[HASH_DIGEST_MAX_LEN];
+    char *line = nullptr;
+    size_t line_cap = 0;
+    ssize_t n;
+    uint64_t pos = from, line_no = 0, skipped = 0;
+    while ((n = getline(&line, &line_cap, fp)) >= 0) {
+        pos += n;
+        line_no++;
+        if (line[0] == '#' || line[0] == '\n' || line[0] == '\r')
+            continue;
+        // The first digest decides the algorithm of the whole list
+        size_t len = parseDigestLine(line, digest, sizeof(digest));
+        if (*digest_len == 0 && hashAlgoFromDigestLen(len) != HASH_ALGO_NONE)
+            *digest_len = len;
+        if (len == 0 || len != *digest_len) {
+            skipped++;
+            continue;
+        }
+        digests.insert(digests.end(), digest, digest + len);
+    }
+    free(line);
+    fclose(fp);
+    HashAlgo algo = hashAlgoFromDigestLen(*digest_len);
+    if (skipped > 0 && algo != HASH_ALGO_NONE)
+        fprintf(stderr, "Hash list %s: %lu of %lu lines have no %s digest, skipped.\n",
+                text_path, (unsigned long)skipped, (unsigned long)line_no, hashAlgoName(algo));
+    *end = pos;
+    return true;
+}
+
+// XXH3 of the HASH_SOURCE_CHECK_LEN bytes of a text list before len
+static bool sourceCheck(const char *text_path, uint64_t len, uint64_t *check)
+{
+    int fd = ::open(text_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    uint8_t buf[HASH_SOURCE_CHECK_LEN];
+    size_t n = (size_t)std::min<uint64_t>(len, sizeof(buf));
+    bool ok = pread(fd, buf, n, len - n) == (ssize_t)n;
+    ::close(fd);
+    if (ok)
+        *check = xxh3_64(buf, n);
+    return ok;
+}
+
+// Runs of an index by sequence number, oldest first
+static std::vector<std::pair<uint64_t, std::string>> listRuns(const std::string &index_path)
+{
+    std::vector<std::pair<uint64_t, std::string>> runs;
+    size_t slash = index_path.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : index_path.substr(0, slash);
+    std::string prefix = (slash == std::string::npos ? index_path : index_path.substr(slash + 1)) +
+                         HASH_RUN_SUFFIX;
+    DIR *d = opendir(dir.c_str());
+    if (d == nullptr)
+        return runs;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != nullptr) {
+        const char *name = entry->d_name;
+        if (strncmp(name, prefix.c_str(), prefix.size()) != 0)
+            continue;
+        const char *seq = name + prefix.size();
+        if (*seq == '\0' || strspn(seq, "0123456789") != strlen(seq))
+            continue;
+        runs.emplace_back(strtoull(seq, nullptr, 10), dir + "/" + name);
+    }
+    closedir(d);
+    std::sort(runs.begin(), runs.end());
+    return runs;
+}
+
+static std::string runPath(const std::string &index_path, uint64_t seq)
+{
+    return index_path + HASH_RUN_SUFFIX + std::to_string(seq);
+}
+
+HashIndex::~HashIndex()
+{
+    close();
+}
+
+bool HashIndex::isIndexFile(const char *path)
+{
+    char magic[8];
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    bool ok = read(fd, magic, sizeof(magic)) == (ssize_t)sizeof(magic) &&
+              memcmp(magic, HASH_INDEX_MAGIC, sizeof(magic)) == 0;
+    ::close(fd);
+    return ok;
+}
+
+std::string HashIndex::textListLine(HashAlgo algo, const uint8_t *digest, const std::string &name)
+{
+    static const char hex[] = "0123456789abcdef";
+    std::string line = algo == HASH_ALGO_XXH3 ? XXH3_PREFIX : "";
+    for (uint32_t i = 0; i < hashDigestLen(algo); i++) {
+        line += hex[digest[i] >> 4];
+        line += hex[digest[i] & 0xf];
+    }
+    line += "  ";
+    line += name;
+    line += '\n';
+    return line;
+}
+
+bool HashIndex::convertTextList(const char *text_path, const char *index_path)
+{
+    std::vector<uint8_t> digests;
+    size_t digest_len = 0;
+    uint64_t end, check;
+    if (!readTextList(text_path, 0, digests, &digest_len, &end))
+        return false;
+    HashAlgo algo = hashAlgoFromDigestLen(digest_len);
+    if (algo == HASH_ALGO_NONE) {
+        fprintf(stderr, "Hash list %s has no SHA-256 or XXH3 digest.\n", text_path);
+        return false;
+    }
+    if (!sourceCheck(text_path, end, &check)) {
+        fprintf(stderr, "Read hash list %s failed: %s\n", text_path, strerror(errno));
+        return false;
+    }
+
+    uint64_t count = sortUniqueDigests(digests, digest_len);
+    if (!writeIndex(index_path, algo, { { digests.data(), count } }, end, check, nullptr, nullptr))
+        return false;
+    fprintf(stdout, "Converted hash list %s: %lu digests -> %s\n",
+            text_path, (unsigned long)count, index_path);
+    return true;
+}
+
+bool HashIndex::appendRun(const char *path, HashAlgo algo, std::vector<uint8_t> &digests)
+{
+    if (digests.empty())
+        return true;
+    std::string index_path = isIndexFile(path) ? std::string(path) : std::string(path) + HASH_INDEX_SUFFIX;
+    std::vector<std::pair<uint64_t, std::string>> existing = listRuns(index_path);
+    uint64_t seq = existing.empty() ? 1 : existing.back().first + 1;
+    uint64_t count = sortUniqueDigests(digests, hashDigestLen(algo));
+    return writeIndex(runPath(index_path, seq), algo, { { digests.data(), count } }, 0, 0, nullptr, nullptr);
+}
+
+HashAlgo HashIndex::detectAlgorithm(const char *path)
+{
+    if (isIndexFile(path)) {
+        HashIndexHeader hdr;
+        int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return HASH_ALGO_NONE;
+        bool ok = read(fd, &hdr, sizeof(hdr)) == (ssize_t)sizeof(hdr);
+        ::close(fd);
+        return ok ? static_cast<HashAlgo>(hdr.algorithm) : HASH_ALGO_NONE;
+    }
+
+    FILE *fp = fopen(path, "r");
+    if (fp == nullptr)
+        return HASH_ALGO_NONE;
+    HashAlgo algo = HASH_ALGO_NONE;
+    uint8_t digest[HASH_DIGEST_MAX_LEN];
+    char *line = nullptr;
+    size_t line_cap = 0;
+    while (algo == HASH_ALGO_NONE && getline(&line, &line_cap, fp) >= 0)
+        algo = hashAlgoFromDigestLen(parseDigestLine(line, digest, sizeof(digest)));
+    free(line);
+    fclose(fp);
+    return algo;
+}
+
+bool HashIndex::open(const char *path)
+{
+    close();
+    std::string index_path;
+    if (isIndexFile(path)) {
+        index_path = path;
+        if (!base.mapFile(path))
+            return false;
+        mapRuns(index_path);
+    } else {
+        index_path = std::string(path) + HASH_INDEX_SUFFIX;
+        bool have = access(index_path.c_str(), F_OK) == 0 && base.mapFile(index_path.c_str());
+        if (have)
+            mapRuns(index_path);
+        if (!have || !ingestTail(path, index_path)) {
+            // Start over from the list, the runs of the old index go with it
+            close();
+            for (auto &run : listRuns(index_path))
+                unlink(run.second.c_str());
+            if (!convertTextList(path, index_path.c_str()) || !base.mapFile(index_path.c_str()))
+                return false;
+        }
+    }
+    loadFilter(path, index_path.c_str());
+    indexPath = index_path;
+    startMerge();
+    return true;
+}
+
+void HashIndex::mapRuns(const std::string &index_path)
+{
+    for (auto &entry : listRuns(index_path)) {
+        Table run;
+        if (!run.mapFile(entry.second.c_str()))
+            continue;
+        if (run.header->algorithm != base.header->algorithm) {
+            fprintf(stderr, "Hash run %s does not hold %s digests, ignored.\n",
+                    entry.second.c_str(), hashAlgoName(getAlgorithm()));
+            run.unmap();
+            continue;
+        }
+        run.seq = entry.first;
+        runs.push_back(run);
+    }
+}
+
+/* Reads what was appended to a text list since the newest of its tables
+ * was made into a new run. Fails when the list no longer starts with what
+ * was indexed: shorter, its last indexed bytes changed, or rewritten to the
+ * same length.
+ */
+bool HashIndex::ingestTail(const char *text_path, const std::string &index_path)
+{
+    const Table *newest = &base;
+    int64_t newest_mtime = base.mtime;
+    for (const Table &run : runs) {
+        if (run.sourceLen > newest->sourceLen)
+            newest = &run;
+        newest_mtime = std::max(newest_mtime, run.mtime);
+    }
+    // A version 1 index does not know what it covers
+    if (newest->sourceLen == 0)
+        return false;
+
+    struct stat st;
+    uint64_t check;
+    if (stat(text_path, &st) != 0)
+        return false;
+    int64_t text_mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    if ((uint64_t)st.st_size < newest->sourceLen || !sourceCheck(text_path, newest->sourceLen, &check) ||
+        check != newest->sourceCheck ||
+        ((uint64_t)st.st_size == newest->sourceLen && text_mtime > newest_mtime)) {
+        fprintf(stdout, "Hash list %s was edited, converting it again.\n", text_path);
+        return false;
+    }
+    if ((uint64_t)st.st_size == newest->sourceLen)
+        return true;
+
+    std::vector<uint8_t> digests;
+    size_t digest_len = base.header->digestLen;
+    uint64_t end;
+    if (!readTextList(text_path, newest->sourceLen, digests, &digest_len, &end) ||
+        !sourceCheck(text_path, end, &check))
+        return false;
+    uint64_t count = sortUniqueDigests(digests, digest_len);
+    // Comments and blank lines only, read again next time
+    if (count == 0)
+        return true;
+
+    std::vector<std::pair<uint64_t, std::string>> existing = listRuns(index_path);
+    Table run;
+    run.seq = existing.empty() ? 1 : existing.back().first + 1;
+    std::string run_path = runPath(index_path, run.seq);
+    if (!writeIndex(run_path, getAlgorithm(), { { digests.data(), count } }, end, check, nullptr, nullptr) ||
+        !run.mapFile(run_path.c_str()))
+        return false;
+    runs.push_back(run);
+    fprintf(stdout, "Hash list %s: %lu new digests -> %s\n", text_path, (unsigned long)count, run_path.c_str());
+    return true;
+}
+
+/* Picks the newest runs while the run before them is less than
+ * HASH_RUN_MERGE_RATIO times their size, like the tiers of an LSM tree,
+ * so a digest is rewritten about log(n) times in all. When those are all
+ * the runs and they add up to a HASH_RUN_MERGE_RATIO-th of the base, the
+ * base is merged with them.
+ */
+void HashIndex::startMerge(void)
+{
+    if (runs.empty())
+        return;
+    size_t first = runs.size() - 1;
+    uint64_t total = runs[first].count();
+    while (first > 0 && runs[first - 1].count() < HASH_RUN_MERGE_RATIO * total) {
+        first--;
+        total += runs[first].count();
+    }
+    if (runs.size() > HASH_RUN_MAX) {
+        for (; first > 0; first--)
+            total += runs[first - 1].count();
+    }
+    bool into_base = first == 0 && total * HASH_RUN_MERGE_RATIO >= base.count();
+    if (!into_base && first + 1 == runs.size())
+        return;
+
+    std::vector<Table> inputs(runs.begin() + first, runs.end());
+    std::string out_path = inputs.back().path;
+    if (into_base) {
+        inputs.insert(inputs.begin(), base);
+        out_path = base.path;
+    }
+
+    /* One merge of an index at a time, whoever holds the lock file merges
+     * and the others leave it to them. The winner may come after another
+     * merge already replaced what it mapped, then it has nothing to do.
+     */
+    std::string lock_path = indexPath + HASH_INDEX_LOCK_SUFFIX;
+    int lock_fd = ::open(lock_path.c_str(), O_RDONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (lock_fd < 0) {
+        fprintf(stderr, "Open hash index lock %s failed: %s\n", lock_path.c_str(), strerror(errno));
+        return;
+    }
+    if (flock(lock_fd, LOCK_EX | LOCK_NB) != 0) {
+        ::close(lock_fd);
+        return;
+    }
+    for (const Table &table : inputs) {
+        struct stat st;
+        if (stat(table.path.c_str(), &st) != 0 ||
+            (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec != table.mtime) {
+            ::close(lock_fd);
+            return;
+        }
+    }
+    mergeCancelled = false;
+    merging = true;
+    merger = std::thread(&HashIndex::merge, this, std::move(inputs), std::move(out_path), lock_fd);
+}
+
+// Reads the mapped tables of this index, which close() keeps until the merge is out
+void HashIndex::merge(std::vector<Table> inputs, std::string out_path, int lock_fd)
+{
+    writeMerge(inputs, out_path);
+    // Closing the descriptor drops the lock
+    ::close(lock_fd);
+    merging = false;
+}
+
+void HashIndex::writeMerge(const std::vector<Table> &inputs, const std::string &out_path)
+{
+    std::vector<SortedInput> sorted;
+    uint64_t source_len = 0, source_check = 0;
+    for (const Table &table : inputs) {
+        sorted.push_back({ table.digests, table.count() });
+        if (table.sourceLen > source_len) {
+            source_len = table.sourceLen;
+            source_check = table.sourceCheck;
+        }
+    }
+    uint64_t count;
+    if (!writeIndex(out_path, getAlgorithm(), sorted, source_len, source_check, &mergeCancelled, &count))
+        return;
+    // The merged file holds all of them now, a crash before these unlinks only leaves duplicates
+    for (const Table &table : inputs)
+        if (table.path != out_path)
+            unlink(table.path.c_str());
+    fprintf(stdout, "Merged %zu hash tables into %s: %lu digests.\n",
+            inputs.size(), out_path.c_str(), (unsigned long)count);
+}
+
+void HashIndex::waitMerge(void)
+{
+    if (merger.joinable())
+        merger.join();
+}
+
+bool HashIndex::isMerging(void) const
+{
+    return merging;
+}
+
+// The filter only speeds up misses, an index without one still answers every lookup
+void HashIndex::loadFilter(const char *path, const char *index_path)
+{
+    std::string filter_path = std::string(path) + XOR_FILTER_SUFFIX;
+    struct stat index_st, filter_st;
+    bool fresh = stat(index_path, &index_st) == 0 && stat(filter_path.c_str(), &filter_st) == 0 &&
+                 (filter_st.st_mtim.tv_sec > index_st.st_mtim.tv_sec ||
+                  (filter_st.st_mtim.tv_sec == index_st.st_mtim.tv_sec &&
+                   filter_st.st_mtim.tv_nsec >= index_st.st_mtim.tv_nsec));
+    if (fresh && filter.load(filter_path.c_str(), base.count()))
+        return;
+
+    std::vector<uint64_t> keys(base.count());
+    for (uint64_t i = 0; i < base.count(); i++)
+        keys[i] = XorFilter::keyFromDigest(base.digests + i * base.header->digestLen);
+    if (!filter.build(keys)) {
+        fprintf(stderr, "Build filter for %s failed, every lookup goes to the index.\n", path);
+        return;
+    }
+    if (!filter.save(filter_path.c_str()))
+        fprintf(stderr, "Save filter %s failed: %s\n", filter_path.c_str(), strerror(errno));
+}
+
+bool HashIndex::Table::mapFile(const char *file)
+{
+    int fd = ::open(file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "Open hash index %s failed: %s\n", file, strerror(errno));
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(HashIndexHeader)) {
+        fprintf(stderr, "Hash index %s is truncated.\n", file);
+        ::close(fd);
+        return false;
+    }
+    void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        fprintf(stderr, "Map hash index %s failed: %s\n", file, strerror(errno));
+        return false;
+    }
+
+    const HashIndexHeader *hdr = static_cast<const HashIndexHeader *>(addr);
+    uint64_t size = st.st_size;
+    bool valid = memcmp(hdr->magic, HASH_INDEX_MAGIC, sizeof(hdr->magic)) == 0 &&
+                 (hdr->version == 1 || hdr->version == HASH_INDEX_VERSION) && hdr->digestLen != 0 &&
+                 hdr->digestLen == hashDigestLen(static_cast<HashAlgo>(hdr->algorithm)) &&
+                 hdr->fanoutBits != 0 && hdr->fanoutBits <= FANOUT_BITS_MAX &&
+                 hdr->fanoutOffset % sizeof(uint64_t) == 0 && hdr->fanoutOffset <= size &&
+                 (((uint64_t)1 << hdr->fanoutBits) + 1) * sizeof(uint64_t) <= size - hdr->fanoutOffset &&
+                 hdr->digestsOffset <= size && hdr->count <= (size - hdr->digestsOffset) / hdr->digestLen;
+    /* Lookups binary search between two fan-out entries without checking
+     * them, so they must start at 0, never decrease and end at the count.
+     */
+    if (valid) {
+        const uint64_t *table = reinterpret_cast<const uint64_t *>(static_cast<const uint8_t *>(addr) +
+                                                                    hdr->fanoutOffset);
+        uint32_t buckets = (uint32_t)1 << hdr->fanoutBits;
+        valid = table[0] == 0 && table[buckets] == hdr->count;
+        for (uint32_t p = 0; valid && p < buckets; p++)
+            valid = table[p] <= table[p + 1];
+    }
+    if (!valid) {
+        fprintf(stderr, "Hash index %s is corrupted.\n", file);
+        munmap(addr, st.st_size);
+        return false;
+    }
+
+    path = file;
+    map = addr;
+    mapLen = st.st_size;
+    mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    header = hdr;
+    fanout = reinterpret_cast<const uint64_t *>(static_cast<const uint8_t *>(addr) + hdr->fanoutOffset);
+    digests = static_cast<const uint8_t *>(addr) + hdr->digestsOffset;
+    // Version 1 ends before the source fields, its fan-out table starts there
+    sourceLen = hdr->version >= 2 ? hdr->sourceLen : 0;
+    sourceCheck = hdr->version >= 2 ? hdr->sourceCheck : 0;
+    // Lookups land on random pages, read-ahead would only pull in pages we never touch
+    madvise(const_cast<uint8_t *>(digests), hdr->count * hdr->digestLen, MADV_RANDOM);
+    return true;
+}
+
+void HashIndex::Table::unmap(void)
+{
+    if (map != nullptr)
+        munmap(map, mapLen);
+    *this = Table();
+}
+
+bool HashIndex::Table::contains(const uint8_t *digest) const
+{
+    uint32_t len = header->digestLen;
+    uint32_t p = digestPrefix(digest, header->fanoutBits);
+    uint64_t lo = fanout[p], hi = fanout[p + 1];
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        int cmp = memcmp(digests + mid * len, digest, len);
+        if (cmp == 0)
+            return true;
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return false;
+}
+
+uint64_t HashIndex::Table::count(void) const
+{
+    return header != nullptr ? header->count : 0;
+}
+
+void HashIndex::close(void)
+{
+    mergeCancelled = true;
+    waitMerge();
+    base.unmap();
+    for (Table &run : runs)
+        run.unmap();
+    runs.clear();
+    filter.clear();
+}
+
+bool HashIndex::contains(const uint8_t *digest) const
+{
+    if (base.header == nullptr)
+        return false;
+    // The runs are small and not in the filter
+    for (const Table &run : runs)
+        if (run.contains(digest))
+            return true;
+    if (useFilter && filter.isBuilt() && !filter.contains(XorFilter::keyFromDigest(digest)))
+        return false;
+    return base.contains(digest);
+}
+
+bool HashIndex::isOpen(void) const
+{
+    return base.header != nullptr;
+}
+
+uint64_t HashIndex::size(void) const
+{
+    uint64_t n = base.count();
+    for (const Table &run : runs)
+        n += run.count();
+    return n;
+}
+
+size_t HashIndex::getRunCount(void) const
+{
+    return runs.size();
+}
+
+uint32_t HashIndex::getDigestLen(void) const
+{
+    return base.header != nullptr ? base.header->digestLen : 0;
+}
+
+HashAlgo HashIndex::getAlgorithm(void) const
+{
+    return base.header != nullptr ? static_cast<HashAlgo>(base.header->algorithm) : HASH_ALGO_NONE;
+}
+
+void HashIndex::setUseFilter(bool use)
+{
+    useFilter = use;
+}
+
+const XorFilter &HashIndex::getFilter(void) const
+{
+    return filter;
+}
@@ -0,0 +1,137 @@
+#ifndef _HASH_INDEX_H
+#define _HASH_INDEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include "hasher.h"
+#include "xor_filter.h"
+
+#define HASH_INDEX_MAGIC        "WBHIDX1"
+#define HASH_INDEX_VERSION      2
+#define HASH_INDEX_SUFFIX       ".widx"
+#define HASH_INDEX_ALIGN        4096
+#define HASH_SOURCE_CHECK_LEN   4096
+// Delta runs sit next to their index as <index>.run.<sequence>
+#define HASH_RUN_SUFFIX         ".run."
+// A run is merged with the ones after it until it is this many times bigger than all of them
+#define HASH_RUN_MERGE_RATIO    4
+// More runs than this are merged whatever their sizes
+#define HASH_RUN_MAX            8
+// Held with flock while a merge writes, <index>.lock, so two openers of one index never merge it together
+#define HASH_INDEX_LOCK_SUFFIX  ".lock"
+
+/* On-disk layout, all integers little endian:
+ *   header | fan-out table | padding to HASH_INDEX_ALIGN | sorted digests
+ * The fan-out table has (1 << fanoutBits) + 1 entries, entry p is the index
+ * of the first digest whose top fanoutBits bits are >= p. A lookup reads two
+ * table entries and binary searches only the digests that share its prefix.
+ * Version 2 adds sourceLen, the bytes of the text list the file covers, and
+ * sourceCheck, the XXH3 of the last HASH_SOURCE_CHECK_LEN of them; both are
+ * 0 for an index that was not made from a text list.
+ */
+struct HashIndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t algorithm;
+    uint32_t digestLen;
+    uint32_t fanoutBits;
+    uint64_t count;
+    uint64_t fanoutOffset;
+    uint64_t digestsOffset;
+    uint64_t sourceLen;
+    uint64_t sourceCheck;
+};
+
+/* A sorted base index plus a few small sorted delta runs, in the manner of
+ * an LSM tree, so a list that grows by a few thousand digests per backup
+ * never has its multi-GB index rewritten for them. Lines appended to a text
+ * list become one new run the next time it is opened, binary indexes take
+ * runs through appendRun(). Lookups check the runs, then the base.
+ * When a run is no longer HASH_RUN_MERGE_RATIO times bigger than the runs
+ * after it, open() merges them in the background; once the runs add up to
+ * a HASH_RUN_MERGE_RATIO-th of the base they are merged into it. A merge
+ * holds the lock file of the index and only writes files, each written to
+ * a temporary file of its own next to the target and renamed over it. What
+ * is mapped stays as it was until the next open(). A crash between the
+ * rename and the removal of the inputs leaves runs whose digests are also
+ * in a newer file, which costs a lookup and nothing else.
+ */
+class HashIndex
+{
+public:
+    ~HashIndex();
+
+    /* Accepts either a binary index or a plain-text hash list. A text list
+     * is converted once to <path>.widx; later only the lines appended since
+     * are read, into a new run. An edit anywhere else converts it again. An
+     * xor filter of the base is cached in <path>.wxor and answers most
+     * misses without touching the base.
+     */
+    bool open(const char *path);
+    // Stops a merge in progress, its inputs stay as they were
+    void close(void);
+    // Waits for the merge open() started, if any
+    void waitMerge(void);
+    bool isMerging(void) const;
+    bool contains(const uint8_t *digest) const;
+    bool isOpen(void) const;
+    // Digests of the base and the runs, a digest in two of them counts twice
+    uint64_t size(void) const;
+    size_t getRunCount(void) const;
+    uint32_t getDigestLen(void) const;
+    HashAlgo getAlgorithm(void) const;
+    // On by default, off only to measure what the filter saves
+    void setUseFilter(bool use);
+    const XorFilter &getFilter(void) const;
+
+    static bool isIndexFile(const char *path);
+    // Reads the header of an index, or the first digest of a text list
+    static HashAlgo detectAlgorithm(const char *path);
+    static bool convertTextList(const char *text_path, const char *index_path);
+    // Adds digests, in any order, as a new run of the index of path, a text list or a binary index
+    static bool appendRun(const char *path, HashAlgo algo, std::vector<uint8_t> &digests);
+    // One line of a text list, in the format the list of that algorithm is read in
+    static std::string textListLine(HashAlgo algo, const uint8_t *digest, const std::string &name);
+
+private:
+    // One mapped file, the base or a run
+    struct Table {
+        std::string path;
+        uint64_t seq = 0;
+        void *map = nullptr;
+        size_t mapLen = 0;
+        int64_t mtime = 0;      // in ns
+        const HashIndexHeader *header = nullptr;
+        const uint64_t *fanout = nullptr;
+        const uint8_t *digests = nullptr;
+        uint64_t sourceLen = 0;
+        uint64_t sourceCheck = 0;
+
+        bool mapFile(const char *file);
+        void unmap(void);
+        bool contains(const uint8_t *digest) const;
+        uint64_t count(void) const;
+    };
+
+    Table base;
+    std::vector<Table> runs;    // oldest first
+    XorFilter filter;
+    bool useFilter = true;
+    std::string indexPath;      // the binary index, whichever path open() was given
+    std::thread merger;
+    std::atomic<bool> mergeCancelled{false};
+    std::atomic<bool> merging{false};
+
+    void mapRuns(const std::string &index_path);
+    bool ingestTail(const char *text_path, const std::string &index_path);
+    void startMerge(void);
+    void merge(std::vector<Table> inputs, std::string out_path, int lock_fd);
+    void writeMerge(const std::vector<Table> &inputs, const std::string &out_path);
+    void loadFilter(const char *path, const char *index_path);
+};
+
+#endif
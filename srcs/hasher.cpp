@@ -0,0 +1,65 @@
+#include "hasher.h"
+
+uint32_t hashDigestLen(HashAlgo algo)
+{
+    switch (algo) {
+    case HASH_ALGO_SHA256:
+        return SHA256_DIGEST_LEN;
+    case HASH_ALGO_XXH3:
+        return XXH3_DIGEST_LEN;
+    default:
+        return 0;
+    }
+}
+
+HashAlgo hashAlgoFromDigestLen(size_t len)
+{
+    if (len == SHA256_DIGEST_LEN)
+        return HASH_ALGO_SHA256;
+    if (len == XXH3_DIGEST_LEN)
+        return HASH_ALGO_XXH3;
+    return HASH_ALGO_NONE;
+}
+
+const char *hashAlgoName(HashAlgo algo)
+{
+    switch (algo) {
+    case HASH_ALGO_SHA256:
+        return "SHA-256";
+    case HASH_ALGO_XXH3:
+        return "XXH3-64";
+    default:
+        return "none";
+    }
+}
+
+void hashSelectKernels(void)
+{
+    sha256GetKernel();
+    xxh3GetKernel();
+}
+
+void Hasher::init(HashAlgo algorithm)
+{
+    algo = algorithm;
+    if (algo == HASH_ALGO_XXH3)
+        xxh3.init();
+    else
+        sha256.init();
+}
+
+void Hasher::update(const void *data, size_t len)
+{
+    if (algo == HASH_ALGO_XXH3)
+        xxh3.update(data, len);
+    else
+        sha256.update(data, len);
+}
+
+void Hasher::final(uint8_t *digest)
+{
+    if (algo == HASH_ALGO_XXH3)
+        xxh3.final(digest);
+    else
+        sha256.final(digest);
+}
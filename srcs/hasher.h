@@ -0,0 +1,39 @@
+#ifndef _HASHER_H
+#define _HASHER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "sha256.h"
+#include "xxh3.h"
+
+#define HASH_DIGEST_MAX_LEN     SHA256_DIGEST_LEN
+
+// Stored in hash index headers, keep the values stable
+enum HashAlgo {
+    HASH_ALGO_NONE = 0,
+    HASH_ALGO_SHA256 = 1,
+    HASH_ALGO_XXH3 = 2
+};
+
+uint32_t hashDigestLen(HashAlgo algo);
+HashAlgo hashAlgoFromDigestLen(size_t len);
+const char *hashAlgoName(HashAlgo algo);
+
+/* Resolves the SIMD kernels for every algorithm. Call it once before any
+ * worker thread hashes, the dispatch tables are not protected by a lock.
+ */
+void hashSelectKernels(void);
+
+struct Hasher {
+    HashAlgo algo;
+    union {
+        Sha256 sha256;
+        Xxh3State xxh3;
+    };
+
+    void init(HashAlgo algorithm);
+    void update(const void *data, size_t len);
+    void final(uint8_t *digest);
+};
+
+#endif
@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include "backup_engine.h"
+#include "headless.h"
+
+#define POLL_MS             100
+
+enum {
+    OPT_HEADLESS = 256,
+    OPT_IMPORT,
+    OPT_OUTPUT,
+    OPT_PHOTO_HASH,
+    OPT_VIDEO_HASH,
+    OPT_IO_URING,
+    OPT_CHUNK_VIDEOS,
+    OPT_NO_GROUP,
+    OPT_DATE_LAYOUT,
+    OPT_WRITERS,
+    OPT_FIXED_WRITERS,
+    OPT_INTERVAL,
+    OPT_HELP
+};
+
+static const struct option options[] = {
+    { "headless",       no_argument,        nullptr, OPT_HEADLESS },
+    { "import",         required_argument,  nullptr, OPT_IMPORT },
+    { "output",         required_argument,  nullptr, OPT_OUTPUT },
+    { "photo-hash",     required_argument,  nullptr, OPT_PHOTO_HASH },
+    { "video-hash",     required_argument,  nullptr, OPT_VIDEO_HASH },
+    { "io-uring",       no_argument,        nullptr, OPT_IO_URING },
+    { "chunk-videos",   no_argument,        nullptr, OPT_CHUNK_VIDEOS },
+    { "no-group",       no_argument,        nullptr, OPT_NO_GROUP },
+    { "date-layout",    no_argument,        nullptr, OPT_DATE_LAYOUT },
+    { "writers",        required_argument,  nullptr, OPT_WRITERS },
+    { "fixed-writers",  no_argument,        nullptr, OPT_FIXED_WRITERS },
+    { "interval",       required_argument,  nullptr, OPT_INTERVAL },
+    { "help",           no_argument,        nullptr, OPT_HELP },
+    { nullptr,          0,                  nullptr, 0 }
+};
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void onStopSignal(int)
+{
+    stopRequested = 1;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s --headless --import <dir> --output <dir> [options]\n"
+            "  --photo-hash <file>     hash list of the photos already on the NAS\n"
+            "  --video-hash <file>     hash list of the videos already on the NAS\n"
+            "  --io-uring              batch I/O with io_uring\n"
+            "  --chunk-videos          store videos as chunks\n"
+            "  --no-group              back up RAW+JPEG pairs and Live Photos file by file\n"
+            "  --date-layout           sort into YYYY/MM/DD\n"
+            "  --writers <min>[-<max>] bounds of the NAS writers, default 1-8\n"
+            "  --fixed-writers         always use the maximum number of writers\n"
+            "  --interval <seconds>    between progress lines, default %.0f\n",
+            name, HEADLESS_INTERVAL);
+}
+
+static double nowSeconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void printProgress(const BackupTotals &totals, double elapsed, double files_rate, double mb_rate)
+{
+    uint64_t scanned = totals.get(STAT_FILES_SCANNED);
+    uint64_t done = filesProcessed(totals) + totals.get(STAT_FILES_RESUMED);
+    char eta[32] = "";
+
+    // The total is only known once the walker is done
+    if (totals.scanDone && files_rate > 0.0 && done < scanned) {
+        unsigned long secs = (unsigned long)((scanned - done) / files_rate);
+        snprintf(eta, sizeof(eta), ", ETA %lu:%02lu:%02lu", secs / 3600, secs / 60 % 60, secs % 60);
+    }
+    fprintf(stdout, "[%8.1fs] %lu/%lu%s done: copied %lu, duplicates %lu, resumed %lu, failed %lu, "
+            "%.0f files/s, %.1f MB/s, %d writers%s\n",
+            elapsed, (unsigned long)done, (unsigned long)scanned, totals.scanDone ? "" : "+",
+            (unsigned long)totals.get(STAT_FILES_VERIFIED), (unsigned long)totals.get(STAT_FILES_DUPLICATE),
+            (unsigned long)totals.get(STAT_FILES_RESUMED), (unsigned long)totals.get(STAT_FILES_FAILED),
+            files_rate, mb_rate, totals.copyLimit, eta);
+    // Redirected to a log by cron, stdout would otherwise hold the lines until the end
+    fflush(stdout);
+}
+
+bool headlessRequested(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++)
+        if (strcmp(argv[i], "--headless") == 0)
+            return true;
+    return false;
+}
+
+int runHeadless(int argc, char **argv)
+{
+    BackupConfig config;
+    bool fixed_writers = false;
+    double interval = HEADLESS_INTERVAL;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "", options, nullptr)) != -1) {
+        switch (opt) {
+        case OPT_HEADLESS:
+            break;
+        case OPT_IMPORT:
+            config.importDir = optarg;
+            break;
+        case OPT_OUTPUT:
+            config.outputDir = optarg;
+            break;
+        case OPT_PHOTO_HASH:
+            config.photoHashFile = optarg;
+            break;
+        case OPT_VIDEO_HASH:
+            config.videoHashFile = optarg;
+            break;
+        case OPT_IO_URING:
+            config.ioBackend = IO_BACKEND_URING;
+            break;
+        case OPT_CHUNK_VIDEOS:
+            config.chunkVideos = true;
+            break;
+        case OPT_NO_GROUP:
+            config.groupCompanions = false;
+            break;
+        case OPT_DATE_LAYOUT:
+            config.layout = OUTPUT_LAYOUT_DATE;
+            break;
+        case OPT_WRITERS: {
+            int min = 0, max = 0;
+            int n = sscanf(optarg, "%d-%d", &min, &max);
+            if (n == 1)
+                max = min;
+            if (n < 1 || min < 1 || max < min) {
+                fprintf(stderr, "Bad writer bounds: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            config.copyWorkersMin = min;
+            config.copyWorkersMax = max;
+            break;
+        }
+        case OPT_FIXED_WRITERS:
+            fixed_writers = true;
+            break;
+        case OPT_INTERVAL:
+            interval = atof(optarg);
+            if (interval <= 0.0) {
+                fprintf(stderr, "Bad interval: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind < argc || config.importDir.empty() || config.outputDir.empty()) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (!isDirectory(config.importDir.c_str(), false)) {
+        fprintf(stderr, "Import directory %s is not a directory.\n", config.importDir.c_str());
+        return EXIT_FAILURE;
+    }
+    if (!isDirectory(config.outputDir.c_str(), true)) {
+        fprintf(stderr, "Output directory %s is not a writable directory.\n", config.outputDir.c_str());
+        return EXIT_FAILURE;
+    }
+    for (const std::string *list : { &config.photoHashFile, &config.videoHashFile }) {
+        if (!list->empty() && !isRegularFile(list->c_str())) {
+            fprintf(stderr, "Hash file %s is not a regular file.\n", list->c_str());
+            return EXIT_FAILURE;
+        }
+    }
+    config.adaptiveCopy = !fixed_writers;
+    // The engine clamps the starting count into the bounds
+    config.copyWorkers = fixed_writers ? config.copyWorkersMax : 2;
+
+    struct sigaction sa = {};
+    sa.sa_handler = onStopSignal;
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+
+    BackupEngine engine;
+    if (!engine.start(config))
+        return EXIT_FAILURE;
+    double start = nowSeconds();
+    double last_print = start;
+    uint64_t last_files = 0;
+    uint64_t last_bytes = 0;
+    BackupTotals totals;
+    while (engine.getState() == BACKUP_RUNNING) {
+        usleep(POLL_MS * 1000);
+        if (stopRequested) {
+            fprintf(stdout, "Cancelling, the next run resumes from the journal.\n");
+            fflush(stdout);
+            engine.cancel();
+            stopRequested = 0;
+        }
+        double now = nowSeconds();
+        if (now - last_print < interval)
+            continue;
+        engine.getTotals(&totals);
+        uint64_t files = filesProcessed(totals);
+        uint64_t bytes = totals.get(STAT_BYTES_COPIED);
+        printProgress(totals, now - start, (files - last_files) / (now - last_print),
+                      (bytes - last_bytes) / (now - last_print) / 1e6);
+        last_print = now;
+        last_files = files;
+        last_bytes = bytes;
+    }
+    engine.wait();
+
+    engine.getTotals(&totals);
+    double elapsed = nowSeconds() - start;
+    printProgress(totals, elapsed, filesProcessed(totals) / elapsed, totals.get(STAT_BYTES_COPIED) / elapsed / 1e6);
+    if (engine.getState() == BACKUP_CANCELLED || totals.get(STAT_FILES_FAILED) > 0)
+        return EXIT_FAILURE;
+    return 0;
+}
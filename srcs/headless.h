@@ -0,0 +1,16 @@
+#ifndef _HEADLESS_H
+#define _HEADLESS_H
+
+// Seconds between two progress lines unless --interval says otherwise
+#define HEADLESS_INTERVAL   5.0
+
+/* warbler --headless: the same backup as the window, configured from the
+ * command line, for machines without a display and for cron. Neither GLFW
+ * nor vulkan is touched. Progress goes to stdout as one line per interval,
+ * SIGINT / SIGTERM cancel the backup cleanly so the journal resumes it.
+ */
+bool headlessRequested(int argc, char **argv);
+// Exit status: 0 when every file made it, 1 on failed files, bad arguments or a cancel
+int runHeadless(int argc, char **argv);
+
+#endif
@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <stb_image.h>
+#include "image_atlas.h"
+
+// imgui_draw.cpp keeps its copy of the packer static, this is the one the atlas links against
+#define STB_RECT_PACK_IMPLEMENTATION
+#include "imstb_rectpack.h"
+
+ImageAtlas::Page *ImageAtlas::addPage(void)
+{
+    std::unique_ptr<Page> page(new Page());
+    page->pixels.assign((size_t)IMAGE_ATLAS_PAGE_SIZE * IMAGE_ATLAS_PAGE_SIZE * 4, 0);
+    page->nodes.resize(IMAGE_ATLAS_PAGE_SIZE);
+    stbrp_init_target(&page->packer, IMAGE_ATLAS_PAGE_SIZE, IMAGE_ATLAS_PAGE_SIZE,
+                      page->nodes.data(), (int)page->nodes.size());
+    page->texture = NULL;
+    page->dirty = true;
+    pages.push_back(std::move(page));
+    return pages.back().get();
+}
+
+/* The first page with room takes the image, a new page only when none has.
+ * The padding repeats the nearest edge pixel of the image.
+ */
+AtlasImageId ImageAtlas::add(const unsigned char *pixels, int width, int height, int stride)
+{
+    const int pad = IMAGE_ATLAS_PADDING;
+    if (width <= 0 || height <= 0 || width + pad * 2 > IMAGE_ATLAS_PAGE_SIZE ||
+        height + pad * 2 > IMAGE_ATLAS_PAGE_SIZE) {
+        fprintf(stderr, "Image of %dx%d does not fit an atlas page.\n", width, height);
+        return 0;
+    }
+
+    stbrp_rect rect = {};
+    rect.w = (stbrp_coord)(width + pad * 2);
+    rect.h = (stbrp_coord)(height + pad * 2);
+    uint32_t index = 0;
+    for (; index < pages.size(); index++) {
+        if (stbrp_pack_rects(&pages[index]->packer, &rect, 1) && rect.was_packed)
+            break;
+    }
+    if (index == pages.size()) {
+        Page *page = addPage();
+        if (!stbrp_pack_rects(&page->packer, &rect, 1) || !rect.was_packed)
+            return 0;
+    }
+
+    Page &page = *pages[index];
+    for (int py = 0; py < rect.h; py++) {
+        int sy = std::min(std::max(py - pad, 0), height - 1);
+        uint8_t *dst = &page.pixels[(((size_t)rect.y + py) * IMAGE_ATLAS_PAGE_SIZE + rect.x) * 4];
+        const unsigned char *src = pixels + (size_t)sy * stride * 4;
+        for (int px = 0; px < rect.w; px++) {
+            int sx = std::min(std::max(px - pad, 0), width - 1);
+            memcpy(dst + px * 4, src + sx * 4, 4);
+        }
+    }
+    page.dirty = true;
+
+    Image image;
+    image.page = index;
+    image.region.texture = page.texture;
+    image.region.uv0 = ImVec2((float)(rect.x + pad) / IMAGE_ATLAS_PAGE_SIZE, (float)(rect.y + pad) / IMAGE_ATLAS_PAGE_SIZE);
+    image.region.uv1 = ImVec2((float)(rect.x + pad + width) / IMAGE_ATLAS_PAGE_SIZE,
+                              (float)(rect.y + pad + height) / IMAGE_ATLAS_PAGE_SIZE);
+    image.region.width = width;
+    image.region.height = height;
+    images.push_back(image);
+    return (AtlasImageId)images.size();
+}
+
+AtlasImageId ImageAtlas::addFile(const char *path, int x, int y, int width, int height)
+{
+    int file_width, file_height, channels;
+    stbi_uc *pixels = stbi_load(path, &file_width, &file_height, &channels, STBI_rgb_alpha);
+    if (!pixels) {
+        fprintf(stderr, "Failed to load image: %s\n", path);
+        return 0;
+    }
+    if (width == 0 || height == 0) {
+        x = 0;
+        y = 0;
+        width = file_width;
+        height = file_height;
+    }
+
+    AtlasImageId id = 0;
+    if (x < 0 || y < 0 || x + width > file_width || y + height > file_height)
+        fprintf(stderr, "Rectangle %d,%d %dx%d is outside of %s.\n", x, y, width, height, path);
+    else
+        id = add(pixels + ((size_t)y * file_width + x) * 4, width, height, file_width);
+    stbi_image_free(pixels);
+    return id;
+}
+
+// A page changed after its upload gets a new texture, the old one is released behind the frames using it
+bool ImageAtlas::upload(ImguiVulkanHelper &helper)
+{
+    for (uint32_t i = 0; i < pages.size(); i++) {
+        Page &page = *pages[i];
+        if (!page.dirty)
+            continue;
+        ImTextureID texture = helper.createTexture(page.pixels.data(), IMAGE_ATLAS_PAGE_SIZE, IMAGE_ATLAS_PAGE_SIZE);
+        if (texture == NULL)
+            return false;
+        if (page.texture != NULL)
+            helper.releaseImage(page.texture);
+        page.texture = texture;
+        page.dirty = false;
+        for (auto &image : images) {
+            if (image.page == i)
+                image.region.texture = texture;
+        }
+    }
+    return true;
+}
+
+const AtlasRegion &ImageAtlas::getRegion(AtlasImageId id) const
+{
+    static const AtlasRegion none = {};
+    if (id == 0 || id > images.size())
+        return none;
+    return images[id - 1].region;
+}
+
+void ImageAtlas::draw(AtlasImageId id, const ImVec2 &size) const
+{
+    const AtlasRegion &region = getRegion(id);
+    if (region.texture == NULL)
+        ImGui::Dummy(size);
+    else
+        ImGui::Image(region.texture, size, region.uv0, region.uv1);
+}
+
+void ImageAtlas::reset(ImguiVulkanHelper &helper)
+{
+    for (auto &page : pages) {
+        if (page->texture != NULL)
+            helper.releaseImage(page->texture);
+    }
+    pages.clear();
+    images.clear();
+}
+
+uint32_t ImageAtlas::getPageCount(void) const
+{
+    return static_cast<uint32_t>(pages.size());
+}
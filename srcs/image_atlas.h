@@ -0,0 +1,70 @@
+#ifndef _IMAGE_ATLAS_H
+#define _IMAGE_ATLAS_H
+
+#include <stdint.h>
+#include <vector>
+#include <memory>
+#include "imstb_rectpack.h"
+#include "imgui_vulkan_helper.h"
+
+// Width and height of a page, an image larger than a page minus the padding is refused
+#define IMAGE_ATLAS_PAGE_SIZE   1024
+// Pixels around every image repeating its edge, so linear filtering never reaches a neighbour
+#define IMAGE_ATLAS_PADDING     2
+
+// Names an image of the atlas, 0 never does
+typedef uint32_t AtlasImageId;
+
+// Where an image ended up, texture is NULL until the page has been uploaded
+struct AtlasRegion {
+    ImTextureID texture;
+    ImVec2 uv0;
+    ImVec2 uv1;
+    int width;
+    int height;
+};
+
+/* Small images such as icons packed into shared pages with the skyline
+ * packer imgui builds its font atlas with. Every image of a page is the
+ * same texture, so imgui merges the draws of all the icons of a window
+ * into one command and the backend binds nothing between them. Pixels are
+ * kept on the CPU; upload() sends the pages changed since the last call
+ * and replaces their textures, so regions are fetched every frame.
+ * Not thread safe, it belongs to the render thread.
+ */
+class ImageAtlas
+{
+public:
+    // width x height RGBA pixels, stride pixels from one row to the next
+    AtlasImageId add(const unsigned char *pixels, int width, int height, int stride);
+    // A rectangle of an image file, the whole image when width or height is 0
+    AtlasImageId addFile(const char *path, int x, int y, int width, int height);
+    // Before drawing, once the images of the frame are added
+    bool upload(ImguiVulkanHelper &helper);
+    const AtlasRegion &getRegion(AtlasImageId id) const;
+    // ImGui::Image() of the region, the space is kept while the page is not uploaded yet
+    void draw(AtlasImageId id, const ImVec2 &size) const;
+    // Releases the pages and forgets every image
+    void reset(ImguiVulkanHelper &helper);
+    uint32_t getPageCount(void) const;
+
+private:
+    struct Page {
+        std::vector<uint8_t> pixels;
+        std::vector<stbrp_node> nodes;
+        stbrp_context packer;
+        ImTextureID texture;
+        bool dirty;
+    };
+    struct Image {
+        uint32_t page;
+        AtlasRegion region;
+    };
+
+    std::vector<std::unique_ptr<Page>> pages;   // the packer points into its page's nodes
+    std::vector<Image> images;                  // by id - 1
+
+    Page *addPage(void);
+};
+
+#endif
@@ -60,6 +60,13 @@ struct ImGui_ImplVulkanH_FrameRenderBuffers
     VkDeviceSize        IndexBufferSize;
     VkBuffer            VertexBuffer;
     VkBuffer            IndexBuffer;
+    // Only set when the memory comes from AllocateMemoryFn
+    VkDeviceSize        VertexBufferOffset;
+    VkDeviceSize        IndexBufferOffset;
+    VkDeviceSize        VertexBufferRange;
+    VkDeviceSize        IndexBufferRange;
+    void*               VertexBufferMap;
+    void*               IndexBufferMap;
 };
 
 // Each viewport will hold 1 ImGui_ImplVulkanH_WindowRenderBuffers
@@ -82,6 +89,12 @@ static VkPipeline               g_Pipeline = VK_NULL_HANDLE;
 static VkShaderModule           g_ShaderModuleVert;
 static VkShaderModule           g_ShaderModuleFrag;
 
+// Bindless textures: one set for all, ImTextureID is the slot + 1
+static VkDescriptorPool         g_BindlessPool = VK_NULL_HANDLE;
+static VkDescriptorSet          g_BindlessSet = VK_NULL_HANDLE;
+static uint32_t                 g_BindlessSlotsUsed = 0;
+static ImVector<uint32_t>       g_BindlessFreeSlots;
+
 // Font data
 static VkSampler                g_FontSampler = VK_NULL_HANDLE;
 static VkDeviceMemory           g_FontMemory = VK_NULL_HANDLE;
@@ -212,6 +225,56 @@ static uint32_t __glsl_shader_frag_spv[] =
     0x00010038
 };
 
+// glsl_shader_bindless.frag, the same but the texture is picked out of an array by a push constant after the vertex stage's.
+// SPIR-V 1.0 written out by hand, the array size is IMGUI_IMPL_VULKAN_BINDLESS_TEXTURES (0x1000):
+/*
+#version 450 core
+layout(location = 0) out vec4 fColor;
+layout(set=0, binding=0) uniform sampler2D sTextures[4096];
+layout(push_constant) uniform uPushConstant { layout(offset = 16) uint uTexture; } pc;
+layout(location = 0) in struct { vec4 Color; vec2 UV; } In;
+void main()
+{
+    fColor = In.Color * texture(sTextures[pc.uTexture], In.UV.st);
+}
+*/
+static uint32_t __glsl_shader_frag_bindless_spv[] =
+{
+    0x07230203,0x00010000,0x00000000,0x00000029,0x00000000,0x00020011,0x00000001,0x00020011,
+    0x0000001d,0x0006000b,0x00000001,0x4c534c47,0x6474732e,0x3035342e,0x00000000,0x0003000e,
+    0x00000000,0x00000001,0x0007000f,0x00000004,0x00000002,0x6e69616d,0x00000000,0x00000009,
+    0x0000000d,0x00030010,0x00000002,0x00000007,0x00030003,0x00000002,0x000001c2,0x00040005,
+    0x00000002,0x6e69616d,0x00000000,0x00040005,0x00000009,0x6c6f4366,0x0000726f,0x00030005,
+    0x0000000b,0x00000000,0x00050006,0x0000000b,0x00000000,0x6f6c6f43,0x00000072,0x00040006,
+    0x0000000b,0x00000001,0x00005655,0x00030005,0x0000000d,0x00006e49,0x00050005,0x00000015,
+    0x78655473,0x65727574,0x00000073,0x00060005,0x0000001a,0x73755075,0x6e6f4368,0x6e617473,
+    0x00000074,0x00060006,0x0000001a,0x00000000,0x78655475,0x65727574,0x00000000,0x00030005,
+    0x0000001c,0x00006370,0x00040047,0x00000009,0x0000001e,0x00000000,0x00040047,0x0000000d,
+    0x0000001e,0x00000000,0x00040047,0x00000015,0x00000022,0x00000000,0x00040047,0x00000015,
+    0x00000021,0x00000000,0x00050048,0x0000001a,0x00000000,0x00000023,0x00000010,0x00030047,
+    0x0000001a,0x00000002,0x00020013,0x00000004,0x00030021,0x00000005,0x00000004,0x00030016,
+    0x00000006,0x00000020,0x00040017,0x00000007,0x00000006,0x00000004,0x00040020,0x00000008,
+    0x00000003,0x00000007,0x0004003b,0x00000008,0x00000009,0x00000003,0x00040017,0x0000000a,
+    0x00000006,0x00000002,0x0004001e,0x0000000b,0x00000007,0x0000000a,0x00040020,0x0000000c,
+    0x00000001,0x0000000b,0x0004003b,0x0000000c,0x0000000d,0x00000001,0x00040015,0x0000000e,
+    0x00000020,0x00000001,0x0004002b,0x0000000e,0x0000000f,0x00000000,0x00040020,0x00000010,
+    0x00000001,0x00000007,0x00090019,0x00000011,0x00000006,0x00000001,0x00000000,0x00000000,
+    0x00000000,0x00000001,0x00000000,0x0003001b,0x00000012,0x00000011,0x00040015,0x00000018,
+    0x00000020,0x00000000,0x0004002b,0x00000018,0x00000019,0x00001000,0x0004001c,0x00000013,
+    0x00000012,0x00000019,0x00040020,0x00000014,0x00000000,0x00000013,0x0004003b,0x00000014,
+    0x00000015,0x00000000,0x0004002b,0x0000000e,0x00000016,0x00000001,0x00040020,0x00000017,
+    0x00000001,0x0000000a,0x0003001e,0x0000001a,0x00000018,0x00040020,0x0000001b,0x00000009,
+    0x0000001a,0x0004003b,0x0000001b,0x0000001c,0x00000009,0x00040020,0x0000001d,0x00000009,
+    0x00000018,0x00040020,0x0000001e,0x00000000,0x00000012,0x00050036,0x00000004,0x00000002,
+    0x00000000,0x00000005,0x000200f8,0x00000003,0x00050041,0x00000010,0x0000001f,0x0000000d,
+    0x0000000f,0x0004003d,0x00000007,0x00000020,0x0000001f,0x00050041,0x0000001d,0x00000021,
+    0x0000001c,0x0000000f,0x0004003d,0x00000018,0x00000022,0x00000021,0x00050041,0x0000001e,
+    0x00000023,0x00000015,0x00000022,0x0004003d,0x00000012,0x00000024,0x00000023,0x00050041,
+    0x00000017,0x00000025,0x0000000d,0x00000016,0x0004003d,0x0000000a,0x00000026,0x00000025,
+    0x00050057,0x00000007,0x00000027,0x00000024,0x00000026,0x00050085,0x00000007,0x00000028,
+    0x00000020,0x00000027,0x0003003e,0x00000009,0x00000028,0x000100fd,0x00010038
+};
+
 //-----------------------------------------------------------------------------
 // FUNCTIONS
 //-----------------------------------------------------------------------------
@@ -234,14 +297,28 @@ static void check_vk_result(VkResult err)
         v->CheckVkResultFn(err);
 }
 
-static void CreateOrResizeBuffer(VkBuffer& buffer, VkDeviceMemory& buffer_memory, VkDeviceSize& p_buffer_size, size_t new_size, VkBufferUsageFlagBits usage)
+static void FreeBufferMemory(VkDevice device, VkDeviceMemory& buffer_memory, VkDeviceSize buffer_offset, const VkAllocationCallbacks* allocator)
+{
+    ImGui_ImplVulkan_InitInfo* v = &g_VulkanInitInfo;
+    if (buffer_memory == VK_NULL_HANDLE)
+        return;
+    if (v->FreeMemoryFn != NULL)
+        v->FreeMemoryFn(buffer_memory, buffer_offset, v->MemoryUserData);
+    else
+        vkFreeMemory(device, buffer_memory, allocator);
+    buffer_memory = VK_NULL_HANDLE;
+}
+
+static void CreateOrResizeBuffer(VkBuffer& buffer, VkDeviceMemory& buffer_memory, VkDeviceSize& buffer_offset, VkDeviceSize& buffer_range, void*& buffer_map, VkDeviceSize& p_buffer_size, size_t new_size, VkBufferUsageFlagBits usage)
 {
     ImGui_ImplVulkan_InitInfo* v = &g_VulkanInitInfo;
     VkResult err;
     if (buffer != VK_NULL_HANDLE)
         vkDestroyBuffer(v->Device, buffer, v->Allocator);
-    if (buffer_memory != VK_NULL_HANDLE)
-        vkFreeMemory(v->Device, buffer_memory, v->Allocator);
+    FreeBufferMemory(v->Device, buffer_memory, buffer_offset, v->Allocator);
+    buffer_offset = 0;
+    buffer_range = VK_WHOLE_SIZE;
+    buffer_map = NULL;
 
     VkDeviceSize vertex_buffer_size_aligned = ((new_size - 1) / g_BufferMemoryAlignment + 1) * g_BufferMemoryAlignment;
     VkBufferCreateInfo buffer_info = {};
@@ -255,14 +332,22 @@ static void CreateOrResizeBuffer(VkBuffer& buffer, VkDeviceMemory& buffer_memory
     VkMemoryRequirements req;
     vkGetBufferMemoryRequirements(v->Device, buffer, &req);
     g_BufferMemoryAlignment = (g_BufferMemoryAlignment > req.alignment) ? g_BufferMemoryAlignment : req.alignment;
-    VkMemoryAllocateInfo alloc_info = {};
-    alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    alloc_info.allocationSize = req.size;
-    alloc_info.memoryTypeIndex = ImGui_ImplVulkan_MemoryType(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, req.memoryTypeBits);
-    err = vkAllocateMemory(v->Device, &alloc_info, v->Allocator, &buffer_memory);
-    check_vk_result(err);
+    if (v->AllocateMemoryFn != NULL)
+    {
+        if (!v->AllocateMemoryFn(&req, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, &buffer_memory, &buffer_offset, &buffer_range, &buffer_map, v->MemoryUserData))
+            check_vk_result(VK_ERROR_OUT_OF_DEVICE_MEMORY);
+    }
+    else
+    {
+        VkMemoryAllocateInfo alloc_info = {};
+        alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        alloc_info.allocationSize = req.size;
+        alloc_info.memoryTypeIndex = ImGui_ImplVulkan_MemoryType(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, req.memoryTypeBits);
+        err = vkAllocateMemory(v->Device, &alloc_info, v->Allocator, &buffer_memory);
+        check_vk_result(err);
+    }
 
-    err = vkBindBufferMemory(v->Device, buffer, buffer_memory, 0);
+    err = vkBindBufferMemory(v->Device, buffer, buffer_memory, buffer_offset);
     check_vk_result(err);
     p_buffer_size = new_size;
 }
@@ -274,6 +359,12 @@ static void ImGui_ImplVulkan_SetupRenderState(ImDrawData* draw_data, VkPipeline
         vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
     }
 
+    // Bind the texture array once, draws only pick a slot of it:
+    if (g_BindlessSet != VK_NULL_HANDLE)
+    {
+        vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, g_PipelineLayout, 0, 1, &g_BindlessSet, 0, NULL);
+    }
+
     // Bind Vertex And Index Buffer:
     if (draw_data->TotalVtxCount > 0)
     {
@@ -342,17 +433,24 @@ void ImGui_ImplVulkan_RenderDrawData(ImDrawData* draw_data, VkCommandBuffer comm
         size_t vertex_size = draw_data->TotalVtxCount * sizeof(ImDrawVert);
         size_t index_size = draw_data->TotalIdxCount * sizeof(ImDrawIdx);
         if (rb->VertexBuffer == VK_NULL_HANDLE || rb->VertexBufferSize < vertex_size)
-            CreateOrResizeBuffer(rb->VertexBuffer, rb->VertexBufferMemory, rb->VertexBufferSize, vertex_size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+            CreateOrResizeBuffer(rb->VertexBuffer, rb->VertexBufferMemory, rb->VertexBufferOffset, rb->VertexBufferRange, rb->VertexBufferMap, rb->VertexBufferSize, vertex_size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
         if (rb->IndexBuffer == VK_NULL_HANDLE || rb->IndexBufferSize < index_size)
-            CreateOrResizeBuffer(rb->IndexBuffer, rb->IndexBufferMemory, rb->IndexBufferSize, index_size, VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+            CreateOrResizeBuffer(rb->IndexBuffer, rb->IndexBufferMemory, rb->IndexBufferOffset, rb->IndexBufferRange, rb->IndexBufferMap, rb->IndexBufferSize, index_size, VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
 
         // Upload vertex/index data into a single contiguous GPU buffer
-        ImDrawVert* vtx_dst = NULL;
-        ImDrawIdx* idx_dst = NULL;
-        VkResult err = vkMapMemory(v->Device, rb->VertexBufferMemory, 0, vertex_size, 0, (void**)(&vtx_dst));
-        check_vk_result(err);
-        err = vkMapMemory(v->Device, rb->IndexBufferMemory, 0, index_size, 0, (void**)(&idx_dst));
-        check_vk_result(err);
+        ImDrawVert* vtx_dst = (ImDrawVert*)rb->VertexBufferMap;
+        ImDrawIdx* idx_dst = (ImDrawIdx*)rb->IndexBufferMap;
+        VkResult err;
+        if (vtx_dst == NULL)
+        {
+            err = vkMapMemory(v->Device, rb->VertexBufferMemory, 0, vertex_size, 0, (void**)(&vtx_dst));
+            check_vk_result(err);
+        }
+        if (idx_dst == NULL)
+        {
+            err = vkMapMemory(v->Device, rb->IndexBufferMemory, 0, index_size, 0, (void**)(&idx_dst));
+            check_vk_result(err);
+        }
         for (int n = 0; n < draw_data->CmdListsCount; n++)
         {
             const ImDrawList* cmd_list = draw_data->CmdLists[n];
@@ -364,14 +462,18 @@ void ImGui_ImplVulkan_RenderDrawData(ImDrawData* draw_data, VkCommandBuffer comm
         VkMappedMemoryRange range[2] = {};
         range[0].sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
         range[0].memory = rb->VertexBufferMemory;
-        range[0].size = VK_WHOLE_SIZE;
+        range[0].offset = rb->VertexBufferOffset;
+        range[0].size = rb->VertexBufferRange;
         range[1].sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
         range[1].memory = rb->IndexBufferMemory;
-        range[1].size = VK_WHOLE_SIZE;
+        range[1].offset = rb->IndexBufferOffset;
+        range[1].size = rb->IndexBufferRange;
         err = vkFlushMappedMemoryRanges(v->Device, 2, range);
         check_vk_result(err);
-        vkUnmapMemory(v->Device, rb->VertexBufferMemory);
-        vkUnmapMemory(v->Device, rb->IndexBufferMemory);
+        if (rb->VertexBufferMap == NULL)
+            vkUnmapMemory(v->Device, rb->VertexBufferMemory);
+        if (rb->IndexBufferMap == NULL)
+            vkUnmapMemory(v->Device, rb->IndexBufferMemory);
     }
 
     // Setup desired Vulkan state
@@ -385,6 +487,7 @@ void ImGui_ImplVulkan_RenderDrawData(ImDrawData* draw_data, VkCommandBuffer comm
     // (Because we merged all buffers into a single one, we maintain our own offset into them)
     int global_vtx_offset = 0;
     int global_idx_offset = 0;
+    ImTextureID bound_texture = NULL;   // Runs of draws with one texture bind it once
     for (int n = 0; n < draw_data->CmdListsCount; n++)
     {
         const ImDrawList* cmd_list = draw_data->CmdLists[n];
@@ -399,6 +502,7 @@ void ImGui_ImplVulkan_RenderDrawData(ImDrawData* draw_data, VkCommandBuffer comm
                     ImGui_ImplVulkan_SetupRenderState(draw_data, pipeline, command_buffer, rb, fb_width, fb_height);
                 else
                     pcmd->UserCallback(cmd_list, pcmd);
+                bound_texture = NULL;
             }
             else
             {
@@ -425,9 +529,21 @@ void ImGui_ImplVulkan_RenderDrawData(ImDrawData* draw_data, VkCommandBuffer comm
                     scissor.extent.height = (uint32_t)(clip_rect.w - clip_rect.y);
                     vkCmdSetScissor(command_buffer, 0, 1, &scissor);
 
-                    // Bind descriptorset with font or user texture
-                    VkDescriptorSet desc_set[1] = { (VkDescriptorSet)pcmd->TextureId };
-                    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, g_PipelineLayout, 0, 1, desc_set, 0, NULL);
+                    // Bind descriptorset with font or user texture, or push its slot of the bindless array
+                    if (pcmd->TextureId != bound_texture)
+                    {
+                        if (g_BindlessSet != VK_NULL_HANDLE)
+                        {
+                            uint32_t slot = (uint32_t)((intptr_t)pcmd->TextureId - 1);
+                            vkCmdPushConstants(command_buffer, g_PipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(float) * 4, sizeof(uint32_t), &slot);
+                        }
+                        else
+                        {
+                            VkDescriptorSet desc_set[1] = { (VkDescriptorSet)pcmd->TextureId };
+                            vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, g_PipelineLayout, 0, 1, desc_set, 0, NULL);
+                        }
+                        bound_texture = pcmd->TextureId;
+                    }
 
                     // Draw
                     vkCmdDrawIndexed(command_buffer, pcmd->ElemCount, 1, pcmd->IdxOffset + global_idx_offset, pcmd->VtxOffset + global_vtx_offset, 0);
@@ -440,6 +556,11 @@ void ImGui_ImplVulkan_RenderDrawData(ImDrawData* draw_data, VkCommandBuffer comm
 }
 
 bool ImGui_ImplVulkan_CreateFontsTexture(VkCommandBuffer command_buffer)
+{
+    return ImGui_ImplVulkan_CreateFontsTextureStaged(command_buffer, VK_NULL_HANDLE, 0, NULL);
+}
+
+bool ImGui_ImplVulkan_CreateFontsTextureStaged(VkCommandBuffer command_buffer, VkBuffer upload_buffer, VkDeviceSize upload_offset, void* upload_map)
 {
     ImGui_ImplVulkan_InitInfo* v = &g_VulkanInitInfo;
     ImGuiIO& io = ImGui::GetIO();
@@ -495,9 +616,14 @@ bool ImGui_ImplVulkan_CreateFontsTexture(VkCommandBuffer command_buffer)
         check_vk_result(err);
     }
 
-    VkDescriptorSet font_descriptor_set = (VkDescriptorSet)ImGui_ImplVulkan_AddTexture(g_FontSampler, g_FontView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    ImTextureID font_texture = ImGui_ImplVulkan_AddTexture(g_FontSampler, g_FontView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 
-    // Create the Upload Buffer:
+    // Create the Upload Buffer, unless the caller staged the pixels:
+    if (upload_buffer != VK_NULL_HANDLE)
+    {
+        memcpy(upload_map, pixels, upload_size);
+    }
+    else
     {
         VkBufferCreateInfo buffer_info = {};
         buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -520,6 +646,7 @@ bool ImGui_ImplVulkan_CreateFontsTexture(VkCommandBuffer command_buffer)
     }
 
     // Upload to Buffer:
+    if (upload_buffer == VK_NULL_HANDLE)
     {
         char* map = NULL;
         err = vkMapMemory(v->Device, g_UploadBufferMemory, 0, upload_size, 0, (void**)(&map));
@@ -532,6 +659,8 @@ bool ImGui_ImplVulkan_CreateFontsTexture(VkCommandBuffer command_buffer)
         err = vkFlushMappedMemoryRanges(v->Device, 1, range);
         check_vk_result(err);
         vkUnmapMemory(v->Device, g_UploadBufferMemory);
+        upload_buffer = g_UploadBuffer;
+        upload_offset = 0;
     }
 
     // Copy to Image:
@@ -550,12 +679,13 @@ bool ImGui_ImplVulkan_CreateFontsTexture(VkCommandBuffer command_buffer)
         vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_HOST_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, copy_barrier);
 
         VkBufferImageCopy region = {};
+        region.bufferOffset = upload_offset;
         region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
         region.imageSubresource.layerCount = 1;
         region.imageExtent.width = width;
         region.imageExtent.height = height;
         region.imageExtent.depth = 1;
-        vkCmdCopyBufferToImage(command_buffer, g_UploadBuffer, g_FontImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+        vkCmdCopyBufferToImage(command_buffer, upload_buffer, g_FontImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
 
         VkImageMemoryBarrier use_barrier[1] = {};
         use_barrier[0].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -573,7 +703,7 @@ bool ImGui_ImplVulkan_CreateFontsTexture(VkCommandBuffer command_buffer)
     }
 
     // Store our identifier
-    io.Fonts->TexID = (ImTextureID)font_descriptor_set;
+    io.Fonts->TexID = font_texture;
 
     return true;
 }
@@ -594,8 +724,16 @@ static void ImGui_ImplVulkan_CreateShaderModules(VkDevice device, const VkAlloca
     {
         VkShaderModuleCreateInfo frag_info = {};
         frag_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-        frag_info.codeSize = sizeof(__glsl_shader_frag_spv);
-        frag_info.pCode = (uint32_t*)__glsl_shader_frag_spv;
+        if (g_VulkanInitInfo.UseBindlessTextures)
+        {
+            frag_info.codeSize = sizeof(__glsl_shader_frag_bindless_spv);
+            frag_info.pCode = (uint32_t*)__glsl_shader_frag_bindless_spv;
+        }
+        else
+        {
+            frag_info.codeSize = sizeof(__glsl_shader_frag_spv);
+            frag_info.pCode = (uint32_t*)__glsl_shader_frag_spv;
+        }
         VkResult err = vkCreateShaderModule(device, &frag_info, allocator, &g_ShaderModuleFrag);
         check_vk_result(err);
     }
@@ -637,6 +775,20 @@ static void ImGui_ImplVulkan_CreateDescriptorSetLayout(VkDevice device, const Vk
     info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
     info.bindingCount = 1;
     info.pBindings = binding;
+
+    // Bindless: the whole array, slots written while the set is bound and left empty until a texture takes them
+    VkDescriptorBindingFlags binding_flags[1] = { VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT };
+    VkDescriptorSetLayoutBindingFlagsCreateInfo flags_info = {};
+    if (g_VulkanInitInfo.UseBindlessTextures)
+    {
+        binding[0].descriptorCount = IMGUI_IMPL_VULKAN_BINDLESS_TEXTURES;
+        binding[0].pImmutableSamplers = NULL;
+        flags_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+        flags_info.bindingCount = 1;
+        flags_info.pBindingFlags = binding_flags;
+        info.pNext = &flags_info;
+        info.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+    }
     VkResult err = vkCreateDescriptorSetLayout(device, &info, allocator, &g_DescriptorSetLayout);
     check_vk_result(err);
 }
@@ -647,17 +799,21 @@ static void ImGui_ImplVulkan_CreatePipelineLayout(VkDevice device, const VkAlloc
         return;
 
     // Constants: we are using 'vec2 offset' and 'vec2 scale' instead of a full 3d projection matrix
+    // Bindless: followed by the texture slot for the fragment shader
     ImGui_ImplVulkan_CreateDescriptorSetLayout(device, allocator);
-    VkPushConstantRange push_constants[1] = {};
+    VkPushConstantRange push_constants[2] = {};
     push_constants[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
     push_constants[0].offset = sizeof(float) * 0;
     push_constants[0].size = sizeof(float) * 4;
+    push_constants[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    push_constants[1].offset = sizeof(float) * 4;
+    push_constants[1].size = sizeof(uint32_t);
     VkDescriptorSetLayout set_layout[1] = { g_DescriptorSetLayout };
     VkPipelineLayoutCreateInfo layout_info = {};
     layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
     layout_info.setLayoutCount = 1;
     layout_info.pSetLayouts = set_layout;
-    layout_info.pushConstantRangeCount = 1;
+    layout_info.pushConstantRangeCount = g_VulkanInitInfo.UseBindlessTextures ? 2 : 1;
     layout_info.pPushConstantRanges = push_constants;
     VkResult  err = vkCreatePipelineLayout(device, &layout_info, allocator, &g_PipelineLayout);
     check_vk_result(err);
@@ -767,10 +923,38 @@ static void ImGui_ImplVulkan_CreatePipeline(VkDevice device, const VkAllocationC
     check_vk_result(err);
 }
 
+static void ImGui_ImplVulkan_CreateBindlessSet(VkDevice device, const VkAllocationCallbacks* allocator)
+{
+    if (g_BindlessSet)
+        return;
+
+    VkDescriptorPoolSize pool_size = { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, IMGUI_IMPL_VULKAN_BINDLESS_TEXTURES };
+    VkDescriptorPoolCreateInfo pool_info = {};
+    pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    pool_info.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+    pool_info.maxSets = 1;
+    pool_info.poolSizeCount = 1;
+    pool_info.pPoolSizes = &pool_size;
+    VkResult err = vkCreateDescriptorPool(device, &pool_info, allocator, &g_BindlessPool);
+    check_vk_result(err);
+
+    VkDescriptorSetAllocateInfo alloc_info = {};
+    alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    alloc_info.descriptorPool = g_BindlessPool;
+    alloc_info.descriptorSetCount = 1;
+    alloc_info.pSetLayouts = &g_DescriptorSetLayout;
+    err = vkAllocateDescriptorSets(device, &alloc_info, &g_BindlessSet);
+    check_vk_result(err);
+    g_BindlessSlotsUsed = 0;
+    g_BindlessFreeSlots.clear();
+}
+
 bool ImGui_ImplVulkan_CreateDeviceObjects()
 {
     ImGui_ImplVulkan_InitInfo* v = &g_VulkanInitInfo;
     ImGui_ImplVulkan_CreatePipeline(v->Device, v->Allocator, v->PipelineCache, g_RenderPass, v->MSAASamples, &g_Pipeline);
+    if (v->UseBindlessTextures)
+        ImGui_ImplVulkan_CreateBindlessSet(v->Device, v->Allocator);
     return true;
 }
 
@@ -804,6 +988,7 @@ void    ImGui_ImplVulkan_DestroyDeviceObjects()
     if (g_DescriptorSetLayout)  { vkDestroyDescriptorSetLayout(v->Device, g_DescriptorSetLayout, v->Allocator); g_DescriptorSetLayout = VK_NULL_HANDLE; }
     if (g_PipelineLayout)       { vkDestroyPipelineLayout(v->Device, g_PipelineLayout, v->Allocator); g_PipelineLayout = VK_NULL_HANDLE; }
     if (g_Pipeline)             { vkDestroyPipeline(v->Device, g_Pipeline, v->Allocator); g_Pipeline = VK_NULL_HANDLE; }
+    if (g_BindlessPool)         { vkDestroyDescriptorPool(v->Device, g_BindlessPool, v->Allocator); g_BindlessPool = VK_NULL_HANDLE; g_BindlessSet = VK_NULL_HANDLE; }
 }
 
 bool    ImGui_ImplVulkan_Init(ImGui_ImplVulkan_InitInfo* info, VkRenderPass render_pass)
@@ -817,7 +1002,8 @@ bool    ImGui_ImplVulkan_Init(ImGui_ImplVulkan_InitInfo* info, VkRenderPass rend
     IM_ASSERT(info->PhysicalDevice != VK_NULL_HANDLE);
     IM_ASSERT(info->Device != VK_NULL_HANDLE);
     IM_ASSERT(info->Queue != VK_NULL_HANDLE);
-    IM_ASSERT(info->DescriptorPool != VK_NULL_HANDLE);
+    IM_ASSERT(info->DescriptorPool != VK_NULL_HANDLE || info->AllocateDescriptorSetFn != NULL || info->UseBindlessTextures);
+    IM_ASSERT((info->AllocateDescriptorSetFn == NULL) == (info->FreeDescriptorSetFn == NULL));
     IM_ASSERT(info->MinImageCount >= 2);
     IM_ASSERT(info->ImageCount >= info->MinImageCount);
     IM_ASSERT(render_pass != VK_NULL_HANDLE);
@@ -1214,9 +1400,11 @@ void ImGui_ImplVulkanH_DestroyFrameSemaphores(VkDevice device, ImGui_ImplVulkanH
 void ImGui_ImplVulkanH_DestroyFrameRenderBuffers(VkDevice device, ImGui_ImplVulkanH_FrameRenderBuffers* buffers, const VkAllocationCallbacks* allocator)
 {
     if (buffers->VertexBuffer) { vkDestroyBuffer(device, buffers->VertexBuffer, allocator); buffers->VertexBuffer = VK_NULL_HANDLE; }
-    if (buffers->VertexBufferMemory) { vkFreeMemory(device, buffers->VertexBufferMemory, allocator); buffers->VertexBufferMemory = VK_NULL_HANDLE; }
+    FreeBufferMemory(device, buffers->VertexBufferMemory, buffers->VertexBufferOffset, allocator);
     if (buffers->IndexBuffer) { vkDestroyBuffer(device, buffers->IndexBuffer, allocator); buffers->IndexBuffer = VK_NULL_HANDLE; }
-    if (buffers->IndexBufferMemory) { vkFreeMemory(device, buffers->IndexBufferMemory, allocator); buffers->IndexBufferMemory = VK_NULL_HANDLE; }
+    FreeBufferMemory(device, buffers->IndexBufferMemory, buffers->IndexBufferOffset, allocator);
+    buffers->VertexBufferMap = NULL;
+    buffers->IndexBufferMap = NULL;
     buffers->VertexBufferSize = 0;
     buffers->IndexBufferSize = 0;
 }
@@ -1236,7 +1424,32 @@ ImTextureID ImGui_ImplVulkan_AddTexture(VkSampler sampler, VkImageView image_vie
 
     ImGui_ImplVulkan_InitInfo* v = &g_VulkanInitInfo;
     VkDescriptorSet descriptor_set;
-    // Create Descriptor Set:
+    uint32_t slot = 0;
+    // Create Descriptor Set, or take a slot of the bindless one:
+    if (g_BindlessSet != VK_NULL_HANDLE)
+    {
+        if (!g_BindlessFreeSlots.empty())
+        {
+            slot = g_BindlessFreeSlots.back();
+            g_BindlessFreeSlots.pop_back();
+        }
+        else if (g_BindlessSlotsUsed < IMGUI_IMPL_VULKAN_BINDLESS_TEXTURES)
+        {
+            slot = g_BindlessSlotsUsed++;
+        }
+        else
+        {
+            return NULL;
+        }
+        descriptor_set = g_BindlessSet;
+    }
+    else if (v->AllocateDescriptorSetFn != NULL)
+    {
+        descriptor_set = v->AllocateDescriptorSetFn(g_DescriptorSetLayout, v->DescriptorUserData);
+        if (descriptor_set == VK_NULL_HANDLE)
+            return NULL;
+    }
+    else
     {
         VkDescriptorSetAllocateInfo alloc_info = {};
         alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
@@ -1256,11 +1469,33 @@ ImTextureID ImGui_ImplVulkan_AddTexture(VkSampler sampler, VkImageView image_vie
         VkWriteDescriptorSet write_desc[1] = {};
         write_desc[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
         write_desc[0].dstSet = descriptor_set;
+        write_desc[0].dstArrayElement = slot;
         write_desc[0].descriptorCount = 1;
         write_desc[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
         write_desc[0].pImageInfo = desc_image;
         vkUpdateDescriptorSets(v->Device, 1, write_desc, 0, NULL);
     }
 
+    if (g_BindlessSet != VK_NULL_HANDLE)
+        return (ImTextureID)(intptr_t)(slot + 1);
     return (ImTextureID)descriptor_set;
 }
+
+void ImGui_ImplVulkan_RemoveTexture(ImTextureID texture_id)
+{
+    ImGui_ImplVulkan_InitInfo* v = &g_VulkanInitInfo;
+    if (texture_id == NULL)
+        return;
+
+    // A bindless slot keeps its stale descriptor, nothing samples it until it is written again.
+    // After ImGui_ImplVulkan_Shutdown() the whole array is already gone.
+    if (v->UseBindlessTextures)
+    {
+        if (g_BindlessSet != VK_NULL_HANDLE)
+            g_BindlessFreeSlots.push_back((uint32_t)((intptr_t)texture_id - 1));
+    }
+    else if (v->FreeDescriptorSetFn != NULL)
+        v->FreeDescriptorSetFn((VkDescriptorSet)texture_id, v->DescriptorUserData);
+    else
+        vkFreeDescriptorSets(v->Device, v->DescriptorPool, 1, (VkDescriptorSet*)&texture_id);
+}
@@ -23,6 +23,9 @@
 #include "imgui.h"      // IMGUI_IMPL_API
 #include <vulkan/vulkan.h>
 
+// Textures one bindless descriptor set holds, the size of the texture array of the bindless fragment shader
+#define IMGUI_IMPL_VULKAN_BINDLESS_TEXTURES 4096
+
 // Initialization data, for ImGui_ImplVulkan_Init()
 // [Please zero-clear before use!]
 struct ImGui_ImplVulkan_InitInfo
@@ -39,6 +42,21 @@ struct ImGui_ImplVulkan_InitInfo
     VkSampleCountFlagBits        MSAASamples;   // >= VK_SAMPLE_COUNT_1_BIT
     const VkAllocationCallbacks* Allocator;
     void                (*CheckVkResultFn)(VkResult err);
+    // Optional: vertex/index buffer memory comes from the application instead of one vkAllocateMemory per buffer.
+    // It must stay mapped, *mapped pointing at *offset, and *size must be valid to flush at *offset.
+    bool                (*AllocateMemoryFn)(const VkMemoryRequirements* requirements, VkMemoryPropertyFlags properties, VkDeviceMemory* memory, VkDeviceSize* offset, VkDeviceSize* size, void** mapped, void* user_data);
+    void                (*FreeMemoryFn)(VkDeviceMemory memory, VkDeviceSize offset, void* user_data);
+    void*               MemoryUserData;
+    // Optional: texture descriptor sets come from the application instead of DescriptorPool, which may then be VK_NULL_HANDLE.
+    // Without them RemoveTexture() frees to DescriptorPool, which needs VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT.
+    VkDescriptorSet     (*AllocateDescriptorSetFn)(VkDescriptorSetLayout layout, void* user_data);
+    void                (*FreeDescriptorSetFn)(VkDescriptorSet descriptor_set, void* user_data);
+    void*               DescriptorUserData;
+    // Optional: every texture goes into one array of IMGUI_IMPL_VULKAN_BINDLESS_TEXTURES, bound once per draw data and indexed
+    // through a push constant, so switching textures costs no descriptor set bind. ImTextureID is then a slot, not a VkDescriptorSet.
+    // The device needs shaderSampledImageArrayDynamicIndexing, descriptorBindingPartiallyBound, descriptorBindingSampledImageUpdateAfterBind
+    // and descriptorBindingUpdateUnusedWhilePending, and that many update-after-bind samplers and sampled images per stage.
+    bool                UseBindlessTextures;
 };
 
 // Called by user code
@@ -47,9 +65,13 @@ IMGUI_IMPL_API void     ImGui_ImplVulkan_Shutdown();
 IMGUI_IMPL_API void     ImGui_ImplVulkan_NewFrame();
 IMGUI_IMPL_API void     ImGui_ImplVulkan_RenderDrawData(ImDrawData* draw_data, VkCommandBuffer command_buffer, VkPipeline pipeline = VK_NULL_HANDLE);
 IMGUI_IMPL_API bool     ImGui_ImplVulkan_CreateFontsTexture(VkCommandBuffer command_buffer);
+// Same, but the pixels go through staging memory of the caller: upload_map is mapped at upload_offset of upload_buffer, with room for the RGBA32 font atlas
+IMGUI_IMPL_API bool     ImGui_ImplVulkan_CreateFontsTextureStaged(VkCommandBuffer command_buffer, VkBuffer upload_buffer, VkDeviceSize upload_offset, void* upload_map);
 IMGUI_IMPL_API void     ImGui_ImplVulkan_DestroyFontUploadObjects();
 IMGUI_IMPL_API void     ImGui_ImplVulkan_SetMinImageCount(uint32_t min_image_count); // To override MinImageCount after initialization (e.g. if swap chain is recreated)
 IMGUI_IMPL_API ImTextureID    ImGui_ImplVulkan_AddTexture(VkSampler sampler, VkImageView image_view, VkImageLayout image_layout);
+// Gives back what AddTexture took, once no frame in flight samples the texture any more
+IMGUI_IMPL_API void     ImGui_ImplVulkan_RemoveTexture(ImTextureID texture_id);
 
 
 //-------------------------------------------------------------------------
@@ -2,16 +2,13 @@
 #include <vector>
 #include <set>
 #include <algorithm>
-#include <array>
 
-#define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
 #include "imgui_vulkan_helper.h"
 
 #define HELPER_NAME         "GLFW Vulkan Helper"
 #define HELPER_VERSION      VK_MAKE_VERSION(0, 1, 0)
-#define BAD_MEMORY_TYPE     0xFFFFFFFF
 
 #define CHECK_RET(exp)      if ((exp) == false) return false;
 
@@ -191,6 +188,39 @@ bool ImguiVulkanHelper::isDeviceSuitable(VkPhysicalDevice device)
     return indices.isComplete() && extensionsSupported && swapChainAdequate && supportedFeatures.samplerAnisotropy;
 }
 
+/* Every texture in one descriptor array indexed by a push constant needs
+ * Vulkan 1.2 descriptor indexing, and the array must fit the update after
+ * bind limits. Without it each texture keeps a descriptor set of its own.
+ */
+bool ImguiVulkanHelper::checkBindlessSupport(VkPhysicalDevice device)
+{
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(device, &properties);
+    if (instanceVersion < VK_API_VERSION_1_2 || properties.apiVersion < VK_API_VERSION_1_2)
+        return false;
+
+    VkPhysicalDeviceDescriptorIndexingFeatures indexing{};
+    indexing.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+    VkPhysicalDeviceFeatures2 features{};
+    features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features.pNext = &indexing;
+    vkGetPhysicalDeviceFeatures2(device, &features);
+    if (!features.features.shaderSampledImageArrayDynamicIndexing || !indexing.descriptorBindingPartiallyBound ||
+        !indexing.descriptorBindingSampledImageUpdateAfterBind || !indexing.descriptorBindingUpdateUnusedWhilePending)
+        return false;
+
+    VkPhysicalDeviceDescriptorIndexingProperties limits{};
+    limits.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES;
+    VkPhysicalDeviceProperties2 properties2{};
+    properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties2.pNext = &limits;
+    vkGetPhysicalDeviceProperties2(device, &properties2);
+    return limits.maxPerStageDescriptorUpdateAfterBindSamplers >= IMGUI_IMPL_VULKAN_BINDLESS_TEXTURES &&
+           limits.maxPerStageDescriptorUpdateAfterBindSampledImages >= IMGUI_IMPL_VULKAN_BINDLESS_TEXTURES &&
+           limits.maxDescriptorSetUpdateAfterBindSamplers >= IMGUI_IMPL_VULKAN_BINDLESS_TEXTURES &&
+           limits.maxDescriptorSetUpdateAfterBindSampledImages >= IMGUI_IMPL_VULKAN_BINDLESS_TEXTURES;
+}
+
 bool ImguiVulkanHelper::createInstance(const char *app_name, uint32_t app_version)
 {
     VkResult ret = VK_SUCCESS;
@@ -212,7 +242,11 @@ bool ImguiVulkanHelper::createInstance(const char *app_name, uint32_t app_versio
     appInfo.applicationVersion = app_version;
     appInfo.pEngineName = HELPER_NAME;
     appInfo.engineVersion = HELPER_VERSION;
-    appInfo.apiVersion = VK_API_VERSION_1_0;
+    // 1.2 when the loader has it, for descriptor indexing; a 1.0 loader rejects anything above 1.0
+    auto enumerateVersion = (PFN_vkEnumerateInstanceVersion)vkGetInstanceProcAddr(nullptr, "vkEnumerateInstanceVersion");
+    if (enumerateVersion != nullptr && enumerateVersion(&instanceVersion) != VK_SUCCESS)
+        instanceVersion = VK_API_VERSION_1_0;
+    appInfo.apiVersion = instanceVersion >= VK_API_VERSION_1_2 ? VK_API_VERSION_1_2 : VK_API_VERSION_1_0;
 
     VkInstanceCreateInfo createInfo{};
     createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -312,8 +346,18 @@ bool ImguiVulkanHelper::createDevice(void)
 
     VkPhysicalDeviceFeatures deviceFeatures{};
     deviceFeatures.samplerAnisotropy = VK_TRUE;
+    VkPhysicalDeviceDescriptorIndexingFeatures indexingFeatures{};
+    indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
     VkDeviceCreateInfo deviceCreateInfo{};
     deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    bindlessTextures = checkBindlessSupport(physicalDevice);
+    if (bindlessTextures) {
+        deviceFeatures.shaderSampledImageArrayDynamicIndexing = VK_TRUE;
+        indexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+        indexingFeatures.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+        indexingFeatures.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+        deviceCreateInfo.pNext = &indexingFeatures;
+    }
     deviceCreateInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
     deviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data();
     deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
@@ -577,27 +621,9 @@ bool ImguiVulkanHelper::createCommandPool(void)
 
 bool ImguiVulkanHelper::createDescriptorPool(void)
 {
-    VkResult ret = VK_SUCCESS;
-
-    // TODO, we need more descriptors here
-    std::array<VkDescriptorPoolSize, 2> poolSizes{};
-    poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    poolSizes[0].descriptorCount = static_cast<uint32_t>(imageCount);
-    poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    poolSizes[1].descriptorCount = static_cast<uint32_t>(imageCount);
-
-    VkDescriptorPoolCreateInfo poolInfo{};
-    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
-    poolInfo.pPoolSizes = poolSizes.data();
-    poolInfo.maxSets = static_cast<uint32_t>(imageCount);
-
-    ret = vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool);
-    if (ret != VK_SUCCESS) {
-        fprintf(stderr, "Creating descriptor pool failed: %d\n", ret);
-        return false;
-    }
-    return true;
+    // Every texture takes one set of a single sampler, given back when it is released
+    std::vector<VkDescriptorPoolSize> perSet = { { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1 } };
+    return descriptors.init(device, perSet);
 }
 
 bool ImguiVulkanHelper::createCommandBuffers(void)
@@ -654,15 +680,104 @@ bool ImguiVulkanHelper::createSyncObjects(void)
     return true;
 }
 
+bool ImguiVulkanHelper::createStagingRing(void)
+{
+    // Coherent, so what the CPU wrote is visible to the copies without a flush
+    if (!createBuffer(STAGING_RING_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                      stagingRing, stagingRingMemory))
+        return false;
+    // The allocator keeps host visible memory mapped
+    stagingRingMap = stagingRingMemory.data;
+    stagingSpans.clear();
+    stagingFirstSpan = 1;
+    return true;
+}
+
+void ImguiVulkanHelper::destroyStagingRing(void)
+{
+    if (stagingRing == VK_NULL_HANDLE)
+        return;
+    vkDestroyBuffer(device, stagingRing, nullptr);
+    allocator.free(stagingRingMemory);
+    stagingRing = VK_NULL_HANDLE;
+    stagingRingMap = nullptr;
+    stagingSpans.clear();
+}
+
+/* Takes size bytes at the head of the ring, wrapping to the start when the
+ * end is too short. Without wait, false means the ring is busy until
+ * uploads in flight finish; with wait, those are waited for. Only an upload
+ * larger than the whole ring gets a buffer of its own.
+ */
+bool ImguiVulkanHelper::allocStaging(VkDeviceSize size, bool wait, StagingAllocation &staging)
+{
+    staging = StagingAllocation{};
+    size = std::max<VkDeviceSize>(STAGING_ALIGN, (size + STAGING_ALIGN - 1) & ~(VkDeviceSize)(STAGING_ALIGN - 1));
+    if (size > STAGING_RING_SIZE) {
+        if (!createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                          staging.buffer, staging.ownMemory))
+            return false;
+        staging.data = staging.ownMemory.data;
+        return true;
+    }
+
+    for (;;) {
+        // Live spans run from the tail to the head, maybe around the end; head == tail is a full ring
+        VkDeviceSize head = stagingSpans.empty() ? 0 : stagingSpans.back().end;
+        VkDeviceSize tail = stagingSpans.empty() ? STAGING_RING_SIZE : stagingSpans.front().begin;
+        VkDeviceSize offset = STAGING_RING_SIZE;
+        if (head < tail) {
+            if (head + size <= tail)
+                offset = head;
+        } else if (head > tail) {
+            if (head + size <= STAGING_RING_SIZE)
+                offset = head;
+            else if (size <= tail)
+                offset = 0;
+        }
+        if (offset != STAGING_RING_SIZE) {
+            stagingSpans.push_back(StagingSpan{ head, offset + size, false });
+            staging.buffer = stagingRing;
+            staging.offset = offset;
+            staging.data = stagingRingMap + offset;
+            staging.span = stagingFirstSpan + stagingSpans.size() - 1;
+            return true;
+        }
+        if (!wait || uploadBatches.empty())
+            return false;
+        finishTextureUploads(true);
+    }
+}
+
+void ImguiVulkanHelper::freeStaging(StagingAllocation &staging)
+{
+    if (staging.ownMemory.memory != VK_NULL_HANDLE) {
+        vkDestroyBuffer(device, staging.buffer, nullptr);
+        allocator.free(staging.ownMemory);
+    } else if (staging.span != 0) {
+        // Space is reclaimed in the order it was taken, a span freed early waits for the older ones
+        stagingSpans[staging.span - stagingFirstSpan].released = true;
+        while (!stagingSpans.empty() && stagingSpans.front().released) {
+            stagingSpans.pop_front();
+            stagingFirstSpan++;
+        }
+    }
+    staging = StagingAllocation{};
+}
+
 bool ImguiVulkanHelper::initVulkan(const char *app_name, uint32_t app_version)
 {
     CHECK_RET(createInstance(app_name, app_version));
     CHECK_RET(createDevice());
+    allocator.init(physicalDevice, device);
     CHECK_RET(createSwapChain());
     CHECK_RET(createImageViews());
     CHECK_RET(createRenderPass());
     CHECK_RET(createFramebuffers());
     CHECK_RET(createCommandPool());
+    CHECK_RET(createStagingRing());
     CHECK_RET(createDescriptorPool());
     CHECK_RET(createCommandBuffers());
     CHECK_RET(createSyncObjects());
@@ -688,22 +803,28 @@ void ImguiVulkanHelper::cleanup(void)
 
     cleanupSwapChain();
 
-    for (size_t i = 0; i < userTextureImages.size(); i++) {
-        vkDestroySampler(device, userTextureImages[i].sampler, nullptr);
-        vkDestroyImageView(device, userTextureImages[i].imageView, nullptr);
-        vkDestroyImage(device, userTextureImages[i].image, nullptr);
-        vkFreeMemory(device, userTextureImages[i].imageMemory, nullptr);
-    }
+    stopTextureUploads();
+    destroyStagingRing();
+    for (size_t i = 0; i < userTextureImages.size(); i++)
+        destroyUserTexture(userTextureImages[i]);
     userTextureImages.clear();
+    collectRetiredTextures(true);
 
     vkDestroyRenderPass(device, renderPass, nullptr);
-    vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+    descriptors.destroy();
     for (size_t i = 0; i < imageCount; i++) {
         vkDestroySemaphore(device, renderFinishedSemaphores[i], nullptr);
         vkDestroySemaphore(device, imageAvailableSemaphores[i], nullptr);
         vkDestroyFence(device, swapChainImageFences[i], nullptr);
     }
     vkDestroyCommandPool(device, commandPool, nullptr);
+#ifdef DEBUG
+    DeviceMemoryStats stats;
+    allocator.getStats(&stats);
+    if (stats.allocations + stats.dedicated > 0)
+        fprintf(stderr, "Device memory leaked: %u allocations, %u dedicated\n", stats.allocations, stats.dedicated);
+#endif
+    allocator.destroy();
     vkDestroyDevice(device, nullptr);
     vkDestroySurfaceKHR(instance, surface, nullptr);
     if (validationLayersRequired.size() > 0) {
@@ -738,6 +859,35 @@ static void check_vk_result(VkResult err)
         abort();
 }
 
+// The imgui backend's vertex and index buffers are carved out of the same blocks as everything else
+static bool allocateImguiMemory(const VkMemoryRequirements *requirements, VkMemoryPropertyFlags properties,
+        VkDeviceMemory *memory, VkDeviceSize *offset, VkDeviceSize *size, void **mapped, void *user_data)
+{
+    DeviceAllocation allocation;
+    if (!reinterpret_cast<DeviceAllocator *>(user_data)->allocate(*requirements, properties, allocation))
+        return false;
+    *memory = allocation.memory;
+    *offset = allocation.offset;
+    *size = allocation.size;
+    *mapped = allocation.data;
+    return true;
+}
+
+static void freeImguiMemory(VkDeviceMemory memory, VkDeviceSize offset, void *user_data)
+{
+    reinterpret_cast<DeviceAllocator *>(user_data)->free(memory, offset);
+}
+
+static VkDescriptorSet allocateImguiDescriptorSet(VkDescriptorSetLayout layout, void *user_data)
+{
+    return reinterpret_cast<DescriptorAllocator *>(user_data)->allocate(layout);
+}
+
+static void freeImguiDescriptorSet(VkDescriptorSet set, void *user_data)
+{
+    reinterpret_cast<DescriptorAllocator *>(user_data)->free(set);
+}
+
 void ImguiVulkanHelper::fillImguiVulkanInitInfo(ImGui_ImplVulkan_InitInfo *info)
 {
     if (info == nullptr)
@@ -752,11 +902,18 @@ void ImguiVulkanHelper::fillImguiVulkanInitInfo(ImGui_ImplVulkan_InitInfo *info)
     info->Queue = graphicsQueue;
 
     info->PipelineCache = VK_NULL_HANDLE;
-    info->DescriptorPool = descriptorPool;
+    info->DescriptorPool = VK_NULL_HANDLE;
     info->Allocator = nullptr;
     info->MinImageCount = imageCount;
     info->ImageCount = imageCount;
     info->CheckVkResultFn = check_vk_result;
+    info->AllocateMemoryFn = allocateImguiMemory;
+    info->FreeMemoryFn = freeImguiMemory;
+    info->MemoryUserData = &allocator;
+    info->AllocateDescriptorSetFn = allocateImguiDescriptorSet;
+    info->FreeDescriptorSetFn = freeImguiDescriptorSet;
+    info->DescriptorUserData = &descriptors;
+    info->UseBindlessTextures = bindlessTextures;
 }
 
 VkRenderPass ImguiVulkanHelper::getRenderPass(void)
@@ -766,32 +923,29 @@ VkRenderPass ImguiVulkanHelper::getRenderPass(void)
 
 bool ImguiVulkanHelper::initializeFontTexture(void)
 {
-    VkResult ret = VK_SUCCESS;
-
-    ret = vkResetCommandPool(device, commandPool, 0);
-    if (ret != VK_SUCCESS) {
-        fprintf(stderr, "Reset command pool failed: %d\n", ret);
+    unsigned char *pixels;
+    int width, height;
+    bool ok = false;
+
+    // The atlas is built here, the backend only reads it back from the cache
+    ImGui::GetIO().Fonts->GetTexDataAsRGBA32(&pixels, &width, &height);
+    StagingAllocation staging;
+    if (!allocStaging((VkDeviceSize)width * height * 4, true, staging))
         return false;
-    }
 
     VkCommandBuffer cmd = beginSingleTimeCommands();
-    if (cmd == nullptr)
-        goto fail;
-    if (!ImGui_ImplVulkan_CreateFontsTexture(cmd)) {
+    if (cmd == VK_NULL_HANDLE)
+        goto out;
+    if (!ImGui_ImplVulkan_CreateFontsTextureStaged(cmd, staging.buffer, staging.offset, staging.data)) {
         fprintf(stderr, "ImGui_ImplVulkan_CreateFontsTexture failed.\n");
-        goto fail;
-    }
-    if (!endSingleTimeCommands(cmd)) {
-        ImGui_ImplVulkan_DestroyFontUploadObjects();
-        return false;
+        vkFreeCommandBuffers(device, commandPool, 1, &cmd);
+        goto out;
     }
+    ok = endSingleTimeCommands(cmd);
 
-    ImGui_ImplVulkan_DestroyFontUploadObjects();
-    return true;
-
-fail:
-    vkFreeCommandBuffers(device, commandPool, 1, &cmd);
-    return false;
+out:
+    freeStaging(staging);
+    return ok;
 }
 
 VkDevice ImguiVulkanHelper::getDevice(void)
@@ -826,21 +980,8 @@ void ImguiVulkanHelper::recreateSwapChain(void)
     createCommandBuffers();
 }
 
-uint32_t ImguiVulkanHelper::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties)
-{
-    VkPhysicalDeviceMemoryProperties memProperties;
-    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
-
-    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++)
-        if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties)
-            return i;
-
-    fprintf(stderr, "failed to find suitable memory type!\n");
-    return BAD_MEMORY_TYPE;
-}
-
 bool ImguiVulkanHelper::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
-            VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory)
+            VkMemoryPropertyFlags properties, VkBuffer& buffer, DeviceAllocation& bufferMemory)
 {
     VkResult ret = VK_SUCCESS;
 
@@ -857,26 +998,19 @@ bool ImguiVulkanHelper::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage
 
     VkMemoryRequirements memRequirements;
     vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
-    if (allocInfo.memoryTypeIndex == BAD_MEMORY_TYPE)
-        return false;
-    ret = vkAllocateMemory(device, &allocInfo, nullptr, &bufferMemory);
-    if (ret != VK_SUCCESS) {
+    if (!allocator.allocate(memRequirements, properties, bufferMemory)) {
         vkDestroyBuffer(device, buffer, nullptr);
-        fprintf(stderr, "Allocate buffer memory failed: %d\n", ret);
+        fprintf(stderr, "Allocate buffer memory failed.\n");
         return false;
     }
 
-    vkBindBufferMemory(device, buffer, bufferMemory, 0);
+    vkBindBufferMemory(device, buffer, bufferMemory.memory, bufferMemory.offset);
     return true;
 }
 
 bool ImguiVulkanHelper::createImage(uint32_t width, uint32_t height,
             VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage,
-            VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory)
+            VkMemoryPropertyFlags properties, VkImage& image, DeviceAllocation& imageMemory)
 {
     VkResult ret = VK_SUCCESS;
 
@@ -902,20 +1036,13 @@ bool ImguiVulkanHelper::createImage(uint32_t width, uint32_t height,
 
     VkMemoryRequirements memRequirements;
     vkGetImageMemoryRequirements(device, image, &memRequirements);
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
-    if (allocInfo.memoryTypeIndex == BAD_MEMORY_TYPE)
-        return false;
-    ret = vkAllocateMemory(device, &allocInfo, nullptr, &imageMemory);
-    if (ret != VK_SUCCESS) {
+    if (!allocator.allocate(memRequirements, properties, imageMemory)) {
         vkDestroyImage(device, image, nullptr);
-        fprintf(stderr, "Failed to allocate image memory: %d\n", ret);
+        fprintf(stderr, "Failed to allocate image memory.\n");
         return false;
     }
 
-    vkBindImageMemory(device, image, imageMemory, 0);
+    vkBindImageMemory(device, image, imageMemory.memory, imageMemory.offset);
     return true;
 }
 
@@ -953,6 +1080,8 @@ bool ImguiVulkanHelper::endSingleTimeCommands(VkCommandBuffer commandBuffer)
     VkResult ret = VK_SUCCESS;
     bool result = false;
     VkSubmitInfo submitInfo{};
+    VkFenceCreateInfo fenceInfo{};
+    VkFence fence = VK_NULL_HANDLE;
 
     ret = vkEndCommandBuffer(commandBuffer);
     if (ret != VK_SUCCESS) {
@@ -960,39 +1089,102 @@ bool ImguiVulkanHelper::endSingleTimeCommands(VkCommandBuffer commandBuffer)
         goto out;
     }
 
+    // Waits for these commands only, not for the frames in flight on the same queue
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    ret = vkCreateFence(device, &fenceInfo, nullptr, &fence);
+    if (ret != VK_SUCCESS) {
+        fprintf(stderr, "Creating fence failed: %d\n", ret);
+        goto out;
+    }
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
     submitInfo.commandBufferCount = 1;
     submitInfo.pCommandBuffers = &commandBuffer;
-    ret = vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
+    ret = vkQueueSubmit(graphicsQueue, 1, &submitInfo, fence);
     if (ret != VK_SUCCESS) {
         fprintf(stderr, "Submit command buffer to graphics queue failed: %d\n", ret);
         goto out;
     }
-    ret = vkQueueWaitIdle(graphicsQueue);
+    ret = vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
     if (ret != VK_SUCCESS) {
-        fprintf(stderr, "Wait graphics queue idle failed: %d\n", ret);
+        fprintf(stderr, "Wait for the single time commands failed: %d\n", ret);
         goto out;
     }
     result = true;
 
 out:
+    if (fence != VK_NULL_HANDLE)
+        vkDestroyFence(device, fence, nullptr);
     vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
     return result;
 }
 
-bool ImguiVulkanHelper::transitionImageLayout(VkImage image, VkFormat format,
-            VkImageLayout oldLayout, VkImageLayout newLayout)
+// Image, memory, view and sampler of a texture, everything but its descriptor set
+bool ImguiVulkanHelper::createTextureImage(uint32_t width, uint32_t height, UserTextureImage &texture)
 {
-    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-    if (commandBuffer == nullptr) {
-        vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+    VkResult ret = VK_SUCCESS;
+    VkSamplerCreateInfo samplerInfo{};
+
+    texture = UserTextureImage{};
+    if (!createImage(width, height, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL,
+                     VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, texture.image, texture.imageMemory))
+        return false;
+
+    texture.imageView = createImageView(texture.image, VK_FORMAT_R8G8B8A8_SRGB);
+    if (texture.imageView == VK_NULL_HANDLE)
+        goto fail;
+
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = VK_FILTER_LINEAR;
+    samplerInfo.minFilter = VK_FILTER_LINEAR;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.anisotropyEnable = VK_TRUE;
+    samplerInfo.maxAnisotropy = 16.0f;
+    samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+    samplerInfo.unnormalizedCoordinates = VK_FALSE;
+    samplerInfo.compareEnable = VK_FALSE;
+    samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    ret = vkCreateSampler(device, &samplerInfo, nullptr, &texture.sampler);
+    if (ret != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create texture sampler: %d\n", ret);
+        goto fail;
+    }
+    return true;
+
+fail:
+    if (texture.imageView != VK_NULL_HANDLE)
+        vkDestroyImageView(device, texture.imageView, nullptr);
+    vkDestroyImage(device, texture.image, nullptr);
+    allocator.free(texture.imageMemory);
+    texture = UserTextureImage{};
+    return false;
+}
+
+bool ImguiVulkanHelper::addTextureDescriptor(UserTextureImage &texture)
+{
+    ImTextureID id = ImGui_ImplVulkan_AddTexture(texture.sampler, texture.imageView,
+                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    if (id == NULL) {
+        fprintf(stderr, "Failed to add user texture to ImplVulkan.\n");
         return false;
     }
+    texture.textureId = id;
+    texture.retiredFrame = 0;
+    userTextureImages.push_back(texture);
+    return true;
+}
 
+// Undefined -> transfer dst, the copy, then shader read, all in the caller's command buffer
+void ImguiVulkanHelper::recordTextureUpload(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset,
+            VkImage image, uint32_t width, uint32_t height)
+{
     VkImageMemoryBarrier barrier{};
     barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-    barrier.oldLayout = oldLayout;
-    barrier.newLayout = newLayout;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
     barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
     barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
     barrier.image = image;
@@ -1001,48 +1193,13 @@ bool ImguiVulkanHelper::transitionImageLayout(VkImage image, VkFormat format,
     barrier.subresourceRange.levelCount = 1;
     barrier.subresourceRange.baseArrayLayer = 0;
     barrier.subresourceRange.layerCount = 1;
-
-    VkPipelineStageFlags sourceStage;
-    VkPipelineStageFlags destinationStage;
-    if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
-        barrier.srcAccessMask = 0;
-        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-        sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-        destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-    } else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL &&
-               newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
-        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-        sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-        destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-    }else {
-        fprintf(stderr, "Unsupported layout transition!\n");
-        vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
-        return false;
-    }
-
-    vkCmdPipelineBarrier(
-        commandBuffer,
-        sourceStage, destinationStage,
-        0,
-        0, nullptr,
-        0, nullptr,
-        1, &barrier
-    );
-
-    return endSingleTimeCommands(commandBuffer);
-}
-
-bool ImguiVulkanHelper::copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height)
-{
-    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-    if (commandBuffer == nullptr) {
-        vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
-        return false;
-    }
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0, 0, nullptr, 0, nullptr, 1, &barrier);
 
     VkBufferImageCopy region{};
-    region.bufferOffset = 0;
+    region.bufferOffset = offset;
     region.bufferRowLength = 0;
     region.bufferImageHeight = 0;
     region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -1053,109 +1210,344 @@ bool ImguiVulkanHelper::copyBufferToImage(VkBuffer buffer, VkImage image, uint32
     region.imageExtent = {width, height, 1};
     vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
 
-    return endSingleTimeCommands(commandBuffer);
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                         0, 0, nullptr, 0, nullptr, 1, &barrier);
 }
 
 ImTextureID ImguiVulkanHelper::loadImage(const char *image, int *width, int *height)
 {
-    ImTextureID result = NULL;
-    VkResult ret = VK_SUCCESS;
-    VkSamplerCreateInfo samplerInfo{};
-
     int texWidth, texHeight, texChannels;
     stbi_uc* pixels = stbi_load(image, &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-    VkDeviceSize imageSize = texWidth * texHeight * 4;
     if (!pixels) {
         fprintf(stderr, "Failed to load image: %s\n", image);
         return NULL;
     }
 
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    if (!createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                      stagingBuffer, stagingBufferMemory))
-        return NULL;
-
-    void* data;
-    vkMapMemory(device, stagingBufferMemory, 0, imageSize, 0, &data);
-    memcpy(data, pixels, static_cast<size_t>(imageSize));
-    vkUnmapMemory(device, stagingBufferMemory);
+    ImTextureID result = createTexture(pixels, texWidth, texHeight);
     stbi_image_free(pixels);
+    if (result != NULL) {
+        if (width)
+            *width = texWidth;
+        if (height)
+            *height = texHeight;
+    }
+    return result;
+}
 
-    VkImage textureImage;
-    VkDeviceMemory textureImageMemory;
-    VkImageView textureImageView;
-    if (!createImage(texWidth, texHeight, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL,
-                     VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageMemory))
-        goto out;
+ImTextureID ImguiVulkanHelper::createTexture(const unsigned char *pixels, int texWidth, int texHeight)
+{
+    VkDeviceSize imageSize = (VkDeviceSize)texWidth * texHeight * 4;
+    UserTextureImage texture;
+    VkCommandBuffer commandBuffer;
+    bool ok = false;
 
-    if (!transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_SRGB,
-            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL))
+    StagingAllocation staging;
+    if (!allocStaging(imageSize, true, staging))
+        return NULL;
+    memcpy(staging.data, pixels, static_cast<size_t>(imageSize));
+
+    if (!createTextureImage(texWidth, texHeight, texture))
         goto out;
-    if (!copyBufferToImage(stagingBuffer, textureImage,
-            static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight)))
+    // Both transitions and the copy go in one submission, waited for once
+    commandBuffer = beginSingleTimeCommands();
+    if (commandBuffer == VK_NULL_HANDLE)
         goto out;
-    if (!transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_SRGB,
-            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL))
+    recordTextureUpload(commandBuffer, staging.buffer, staging.offset, texture.image,
+            static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
+    if (!endSingleTimeCommands(commandBuffer))
         goto out;
+    ok = addTextureDescriptor(texture);
 
-    textureImageView = createImageView(textureImage, VK_FORMAT_R8G8B8A8_SRGB);
-    if (textureImageView == VK_NULL_HANDLE)
-        goto out;
+out:
+    freeStaging(staging);
+    if (!ok && texture.image != VK_NULL_HANDLE)
+        destroyUserTexture(texture);
+    return ok ? texture.textureId : NULL;
+}
 
-    VkSampler textureSampler;
-    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
-    samplerInfo.magFilter = VK_FILTER_LINEAR;
-    samplerInfo.minFilter = VK_FILTER_LINEAR;
-    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-    samplerInfo.anisotropyEnable = VK_TRUE;
-    samplerInfo.maxAnisotropy = 16.0f;
-    samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
-    samplerInfo.unnormalizedCoordinates = VK_FALSE;
-    samplerInfo.compareEnable = VK_FALSE;
-    samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
-    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
-    ret = vkCreateSampler(device, &samplerInfo, nullptr, &textureSampler);
+TextureRequest ImguiVulkanHelper::loadImageAsync(const char *image)
+{
+    TextureRequest request = nextTextureRequest++;
+    asyncTextures[request] = AsyncTexture{ TEXTURE_PENDING, NULL, 0, 0 };
+    {
+        std::lock_guard<std::mutex> lock(decodeMutex);
+        if (!decodeThread.joinable()) {
+            decodeStop = false;
+            decodeThread = std::thread(&ImguiVulkanHelper::decodeWorker, this);
+        }
+        decodeQueue.emplace_back(request, image);
+    }
+    decodeCond.notify_one();
+    return request;
+}
+
+TextureRequest ImguiVulkanHelper::createTextureAsync(std::vector<uint8_t> &&pixels, int width, int height)
+{
+    TextureRequest request = nextTextureRequest++;
+    asyncTextures[request] = AsyncTexture{ TEXTURE_PENDING, NULL, 0, 0 };
+    std::lock_guard<std::mutex> lock(decodeMutex);
+    decodedTextures.push_back(DecodedTexture{ request, std::move(pixels), width, height });
+    return request;
+}
+
+TextureStatus ImguiVulkanHelper::pollTexture(TextureRequest request, ImTextureID *texture, int *width, int *height)
+{
+    auto it = asyncTextures.find(request);
+    if (it == asyncTextures.end())
+        return TEXTURE_UNKNOWN;
+    TextureStatus status = it->second.status;
+    if (status == TEXTURE_READY) {
+        if (texture)
+            *texture = it->second.texture;
+        if (width)
+            *width = it->second.width;
+        if (height)
+            *height = it->second.height;
+    }
+    if (status != TEXTURE_PENDING)
+        asyncTextures.erase(it);
+    return status;
+}
+
+void ImguiVulkanHelper::cancelTexture(TextureRequest request)
+{
+    auto it = asyncTextures.find(request);
+    if (it == asyncTextures.end())
+        return;
+    if (it->second.status == TEXTURE_READY)
+        releaseImage(it->second.texture);
+    // A pending one finds no entry when its batch completes and is destroyed there
+    asyncTextures.erase(it);
+}
+
+void ImguiVulkanHelper::decodeWorker(void)
+{
+    std::unique_lock<std::mutex> lock(decodeMutex);
+    for (;;) {
+        decodeCond.wait(lock, [this] { return decodeStop || !decodeQueue.empty(); });
+        if (decodeStop)
+            return;
+        std::pair<TextureRequest, std::string> job = std::move(decodeQueue.front());
+        decodeQueue.pop_front();
+        lock.unlock();
+
+        DecodedTexture decoded = { job.first, {}, 0, 0 };
+        int channels;
+        stbi_uc *pixels = stbi_load(job.second.c_str(), &decoded.width, &decoded.height, &channels, STBI_rgb_alpha);
+        if (pixels != nullptr) {
+            decoded.pixels.assign(pixels, pixels + (size_t)decoded.width * decoded.height * 4);
+            stbi_image_free(pixels);
+        } else {
+            fprintf(stderr, "Failed to load image: %s\n", job.second.c_str());
+        }
+
+        lock.lock();
+        decodedTextures.push_back(std::move(decoded));
+    }
+}
+
+/* Everything decoded since the last frame, up to the batch limits, goes to
+ * the GPU in one command buffer out of one span of the staging ring.
+ * Nothing waits: when the ring is busy the textures stay queued for the
+ * next frame, and the fence of a batch is looked at again in the next
+ * frames. Only then do the textures get their descriptor sets and become
+ * READY, so no frame can sample an image before its copy is done.
+ */
+void ImguiVulkanHelper::submitTextureUploads(void)
+{
+    VkResult ret = VK_SUCCESS;
+    VkDeviceSize total = 0;
+
+    uploadScratch.clear();
+    {
+        std::lock_guard<std::mutex> lock(decodeMutex);
+        while (!decodedTextures.empty() && uploadScratch.size() < TEXTURE_UPLOAD_BATCH_MAX) {
+            DecodedTexture &next = decodedTextures.front();
+            // Failed decodes and cancelled requests go no further
+            auto it = asyncTextures.find(next.request);
+            if (it == asyncTextures.end() || next.pixels.empty()) {
+                if (it != asyncTextures.end())
+                    it->second.status = TEXTURE_FAILED;
+                decodedTextures.pop_front();
+                continue;
+            }
+            VkDeviceSize len = (next.pixels.size() + STAGING_ALIGN - 1) & ~(VkDeviceSize)(STAGING_ALIGN - 1);
+            if (!uploadScratch.empty() && total + len > TEXTURE_UPLOAD_BATCH_BYTES)
+                break;
+            total += len;
+            uploadScratch.push_back(std::move(next));
+            decodedTextures.pop_front();
+        }
+    }
+    if (uploadScratch.empty())
+        return;
+
+    TextureUploadBatch batch{};
+    VkFenceCreateInfo fenceInfo{};
+    VkSubmitInfo submitInfo{};
+    VkDeviceSize offset = 0;
+    if (!allocStaging(total, false, batch.staging)) {
+        // The ring is still busy with earlier batches, try again next frame
+        std::lock_guard<std::mutex> lock(decodeMutex);
+        for (auto it = uploadScratch.rbegin(); it != uploadScratch.rend(); ++it)
+            decodedTextures.push_front(std::move(*it));
+        uploadScratch.clear();
+        return;
+    }
+    batch.commandBuffer = beginSingleTimeCommands();
+    if (batch.commandBuffer == VK_NULL_HANDLE)
+        goto fail;
+
+    for (DecodedTexture &decoded : uploadScratch) {
+        UserTextureImage texture;
+        if (!createTextureImage(decoded.width, decoded.height, texture)) {
+            asyncTextures[decoded.request].status = TEXTURE_FAILED;
+            continue;
+        }
+        memcpy(batch.staging.data + offset, decoded.pixels.data(), decoded.pixels.size());
+        recordTextureUpload(batch.commandBuffer, batch.staging.buffer, batch.staging.offset + offset, texture.image,
+                static_cast<uint32_t>(decoded.width), static_cast<uint32_t>(decoded.height));
+        offset += (decoded.pixels.size() + STAGING_ALIGN - 1) & ~(VkDeviceSize)(STAGING_ALIGN - 1);
+        AsyncTexture &async = asyncTextures[decoded.request];
+        async.width = decoded.width;
+        async.height = decoded.height;
+        batch.textures.emplace_back(decoded.request, texture);
+    }
+
+    ret = vkEndCommandBuffer(batch.commandBuffer);
     if (ret != VK_SUCCESS) {
-        fprintf(stderr, "Failed to create texture sampler: %d\n", ret);
-        goto out;
+        fprintf(stderr, "End command buffer failed: %d\n", ret);
+        goto fail;
+    }
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    ret = vkCreateFence(device, &fenceInfo, nullptr, &batch.fence);
+    if (ret != VK_SUCCESS) {
+        fprintf(stderr, "Creating fence failed: %d\n", ret);
+        goto fail;
+    }
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &batch.commandBuffer;
+    ret = vkQueueSubmit(graphicsQueue, 1, &submitInfo, batch.fence);
+    if (ret != VK_SUCCESS) {
+        fprintf(stderr, "Submit texture uploads failed: %d\n", ret);
+        goto fail;
     }
+    uploadBatches.push_back(std::move(batch));
+    uploadScratch.clear();
+    return;
 
-    result = ImGui_ImplVulkan_AddTexture(textureSampler, textureImageView,
-                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-    if (result == NULL) {
-        fprintf(stderr, "Failed to add user texture to ImplVulkan.\n");
-        goto out;
+fail:
+    for (auto &texture : batch.textures) {
+        destroyUserTexture(texture.second);
+        asyncTextures[texture.first].status = TEXTURE_FAILED;
+    }
+    for (DecodedTexture &decoded : uploadScratch) {
+        auto it = asyncTextures.find(decoded.request);
+        if (it != asyncTextures.end() && it->second.status == TEXTURE_PENDING)
+            it->second.status = TEXTURE_FAILED;
     }
+    if (batch.fence != VK_NULL_HANDLE)
+        vkDestroyFence(device, batch.fence, nullptr);
+    if (batch.commandBuffer != VK_NULL_HANDLE)
+        vkFreeCommandBuffers(device, commandPool, 1, &batch.commandBuffer);
+    freeStaging(batch.staging);
+    uploadScratch.clear();
+}
 
-    UserTextureImage uti;
-    uti.image = textureImage;
-    uti.imageMemory = textureImageMemory;
-    uti.imageView = textureImageView;
-    uti.sampler = textureSampler;
-    userTextureImages.push_back(uti);
+void ImguiVulkanHelper::finishTextureUploads(bool wait)
+{
+    size_t kept = 0;
+    for (size_t i = 0; i < uploadBatches.size(); i++) {
+        TextureUploadBatch &batch = uploadBatches[i];
+        if (wait)
+            vkWaitForFences(device, 1, &batch.fence, VK_TRUE, UINT64_MAX);
+        else if (vkGetFenceStatus(device, batch.fence) != VK_SUCCESS) {
+            if (kept != i)
+                uploadBatches[kept] = std::move(batch);
+            kept++;
+            continue;
+        }
 
-    if (width)
-        *width = texWidth;
-    if (height)
-        *height = texHeight;
+        for (auto &texture : batch.textures) {
+            auto it = asyncTextures.find(texture.first);
+            if (it == asyncTextures.end()) {
+                destroyUserTexture(texture.second);
+            } else if (!addTextureDescriptor(texture.second)) {
+                destroyUserTexture(texture.second);
+                it->second.status = TEXTURE_FAILED;
+            } else {
+                it->second.status = TEXTURE_READY;
+                it->second.texture = texture.second.textureId;
+            }
+        }
+        vkDestroyFence(device, batch.fence, nullptr);
+        vkFreeCommandBuffers(device, commandPool, 1, &batch.commandBuffer);
+        freeStaging(batch.staging);
+    }
+    uploadBatches.resize(kept);
+}
 
-out:
-    vkDestroyBuffer(device, stagingBuffer, nullptr);
-    vkFreeMemory(device, stagingBufferMemory, nullptr);
-    if (textureImageView != VK_NULL_HANDLE && !result)
-        vkDestroyImageView(device, textureImageView, nullptr);
-    if (textureImage != VK_NULL_HANDLE && !result)
-        vkDestroyImage(device, textureImage, nullptr);
-    if (textureImageMemory != VK_NULL_HANDLE && !result)
-        vkFreeMemory(device, textureImageMemory, nullptr);
-    if (textureSampler != VK_NULL_HANDLE && !result)
-        vkDestroySampler(device, textureSampler, nullptr);
-    return result;
+void ImguiVulkanHelper::stopTextureUploads(void)
+{
+    {
+        std::lock_guard<std::mutex> lock(decodeMutex);
+        decodeStop = true;
+        decodeQueue.clear();
+        decodedTextures.clear();
+    }
+    decodeCond.notify_all();
+    if (decodeThread.joinable())
+        decodeThread.join();
+    finishTextureUploads(true);
+    asyncTextures.clear();
+}
+
+void ImguiVulkanHelper::releaseImage(ImTextureID texture)
+{
+    for (size_t i = 0; i < userTextureImages.size(); i++) {
+        if (userTextureImages[i].textureId != texture)
+            continue;
+        userTextureImages[i].retiredFrame = frameCount;
+        retiredTextureImages.push_back(userTextureImages[i]);
+        userTextureImages[i] = userTextureImages.back();
+        userTextureImages.pop_back();
+        return;
+    }
+}
+
+void ImguiVulkanHelper::getMemoryStats(DeviceMemoryStats *stats) const
+{
+    allocator.getStats(stats);
+}
+
+void ImguiVulkanHelper::destroyUserTexture(const UserTextureImage &texture)
+{
+    ImGui_ImplVulkan_RemoveTexture(texture.textureId);
+    vkDestroySampler(device, texture.sampler, nullptr);
+    vkDestroyImageView(device, texture.imageView, nullptr);
+    vkDestroyImage(device, texture.image, nullptr);
+    allocator.free(texture.imageMemory.memory, texture.imageMemory.offset);
+}
+
+/* A frame waits for the fence of the swapchain slot it reuses, so every frame
+ * up to imageCount back has finished by then and no command buffer still
+ * samples what was released before it.
+ */
+void ImguiVulkanHelper::collectRetiredTextures(bool all)
+{
+    size_t kept = 0;
+    for (size_t i = 0; i < retiredTextureImages.size(); i++) {
+        if (all || retiredTextureImages[i].retiredFrame + imageCount <= frameCount)
+            destroyUserTexture(retiredTextureImages[i]);
+        else
+            retiredTextureImages[kept++] = retiredTextureImages[i];
+    }
+    retiredTextureImages.resize(kept);
 }
 
 void ImguiVulkanHelper::drawFrame(ImDrawData *data)
@@ -1177,6 +1569,10 @@ void ImguiVulkanHelper::drawFrame(ImDrawData *data)
     }
 
     vkWaitForFences(device, 1, &swapChainImageFences[currentFrame], VK_TRUE, UINT64_MAX);
+    collectRetiredTextures(false);
+    // Uploads go on the queue ahead of this frame, their textures show from a later one
+    finishTextureUploads(false);
+    submitTextureUploads();
 
     VkCommandBufferBeginInfo beginInfo{};
     beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
@@ -1258,4 +1654,5 @@ void ImguiVulkanHelper::drawFrame(ImDrawData *data)
 
 out:
     currentFrame = (currentFrame + 1) % imageCount;
+    frameCount++;
 }
@@ -1,7 +1,14 @@
 #ifndef _GLFW_VULKAN_HELPER_H
 #define _GLFW_VULKAN_HELPER_H
 
+#include <stdint.h>
+#include <string>
 #include <vector>
+#include <deque>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <imgui.h>
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_vulkan.h>
@@ -9,6 +16,8 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 #include <vulkan/vulkan.h>
+#include "descriptor_allocator.h"
+#include "device_allocator.h"
 
 struct QueueFamilyIndices {
     int graphicsFamily;
@@ -32,9 +41,69 @@ struct SwapChainSupportDetails {
 
 struct UserTextureImage {
     VkImage image;
-    VkDeviceMemory imageMemory;
+    DeviceAllocation imageMemory;
     VkImageView imageView;
     VkSampler sampler;
+    ImTextureID textureId;      // what the backend handed out for it, a descriptor set or a bindless slot
+    uint64_t retiredFrame;      // frames drawn when it was released
+};
+
+// Bytes of pixels and number of textures one frame sends to the GPU at most, the rest waits a frame
+#define TEXTURE_UPLOAD_BATCH_BYTES  (16 * 1024 * 1024)
+#define TEXTURE_UPLOAD_BATCH_MAX    64
+
+// Names a texture on its way to the GPU, 0 never does
+typedef uint32_t TextureRequest;
+
+enum TextureStatus {
+    TEXTURE_PENDING = 0,        // decoding, queued or copying
+    TEXTURE_READY,
+    TEXTURE_FAILED,
+    TEXTURE_UNKNOWN             // never requested, cancelled or already taken
+};
+
+// Pixels waiting for the next batch, empty when the decode failed
+struct DecodedTexture {
+    TextureRequest request;
+    std::vector<uint8_t> pixels;
+    int width;
+    int height;
+};
+
+/* Staging memory every upload goes through: one buffer, mapped once, handed
+ * out front to back and wrapping around. Space is given back in the order
+ * it was taken, when the fence of the upload that used it has signaled.
+ */
+#define STAGING_RING_SIZE       (32 * 1024 * 1024)
+#define STAGING_ALIGN           16
+
+struct StagingSpan {
+    VkDeviceSize begin;         // where the ring head was, the padding before a wrap included
+    VkDeviceSize end;
+    bool released;
+};
+
+struct StagingAllocation {
+    VkBuffer buffer;
+    VkDeviceSize offset;
+    uint8_t *data;              // mapped, at offset
+    uint64_t span;              // 0 when not in the ring
+    DeviceAllocation ownMemory; // a buffer of its own, only for an upload larger than the ring
+};
+
+// One frame's uploads: a command buffer copying out of one staging allocation, done when the fence is
+struct TextureUploadBatch {
+    VkFence fence;
+    VkCommandBuffer commandBuffer;
+    StagingAllocation staging;
+    std::vector<std::pair<TextureRequest, UserTextureImage>> textures;
+};
+
+struct AsyncTexture {
+    TextureStatus status;
+    ImTextureID texture;
+    int width;
+    int height;
 };
 
 class ImguiVulkanHelper
@@ -51,16 +120,34 @@ public:
     VkRenderPass getRenderPass(void);
     bool initializeFontTexture(void);
     ImTextureID loadImage(const char *image, int *width, int *height);
+    // Uploads width x height RGBA pixels, rows top to bottom
+    ImTextureID createTexture(const unsigned char *pixels, int width, int height);
+    /* The same without waiting: the file is decoded on a worker thread,
+     * pixels are copied to the GPU in one batch per frame by drawFrame(),
+     * and pollTexture() says when the texture can be drawn.
+     */
+    TextureRequest loadImageAsync(const char *image);
+    TextureRequest createTextureAsync(std::vector<uint8_t> &&pixels, int width, int height);
+    // Once READY or FAILED the request is forgotten, a ready texture then belongs to the caller
+    TextureStatus pollTexture(TextureRequest request, ImTextureID *texture, int *width, int *height);
+    // The texture is dropped whenever its upload finishes, or released when it already has
+    void cancelTexture(TextureRequest request);
+    // Destroyed once the frames that may still sample it are done, it must not be drawn any more
+    void releaseImage(ImTextureID texture);
     void drawFrame(ImDrawData *data);
+    void getMemoryStats(DeviceMemoryStats *stats) const;
 
 private:
     bool framebufferResized = false;
     bool terminated = false;
     uint32_t currentFrame = 0;
+    uint64_t frameCount = 0;
     VkClearValue clearColor = { 0.45f, 0.55f, 0.60f, 1.00f };
 
     GLFWwindow* window;
     VkInstance instance;
+    uint32_t instanceVersion = VK_API_VERSION_1_0;
+    bool bindlessTextures = false;      // the device can index one array of every texture
     VkDebugUtilsMessengerEXT debugMessenger;
     VkSurfaceKHR surface;
     VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
@@ -76,12 +163,32 @@ private:
     VkRenderPass renderPass;
     std::vector<VkFramebuffer> swapChainFramebuffers;
     VkCommandPool commandPool;
-    VkDescriptorPool descriptorPool;
+    DescriptorAllocator descriptors;
     std::vector<VkCommandBuffer> commandBuffers;
     std::vector<VkSemaphore> imageAvailableSemaphores;
     std::vector<VkSemaphore> renderFinishedSemaphores;
     std::vector<VkFence> swapChainImageFences;
     std::vector<UserTextureImage> userTextureImages;
+    std::vector<UserTextureImage> retiredTextureImages;
+    DeviceAllocator allocator;
+    VkBuffer stagingRing = VK_NULL_HANDLE;
+    DeviceAllocation stagingRingMemory = {};
+    uint8_t *stagingRingMap = nullptr;
+    std::deque<StagingSpan> stagingSpans;
+    uint64_t stagingFirstSpan = 1;      // id of stagingSpans.front()
+
+    // Only the render thread touches the async textures and the batches in flight
+    TextureRequest nextTextureRequest = 1;
+    std::unordered_map<TextureRequest, AsyncTexture> asyncTextures;
+    std::vector<TextureUploadBatch> uploadBatches;
+    std::vector<DecodedTexture> uploadScratch;
+    // Shared with the decode thread, started by the first loadImageAsync()
+    std::thread decodeThread;
+    std::mutex decodeMutex;
+    std::condition_variable decodeCond;
+    bool decodeStop = false;
+    std::deque<std::pair<TextureRequest, std::string>> decodeQueue;
+    std::deque<DecodedTexture> decodedTextures;
 
     bool createInstance(const char *app_name, uint32_t app_version);
     bool createDevice(void);
@@ -93,29 +200,40 @@ private:
     bool createDescriptorPool(void);
     bool createCommandBuffers(void);
     bool createSyncObjects(void);
+    bool createStagingRing(void);
+    void destroyStagingRing(void);
+    bool allocStaging(VkDeviceSize size, bool wait, StagingAllocation &staging);
+    void freeStaging(StagingAllocation &staging);
     bool checkValidationLayerSupport(void);
     void cleanupSwapChain(void);
+    void destroyUserTexture(const UserTextureImage &texture);
+    void collectRetiredTextures(bool all);
+    void decodeWorker(void);
+    void submitTextureUploads(void);
+    void finishTextureUploads(bool wait);
+    void stopTextureUploads(void);
     void cleanup(void);
     void recreateSwapChain(void);
     SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device);
     QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device);
     bool checkDeviceExtensionSupport(VkPhysicalDevice device);
     bool isDeviceSuitable(VkPhysicalDevice device);
+    bool checkBindlessSupport(VkPhysicalDevice device);
     VkSurfaceFormatKHR chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats);
     VkPresentModeKHR chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes);
     VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities);
     VkImageView createImageView(VkImage image, VkFormat format);
     bool createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
-            VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory);
-    uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
+            VkMemoryPropertyFlags properties, VkBuffer& buffer, DeviceAllocation& bufferMemory);
     bool createImage(uint32_t width, uint32_t height,
             VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage,
-            VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory);
+            VkMemoryPropertyFlags properties, VkImage& image, DeviceAllocation& imageMemory);
     VkCommandBuffer beginSingleTimeCommands();
     bool endSingleTimeCommands(VkCommandBuffer commandBuffer);
-    bool transitionImageLayout(VkImage image, VkFormat format,
-            VkImageLayout oldLayout, VkImageLayout newLayout);
-    bool copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height);
+    bool createTextureImage(uint32_t width, uint32_t height, UserTextureImage &texture);
+    bool addTextureDescriptor(UserTextureImage &texture);
+    void recordTextureUpload(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset,
+            VkImage image, uint32_t width, uint32_t height);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,252 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "io_ring.h"
+
+#define IO_RING_MAX_ENTRIES 4096
+
+static int io_uring_setup(unsigned entries, struct io_uring_params *params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+static int io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+IoRing::~IoRing()
+{
+    close();
+}
+
+bool IoRing::init(unsigned n)
+{
+    close();
+    if (n < 1)
+        n = 1;
+    if (n > IO_RING_MAX_ENTRIES)
+        n = IO_RING_MAX_ENTRIES;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = io_uring_setup(n, &params);
+    if (fd < 0)
+        return false;
+    ringFd = fd;
+    entries = params.sq_entries;
+
+    sqMapLen = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqMapLen = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    // Since 5.4 both rings live in one mapping
+    bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && cqMapLen > sqMapLen)
+        sqMapLen = cqMapLen;
+    sqMap = mmap(nullptr, sqMapLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sqMap == MAP_FAILED) {
+        sqMap = nullptr;
+        close();
+        return false;
+    }
+    if (single) {
+        cqMap = sqMap;
+    } else {
+        cqMap = mmap(nullptr, cqMapLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cqMap == MAP_FAILED) {
+            cqMap = nullptr;
+            close();
+            return false;
+        }
+    }
+    sqesLen = params.sq_entries * sizeof(struct io_uring_sqe);
+    void *p = mmap(nullptr, sqesLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (p == MAP_FAILED) {
+        close();
+        return false;
+    }
+    sqes = static_cast<struct io_uring_sqe *>(p);
+
+    uint8_t *sq = static_cast<uint8_t *>(sqMap);
+    uint8_t *cq = static_cast<uint8_t *>(cqMap);
+    sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sqMask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cqMask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+    localTail = *sqTail;
+    return true;
+}
+
+void IoRing::close(void)
+{
+    if (sqes != nullptr)
+        munmap(sqes, sqesLen);
+    if (cqMap != nullptr && cqMap != sqMap)
+        munmap(cqMap, cqMapLen);
+    if (sqMap != nullptr)
+        munmap(sqMap, sqMapLen);
+    if (ringFd >= 0)
+        ::close(ringFd);
+    ringFd = -1;
+    entries = 0;
+    sqMap = cqMap = nullptr;
+    sqes = nullptr;
+}
+
+bool IoRing::isOpen(void) const
+{
+    return ringFd >= 0;
+}
+
+unsigned IoRing::getEntries(void) const
+{
+    return entries;
+}
+
+bool IoRing::supported(void)
+{
+    // Probed once, io_uring may be missing, disabled by sysctl or filtered by seccomp
+    static const bool result = [] {
+        static const uint8_t needed[] = {
+            IORING_OP_STATX, IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_FSYNC
+        };
+        IoRing ring;
+        if (!ring.init(2))
+            return false;
+
+        size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+        struct io_uring_probe *probe = static_cast<struct io_uring_probe *>(calloc(1, len));
+        bool ok = probe != nullptr && io_uring_register(ring.ringFd, IORING_REGISTER_PROBE, probe, 256) == 0;
+        for (uint8_t op : needed) {
+            if (!ok)
+                break;
+            ok = op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED) != 0;
+        }
+        free(probe);
+        return ok;
+    }();
+    return result;
+}
+
+struct io_uring_sqe *IoRing::getSqe(uint8_t opcode, uint64_t user_data)
+{
+    if (ringFd < 0)
+        return nullptr;
+    unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    if (localTail - head >= entries)
+        return nullptr;
+    unsigned index = localTail & sqMask;
+    struct io_uring_sqe *sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->user_data = user_data;
+    sqArray[index] = index;
+    localTail++;
+    return sqe;
+}
+
+bool IoRing::prepStatx(int dir_fd, const char *path, int flags, unsigned mask, struct statx *buf,
+        uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = getSqe(IORING_OP_STATX, user_data);
+    if (sqe == nullptr)
+        return false;
+    sqe->fd = dir_fd;
+    sqe->addr = (uint64_t)(uintptr_t)path;
+    sqe->len = mask;
+    sqe->off = (uint64_t)(uintptr_t)buf;
+    sqe->statx_flags = flags;
+    return true;
+}
+
+bool IoRing::prepOpenat(int dir_fd, const char *path, int flags, mode_t mode, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = getSqe(IORING_OP_OPENAT, user_data);
+    if (sqe == nullptr)
+        return false;
+    sqe->fd = dir_fd;
+    sqe->addr = (uint64_t)(uintptr_t)path;
+    sqe->len = mode;
+    sqe->open_flags = flags;
+    return true;
+}
+
+bool IoRing::prepRead(int fd, void *buf, unsigned len, uint64_t offset, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = getSqe(IORING_OP_READ, user_data);
+    if (sqe == nullptr)
+        return false;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = offset;
+    return true;
+}
+
+bool IoRing::prepWrite(int fd, const void *buf, unsigned len, uint64_t offset, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = getSqe(IORING_OP_WRITE, user_data);
+    if (sqe == nullptr)
+        return false;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = offset;
+    return true;
+}
+
+bool IoRing::prepFsync(int fd, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = getSqe(IORING_OP_FSYNC, user_data);
+    if (sqe == nullptr)
+        return false;
+    sqe->fd = fd;
+    return true;
+}
+
+int IoRing::submit(unsigned wait_nr)
+{
+    if (ringFd < 0) {
+        errno = EBADF;
+        return -1;
+    }
+    __atomic_store_n(sqTail, localTail, __ATOMIC_RELEASE);
+    unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+    for (;;) {
+        // Everything published that the kernel has not consumed yet
+        unsigned to_submit = localTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+        if (to_submit == 0 && wait_nr == 0)
+            return 0;
+        int ret = io_uring_enter(ringFd, to_submit, wait_nr, flags);
+        if (ret >= 0 || errno != EINTR)
+            return ret;
+    }
+}
+
+bool IoRing::popCompletion(uint64_t *user_data, int32_t *res)
+{
+    if (ringFd < 0)
+        return false;
+    unsigned head = *cqHead;
+    if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+        return false;
+    const struct io_uring_cqe *cqe = &cqes[head & cqMask];
+    *user_data = cqe->user_data;
+    *res = cqe->res;
+    __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
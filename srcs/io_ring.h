@@ -0,0 +1,67 @@
+#ifndef _IO_RING_H
+#define _IO_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+/* A thin io_uring wrapper on the raw syscalls, liburing is not a dependency.
+ * Each ring belongs to one thread. Operations are queued with the prep
+ * methods, which fail when the submission queue is full, and go to the
+ * kernel in one io_uring_enter on submit(). Every completion carries back
+ * the user_data it was queued with.
+ */
+class IoRing
+{
+public:
+    ~IoRing();
+
+    bool init(unsigned entries);
+    void close(void);
+    bool isOpen(void) const;
+    unsigned getEntries(void) const;
+
+    // True when the kernel has io_uring and every opcode the engine uses
+    static bool supported(void);
+
+    bool prepStatx(int dir_fd, const char *path, int flags, unsigned mask, struct statx *buf, uint64_t user_data);
+    bool prepOpenat(int dir_fd, const char *path, int flags, mode_t mode, uint64_t user_data);
+    bool prepRead(int fd, void *buf, unsigned len, uint64_t offset, uint64_t user_data);
+    bool prepWrite(int fd, const void *buf, unsigned len, uint64_t offset, uint64_t user_data);
+    bool prepFsync(int fd, uint64_t user_data);
+
+    // Hands the queued operations to the kernel and waits for at least wait_nr completions
+    int submit(unsigned wait_nr = 0);
+    // Pops one completion, res is the syscall result or -errno
+    bool popCompletion(uint64_t *user_data, int32_t *res);
+
+private:
+    int ringFd = -1;
+    unsigned entries = 0;
+
+    void *sqMap = nullptr;
+    size_t sqMapLen = 0;
+    void *cqMap = nullptr;
+    size_t cqMapLen = 0;
+    struct io_uring_sqe *sqes = nullptr;
+    size_t sqesLen = 0;
+
+    unsigned *sqHead = nullptr;
+    unsigned *sqTail = nullptr;
+    unsigned sqMask = 0;
+    unsigned *sqArray = nullptr;
+    unsigned *cqHead = nullptr;
+    unsigned *cqTail = nullptr;
+    unsigned cqMask = 0;
+    struct io_uring_cqe *cqes = nullptr;
+
+    // Queued by the prep methods but not yet published to the kernel
+    unsigned localTail = 0;
+
+    struct io_uring_sqe *getSqe(uint8_t opcode, uint64_t user_data);
+};
+
+#endif
@@ -0,0 +1,252 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <chrono>
+#include "xxh3.h"
+#include "journal.h"
+
+static bool writeAll(int fd, const void *data, size_t len)
+{
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool readAll(int fd, void *data, size_t len)
+{
+    uint8_t *p = static_cast<uint8_t *>(data);
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static uint64_t recordCheck(const JournalRecord &record, const void *rel_path)
+{
+    Xxh3State state;
+    state.init();
+    state.update(reinterpret_cast<const uint8_t *>(&record) + sizeof(record.check),
+                 sizeof(record) - sizeof(record.check));
+    state.update(rel_path, record.pathLen);
+    return state.digest();
+}
+
+Journal::~Journal()
+{
+    close();
+}
+
+bool Journal::open(const std::string &journal_path)
+{
+    close();
+    entries.clear();
+    path = journal_path;
+
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Open journal %s failed: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+    if (!replay()) {
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+    stopping = false;
+    flusher = std::thread(&Journal::flushLoop, this);
+    return true;
+}
+
+// Loads every intact record and leaves the file offset at the end of the last one
+bool Journal::replay(void)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        fprintf(stderr, "Stat journal %s failed: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    JournalHeader header;
+    if (st.st_size == 0) {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+        header.version = JOURNAL_VERSION;
+        header.recordLen = sizeof(JournalRecord);
+        if (!writeAll(fd, &header, sizeof(header)) || fsync(fd) != 0) {
+            fprintf(stderr, "Write journal %s failed: %s\n", path.c_str(), strerror(errno));
+            return false;
+        }
+        return true;
+    }
+
+    // One read of the whole log, replaying even a large one is bound by memory speed
+    std::vector<uint8_t> data(st.st_size);
+    if (!readAll(fd, data.data(), data.size())) {
+        fprintf(stderr, "Read journal %s failed: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+    memcpy(&header, data.data(), data.size() < sizeof(header) ? data.size() : sizeof(header));
+    if (data.size() < sizeof(header) || memcmp(header.magic, JOURNAL_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != JOURNAL_VERSION || header.recordLen != sizeof(JournalRecord)) {
+        fprintf(stderr, "Journal %s is not valid, move it away to start over.\n", path.c_str());
+        return false;
+    }
+
+    size_t pos = sizeof(header);
+    while (pos + sizeof(JournalRecord) <= data.size()) {
+        JournalRecord record;
+        memcpy(&record, data.data() + pos, sizeof(record));
+        size_t len = sizeof(record) + record.pathLen;
+        const uint8_t *name = data.data() + pos + sizeof(record);
+        if (pos + len > data.size() || record.check != recordCheck(record, name))
+            break;
+        entries[std::string(reinterpret_cast<const char *>(name), record.pathLen)] = record;
+        pos += len;
+    }
+    if (pos < data.size()) {
+        fprintf(stderr, "Journal %s: dropping %lu bytes of a torn record.\n",
+                path.c_str(), (unsigned long)(data.size() - pos));
+        if (ftruncate(fd, pos) != 0 || fsync(fd) != 0) {
+            fprintf(stderr, "Truncate journal %s failed: %s\n", path.c_str(), strerror(errno));
+            return false;
+        }
+    }
+    if (lseek(fd, pos, SEEK_SET) < 0) {
+        fprintf(stderr, "Seek journal %s failed: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void Journal::close(void)
+{
+    if (fd < 0)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    if (flusher.joinable())
+        flusher.join();
+    ::close(fd);
+    fd = -1;
+}
+
+bool Journal::reset(void)
+{
+    close();
+    entries.clear();
+    int reset_fd = ::open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    if (reset_fd < 0 || ftruncate(reset_fd, sizeof(JournalHeader)) != 0 || fsync(reset_fd) != 0) {
+        fprintf(stderr, "Reset journal %s failed: %s\n", path.c_str(), strerror(errno));
+        if (reset_fd >= 0)
+            ::close(reset_fd);
+        return false;
+    }
+    ::close(reset_fd);
+    return true;
+}
+
+bool Journal::isOpen(void) const
+{
+    return fd >= 0;
+}
+
+bool Journal::lookup(const std::string &rel_path, uint64_t size, int64_t mtime, JournalRecord *record) const
+{
+    auto it = entries.find(rel_path);
+    if (it == entries.end() || it->second.size != size)
+        return false;
+    const JournalRecord &found = it->second;
+    if (found.flags & JOURNAL_FLAG_MTIME_NS ? found.mtime != mtime : found.mtime != mtime / 1000000000)
+        return false;
+    *record = found;
+    return true;
+}
+
+void Journal::append(JournalKind kind, const std::string &rel_path, uint64_t size, int64_t mtime,
+        HashAlgo algo, const uint8_t *digest)
+{
+    if (fd < 0 || rel_path.size() > UINT16_MAX)
+        return;
+
+    JournalRecord record;
+    memset(&record, 0, sizeof(record));
+    record.kind = kind;
+    record.algorithm = algo;
+    record.pathLen = rel_path.size();
+    record.flags = JOURNAL_FLAG_MTIME_NS;
+    record.size = size;
+    record.mtime = mtime;
+    memcpy(record.digest, digest, hashDigestLen(algo));
+    record.check = recordCheck(record, rel_path.data());
+
+    const uint8_t *p = reinterpret_cast<const uint8_t *>(&record);
+    const uint8_t *name = reinterpret_cast<const uint8_t *>(rel_path.data());
+    bool full;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.insert(pending.end(), p, p + sizeof(record));
+        pending.insert(pending.end(), name, name + rel_path.size());
+        full = pending.size() >= JOURNAL_COMMIT_BYTES;
+    }
+    if (full)
+        wake.notify_one();
+}
+
+/* Group commit: whatever the workers appended while the previous group was
+ * being synced goes out with a single write and fdatasync, so the cost of a
+ * sync is shared by every file that finished in the meantime.
+ */
+void Journal::flushLoop(void)
+{
+    std::vector<uint8_t> group;
+    std::unique_lock<std::mutex> lock(mutex);
+
+    for (;;) {
+        wake.wait_for(lock, std::chrono::milliseconds(JOURNAL_COMMIT_MS),
+                      [this] { return stopping || pending.size() >= JOURNAL_COMMIT_BYTES; });
+        bool stop = stopping;
+        group.clear();
+        group.swap(pending);
+        lock.unlock();
+
+        if (!group.empty()) {
+            if (!writeAll(fd, group.data(), group.size()) || fdatasync(fd) != 0)
+                fprintf(stderr, "Write journal %s failed: %s\n", path.c_str(), strerror(errno));
+            commits++;
+        }
+        if (stop)
+            return;
+        lock.lock();
+    }
+}
+
+size_t Journal::size(void) const
+{
+    return entries.size();
+}
+
+uint64_t Journal::getCommits(void) const
+{
+    return commits;
+}
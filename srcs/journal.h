@@ -0,0 +1,98 @@
+#ifndef _JOURNAL_H
+#define _JOURNAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <atomic>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include "hasher.h"
+
+#define JOURNAL_MAGIC           "WBJRNL1"
+#define JOURNAL_VERSION         1
+#define JOURNAL_COMMIT_MS       20
+#define JOURNAL_COMMIT_BYTES    (256 * 1024)
+// The mtime of the record is in ns, records without it hold whole seconds
+#define JOURNAL_FLAG_MTIME_NS   1
+
+enum JournalKind {
+    JOURNAL_COPIED = 1,         // copied and verified, the digest is on the NAS now
+    JOURNAL_DUPLICATE           // already on the NAS, nothing was written
+};
+
+/* On-disk layout, all integers little endian:
+ *   header | records
+ * A record is a JournalRecord followed by pathLen bytes of the path relative
+ * to the import directory. check is the XXH3 of everything after it, the
+ * first record that does not match marks the torn tail of a crashed run.
+ */
+struct JournalHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordLen;
+};
+
+struct JournalRecord {
+    uint64_t check;
+    uint8_t kind;
+    uint8_t algorithm;
+    uint16_t pathLen;
+    uint32_t flags;
+    uint64_t size;
+    int64_t mtime;
+    uint8_t digest[HASH_DIGEST_MAX_LEN];
+};
+
+/* Append-only log of the files a backup has finished, kept in the output
+ * directory so a restarted backup skips them. open() replays the whole log
+ * into a map that lookups read without a lock. Appends are buffered and a
+ * flusher thread writes and syncs them as one group at most every
+ * JOURNAL_COMMIT_MS, a crash loses at most that window, whose files are
+ * simply backed up again.
+ */
+class Journal
+{
+public:
+    ~Journal();
+
+    // A missing log is created, a torn tail is cut off
+    bool open(const std::string &path);
+    // Flushes whatever is still buffered
+    void close(void);
+    // Closes the log and cuts it back to its header, for a run that finished every file
+    bool reset(void);
+    bool isOpen(void) const;
+    bool lookup(const std::string &rel_path, uint64_t size, int64_t mtime, JournalRecord *record) const;
+    void append(JournalKind kind, const std::string &rel_path, uint64_t size, int64_t mtime,
+            HashAlgo algo, const uint8_t *digest);
+    size_t size(void) const;
+    uint64_t getCommits(void) const;
+
+    template <typename Fn>
+    void forEach(Fn fn) const
+    {
+        for (const auto &it : entries)
+            fn(it.first, it.second);
+    }
+
+private:
+    std::string path;
+    int fd = -1;
+    std::unordered_map<std::string, JournalRecord> entries;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::vector<uint8_t> pending;
+    bool stopping = false;
+    std::atomic<uint64_t> commits{0};
+    std::thread flusher;
+
+    bool replay(void);
+    void flushLoop(void);
+};
+
+#endif
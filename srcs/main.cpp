@@ -1,6 +1,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "imgui_vulkan_helper.h"
+#include "backup_engine.h"
+#include "headless.h"
+#include "image_atlas.h"
+#include "progress_panel.h"
+#include "thumbnailer.h"
+#include "thumb_grid.h"
 
 #define APP_NAME            "NAS Backup"
 #define APP_VERSION         VK_MAKE_VERSION(0, 1, 0)
@@ -14,17 +20,20 @@
 
 #define FONT                "fonts/SourceHanSansCN/SourceHanSansCN-Medium.otf"
 #define TEX_YESNO           "textures/yes-no-01.png"
-#define TEX_YES_UL_X        670.0f
-#define TEX_YES_UL_Y        508.0f
-#define TEX_YES_RB_X        885.0f
-#define TEX_YES_RB_Y        724.0f
-#define TEX_NO_UL_X         943.0f
-#define TEX_NO_UL_Y         508.0f
-#define TEX_NO_RB_X         1158.0f
-#define TEX_NO_RB_Y         724.0f
-
-int main(int, char**)
+// The two icons of TEX_YESNO in pixels, only they go to the GPU
+#define TEX_YES_X           670
+#define TEX_YES_Y           508
+#define TEX_NO_X            943
+#define TEX_NO_Y            508
+#define TEX_ICON_WIDTH      215
+#define TEX_ICON_HEIGHT     216
+
+int main(int argc, char **argv)
 {
+    // Before anything touches GLFW or vulkan, neither is there on a NAS
+    if (headlessRequested(argc, argv))
+        return runHeadless(argc, argv);
+
     ImguiVulkanHelper gui_helper;
 
     if (!gui_helper.initWindow(WIDTH, HEIGHT, APP_NAME))
@@ -54,15 +63,12 @@ int main(int, char**)
         return EXIT_FAILURE;
     }
 
-    ImTextureID tex_yesno;
-    int tex_yesno_width, tex_yesno_height;
-    tex_yesno = gui_helper.loadImage(TEX_YESNO, &tex_yesno_width, &tex_yesno_height);
-    if (tex_yesno == NULL) {
+    ImageAtlas icons;
+    AtlasImageId icon_yes = icons.addFile(TEX_YESNO, TEX_YES_X, TEX_YES_Y, TEX_ICON_WIDTH, TEX_ICON_HEIGHT);
+    AtlasImageId icon_no = icons.addFile(TEX_YESNO, TEX_NO_X, TEX_NO_Y, TEX_ICON_WIDTH, TEX_ICON_HEIGHT);
+    if (icon_yes == 0 || icon_no == 0 || !icons.upload(gui_helper)) {
         fprintf(stderr, "Load image: %s failed.\n", TEX_YESNO);
         return EXIT_FAILURE;
-    } else {
-        fprintf(stdout, "Load image: %s succeeded. Width: %d, height: %d\n",
-                TEX_YESNO, tex_yesno_width, tex_yesno_height);
     }
 
     ImGuiStyle& style = ImGui::GetStyle();
@@ -81,6 +87,17 @@ int main(int, char**)
     bool video_hash_valid = false;
     bool import_dir_valid = false;
     bool output_dir_valid = false;
+    bool use_io_uring = false;
+    bool chunk_videos = false;
+    bool group_shots = true;
+    bool date_layout = false;
+    bool adapt_writers = true;
+    int writers_min = 1;
+    int writers_max = 8;
+    BackupEngine engine;
+    ProgressPanel progress_panel;
+    Thumbnailer thumbnailer;
+    ThumbGrid thumb_grid;
 
     while (!glfwWindowShouldClose(gui_helper.getWindow())) {
         glfwPollEvents();
@@ -100,61 +117,86 @@ int main(int, char**)
         float push_input_width = input_text_dimension.x+ yesno_dimension.x + style.ItemInnerSpacing.x * 4;
 
         ImGui::PushItemWidth(-push_input_width);
-        ImGui::InputText("Photo hash file", photo_hash_file, sizeof(photo_hash_file));
+        if (ImGui::InputText("Photo hash file", photo_hash_file, sizeof(photo_hash_file)))
+            photo_hash_valid = isRegularFile(photo_hash_file);
         ImGui::SameLine();
         ImGui::SetCursorPosX(yesno_pos);
-        if (photo_hash_valid)
-            ImGui::Image(tex_yesno, yesno_dimension,
-                        ImVec2(TEX_YES_UL_X / tex_yesno_width, TEX_YES_UL_Y / tex_yesno_height),
-                        ImVec2(TEX_YES_RB_X / tex_yesno_width, TEX_YES_RB_Y / tex_yesno_height));
-        else
-            ImGui::Image(tex_yesno, yesno_dimension,
-                        ImVec2(TEX_NO_UL_X / tex_yesno_width, TEX_NO_UL_Y / tex_yesno_height),
-                        ImVec2(TEX_NO_RB_X / tex_yesno_width, TEX_NO_RB_Y / tex_yesno_height));
-
-        ImGui::InputText("Video hash file", video_hash_file, sizeof(video_hash_file));
+        icons.draw(photo_hash_valid ? icon_yes : icon_no, yesno_dimension);
+
+        if (ImGui::InputText("Video hash file", video_hash_file, sizeof(video_hash_file)))
+            video_hash_valid = isRegularFile(video_hash_file);
         ImGui::SameLine();
         ImGui::SetCursorPosX(yesno_pos);
-        if (video_hash_valid)
-            ImGui::Image(tex_yesno, yesno_dimension,
-                        ImVec2(TEX_YES_UL_X / tex_yesno_width, TEX_YES_UL_Y / tex_yesno_height),
-                        ImVec2(TEX_YES_RB_X / tex_yesno_width, TEX_YES_RB_Y / tex_yesno_height));
-        else
-            ImGui::Image(tex_yesno, yesno_dimension,
-                        ImVec2(TEX_NO_UL_X / tex_yesno_width, TEX_NO_UL_Y / tex_yesno_height),
-                        ImVec2(TEX_NO_RB_X / tex_yesno_width, TEX_NO_RB_Y / tex_yesno_height));
-
-        ImGui::InputText("Import directory", import_dir, sizeof(import_dir));
+        icons.draw(video_hash_valid ? icon_yes : icon_no, yesno_dimension);
+
+        if (ImGui::InputText("Import directory", import_dir, sizeof(import_dir)))
+            import_dir_valid = isDirectory(import_dir, false);
         ImGui::SameLine();
         ImGui::SetCursorPosX(yesno_pos);
-        if (import_dir_valid)
-            ImGui::Image(tex_yesno, yesno_dimension,
-                         ImVec2(TEX_YES_UL_X / tex_yesno_width, TEX_YES_UL_Y / tex_yesno_height),
-                         ImVec2(TEX_YES_RB_X / tex_yesno_width, TEX_YES_RB_Y / tex_yesno_height));
-        else
-            ImGui::Image(tex_yesno, yesno_dimension,
-                         ImVec2(TEX_NO_UL_X / tex_yesno_width, TEX_NO_UL_Y / tex_yesno_height),
-                         ImVec2(TEX_NO_RB_X / tex_yesno_width, TEX_NO_RB_Y / tex_yesno_height));
-
-        ImGui::InputText("Output directory", output_dir, sizeof(output_dir));
+        icons.draw(import_dir_valid ? icon_yes : icon_no, yesno_dimension);
+
+        if (ImGui::InputText("Output directory", output_dir, sizeof(output_dir)))
+            output_dir_valid = isDirectory(output_dir, true);
         ImGui::SameLine();
         ImGui::SetCursorPosX(yesno_pos);
-        if (output_dir_valid)
-            ImGui::Image(tex_yesno, yesno_dimension,
-                        ImVec2(TEX_YES_UL_X / tex_yesno_width, TEX_YES_UL_Y / tex_yesno_height),
-                        ImVec2(TEX_YES_RB_X / tex_yesno_width, TEX_YES_RB_Y / tex_yesno_height));
-        else
-            ImGui::Image(tex_yesno, yesno_dimension,
-                        ImVec2(TEX_NO_UL_X / tex_yesno_width, TEX_NO_UL_Y / tex_yesno_height),
-                        ImVec2(TEX_NO_RB_X / tex_yesno_width, TEX_NO_RB_Y / tex_yesno_height));
+        icons.draw(output_dir_valid ? icon_yes : icon_no, yesno_dimension);
+        ImGui::PopItemWidth();
+        ImGui::Checkbox("Batch I/O with io_uring", &use_io_uring);
+        ImGui::SameLine();
+        ImGui::Checkbox("Store videos as chunks", &chunk_videos);
+        ImGui::SameLine();
+        ImGui::Checkbox("Keep RAW+JPEG and Live Photos together", &group_shots);
+        ImGui::SameLine();
+        ImGui::Checkbox("Sort into YYYY/MM/DD", &date_layout);
+        ImGui::Checkbox("Adapt NAS writers", &adapt_writers);
+        ImGui::SameLine();
+        ImGui::PushItemWidth(ImGui::CalcTextSize("000 - 000").x * 2.0f);
+        ImGui::DragIntRange2("Writers", &writers_min, &writers_max, 0.1f, 1, 64);
         ImGui::PopItemWidth();
 
+        bool running = engine.getState() == BACKUP_RUNNING;
+        const char *btn_label = running ? "Cancel" : "Start";
         ImGui::PushFont(font_large);
-        float start_btn_pos = (window_width - (ImGui::CalcTextSize("Start").x + BTN_FILL_WIDTH * 4)) * 0.5f;
+        float start_btn_pos = (window_width - (ImGui::CalcTextSize(btn_label).x + BTN_FILL_WIDTH * 4)) * 0.5f;
         ImGui::SetCursorPosX(start_btn_pos);
-        ImGui::Button("Start", ImVec2(ImGui::CalcTextSize("Start").x + BTN_FILL_WIDTH * 4,
-                               ImGui::CalcTextSize("Start").y + BTN_FILL_WIDTH));
+        if (ImGui::Button(btn_label, ImVec2(ImGui::CalcTextSize(btn_label).x + BTN_FILL_WIDTH * 4,
+                               ImGui::CalcTextSize(btn_label).y + BTN_FILL_WIDTH))) {
+            if (running) {
+                engine.cancel();
+                thumbnailer.cancel();
+            } else if (import_dir_valid && output_dir_valid) {
+                BackupConfig config;
+                config.importDir = import_dir;
+                config.outputDir = output_dir;
+                config.photoHashFile = photo_hash_file;
+                config.videoHashFile = video_hash_file;
+                config.ioBackend = use_io_uring ? IO_BACKEND_URING : IO_BACKEND_THREADS;
+                config.chunkVideos = chunk_videos;
+                config.groupCompanions = group_shots;
+                config.layout = date_layout ? OUTPUT_LAYOUT_DATE : OUTPUT_LAYOUT_MIRROR;
+                config.adaptiveCopy = adapt_writers;
+                config.copyWorkersMin = writers_min;
+                config.copyWorkersMax = writers_max;
+                // The engine clamps the starting count into the bounds
+                config.copyWorkers = adapt_writers ? 2 : writers_max;
+                if (engine.start(config)) {
+                    progress_panel.reset();
+                    thumb_grid.reset(gui_helper);
+                    thumbnailer.start(import_dir, output_dir);
+                }
+            }
+        }
         ImGui::PopFont();
+
+        // The engine only publishes atomic counters, summing them once per frame never blocks it
+        if (engine.getState() != BACKUP_IDLE) {
+            BackupTotals totals;
+            engine.getTotals(&totals);
+            progress_panel.update(totals, ImGui::GetTime());
+            progress_panel.draw(totals);
+        }
+        if (thumbnailer.getFound() > 0)
+            thumb_grid.draw(gui_helper, thumbnailer);
         ImGui::End();
 
         // Rendering
@@ -162,6 +204,12 @@ int main(int, char**)
         ImDrawData* draw_data = ImGui::GetDrawData();
         gui_helper.drawFrame(draw_data);
     }
+    engine.cancel();
+    engine.wait();
+    thumbnailer.cancel();
+    thumbnailer.wait();
+    thumb_grid.reset(gui_helper);
+    icons.reset(gui_helper);
     vkDeviceWaitIdle(gui_helper.getDevice());
 
     ImGui_ImplVulkan_Shutdown();
@@ -0,0 +1,462 @@
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "media_meta.h"
+
+#define TAG_DATE_TIME           0x0132
+#define TAG_EXIF_IFD            0x8769
+#define TAG_DATE_TIME_ORIGINAL  0x9003
+#define TAG_JPEG_OFFSET         0x0201
+#define TAG_JPEG_LENGTH         0x0202
+#define EXIF_DATE_LEN           19          // "YYYY:MM:DD HH:MM:SS"
+#define MP4_EPOCH_OFFSET        2082844800LL // 1904-01-01 to 1970-01-01
+
+static inline uint32_t fourcc(const char *s)
+{
+    return ((uint32_t)(uint8_t)s[0] << 24) | ((uint32_t)(uint8_t)s[1] << 16) |
+           ((uint32_t)(uint8_t)s[2] << 8) | (uint32_t)(uint8_t)s[3];
+}
+
+static inline uint16_t get16(const uint8_t *p, bool le)
+{
+    return le ? (uint16_t)(p[0] | p[1] << 8) : (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static inline uint32_t get32(const uint8_t *p, bool le)
+{
+    return le ? (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24
+              : (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+static inline uint64_t get64(const uint8_t *p)
+{
+    return (uint64_t)get32(p, false) << 32 | get32(p + 4, false);
+}
+
+/* The bytes of a file as the parsers see them: the head the caller already
+ * read, then a small window that is refilled with pread() on demand. A
+ * pointer returned by at() is only valid until the next call.
+ */
+struct MetaSource {
+    int fd;
+    const uint8_t *head;
+    size_t headLen;
+    uint64_t fileLen;
+    uint64_t windowOff;
+    size_t windowLen;
+    uint8_t window[MEDIA_META_WINDOW_LEN];
+
+    const uint8_t *at(uint64_t off, size_t len)
+    {
+        if (len > sizeof(window) || off > fileLen || len > fileLen - off)
+            return nullptr;
+        if (off + len <= headLen)
+            return head + off;
+        if (off >= windowOff && off + len <= windowOff + windowLen)
+            return window + (off - windowOff);
+        if (fd < 0)
+            return nullptr;
+        ssize_t n;
+        do {
+            n = pread(fd, window, sizeof(window), off);
+        } while (n < 0 && errno == EINTR);
+        if (n < (ssize_t)len) {
+            windowLen = 0;
+            return nullptr;
+        }
+        windowOff = off;
+        windowLen = n;
+        return window;
+    }
+
+    // Big endian integer of 0, 2, 4 or 8 bytes, as the variable size fields of an iloc box
+    bool uint(uint64_t off, unsigned size, uint64_t *value)
+    {
+        if (size == 0) {
+            *value = 0;
+            return true;
+        }
+        const uint8_t *p = at(off, size);
+        if (p == nullptr)
+            return false;
+        *value = size == 2 ? get16(p, false) : size == 4 ? get32(p, false) : size == 8 ? get64(p) : 0;
+        return size == 2 || size == 4 || size == 8;
+    }
+};
+
+int64_t mediaWallClock(int64_t utc)
+{
+    time_t t = (time_t)utc;
+    struct tm tm;
+    if (localtime_r(&t, &tm) == nullptr)
+        return 0;
+    return (int64_t)timegm(&tm);
+}
+
+static bool parseDigits(const uint8_t *p, int len, int *value)
+{
+    *value = 0;
+    for (int i = 0; i < len; i++) {
+        if (p[i] < '0' || p[i] > '9')
+            return false;
+        *value = *value * 10 + (p[i] - '0');
+    }
+    return true;
+}
+
+// Cameras that never had their clock set write blanks or zeros, those are no time
+static bool parseExifDate(const uint8_t *p, int64_t *time)
+{
+    int year, mon, day, hour, min, sec;
+    if (!parseDigits(p, 4, &year) || !parseDigits(p + 5, 2, &mon) || !parseDigits(p + 8, 2, &day) ||
+        !parseDigits(p + 11, 2, &hour) || !parseDigits(p + 14, 2, &min) || !parseDigits(p + 17, 2, &sec))
+        return false;
+    if (year < 1970 || mon < 1 || mon > 12 || day < 1 || day > 31 || hour > 23 || min > 59 || sec > 60)
+        return false;
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    tm.tm_year = year - 1900;
+    tm.tm_mon = mon - 1;
+    tm.tm_mday = day;
+    tm.tm_hour = hour;
+    tm.tm_min = min;
+    tm.tm_sec = sec;
+    *time = (int64_t)timegm(&tm);
+    return true;
+}
+
+// Value or offset field of a tag of the IFD at ifd, offsets relative to the TIFF header at base
+static bool tiffTag(MetaSource &src, uint64_t base, bool le, uint32_t ifd, uint16_t tag, uint32_t *value)
+{
+    const uint8_t *p = src.at(base + ifd, 2);
+    if (p == nullptr)
+        return false;
+    uint16_t entries = get16(p, le);
+    for (uint16_t i = 0; i < entries; i++) {
+        p = src.at(base + ifd + 2 + 12 * (uint64_t)i, 12);
+        if (p == nullptr)
+            return false;
+        if (get16(p, le) == tag) {
+            *value = get32(p + 8, le);
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool tiffDate(MetaSource &src, uint64_t base, bool le, uint32_t ifd, uint16_t tag, int64_t *time)
+{
+    uint32_t offset;
+    if (!tiffTag(src, base, le, ifd, tag, &offset))
+        return false;
+    const uint8_t *p = src.at(base + offset, EXIF_DATE_LEN);
+    return p != nullptr && parseExifDate(p, time);
+}
+
+/* A TIFF structure at base: a plain TIFF raw, the APP1 segment of a JPEG or
+ * the Exif item of a HEIC. DateTime in IFD0 is when the file was last
+ * written, DateTimeOriginal in the Exif IFD when the shutter fired.
+ */
+static bool tiffHeader(MetaSource &src, uint64_t base, bool *le, uint32_t *ifd0)
+{
+    const uint8_t *p = src.at(base, 8);
+    if (p == nullptr || !(p[0] == p[1] && (p[0] == 'I' || p[0] == 'M')))
+        return false;
+    *le = p[0] == 'I';
+    // 42 for TIFF, ORF and RW2 put their own magic there and keep the layout
+    uint16_t magic = get16(p + 2, *le);
+    if (magic != 42 && magic != 0x4f52 && magic != 0x5352 && magic != 0x55)
+        return false;
+    *ifd0 = get32(p + 4, *le);
+    return true;
+}
+
+static bool parseTiff(MetaSource &src, uint64_t base, int64_t *time)
+{
+    bool le;
+    uint32_t ifd0;
+    if (!tiffHeader(src, base, &le, &ifd0))
+        return false;
+
+    uint32_t exif_ifd;
+    if (tiffTag(src, base, le, ifd0, TAG_EXIF_IFD, &exif_ifd) &&
+        tiffDate(src, base, le, exif_ifd, TAG_DATE_TIME_ORIGINAL, time))
+        return true;
+    return tiffDate(src, base, le, ifd0, TAG_DATE_TIME, time);
+}
+
+/* IFD1 describes the thumbnail, it follows the entries of IFD0. Its JPEG
+ * lives inside the TIFF structure, at an offset relative to base.
+ */
+static bool parseTiffThumbnail(MetaSource &src, uint64_t base, uint64_t *offset, uint32_t *len)
+{
+    bool le;
+    uint32_t ifd0;
+    if (!tiffHeader(src, base, &le, &ifd0))
+        return false;
+    const uint8_t *p = src.at(base + ifd0, 2);
+    if (p == nullptr)
+        return false;
+    p = src.at(base + ifd0 + 2 + 12 * (uint64_t)get16(p, le), 4);
+    if (p == nullptr)
+        return false;
+    uint32_t ifd1 = get32(p, le);
+    uint32_t jpeg_offset, jpeg_len;
+    if (ifd1 == 0 || !tiffTag(src, base, le, ifd1, TAG_JPEG_OFFSET, &jpeg_offset) ||
+        !tiffTag(src, base, le, ifd1, TAG_JPEG_LENGTH, &jpeg_len) || jpeg_len == 0 ||
+        base + jpeg_offset > src.fileLen || jpeg_len > src.fileLen - base - jpeg_offset)
+        return false;
+    *offset = base + jpeg_offset;
+    *len = jpeg_len;
+    return true;
+}
+
+// Segments up to the start of the image data, the EXIF sits in APP1 right after SOI
+static bool jpegExif(MetaSource &src, uint64_t *base)
+{
+    uint64_t pos = 2;
+    for (;;) {
+        const uint8_t *p = src.at(pos, 4);
+        if (p == nullptr || p[0] != 0xFF)
+            return false;
+        uint8_t marker = p[1];
+        if (marker == 0xFF) {
+            pos++;
+            continue;
+        }
+        // Start of scan or end of image, no EXIF follows
+        if (marker == 0xDA || marker == 0xD9)
+            return false;
+        uint16_t len = get16(p + 2, false);
+        if (marker == 0xE1) {
+            p = src.at(pos + 4, 6);
+            if (p != nullptr && memcmp(p, "Exif\0\0", 6) == 0) {
+                *base = pos + 10;
+                return true;
+            }
+        }
+        pos += 2 + len;
+    }
+}
+
+static bool parseJpeg(MetaSource &src, int64_t *time)
+{
+    uint64_t base;
+    return jpegExif(src, &base) && parseTiff(src, base, time);
+}
+
+struct Box {
+    uint64_t offset;
+    uint64_t size;
+    uint32_t type;
+    uint32_t headerLen;
+};
+
+// The box at off, which must end by end. A size of 0 runs to end
+static bool readBox(MetaSource &src, uint64_t off, uint64_t end, Box *box)
+{
+    const uint8_t *p = src.at(off, 8);
+    if (p == nullptr)
+        return false;
+    box->offset = off;
+    box->size = get32(p, false);
+    box->type = get32(p + 4, false);
+    box->headerLen = 8;
+    if (box->size == 1) {
+        p = src.at(off + 8, 8);
+        if (p == nullptr)
+            return false;
+        box->size = get64(p);
+        box->headerLen = 16;
+    } else if (box->size == 0) {
+        box->size = end - off;
+    }
+    return box->size >= box->headerLen && box->size <= end - off;
+}
+
+// First child of the given type, children start at first
+static bool findChild(MetaSource &src, const Box &parent, uint64_t first, uint32_t type, Box *child)
+{
+    uint64_t end = parent.offset + parent.size;
+    for (uint64_t off = first; off < end; off += child->size) {
+        if (!readBox(src, off, end, child))
+            return false;
+        if (child->type == type)
+            return true;
+    }
+    return false;
+}
+
+static bool parseMvhd(MetaSource &src, const Box &moov, int64_t *time)
+{
+    Box mvhd;
+    if (!findChild(src, moov, moov.offset + moov.headerLen, fourcc("mvhd"), &mvhd))
+        return false;
+    const uint8_t *p = src.at(mvhd.offset + mvhd.headerLen, 12);
+    if (p == nullptr)
+        return false;
+    // Seconds since 1904 in UTC, 0 from devices that do not know the time
+    int64_t created = p[0] == 1 ? (int64_t)get64(p + 4) : (int64_t)get32(p + 4, false);
+    if (created <= MP4_EPOCH_OFFSET)
+        return false;
+    *time = mediaWallClock(created - MP4_EPOCH_OFFSET);
+    return *time > 0;
+}
+
+// Item id of the Exif item listed in iinf
+static bool heifExifItem(MetaSource &src, const Box &iinf, uint32_t *item_id)
+{
+    const uint8_t *p = src.at(iinf.offset + iinf.headerLen, 4);
+    if (p == nullptr)
+        return false;
+    uint64_t first = iinf.offset + iinf.headerLen + (p[0] == 0 ? 6 : 8);
+    uint64_t end = iinf.offset + iinf.size;
+    Box infe;
+    for (uint64_t off = first; off < end; off += infe.size) {
+        if (!readBox(src, off, end, &infe))
+            return false;
+        if (infe.type != fourcc("infe"))
+            continue;
+        // Versions 2 and 3 carry the item type, 16 and 32 bit ids
+        p = src.at(infe.offset + infe.headerLen, 14);
+        if (p == nullptr || p[0] < 2)
+            continue;
+        uint32_t id = p[0] == 2 ? get16(p + 4, false) : get32(p + 4, false);
+        uint32_t type = p[0] == 2 ? get32(p + 8, false) : get32(p + 10, false);
+        if (type == fourcc("Exif")) {
+            *item_id = id;
+            return true;
+        }
+    }
+    return false;
+}
+
+// File offset of the first extent of an item, only items stored in the file itself
+static bool heifItemOffset(MetaSource &src, const Box &iloc, uint32_t item_id, uint64_t *offset)
+{
+    uint64_t pos = iloc.offset + iloc.headerLen;
+    const uint8_t *p = src.at(pos, 8);
+    if (p == nullptr)
+        return false;
+    unsigned version = p[0];
+    unsigned offset_size = p[4] >> 4, length_size = p[4] & 15;
+    unsigned base_size = p[5] >> 4, index_size = version >= 1 ? p[5] & 15 : 0;
+    uint64_t items;
+    pos += 6;
+    if (!src.uint(pos, version < 2 ? 2 : 4, &items))
+        return false;
+    pos += version < 2 ? 2 : 4;
+
+    for (uint64_t i = 0; i < items; i++) {
+        uint64_t id, method = 0, base, extents;
+        if (!src.uint(pos, version < 2 ? 2 : 4, &id))
+            return false;
+        pos += version < 2 ? 2 : 4;
+        if (version >= 1) {
+            if (!src.uint(pos, 2, &method))
+                return false;
+            method &= 15;
+            pos += 2;
+        }
+        pos += 2;               // data reference index
+        if (!src.uint(pos, base_size, &base))
+            return false;
+        pos += base_size;
+        if (!src.uint(pos, 2, &extents))
+            return false;
+        pos += 2;
+        if (id == item_id) {
+            uint64_t extent_offset;
+            if (method != 0 || extents == 0 || !src.uint(pos + index_size, offset_size, &extent_offset))
+                return false;
+            *offset = base + extent_offset;
+            return true;
+        }
+        pos += extents * (index_size + offset_size + length_size);
+    }
+    return false;
+}
+
+/* HEIF keeps the EXIF as an item: iinf names it, iloc says where it is. The
+ * item data starts with the offset of the TIFF header behind "Exif\0\0".
+ */
+static bool parseHeifMeta(MetaSource &src, const Box &meta, int64_t *time)
+{
+    uint64_t first = meta.offset + meta.headerLen + 4;
+    Box iinf, iloc;
+    uint32_t item_id;
+    uint64_t offset;
+    if (!findChild(src, meta, first, fourcc("iinf"), &iinf) || !heifExifItem(src, iinf, &item_id) ||
+        !findChild(src, meta, first, fourcc("iloc"), &iloc) || !heifItemOffset(src, iloc, item_id, &offset))
+        return false;
+    const uint8_t *p = src.at(offset, 4);
+    return p != nullptr && parseTiff(src, offset + 4 + get32(p, false), time);
+}
+
+// ISO media files: HEIC and AVIF photos, MP4, MOV and 3GP videos
+static bool parseIsoMedia(MetaSource &src, int64_t *time)
+{
+    uint64_t off = 0;
+    Box box;
+    for (int i = 0; i < MEDIA_META_MAX_BOXES && off < src.fileLen; i++, off += box.size) {
+        if (!readBox(src, off, src.fileLen, &box))
+            return false;
+        if (box.type == fourcc("meta") && parseHeifMeta(src, box, time))
+            return true;
+        if (box.type == fourcc("moov"))
+            return parseMvhd(src, box, time);
+    }
+    return false;
+}
+
+static bool isIsoMedia(const uint8_t *head, size_t head_len)
+{
+    if (head_len < 8)
+        return false;
+    uint32_t type = get32(head + 4, false);
+    // QuickTime files from before ftyp start straight with one of these
+    return type == fourcc("ftyp") || type == fourcc("moov") || type == fourcc("mdat") ||
+           type == fourcc("wide") || type == fourcc("free") || type == fourcc("skip");
+}
+
+static void initSource(MetaSource &src, int fd, const uint8_t *head, size_t head_len)
+{
+    src.fd = fd;
+    src.head = head;
+    src.headLen = head_len;
+    src.fileLen = head_len;
+    src.windowOff = 0;
+    src.windowLen = 0;
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0 && (uint64_t)st.st_size > head_len)
+        src.fileLen = st.st_size;
+}
+
+bool mediaCaptureTime(int fd, const uint8_t *head, size_t head_len, int64_t *time)
+{
+    MetaSource src;
+    initSource(src, fd, head, head_len);
+
+    if (head_len >= 2 && head[0] == 0xFF && head[1] == 0xD8)
+        return parseJpeg(src, time);
+    if (head_len >= 8 && (head[0] == 'I' || head[0] == 'M') && head[0] == head[1])
+        return parseTiff(src, 0, time);
+    if (isIsoMedia(head, head_len))
+        return parseIsoMedia(src, time);
+    return false;
+}
+
+bool mediaExifThumbnail(int fd, const uint8_t *head, size_t head_len, uint64_t *offset, uint32_t *len)
+{
+    MetaSource src;
+    initSource(src, fd, head, head_len);
+
+    uint64_t base;
+    if (head_len >= 2 && head[0] == 0xFF && head[1] == 0xD8)
+        return jpegExif(src, &base) && parseTiffThumbnail(src, base, offset, len);
+    if (head_len >= 8 && (head[0] == 'I' || head[0] == 'M') && head[0] == head[1])
+        return parseTiffThumbnail(src, 0, offset, len);
+    return false;
+}
@@ -0,0 +1,38 @@
+#ifndef _MEDIA_META_H
+#define _MEDIA_META_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Enough for the EXIF of a JPEG or a TIFF based raw, and the boxes in front of the data of a HEIC or MP4
+#define MEDIA_META_HEAD_LEN     (64 * 1024)
+// Reads past the head go through a window of this size on the stack
+#define MEDIA_META_WINDOW_LEN   4096
+// Top-level boxes followed before a QuickTime file is given up on
+#define MEDIA_META_MAX_BOXES    64
+
+/* Capture times are wall clock seconds since 1970 as the camera showed them,
+ * timegm() of the local date and time, so that gmtime_r() gives back the day
+ * the shot was taken on wherever it was taken.
+ */
+int64_t mediaWallClock(int64_t utc);
+
+/* Finds the capture time of a photo or video:
+ *   JPEG and TIFF based raws (CR2, NEF, ARW, DNG, ORF, RW2, PEF, SRW)
+ *     EXIF DateTimeOriginal, else DateTime
+ *   HEIC / HEIF / AVIF                  DateTimeOriginal of the Exif item
+ *   MP4 / MOV / 3GP                     mvhd creation time
+ * head holds the first head_len bytes of the file, usually the first read of
+ * the hash pass. Whatever lies beyond it is read with pread() on fd, a few
+ * small reads at most, so the file offset is left alone. Nothing is allocated.
+ * False when the format is unknown or carries no usable time.
+ */
+bool mediaCaptureTime(int fd, const uint8_t *head, size_t head_len, int64_t *time);
+
+/* Finds the preview JPEG a camera embeds in IFD1 of the EXIF of a JPEG or a
+ * TIFF based raw, usually 160x120. offset is from the start of the file.
+ * Reads the same way as mediaCaptureTime(). False when there is none.
+ */
+bool mediaExifThumbnail(int fd, const uint8_t *head, size_t head_len, uint64_t *offset, uint32_t *len);
+
+#endif
@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include "imgui.h"
+#include "progress_panel.h"
+
+#define PLOT_HEIGHT         60.0f
+#define RATE_SMOOTHING      0.2
+
+void ProgressPanel::reset(void)
+{
+    for (auto &plot : history)
+        for (auto &v : plot)
+            v = 0.0f;
+    historyPos = 0;
+    historyLen = 0;
+    lastSample = -1.0;
+    lastFiles = 0;
+    lastBytes = 0;
+    filesRate = 0.0;
+    mbRate = 0.0;
+}
+
+void ProgressPanel::update(const BackupTotals &totals, double now)
+{
+    uint64_t files = filesProcessed(totals);
+    uint64_t bytes = totals.get(STAT_BYTES_COPIED);
+
+    if (lastSample < 0.0) {
+        lastSample = now;
+        lastFiles = files;
+        lastBytes = bytes;
+        return;
+    }
+    double elapsed = now - lastSample;
+    if (elapsed < PROGRESS_SAMPLE_INTERVAL)
+        return;
+
+    double files_rate = (files - lastFiles) / elapsed;
+    double mb_rate = (bytes - lastBytes) / elapsed / 1e6;
+    // An exponential average keeps the ETA from jumping with every big file
+    if (historyLen == 0) {
+        filesRate = files_rate;
+        mbRate = mb_rate;
+    } else {
+        filesRate += (files_rate - filesRate) * RATE_SMOOTHING;
+        mbRate += (mb_rate - mbRate) * RATE_SMOOTHING;
+    }
+
+    history[PROGRESS_FILES_RATE][historyPos] = (float)files_rate;
+    history[PROGRESS_MB_RATE][historyPos] = (float)mb_rate;
+    history[PROGRESS_HASH_QUEUE][historyPos] = (float)totals.hashQueued;
+    history[PROGRESS_DEDUP_QUEUE][historyPos] = (float)totals.dedupQueued;
+    history[PROGRESS_COPY_QUEUE][historyPos] = (float)totals.copyQueued;
+    history[PROGRESS_VERIFY_QUEUE][historyPos] = (float)totals.verifyQueued;
+    history[PROGRESS_COPY_LIMIT][historyPos] = (float)totals.copyLimit;
+    historyPos = (historyPos + 1) % PROGRESS_HISTORY_LEN;
+    if (historyLen < PROGRESS_HISTORY_LEN)
+        historyLen++;
+
+    lastSample = now;
+    lastFiles = files;
+    lastBytes = bytes;
+}
+
+void ProgressPanel::plot(ProgressPlot which, const char *label, const char *fmt, double value)
+{
+    char overlay[64];
+
+    snprintf(overlay, sizeof(overlay), fmt, value);
+    // Until the ring fills, plot only the samples taken so far, oldest first
+    int offset = historyLen < PROGRESS_HISTORY_LEN ? 0 : historyPos;
+    ImGui::PlotLines(label, history[which], historyLen, offset, overlay, 0.0f, FLT_MAX,
+                     ImVec2(ImGui::GetContentRegionAvail().x, PLOT_HEIGHT));
+}
+
+void ProgressPanel::draw(const BackupTotals &totals)
+{
+    uint64_t scanned = totals.get(STAT_FILES_SCANNED);
+    uint64_t done = filesProcessed(totals) + totals.get(STAT_FILES_RESUMED);
+    float progress = scanned > 0 ? (float)done / (float)scanned : 0.0f;
+    char eta[32] = "";
+
+    // The total is only known once the walker is done
+    if (totals.scanDone && filesRate > 0.0 && done < scanned) {
+        unsigned long secs = (unsigned long)((scanned - done) / filesRate);
+        snprintf(eta, sizeof(eta), "ETA %lu:%02lu:%02lu", secs / 3600, secs / 60 % 60, secs % 60);
+    }
+    ImGui::ProgressBar(totals.scanDone ? progress : 0.0f, ImVec2(-1.0f, 0.0f), eta[0] != '\0' ? eta : nullptr);
+    ImGui::Text("Scanned %lu%s (%.0f files/s), resumed %lu, unchanged %lu, copied %lu, duplicates %lu, failed %lu",
+                (unsigned long)scanned, totals.scanDone ? "" : "...", totals.scanRate,
+                (unsigned long)totals.get(STAT_FILES_RESUMED),
+                (unsigned long)totals.get(STAT_FILES_CACHED),
+                (unsigned long)totals.get(STAT_FILES_VERIFIED),
+                (unsigned long)totals.get(STAT_FILES_DUPLICATE),
+                (unsigned long)totals.get(STAT_FILES_FAILED));
+    ImGui::Text("Copy path: reflink %lu, copy_file_range %lu, sendfile %lu, read/write %lu, io_uring %lu, read back %lu",
+                (unsigned long)totals.get((StatCounter)(STAT_COPY_METHOD + COPY_METHOD_REFLINK)),
+                (unsigned long)totals.get((StatCounter)(STAT_COPY_METHOD + COPY_METHOD_COPY_FILE_RANGE)),
+                (unsigned long)totals.get((StatCounter)(STAT_COPY_METHOD + COPY_METHOD_SENDFILE)),
+                (unsigned long)totals.get((StatCounter)(STAT_COPY_METHOD + COPY_METHOD_READ_WRITE)),
+                (unsigned long)totals.get((StatCounter)(STAT_COPY_METHOD + COPY_METHOD_IO_URING)),
+                (unsigned long)totals.get(STAT_FILES_READ_BACK));
+    uint64_t grouped = totals.get(STAT_FILES_GROUPED);
+    if (grouped > 0)
+        ImGui::Text("Grouped: %lu files travel with the shot they belong to, %lu index lookups",
+                    (unsigned long)grouped, (unsigned long)totals.get(STAT_INDEX_LOOKUPS));
+    uint64_t chunk_bytes = totals.get(STAT_CHUNK_BYTES);
+    if (chunk_bytes > 0) {
+        uint64_t chunk_new = totals.get(STAT_CHUNK_BYTES_NEW);
+        uint64_t chunk_nanos = totals.get(STAT_CHUNK_NANOS);
+        ImGui::Text("Chunks: %lu, %lu new, dedup %.2fx, chunking %.0f MB/s",
+                    (unsigned long)totals.get(STAT_CHUNKS), (unsigned long)totals.get(STAT_CHUNKS_NEW),
+                    chunk_new > 0 ? (double)chunk_bytes / chunk_new : 0.0,
+                    chunk_nanos > 0 ? chunk_bytes * 1e3 / chunk_nanos : 0.0);
+    }
+
+    plot(PROGRESS_FILES_RATE, "##files", "%.0f files/s", filesRate);
+    plot(PROGRESS_MB_RATE, "##mb", "%.1f MB/s", mbRate);
+    // Chosen by the engine from the measured write cost, flat when the bounds are equal
+    char writers_fmt[64];
+    snprintf(writers_fmt, sizeof(writers_fmt), "%%.0f NAS writers (%d - %d)", totals.copyLimitMin, totals.copyLimitMax);
+    plot(PROGRESS_COPY_LIMIT, "##writers", writers_fmt, (double)totals.copyLimit);
+    // A queue that stays full points at the stage after it as the bottleneck
+    ImGui::Columns(4, "queues", false);
+    plot(PROGRESS_HASH_QUEUE, "##hashq", "hash queue %.0f", (double)totals.hashQueued);
+    ImGui::NextColumn();
+    plot(PROGRESS_DEDUP_QUEUE, "##dedupq", "dedup queue %.0f", (double)totals.dedupQueued);
+    ImGui::NextColumn();
+    plot(PROGRESS_COPY_QUEUE, "##copyq", "copy queue %.0f", (double)totals.copyQueued);
+    ImGui::NextColumn();
+    plot(PROGRESS_VERIFY_QUEUE, "##verifyq", "verify queue %.0f", (double)totals.verifyQueued);
+    ImGui::Columns(1);
+}
@@ -0,0 +1,45 @@
+#ifndef _PROGRESS_PANEL_H
+#define _PROGRESS_PANEL_H
+
+#include "backup_engine.h"
+
+#define PROGRESS_HISTORY_LEN        120
+#define PROGRESS_SAMPLE_INTERVAL    0.5
+
+enum ProgressPlot {
+    PROGRESS_FILES_RATE = 0,
+    PROGRESS_MB_RATE,
+    PROGRESS_HASH_QUEUE,
+    PROGRESS_DEDUP_QUEUE,
+    PROGRESS_COPY_QUEUE,
+    PROGRESS_VERIFY_QUEUE,
+    PROGRESS_COPY_LIMIT,
+    PROGRESS_PLOT_COUNT
+};
+
+/* Throughput, queue depth and ETA of a running backup. The render loop
+ * aggregates the engine counters once per frame and hands them to update(),
+ * which samples a fixed ring of history every PROGRESS_SAMPLE_INTERVAL
+ * seconds, so drawing costs the same however long the import runs.
+ */
+class ProgressPanel
+{
+public:
+    void reset(void);
+    void update(const BackupTotals &totals, double now);
+    void draw(const BackupTotals &totals);
+
+private:
+    float history[PROGRESS_PLOT_COUNT][PROGRESS_HISTORY_LEN] = {};
+    int historyPos = 0;
+    int historyLen = 0;
+    double lastSample = -1.0;
+    uint64_t lastFiles = 0;
+    uint64_t lastBytes = 0;
+    double filesRate = 0.0;     // smoothed, for the ETA
+    double mbRate = 0.0;
+
+    void plot(ProgressPlot which, const char *label, const char *fmt, double value);
+};
+
+#endif
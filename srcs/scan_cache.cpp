@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "scan_cache.h"
+
+static bool writeAll(int fd, const void *data, size_t len)
+{
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool readAll(int fd, void *data, size_t len)
+{
+    uint8_t *p = static_cast<uint8_t *>(data);
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool ScanCache::load(const std::string &cache_path)
+{
+    clear();
+    path = cache_path;
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOENT)
+            return true;
+        fprintf(stderr, "Open scan cache %s failed: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    ScanCacheHeader header;
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0 && readAll(fd, &header, sizeof(header)) &&
+              memcmp(header.magic, SCAN_CACHE_MAGIC, sizeof(header.magic)) == 0;
+    // Older versions keyed on the mtime in whole seconds, their digests are not trusted and simply dropped
+    if (ok && header.version < SCAN_CACHE_VERSION) {
+        close(fd);
+        return true;
+    }
+    ok = ok && header.version == SCAN_CACHE_VERSION && header.entryLen == sizeof(ScanCacheEntry) &&
+         (uint64_t)st.st_size == sizeof(header) + header.count * sizeof(ScanCacheEntry);
+    if (!ok) {
+        fprintf(stderr, "Scan cache %s is not valid, every file is hashed again.\n", path.c_str());
+        close(fd);
+        return false;
+    }
+
+    std::vector<ScanCacheEntry> loaded(header.count);
+    ok = readAll(fd, loaded.data(), loaded.size() * sizeof(ScanCacheEntry));
+    close(fd);
+    if (!ok) {
+        fprintf(stderr, "Read scan cache %s failed: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+    entries.reserve(loaded.size());
+    for (const auto &entry : loaded)
+        entries[std::make_pair(entry.dev, entry.inode)] = entry;
+    return true;
+}
+
+bool ScanCache::lookup(uint64_t dev, uint64_t inode, uint64_t size, int64_t mtime, int64_t ctime, HashAlgo algo,
+        uint8_t *digest, int64_t *capture_time) const
+{
+    auto it = entries.find(std::make_pair(dev, inode));
+    if (it == entries.end())
+        return false;
+    const ScanCacheEntry &entry = it->second;
+    if (entry.size != size || entry.mtime != mtime || entry.ctime != ctime || entry.algorithm != (uint32_t)algo)
+        return false;
+    memcpy(digest, entry.digest, hashDigestLen(algo));
+    *capture_time = entry.captureTime;
+    return true;
+}
+
+void ScanCache::update(uint64_t dev, uint64_t inode, uint64_t size, int64_t mtime, int64_t ctime, HashAlgo algo,
+        const uint8_t *digest, int64_t capture_time)
+{
+    ScanCacheEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.dev = dev;
+    entry.inode = inode;
+    entry.size = size;
+    entry.mtime = mtime;
+    entry.ctime = ctime;
+    entry.algorithm = algo;
+    // Unsigned 32 bits last until 2106, anything outside is left unknown
+    entry.captureTime = capture_time > 0 && capture_time <= UINT32_MAX ? (uint32_t)capture_time : 0;
+    memcpy(entry.digest, digest, hashDigestLen(algo));
+
+    std::lock_guard<std::mutex> lock(updatesMutex);
+    updates.push_back(entry);
+}
+
+bool ScanCache::save(void)
+{
+    {
+        std::lock_guard<std::mutex> lock(updatesMutex);
+        if (updates.empty() || path.empty())
+            return true;
+        for (const auto &entry : updates)
+            entries[std::make_pair(entry.dev, entry.inode)] = entry;
+        updates.clear();
+    }
+
+    ScanCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SCAN_CACHE_MAGIC, sizeof(header.magic));
+    header.version = SCAN_CACHE_VERSION;
+    header.entryLen = sizeof(ScanCacheEntry);
+    header.count = entries.size();
+    std::vector<ScanCacheEntry> out;
+    out.reserve(entries.size());
+    for (const auto &it : entries)
+        out.push_back(it.second);
+
+    // Write next to the target and rename, a crash never leaves a torn cache behind
+    std::string tmp_path = path + ".tmp";
+    int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Create scan cache %s failed: %s\n", tmp_path.c_str(), strerror(errno));
+        return false;
+    }
+    bool ok = writeAll(fd, &header, sizeof(header)) &&
+              writeAll(fd, out.data(), out.size() * sizeof(ScanCacheEntry)) &&
+              fsync(fd) == 0;
+    close(fd);
+    if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        fprintf(stderr, "Write scan cache %s failed: %s\n", path.c_str(), strerror(errno));
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+void ScanCache::clear(void)
+{
+    entries.clear();
+    std::lock_guard<std::mutex> lock(updatesMutex);
+    updates.clear();
+}
+
+size_t ScanCache::size(void) const
+{
+    return entries.size();
+}
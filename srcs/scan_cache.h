@@ -0,0 +1,71 @@
+#ifndef _SCAN_CACHE_H
+#define _SCAN_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <unordered_map>
+#include "hasher.h"
+
+#define SCAN_CACHE_MAGIC        "WBSCAN1"
+#define SCAN_CACHE_VERSION      2
+
+/* On-disk layout, all integers little endian:
+ *   header | count fixed size entries
+ * An entry remembers the digest of a file, identified by device and inode,
+ * as it was when its size, mtime and ctime (in ns) were the recorded ones,
+ * and its capture time when that was looked up (wall clock seconds, 0
+ * unknown).
+ */
+struct ScanCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t entryLen;
+    uint64_t count;
+};
+
+struct ScanCacheEntry {
+    uint64_t dev;
+    uint64_t inode;
+    uint64_t size;
+    int64_t mtime;
+    int64_t ctime;
+    uint32_t algorithm;
+    uint32_t captureTime;
+    uint8_t digest[HASH_DIGEST_MAX_LEN];
+};
+
+/* Lookups only read the map loaded at the start of a run, so any number of
+ * hash workers may call them without a lock. New digests are queued under a
+ * mutex and merged by save(), which must not race with lookups.
+ */
+class ScanCache
+{
+public:
+    // A missing file is an empty cache, a corrupt one is ignored
+    bool load(const std::string &path);
+    bool lookup(uint64_t dev, uint64_t inode, uint64_t size, int64_t mtime, int64_t ctime, HashAlgo algo,
+            uint8_t *digest, int64_t *capture_time) const;
+    void update(uint64_t dev, uint64_t inode, uint64_t size, int64_t mtime, int64_t ctime, HashAlgo algo,
+            const uint8_t *digest, int64_t capture_time);
+    bool save(void);
+    void clear(void);
+    size_t size(void) const;
+
+private:
+    struct KeyHash {
+        size_t operator()(const std::pair<uint64_t, uint64_t> &key) const
+        {
+            return std::hash<uint64_t>()(key.second * 0x9E3779B97F4A7C15ULL ^ key.first);
+        }
+    };
+
+    std::string path;
+    std::unordered_map<std::pair<uint64_t, uint64_t>, ScanCacheEntry, KeyHash> entries;
+    std::mutex updatesMutex;
+    std::vector<ScanCacheEntry> updates;
+};
+
+#endif
@@ -0,0 +1,237 @@
+#include <string.h>
+#include "cpu_features.h"
+#include "sha256.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SHA256_X86
+#endif
+
+typedef void (*BlocksFn)(uint32_t state[8], const uint8_t *data, size_t blocks);
+
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t rotr(uint32_t x, int n)
+{
+    return (x >> n) | (x << (32 - n));
+}
+
+static void sha256_blocks_scalar(uint32_t state[8], const uint8_t *data, size_t blocks)
+{
+    uint32_t w[64];
+
+    while (blocks--) {
+        for (int i = 0; i < 16; i++)
+            w[i] = ((uint32_t)data[i * 4] << 24) | ((uint32_t)data[i * 4 + 1] << 16) |
+                   ((uint32_t)data[i * 4 + 2] << 8) | (uint32_t)data[i * 4 + 3];
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; i++) {
+            uint32_t S1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+            uint32_t ch = (e & f) ^ (~e & g);
+            uint32_t t1 = h + S1 + ch + K[i] + w[i];
+            uint32_t S0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+            uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+            uint32_t t2 = S0 + maj;
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+        data += SHA256_BLOCK_LEN;
+    }
+}
+
+#ifdef SHA256_X86
+/* SHA extensions: the state lives in two registers as ABEF/CDGH, every
+ * sha256rnds2 does two rounds and msg1/msg2 compute the message schedule
+ * four words at a time.
+ */
+__attribute__((target("sha,sse4.1,ssse3")))
+static void sha256_blocks_shani(uint32_t state[8], const uint8_t *data, size_t blocks)
+{
+    const __m128i shuffle_mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i tmp = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&state[0]));
+    __m128i state1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&state[4]));
+    tmp = _mm_shuffle_epi32(tmp, 0xB1);                 // CDAB
+    state1 = _mm_shuffle_epi32(state1, 0x1B);           // EFGH
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);   // ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);        // CDGH
+
+    while (blocks--) {
+        __m128i abef_save = state0;
+        __m128i cdgh_save = state1;
+        __m128i msg[4];
+
+        for (int g = 0; g < 16; g++) {
+            if (g < 4)
+                msg[g] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data) + g),
+                                          shuffle_mask);
+            __m128i m = _mm_add_epi32(msg[g & 3], _mm_loadu_si128(reinterpret_cast<const __m128i *>(&K[g * 4])));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, m);
+            if (g >= 3 && g <= 14) {
+                // W[g+1] = msg2(msg1(W[g-3], W[g-2]) + W[g-1..g] shifted, W[g])
+                __m128i t = _mm_alignr_epi8(msg[g & 3], msg[(g - 1) & 3], 4);
+                msg[(g + 1) & 3] = _mm_sha256msg2_epu32(_mm_add_epi32(msg[(g + 1) & 3], t), msg[g & 3]);
+            }
+            m = _mm_shuffle_epi32(m, 0x0E);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, m);
+            if (g >= 1 && g <= 12)
+                msg[(g - 1) & 3] = _mm_sha256msg1_epu32(msg[(g - 1) & 3], msg[g & 3]);
+        }
+
+        state0 = _mm_add_epi32(state0, abef_save);
+        state1 = _mm_add_epi32(state1, cdgh_save);
+        data += SHA256_BLOCK_LEN;
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);              // FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xB1);           // DCHG
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);        // DCBA
+    state1 = _mm_alignr_epi8(state1, tmp, 8);           // HGFE
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(&state[0]), state0);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(&state[4]), state1);
+}
+#endif
+
+static Sha256Kernel currentKernel = SHA256_KERNEL_AUTO;
+static BlocksFn sha256_blocks = sha256_blocks_scalar;
+
+bool sha256SetKernel(Sha256Kernel kernel)
+{
+#ifdef SHA256_X86
+    if (kernel == SHA256_KERNEL_AUTO)
+        kernel = cpuFeatures().shaNi ? SHA256_KERNEL_SHANI : SHA256_KERNEL_SCALAR;
+    if (kernel == SHA256_KERNEL_SHANI) {
+        if (!cpuFeatures().shaNi)
+            return false;
+        sha256_blocks = sha256_blocks_shani;
+    } else {
+        kernel = SHA256_KERNEL_SCALAR;
+        sha256_blocks = sha256_blocks_scalar;
+    }
+#else
+    if (kernel == SHA256_KERNEL_SHANI)
+        return false;
+    kernel = SHA256_KERNEL_SCALAR;
+#endif
+    currentKernel = kernel;
+    return true;
+}
+
+Sha256Kernel sha256GetKernel(void)
+{
+    if (currentKernel == SHA256_KERNEL_AUTO)
+        sha256SetKernel(SHA256_KERNEL_AUTO);
+    return currentKernel;
+}
+
+const char *sha256KernelName(Sha256Kernel kernel)
+{
+    switch (kernel) {
+    case SHA256_KERNEL_SCALAR:
+        return "scalar";
+    case SHA256_KERNEL_SHANI:
+        return "sha-ni";
+    default:
+        return "auto";
+    }
+}
+
+void Sha256::init(void)
+{
+    if (currentKernel == SHA256_KERNEL_AUTO)
+        sha256SetKernel(SHA256_KERNEL_AUTO);
+    state[0] = 0x6a09e667;
+    state[1] = 0xbb67ae85;
+    state[2] = 0x3c6ef372;
+    state[3] = 0xa54ff53a;
+    state[4] = 0x510e527f;
+    state[5] = 0x9b05688c;
+    state[6] = 0x1f83d9ab;
+    state[7] = 0x5be0cd19;
+    totalLen = 0;
+    blockLen = 0;
+}
+
+void Sha256::update(const void *data, size_t len)
+{
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+
+    totalLen += len;
+    if (blockLen > 0) {
+        size_t n = SHA256_BLOCK_LEN - blockLen;
+        if (n > len)
+            n = len;
+        memcpy(block + blockLen, p, n);
+        blockLen += n;
+        p += n;
+        len -= n;
+        if (blockLen < SHA256_BLOCK_LEN)
+            return;
+        sha256_blocks(state, block, 1);
+        blockLen = 0;
+    }
+
+    // Hash the whole blocks straight from the caller's buffer
+    size_t blocks = len / SHA256_BLOCK_LEN;
+    if (blocks > 0) {
+        sha256_blocks(state, p, blocks);
+        p += blocks * SHA256_BLOCK_LEN;
+        len -= blocks * SHA256_BLOCK_LEN;
+    }
+    if (len > 0) {
+        memcpy(block, p, len);
+        blockLen = len;
+    }
+}
+
+void Sha256::final(uint8_t digest[SHA256_DIGEST_LEN])
+{
+    uint64_t bits = totalLen * 8;
+
+    block[blockLen++] = 0x80;
+    if (blockLen > SHA256_BLOCK_LEN - 8) {
+        memset(block + blockLen, 0, SHA256_BLOCK_LEN - blockLen);
+        sha256_blocks(state, block, 1);
+        blockLen = 0;
+    }
+    memset(block + blockLen, 0, SHA256_BLOCK_LEN - 8 - blockLen);
+    for (int i = 0; i < 8; i++)
+        block[SHA256_BLOCK_LEN - 1 - i] = (uint8_t)(bits >> (i * 8));
+    sha256_blocks(state, block, 1);
+
+    for (int i = 0; i < 8; i++) {
+        digest[i * 4] = (uint8_t)(state[i] >> 24);
+        digest[i * 4 + 1] = (uint8_t)(state[i] >> 16);
+        digest[i * 4 + 2] = (uint8_t)(state[i] >> 8);
+        digest[i * 4 + 3] = (uint8_t)state[i];
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef _SHA256_H
+#define _SHA256_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHA256_DIGEST_LEN   32
+#define SHA256_BLOCK_LEN    64
+
+enum Sha256Kernel {
+    SHA256_KERNEL_AUTO = 0,
+    SHA256_KERNEL_SCALAR,
+    SHA256_KERNEL_SHANI
+};
+
+// Not thread safe, pick a kernel before any worker starts hashing
+bool sha256SetKernel(Sha256Kernel kernel);
+Sha256Kernel sha256GetKernel(void);
+const char *sha256KernelName(Sha256Kernel kernel);
+
+struct Sha256 {
+    uint32_t state[8];
+    uint64_t totalLen;
+    uint8_t block[SHA256_BLOCK_LEN];
+    size_t blockLen;
+
+    void init(void);
+    void update(const void *data, size_t len);
+    void final(uint8_t digest[SHA256_DIGEST_LEN]);
+};
+
+#endif
@@ -0,0 +1,3 @@
+// The decoder is shared by the texture loader and the thumbnail workers, compiled once here
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
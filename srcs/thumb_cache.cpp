@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "xxh3.h"
+#include "thumb_cache.h"
+
+static bool preadAll(int fd, void *data, size_t len, uint64_t off)
+{
+    uint8_t *p = static_cast<uint8_t *>(data);
+    while (len > 0) {
+        ssize_t n = pread(fd, p, len, off);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        off += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool pwriteAll(int fd, const void *data, size_t len, uint64_t off)
+{
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    while (len > 0) {
+        ssize_t n = pwrite(fd, p, len, off);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        p += n;
+        off += n;
+        len -= n;
+    }
+    return true;
+}
+
+static uint64_t recordCheck(const ThumbRecord &record)
+{
+    return xxh3_64(reinterpret_cast<const uint8_t *>(&record) + sizeof(record.check),
+                   sizeof(record) - sizeof(record.check));
+}
+
+ThumbCache::~ThumbCache()
+{
+    close();
+}
+
+bool ThumbCache::open(const std::string &cache_path)
+{
+    close();
+    path = cache_path;
+
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Open thumbnail cache %s failed: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+    if (!replay()) {
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+    return true;
+}
+
+// Hops from record header to record header, the pixels are not touched
+bool ThumbCache::replay(void)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        fprintf(stderr, "Stat thumbnail cache %s failed: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    ThumbCacheHeader header;
+    bool valid = (uint64_t)st.st_size >= sizeof(header) && preadAll(fd, &header, sizeof(header), 0) &&
+                 memcmp(header.magic, THUMB_CACHE_MAGIC, sizeof(header.magic)) == 0 &&
+                 header.version == THUMB_CACHE_VERSION && header.recordLen == sizeof(ThumbRecord);
+    if (!valid) {
+        if (st.st_size != 0)
+            fprintf(stderr, "Thumbnail cache %s is not valid, starting over.\n", path.c_str());
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, THUMB_CACHE_MAGIC, sizeof(header.magic));
+        header.version = THUMB_CACHE_VERSION;
+        header.recordLen = sizeof(ThumbRecord);
+        if (ftruncate(fd, 0) != 0 || !pwriteAll(fd, &header, sizeof(header), 0)) {
+            fprintf(stderr, "Write thumbnail cache %s failed: %s\n", path.c_str(), strerror(errno));
+            return false;
+        }
+        end = sizeof(header);
+        return true;
+    }
+
+    uint64_t pos = sizeof(header);
+    ThumbRecord record;
+    while (pos + sizeof(record) <= (uint64_t)st.st_size && preadAll(fd, &record, sizeof(record), pos)) {
+        uint64_t len = sizeof(record) + record.dataLen;
+        if (record.check != recordCheck(record) || pos + len > (uint64_t)st.st_size)
+            break;
+        entries[std::make_pair(record.dev, record.inode)] = std::make_pair(pos, record);
+        pos += len;
+    }
+    if (pos < (uint64_t)st.st_size) {
+        fprintf(stderr, "Thumbnail cache %s: dropping %lu bytes of a torn record.\n",
+                path.c_str(), (unsigned long)(st.st_size - pos));
+        if (ftruncate(fd, pos) != 0) {
+            fprintf(stderr, "Truncate thumbnail cache %s failed: %s\n", path.c_str(), strerror(errno));
+            return false;
+        }
+    }
+    end = pos;
+    return true;
+}
+
+void ThumbCache::close(void)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (fd >= 0) {
+        fdatasync(fd);
+        ::close(fd);
+        fd = -1;
+    }
+    entries.clear();
+    end = 0;
+}
+
+bool ThumbCache::isOpen(void) const
+{
+    return fd >= 0;
+}
+
+bool ThumbCache::contains(uint64_t dev, uint64_t inode, uint64_t size, int64_t mtime)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(std::make_pair(dev, inode));
+    return it != entries.end() && it->second.second.size == size && it->second.second.mtime == mtime;
+}
+
+bool ThumbCache::lookup(uint64_t dev, uint64_t inode, uint64_t size, int64_t mtime,
+        int *width, int *height, std::vector<uint8_t> &rgb)
+{
+    uint64_t offset;
+    ThumbRecord record;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(std::make_pair(dev, inode));
+        if (it == entries.end())
+            return false;
+        offset = it->second.first;
+        record = it->second.second;
+    }
+    if (record.size != size || record.mtime != mtime)
+        return false;
+
+    rgb.resize(record.dataLen);
+    if (!preadAll(fd, rgb.data(), rgb.size(), offset + sizeof(record)) ||
+        xxh3_64(rgb.data(), rgb.size()) != record.dataCheck)
+        return false;
+    *width = record.width;
+    *height = record.height;
+    return true;
+}
+
+bool ThumbCache::append(uint64_t dev, uint64_t inode, uint64_t size, int64_t mtime,
+        int width, int height, const uint8_t *rgb)
+{
+    ThumbRecord record;
+    memset(&record, 0, sizeof(record));
+    record.dev = dev;
+    record.inode = inode;
+    record.size = size;
+    record.mtime = mtime;
+    record.width = (uint16_t)width;
+    record.height = (uint16_t)height;
+    record.dataLen = (uint32_t)width * height * 3;
+    record.dataCheck = xxh3_64(rgb, record.dataLen);
+    record.check = recordCheck(record);
+
+    // Only the offset is taken under the lock, the writers then fill their ranges side by side
+    uint64_t offset;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (fd < 0)
+            return false;
+        offset = end;
+        end += sizeof(record) + record.dataLen;
+    }
+    if (!pwriteAll(fd, &record, sizeof(record), offset) ||
+        !pwriteAll(fd, rgb, record.dataLen, offset + sizeof(record))) {
+        fprintf(stderr, "Write thumbnail cache %s failed: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    entries[std::make_pair(dev, inode)] = std::make_pair(offset, record);
+    return true;
+}
+
+size_t ThumbCache::size(void)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.size();
+}
@@ -0,0 +1,83 @@
+#ifndef _THUMB_CACHE_H
+#define _THUMB_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <unordered_map>
+
+#define THUMB_CACHE_MAGIC       "WBTHUMB"
+#define THUMB_CACHE_VERSION     2
+
+/* On-disk layout, all integers little endian:
+ *   header | records
+ * A record is a ThumbRecord followed by dataLen bytes of RGB pixels, rows top
+ * to bottom. check is the XXH3 of the rest of the record header, dataCheck
+ * the XXH3 of the pixels. The first header that does not match marks the
+ * torn tail of a crashed run.
+ */
+struct ThumbCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordLen;
+};
+
+struct ThumbRecord {
+    uint64_t check;
+    uint64_t dataCheck;
+    uint64_t dev;
+    uint64_t inode;
+    uint64_t size;
+    int64_t mtime;              // in ns
+    uint16_t width;
+    uint16_t height;
+    uint32_t dataLen;
+};
+
+/* Thumbnails of the import directory packed into one file, so a hundred
+ * thousand of them cost one descriptor and no directory entries. Like the
+ * scan cache, a file is identified by device and inode and its thumbnail is
+ * valid while size and mtime are the recorded ones. open() only reads the
+ * record headers; pixels are read with pread() when looked up. Appends go to
+ * the end and are not synced, a crash loses at most the last few, which are
+ * simply made again. A file that changed leaves its old record behind.
+ * Any number of threads may look up and append at the same time.
+ */
+class ThumbCache
+{
+public:
+    ~ThumbCache();
+
+    // A missing file is created, a torn tail is cut off, a corrupt one is started over
+    bool open(const std::string &path);
+    void close(void);
+    bool isOpen(void) const;
+    // Whether lookup() would find it, without reading the pixels
+    bool contains(uint64_t dev, uint64_t inode, uint64_t size, int64_t mtime);
+    bool lookup(uint64_t dev, uint64_t inode, uint64_t size, int64_t mtime,
+            int *width, int *height, std::vector<uint8_t> &rgb);
+    bool append(uint64_t dev, uint64_t inode, uint64_t size, int64_t mtime,
+            int width, int height, const uint8_t *rgb);
+    size_t size(void);
+
+private:
+    struct KeyHash {
+        size_t operator()(const std::pair<uint64_t, uint64_t> &key) const
+        {
+            return std::hash<uint64_t>()(key.second * 0x9E3779B97F4A7C15ULL ^ key.first);
+        }
+    };
+
+    std::string path;
+    int fd = -1;
+    std::mutex mutex;
+    uint64_t end = 0;
+    // Offset of the record of every file
+    std::unordered_map<std::pair<uint64_t, uint64_t>, std::pair<uint64_t, ThumbRecord>, KeyHash> entries;
+
+    bool replay(void);
+};
+
+#endif
@@ -0,0 +1,199 @@
+#include <algorithm>
+#include <functional>
+#include "imgui.h"
+#include "thumb_grid.h"
+
+void ThumbGrid::reset(ImguiVulkanHelper &helper)
+{
+    for (auto &cell : cells)
+        releaseCell(helper, cell.second);
+    cells.clear();
+    arrived.clear();
+    firstId = 0;
+    endId = 0;
+    lastScroll = 0.0f;
+    scrollingUp = false;
+}
+
+// How many photos away from the view a cell is, 0 on screen
+uint32_t ThumbGrid::distance(uint32_t id) const
+{
+    if (id < firstId)
+        return firstId - id;
+    if (id >= endId)
+        return id - endId + 1;
+    return 0;
+}
+
+void ThumbGrid::releaseCell(ImguiVulkanHelper &helper, Cell &cell)
+{
+    if (cell.request != 0)
+        helper.cancelTexture(cell.request);
+    else
+        helper.releaseImage(cell.texture);
+}
+
+void ThumbGrid::pollUploads(ImguiVulkanHelper &helper)
+{
+    for (auto it = cells.begin(); it != cells.end();) {
+        Cell &cell = it->second;
+        if (cell.request == 0) {
+            ++it;
+            continue;
+        }
+        TextureStatus status = helper.pollTexture(cell.request, &cell.texture, nullptr, nullptr);
+        if (status == TEXTURE_PENDING) {
+            ++it;
+        } else if (status == TEXTURE_READY) {
+            cell.request = 0;
+            ++it;
+        } else {
+            // Asked for again by the next requestMissing()
+            it = cells.erase(it);
+        }
+    }
+}
+
+void ThumbGrid::evict(ImguiVulkanHelper &helper, size_t max)
+{
+    uint32_t keep = THUMB_GRID_KEEP_SCREENS * std::max(1u, endId - firstId);
+    for (auto it = cells.begin(); it != cells.end();) {
+        if (distance(it->first) > keep) {
+            releaseCell(helper, it->second);
+            it = cells.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    if (cells.size() <= max)
+        return;
+
+    // Still too many, the furthest go first
+    std::vector<std::pair<uint32_t, uint32_t>> by_distance;
+    by_distance.reserve(cells.size());
+    for (auto &cell : cells)
+        by_distance.emplace_back(distance(cell.first), cell.first);
+    size_t extra = cells.size() - max;
+    std::nth_element(by_distance.begin(), by_distance.begin() + extra, by_distance.end(),
+                     std::greater<std::pair<uint32_t, uint32_t>>());
+    for (size_t i = 0; i < extra; i++) {
+        auto it = cells.find(by_distance[i].second);
+        releaseCell(helper, it->second);
+        cells.erase(it);
+    }
+}
+
+void ThumbGrid::upload(ImguiVulkanHelper &helper, Thumbnailer &thumbnailer)
+{
+    pollUploads(helper);
+    arrived.clear();
+    if (thumbnailer.takeReady(arrived, THUMB_GRID_UPLOADS) == 0)
+        return;
+
+    evict(helper, THUMB_GRID_TEXTURE_MAX - arrived.size());
+    uint32_t keep = THUMB_GRID_KEEP_SCREENS * std::max(1u, endId - firstId);
+    for (Thumbnail &thumb : arrived) {
+        // Scrolled away while it was made
+        if (cells.count(thumb.id) != 0 || distance(thumb.id) > keep)
+            continue;
+        TextureRequest request = helper.createTextureAsync(std::move(thumb.rgba), thumb.width, thumb.height);
+        cells[thumb.id] = { NULL, request, thumb.width, thumb.height };
+    }
+}
+
+void ThumbGrid::drawCell(Thumbnailer &thumbnailer, uint32_t id)
+{
+    ImVec2 p0 = ImGui::GetCursorScreenPos();
+    ImVec2 p1 = ImVec2(p0.x + THUMB_GRID_CELL, p0.y + THUMB_GRID_CELL);
+    ImGui::Dummy(ImVec2(THUMB_GRID_CELL, THUMB_GRID_CELL));
+    ImDrawList *draw_list = ImGui::GetWindowDrawList();
+
+    auto it = cells.find(id);
+    if (it == cells.end() || it->second.texture == NULL) {
+        draw_list->AddRectFilled(p0, p1, ImGui::GetColorU32(ImGuiCol_FrameBg));
+        if (it == cells.end() && thumbnailer.isFailed(id))
+            draw_list->AddText(ImVec2(p0.x + ImGui::GetStyle().FramePadding.x, p0.y + ImGui::GetStyle().FramePadding.y),
+                               ImGui::GetColorU32(ImGuiCol_TextDisabled), "No preview");
+    } else {
+        // Centered in the cell, aspect kept
+        float scale = THUMB_GRID_CELL / std::max(it->second.width, it->second.height);
+        float w = it->second.width * scale;
+        float h = it->second.height * scale;
+        ImVec2 q0 = ImVec2(p0.x + (THUMB_GRID_CELL - w) * 0.5f, p0.y + (THUMB_GRID_CELL - h) * 0.5f);
+        draw_list->AddImage(it->second.texture, q0, ImVec2(q0.x + w, q0.y + h));
+    }
+    if (ImGui::IsItemHovered())
+        ImGui::SetTooltip("%s", thumbnailer.getRelPath(id).c_str());
+}
+
+// The view first, top to bottom, then a screen ahead nearest first, never more than the cap holds
+void ThumbGrid::requestMissing(Thumbnailer &thumbnailer, uint32_t count)
+{
+    wanted.clear();
+    size_t budget = THUMB_GRID_TEXTURE_MAX;
+    auto want = [&](uint32_t id) {
+        if (budget == 0)
+            return;
+        budget--;
+        if (cells.count(id) == 0)
+            wanted.push_back(id);
+    };
+
+    uint32_t prefetch = THUMB_GRID_PREFETCH_SCREENS * (endId - firstId);
+    for (uint32_t id = firstId; id < endId; id++)
+        want(id);
+    if (scrollingUp) {
+        for (uint32_t i = 1; i <= prefetch && i <= firstId; i++)
+            want(firstId - i);
+    } else {
+        for (uint32_t id = endId; id < count && id < endId + prefetch; id++)
+            want(id);
+    }
+    thumbnailer.request(wanted);
+}
+
+void ThumbGrid::draw(ImguiVulkanHelper &helper, Thumbnailer &thumbnailer)
+{
+    uint32_t count = (uint32_t)thumbnailer.getFound();
+    evict(helper, THUMB_GRID_TEXTURE_MAX);
+    upload(helper, thumbnailer);
+
+    const ImGuiStyle &style = ImGui::GetStyle();
+    float height = std::max(ImGui::GetContentRegionAvail().y, THUMB_GRID_CELL * 2.0f);
+    ImGui::BeginChild("Thumbnails", ImVec2(0.0f, height), true);
+    float scroll = ImGui::GetScrollY();
+    if (scroll != lastScroll)
+        scrollingUp = scroll < lastScroll;
+    lastScroll = scroll;
+
+    int columns = std::max(1, (int)((ImGui::GetContentRegionAvail().x + style.ItemSpacing.x) /
+                                    (THUMB_GRID_CELL + style.ItemSpacing.x)));
+    int rows = (int)((count + columns - 1) / columns);
+    int first_row = rows, end_row = 0;
+    ImGuiListClipper clipper;
+    clipper.Begin(rows, THUMB_GRID_CELL + style.ItemSpacing.y);
+    while (clipper.Step()) {
+        first_row = std::min(first_row, clipper.DisplayStart);
+        end_row = std::max(end_row, clipper.DisplayEnd);
+        for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; row++) {
+            for (int col = 0; col < columns; col++) {
+                uint32_t id = (uint32_t)(row * columns + col);
+                if (id >= count)
+                    break;
+                if (col > 0)
+                    ImGui::SameLine();
+                drawCell(thumbnailer, id);
+            }
+        }
+    }
+    ImGui::EndChild();
+
+    if (first_row < end_row) {
+        firstId = (uint32_t)(first_row * columns);
+        endId = std::min(count, (uint32_t)(end_row * columns));
+    } else {
+        firstId = 0;
+        endId = 0;
+    }
+    requestMissing(thumbnailer, count);
+}
@@ -0,0 +1,62 @@
+#ifndef _THUMB_GRID_H
+#define _THUMB_GRID_H
+
+#include <stdint.h>
+#include <vector>
+#include <unordered_map>
+#include "imgui_vulkan_helper.h"
+#include "thumbnailer.h"
+
+#define THUMB_GRID_CELL             128.0f
+// Screens of cells requested past the view, in the direction of the scroll
+#define THUMB_GRID_PREFETCH_SCREENS 1
+// Textures further than this many screens from the view are released
+#define THUMB_GRID_KEEP_SCREENS     3
+// Bounds the GPU memory of the grid, and stays far below IMGUI_IMPL_VULKAN_BINDLESS_TEXTURES
+#define THUMB_GRID_TEXTURE_MAX      192
+// Thumbnails handed to the helper's upload queue per frame, it batches the copies and never waits on them
+#define THUMB_GRID_UPLOADS          16
+
+/* The photos of the import as a scrolling grid of thumbnails. Rows go
+ * through ImGuiListClipper, so a frame only lays out the rows on screen
+ * whether the import has a hundred photos or a hundred thousand. Only the
+ * visible cells and one screen ahead of them are asked from the
+ * Thumbnailer; textures of cells scrolled far away are given back, and
+ * the count is capped so video memory stays bounded. Cells are
+ * identified by the number the Thumbnailer gave the photo, so resizing the
+ * window reflows the grid without touching a texture.
+ */
+class ThumbGrid
+{
+public:
+    // Releases every texture, for a new import or before the helper goes away
+    void reset(ImguiVulkanHelper &helper);
+    void draw(ImguiVulkanHelper &helper, Thumbnailer &thumbnailer);
+
+private:
+    struct Cell {
+        ImTextureID texture;    // NULL until the upload is done
+        TextureRequest request; // 0 once it is
+        int width;
+        int height;
+    };
+
+    std::unordered_map<uint32_t, Cell> cells;
+    std::vector<Thumbnail> arrived;
+    std::vector<uint32_t> wanted;
+    // Photos on screen in the last frame, [firstId, endId)
+    uint32_t firstId = 0;
+    uint32_t endId = 0;
+    float lastScroll = 0.0f;
+    bool scrollingUp = false;
+
+    uint32_t distance(uint32_t id) const;
+    void releaseCell(ImguiVulkanHelper &helper, Cell &cell);
+    void pollUploads(ImguiVulkanHelper &helper);
+    void evict(ImguiVulkanHelper &helper, size_t max);
+    void upload(ImguiVulkanHelper &helper, Thumbnailer &thumbnailer);
+    void drawCell(Thumbnailer &thumbnailer, uint32_t id);
+    void requestMissing(Thumbnailer &thumbnailer, uint32_t count);
+};
+
+#endif
@@ -0,0 +1,404 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <stb_image.h>
+#include "backup_engine.h"
+#include "dir_walker.h"
+#include "media_meta.h"
+#include "thumbnailer.h"
+
+// An EXIF preview larger than this is not a thumbnail, decode the photo instead
+#define EXIF_THUMB_MAX_LEN  (1024 * 1024)
+
+static bool isPhotoName(const char *name)
+{
+    return mediaTypeFromPath(name) == MEDIA_PHOTO;
+}
+
+// Size that fits a w x h picture into THUMB_SIZE, never enlarged
+static void fitThumbnail(int w, int h, int *tw, int *th)
+{
+    if (w <= THUMB_SIZE && h <= THUMB_SIZE) {
+        *tw = w;
+        *th = h;
+    } else if (w >= h) {
+        *tw = THUMB_SIZE;
+        *th = std::max(1, (int)((int64_t)h * THUMB_SIZE / w));
+    } else {
+        *th = THUMB_SIZE;
+        *tw = std::max(1, (int)((int64_t)w * THUMB_SIZE / h));
+    }
+}
+
+/* Box filter: every destination pixel is the mean of the source pixels it
+ * covers, which keeps fine detail from aliasing at the large ratios between
+ * a 24 MP photo and a thumbnail. One pass over the source, rows summed into
+ * a line of accumulators.
+ */
+static void scaleDown(const uint8_t *src, int sw, int sh, uint8_t *dst, int dw, int dh)
+{
+    std::vector<uint32_t> acc(dw * 3);
+    std::vector<int> col(sw);
+    for (int x = 0; x < sw; x++)
+        col[x] = (int)((int64_t)x * dw / sw);
+
+    int sy = 0;
+    for (int dy = 0; dy < dh; dy++) {
+        int y_end = (int)((int64_t)(dy + 1) * sh / dh);
+        std::fill(acc.begin(), acc.end(), 0);
+        int rows = 0;
+        for (; sy < y_end; sy++, rows++) {
+            const uint8_t *p = src + (size_t)sy * sw * 3;
+            for (int x = 0; x < sw; x++, p += 3) {
+                uint32_t *a = &acc[col[x] * 3];
+                a[0] += p[0];
+                a[1] += p[1];
+                a[2] += p[2];
+            }
+        }
+        uint8_t *q = dst + (size_t)dy * dw * 3;
+        for (int dx = 0; dx < dw; dx++) {
+            int x0 = (int)(((int64_t)dx * sw + dw - 1) / dw);
+            int x1 = (int)(((int64_t)(dx + 1) * sw + dw - 1) / dw);
+            uint32_t n = (uint32_t)std::max(1, (x1 - x0) * rows);
+            for (int c = 0; c < 3; c++)
+                q[dx * 3 + c] = (uint8_t)((acc[dx * 3 + c] + n / 2) / n);
+        }
+    }
+}
+
+Thumbnailer::~Thumbnailer()
+{
+    cancel();
+    wait();
+}
+
+bool Thumbnailer::start(const std::string &import_dir, const std::string &output_dir, int workers)
+{
+    cancel();
+    wait();
+
+    importDir = import_dir;
+    while (importDir.size() > 1 && importDir.back() == '/')
+        importDir.pop_back();
+    outputDir = output_dir;
+    // Without a cache thumbnails are still made, just not kept
+    std::string state_dir = outputDir + "/" STATE_DIR;
+    if ((mkdir(state_dir.c_str(), 0755) != 0 && errno != EEXIST) ||
+        !cache.open(state_dir + "/" THUMB_CACHE_FILE))
+        fprintf(stderr, "Thumbnails of %s are not cached.\n", importDir.c_str());
+
+    found = 0;
+    done = 0;
+    cached = 0;
+    failed = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        cancelled = false;
+        files.clear();
+        scanDone = false;
+        warmNext = 0;
+        requests.clear();
+        ready.clear();
+    }
+
+    if (workers < 1)
+        workers = 1;
+    workersLive = workers;
+    for (int i = 0; i < workers; i++)
+        threads.emplace_back(&Thumbnailer::thumbWorker, this);
+    threads.emplace_back(&Thumbnailer::scanWorker, this);
+    return true;
+}
+
+void Thumbnailer::cancel(void)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        cancelled = true;
+    }
+    cond.notify_all();
+}
+
+void Thumbnailer::wait(void)
+{
+    for (auto &t : threads)
+        if (t.joinable())
+            t.join();
+    threads.clear();
+}
+
+// Still walking the import or filling the cache, the workers stay for requests until cancelled
+bool Thumbnailer::isRunning(void)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return workersLive > 0 && (!scanDone || done + failed < files.size());
+}
+
+void Thumbnailer::request(const std::vector<uint32_t> &ids)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        // What no worker took yet is not wanted anymore unless asked again
+        for (uint32_t id : requests)
+            files[id].wanted = false;
+        requests.clear();
+        for (auto it = ids.rbegin(); it != ids.rend(); ++it) {
+            if (*it >= files.size())
+                continue;
+            File &file = files[*it];
+            if (file.wanted || file.inReady || file.failed)
+                continue;
+            file.wanted = true;
+            // A busy one is handed over when its worker finishes
+            if (!file.busy)
+                requests.push_back(*it);
+        }
+    }
+    cond.notify_all();
+}
+
+size_t Thumbnailer::takeReady(std::vector<Thumbnail> &out, size_t max)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t n = 0;
+    while (n < max && !ready.empty()) {
+        files[ready.front().id].inReady = false;
+        out.push_back(std::move(ready.front()));
+        ready.pop_front();
+        n++;
+    }
+    return n;
+}
+
+std::string Thumbnailer::getRelPath(uint32_t id)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return id < files.size() ? files[id].job.relPath : std::string();
+}
+
+bool Thumbnailer::isFailed(uint32_t id)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return id < files.size() && files[id].failed;
+}
+
+uint64_t Thumbnailer::getFound(void) const
+{
+    return found;
+}
+
+uint64_t Thumbnailer::getDone(void) const
+{
+    return done;
+}
+
+uint64_t Thumbnailer::getCached(void) const
+{
+    return cached;
+}
+
+uint64_t Thumbnailer::getFailed(void) const
+{
+    return failed;
+}
+
+void Thumbnailer::scanWorker(void)
+{
+    DirWalkerOptions options;
+    options.threads = 2;
+    options.nameFilter = isPhotoName;
+    options.excludeDir = outputDir;
+
+    DirWalker walker;
+    walker.walk(importDir, options, [this](const WalkEntry &entry) {
+        if (cancelled)
+            return false;
+        File file = {};
+        file.job.relPath = entry.relPath;
+        file.job.size = entry.size;
+        file.job.mtime = entry.mtime;
+        file.job.dev = entry.dev;
+        file.job.inode = entry.inode;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            file.job.id = (uint32_t)files.size();
+            files.push_back(std::move(file));
+            found = files.size();
+        }
+        cond.notify_one();
+        return true;
+    });
+    std::lock_guard<std::mutex> lock(mutex);
+    scanDone = true;
+}
+
+// Requests first, newest most wanted, then the next file the cache does not have
+bool Thumbnailer::nextJob(Job &job, bool *requested)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        if (cancelled)
+            return false;
+        while (!requests.empty()) {
+            File &file = files[requests.back()];
+            requests.pop_back();
+            if (file.busy || !file.wanted)
+                continue;
+            file.busy = true;
+            job = file.job;
+            *requested = true;
+            return true;
+        }
+        while (warmNext < files.size()) {
+            File &file = files[warmNext++];
+            if (file.warm || file.busy)
+                continue;
+            file.busy = true;
+            job = file.job;
+            *requested = false;
+            return true;
+        }
+        cond.wait(lock);
+    }
+}
+
+void Thumbnailer::thumbWorker(void)
+{
+    Job job;
+    std::vector<uint8_t> rgb;
+    bool requested;
+
+    while (nextJob(job, &requested)) {
+        int width = 0, height = 0;
+        bool ok = true, from_cache = true;
+        rgb.clear();
+        // Filling the cache does not need the pixels of what it already has
+        bool skip = !requested && cache.isOpen() && cache.contains(job.dev, job.inode, job.size, job.mtime);
+        if (!skip && !(cache.isOpen() && cache.lookup(job.dev, job.inode, job.size, job.mtime, &width, &height, rgb))) {
+            from_cache = false;
+            ok = makeThumbnail(job, &width, &height, rgb);
+            if (ok && cache.isOpen())
+                cache.append(job.dev, job.inode, job.size, job.mtime, width, height, rgb.data());
+        }
+        finish(job, ok, from_cache, width, height, rgb);
+    }
+    // The last worker out makes the cache durable
+    if (--workersLive == 0)
+        cache.close();
+}
+
+bool Thumbnailer::makeThumbnail(const Job &job, int *width, int *height, std::vector<uint8_t> &rgb)
+{
+    std::string path = importDir + "/" + job.relPath;
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "Open %s failed: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    static thread_local std::vector<uint8_t> head(MEDIA_META_HEAD_LEN);
+    static thread_local std::vector<uint8_t> jpeg;
+    ssize_t n = pread(fd, head.data(), head.size(), 0);
+    int w = 0, h = 0, channels;
+    stbi_uc *pixels = nullptr;
+    uint64_t offset;
+    uint32_t len;
+    if (n > 0 && mediaExifThumbnail(fd, head.data(), n, &offset, &len) && len <= EXIF_THUMB_MAX_LEN) {
+        jpeg.resize(len);
+        if (offset + len <= (uint64_t)n)
+            memcpy(jpeg.data(), head.data() + offset, len);
+        else if (pread(fd, jpeg.data(), len, offset) != (ssize_t)len)
+            jpeg.clear();
+        if (!jpeg.empty())
+            pixels = stbi_load_from_memory(jpeg.data(), (int)jpeg.size(), &w, &h, &channels, 3);
+    }
+    if (pixels == nullptr) {
+        FILE *f = fdopen(fd, "rb");
+        if (f == nullptr) {
+            close(fd);
+            return false;
+        }
+        fd = -1;
+        if (stbi_info_from_file(f, &w, &h, &channels) && (int64_t)w * h <= THUMB_MAX_PIXELS)
+            pixels = stbi_load_from_file(f, &w, &h, &channels, 3);
+        fclose(f);
+    }
+    if (fd >= 0)
+        close(fd);
+    if (pixels == nullptr)
+        return false;
+
+    fitThumbnail(w, h, width, height);
+    rgb.resize((size_t)*width * *height * 3);
+    if (*width == w && *height == h)
+        memcpy(rgb.data(), pixels, rgb.size());
+    else
+        scaleDown(pixels, w, h, rgb.data(), *width, *height);
+    stbi_image_free(pixels);
+    return true;
+}
+
+void Thumbnailer::finish(const Job &job, bool ok, bool from_cache, int width, int height, std::vector<uint8_t> &rgb)
+{
+    bool publish;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        publish = ok && files[job.id].wanted;
+    }
+    // Wanted while it was only checked against the cache
+    if (publish && rgb.empty())
+        publish = cache.lookup(job.dev, job.inode, job.size, job.mtime, &width, &height, rgb);
+
+    Thumbnail thumb;
+    if (publish) {
+        thumb.id = job.id;
+        thumb.relPath = job.relPath;
+        thumb.width = width;
+        thumb.height = height;
+        thumb.rgba.resize((size_t)width * height * 4);
+        for (size_t i = 0, j = 0; i < rgb.size(); i += 3, j += 4) {
+            thumb.rgba[j] = rgb[i];
+            thumb.rgba[j + 1] = rgb[i + 1];
+            thumb.rgba[j + 2] = rgb[i + 2];
+            thumb.rgba[j + 3] = 0xFF;
+        }
+    }
+
+    bool notify = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        File &file = files[job.id];
+        if (!file.warm) {
+            if (!ok) {
+                failed++;
+            } else {
+                done++;
+                if (from_cache)
+                    cached++;
+            }
+        }
+        file.busy = false;
+        file.warm = true;
+        file.failed = !ok;
+        if (file.wanted) {
+            if (publish) {
+                file.wanted = false;
+                file.inReady = true;
+                ready.push_back(std::move(thumb));
+            } else if (ok) {
+                // Asked for after the first look, serve it like any request
+                requests.push_back(job.id);
+                notify = true;
+            } else {
+                file.wanted = false;
+            }
+        }
+    }
+    if (notify)
+        cond.notify_one();
+}
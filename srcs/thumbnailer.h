@@ -0,0 +1,108 @@
+#ifndef _THUMBNAILER_H
+#define _THUMBNAILER_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include "thumb_cache.h"
+
+// Longest edge of a thumbnail in pixels
+#define THUMB_SIZE              256
+// Photos above this many pixels are not decoded, their thumbnail fails unless the EXIF has one
+#define THUMB_MAX_PIXELS        (100 * 1000 * 1000)
+// In the state directory of the output directory
+#define THUMB_CACHE_FILE        "thumbs"
+
+struct Thumbnail {
+    uint32_t id;                // in the order the walker found the files
+    std::string relPath;        // relative to the import directory
+    int width;
+    int height;
+    std::vector<uint8_t> rgba;
+};
+
+/* Makes thumbnails of the photos of an import directory in the background.
+ * A walker numbers the photos in the order it finds them, a pool of workers
+ * takes the preview JPEG of the EXIF when there is one and else decodes the
+ * whole photo with stb_image, then scales it down to fit THUMB_SIZE.
+ * Thumbnails land in a ThumbCache, so the next look at the same card only
+ * reads them back.
+ * Only requested thumbnails come out: request() names the ones the grid is
+ * missing, most wanted first, and replaces whatever the previous call asked
+ * for and no worker took yet, so scrolling past a screen cancels it. With no
+ * request waiting, the workers fill the cache in walk order. The render loop
+ * collects finished ones with takeReady(), which never waits on a worker.
+ */
+class Thumbnailer
+{
+public:
+    ~Thumbnailer();
+
+    // The output directory holds the cache and is not walked when it lies within the import directory
+    bool start(const std::string &import_dir, const std::string &output_dir, int workers = 2);
+    void cancel(void);
+    void wait(void);
+    bool isRunning(void);
+    void request(const std::vector<uint32_t> &ids);
+    // Moves up to max finished thumbnails, oldest first, into out
+    size_t takeReady(std::vector<Thumbnail> &out, size_t max);
+    // Files found so far are numbered 0 to getFound() - 1
+    std::string getRelPath(uint32_t id);
+    bool isFailed(uint32_t id);
+
+    uint64_t getFound(void) const;
+    uint64_t getDone(void) const;
+    uint64_t getCached(void) const;
+    uint64_t getFailed(void) const;
+
+private:
+    struct Job {
+        uint32_t id;
+        std::string relPath;
+        uint64_t size;
+        int64_t mtime;
+        uint64_t dev;
+        uint64_t inode;
+    };
+    struct File {
+        Job job;
+        bool warm;              // its thumbnail is in the cache, or failed
+        bool failed;
+        bool busy;              // a worker has it
+        bool wanted;            // requested and not made yet
+        bool inReady;           // made and not taken by the render loop yet
+    };
+
+    std::string importDir;
+    std::string outputDir;
+    ThumbCache cache;
+    std::vector<std::thread> threads;
+    std::atomic<bool> cancelled{false};
+    std::atomic<int> workersLive{0};
+    std::atomic<uint64_t> found{0};
+    std::atomic<uint64_t> done{0};
+    std::atomic<uint64_t> cached{0};
+    std::atomic<uint64_t> failed{0};
+
+    // Guards everything below, workers sleep on cond when there is nothing to do
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::vector<File> files;
+    bool scanDone = false;
+    size_t warmNext = 0;
+    std::vector<uint32_t> requests;     // most wanted last
+    std::deque<Thumbnail> ready;
+
+    void scanWorker(void);
+    void thumbWorker(void);
+    bool nextJob(Job &job, bool *requested);
+    bool makeThumbnail(const Job &job, int *width, int *height, std::vector<uint8_t> &rgb);
+    void finish(const Job &job, bool ok, bool from_cache, int width, int height, std::vector<uint8_t> &rgb);
+};
+
+#endif
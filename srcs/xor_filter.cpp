@@ -0,0 +1,254 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <string>
+#include <algorithm>
+#include "xor_filter.h"
+
+#define BUILD_MAX_ATTEMPTS  100
+
+static inline uint64_t murmur64(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static inline uint64_t rotl64(uint64_t n, unsigned c)
+{
+    return (n << c) | (n >> (64 - c));
+}
+
+// Maps a 32 bit hash onto [0, n) without a division
+static inline uint32_t reduce(uint32_t hash, uint32_t n)
+{
+    return (uint32_t)(((uint64_t)hash * n) >> 32);
+}
+
+static inline uint8_t fingerprint(uint64_t hash)
+{
+    return (uint8_t)(hash ^ (hash >> 32));
+}
+
+struct SlotIndexes {
+    uint32_t h0, h1, h2;
+};
+
+static inline SlotIndexes slots(uint64_t hash, uint32_t block_length)
+{
+    SlotIndexes s;
+    s.h0 = reduce((uint32_t)hash, block_length);
+    s.h1 = reduce((uint32_t)rotl64(hash, 21), block_length) + block_length;
+    s.h2 = reduce((uint32_t)rotl64(hash, 42), block_length) + 2 * block_length;
+    return s;
+}
+
+static bool writeAll(int fd, const void *data, size_t len)
+{
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool readAll(int fd, void *data, size_t len)
+{
+    uint8_t *p = static_cast<uint8_t *>(data);
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+uint64_t XorFilter::keyFromDigest(const uint8_t *digest)
+{
+    uint64_t key;
+    memcpy(&key, digest, sizeof(key));
+    return key;
+}
+
+/* Every key is xor'ed into three slots, one per block. Slots holding a
+ * single key are peeled off one after the other, and assigning the
+ * fingerprints in reverse peeling order makes the three slots of every key
+ * xor to its fingerprint. With 1.23 slots per key peeling nearly always
+ * succeeds, otherwise it is retried with another seed.
+ */
+bool XorFilter::build(std::vector<uint64_t> &keys)
+{
+    clear();
+    uint64_t source_count = keys.size();
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    if (keys.size() > UINT32_MAX / 2)
+        return false;
+
+    size_t capacity = 32 + (size_t)(1.23 * keys.size());
+    uint32_t block_length = capacity / 3;
+    capacity = (size_t)block_length * 3;
+
+    struct Slot {
+        uint64_t xorMask;
+        uint32_t count;
+    };
+    struct Peeled {
+        uint64_t hash;
+        uint32_t index;
+    };
+    std::vector<Slot> sets(capacity);
+    std::vector<uint32_t> queue;
+    std::vector<Peeled> stack;
+    queue.reserve(capacity);
+    stack.reserve(keys.size());
+
+    uint64_t rng = 0x57415242584F5231ULL;
+    for (int attempt = 0; attempt < BUILD_MAX_ATTEMPTS; attempt++) {
+        rng += 0x9E3779B97F4A7C15ULL;
+        uint64_t try_seed = murmur64(rng);
+
+        std::fill(sets.begin(), sets.end(), Slot{0, 0});
+        for (uint64_t key : keys) {
+            uint64_t hash = murmur64(key + try_seed);
+            SlotIndexes s = slots(hash, block_length);
+            sets[s.h0].xorMask ^= hash;
+            sets[s.h0].count++;
+            sets[s.h1].xorMask ^= hash;
+            sets[s.h1].count++;
+            sets[s.h2].xorMask ^= hash;
+            sets[s.h2].count++;
+        }
+
+        queue.clear();
+        stack.clear();
+        for (uint32_t i = 0; i < capacity; i++)
+            if (sets[i].count == 1)
+                queue.push_back(i);
+        while (!queue.empty()) {
+            uint32_t index = queue.back();
+            queue.pop_back();
+            if (sets[index].count != 1)
+                continue;
+            uint64_t hash = sets[index].xorMask;
+            stack.push_back(Peeled{hash, index});
+            SlotIndexes s = slots(hash, block_length);
+            for (uint32_t h : { s.h0, s.h1, s.h2 }) {
+                sets[h].xorMask ^= hash;
+                if (--sets[h].count == 1)
+                    queue.push_back(h);
+            }
+        }
+        if (stack.size() != keys.size())
+            continue;
+
+        fingerprints.assign(capacity, 0);
+        for (auto it = stack.rbegin(); it != stack.rend(); ++it) {
+            SlotIndexes s = slots(it->hash, block_length);
+            fingerprints[it->index] = 0;
+            fingerprints[it->index] = fingerprint(it->hash) ^ fingerprints[s.h0] ^
+                                      fingerprints[s.h1] ^ fingerprints[s.h2];
+        }
+        seed = try_seed;
+        blockLength = block_length;
+        count = source_count;
+        return true;
+    }
+    return false;
+}
+
+bool XorFilter::contains(uint64_t key) const
+{
+    uint64_t hash = murmur64(key + seed);
+    SlotIndexes s = slots(hash, blockLength);
+    return fingerprint(hash) == (fingerprints[s.h0] ^ fingerprints[s.h1] ^ fingerprints[s.h2]);
+}
+
+bool XorFilter::load(const char *path, uint64_t expect_count)
+{
+    clear();
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    XorFilterHeader header;
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0 && readAll(fd, &header, sizeof(header)) &&
+              memcmp(header.magic, XOR_FILTER_MAGIC, sizeof(header.magic)) == 0 &&
+              header.version == XOR_FILTER_VERSION && header.count == expect_count &&
+              (uint64_t)st.st_size == sizeof(header) + (uint64_t)header.blockLength * 3;
+    if (ok) {
+        fingerprints.resize((size_t)header.blockLength * 3);
+        ok = readAll(fd, fingerprints.data(), fingerprints.size());
+    }
+    close(fd);
+    if (!ok) {
+        clear();
+        return false;
+    }
+    seed = header.seed;
+    blockLength = header.blockLength;
+    count = header.count;
+    return true;
+}
+
+bool XorFilter::save(const char *path) const
+{
+    XorFilterHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, XOR_FILTER_MAGIC, sizeof(header.magic));
+    header.version = XOR_FILTER_VERSION;
+    header.blockLength = blockLength;
+    header.seed = seed;
+    header.count = count;
+
+    // Write next to the target and rename, a crash never leaves a torn filter behind
+    std::string tmp_path = std::string(path) + ".tmp";
+    int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return false;
+    bool ok = writeAll(fd, &header, sizeof(header)) &&
+              writeAll(fd, fingerprints.data(), fingerprints.size()) &&
+              fsync(fd) == 0;
+    close(fd);
+    if (!ok || rename(tmp_path.c_str(), path) != 0) {
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+void XorFilter::clear(void)
+{
+    seed = 0;
+    blockLength = 0;
+    count = 0;
+    fingerprints.clear();
+    fingerprints.shrink_to_fit();
+}
+
+bool XorFilter::isBuilt(void) const
+{
+    return blockLength > 0;
+}
+
+size_t XorFilter::sizeInBytes(void) const
+{
+    return fingerprints.size();
+}
@@ -0,0 +1,48 @@
+#ifndef _XOR_FILTER_H
+#define _XOR_FILTER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#define XOR_FILTER_MAGIC    "WBXOR01"
+#define XOR_FILTER_VERSION  1
+#define XOR_FILTER_SUFFIX   ".wxor"
+
+struct XorFilterHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t blockLength;
+    uint64_t seed;
+    uint64_t count;             // entries of the index it was built from
+};
+
+/* Xor filter with 8 bit fingerprints (Graf and Lemire, 2020): about 9.84
+ * bits per key and a 0.39% false positive rate, with three independent
+ * byte reads per lookup. It is static, built once from a set of unique
+ * keys. A negative answer is always right, a positive one has to be
+ * confirmed by the real index.
+ */
+class XorFilter
+{
+public:
+    // Duplicates are dropped, the keys are reordered
+    bool build(std::vector<uint64_t> &keys);
+    bool contains(uint64_t key) const;
+    bool load(const char *path, uint64_t expect_count);
+    bool save(const char *path) const;
+    void clear(void);
+    bool isBuilt(void) const;
+    size_t sizeInBytes(void) const;
+
+    // Digests are uniformly distributed already, their first 8 bytes make a good key
+    static uint64_t keyFromDigest(const uint8_t *digest);
+
+private:
+    uint64_t seed = 0;
+    uint32_t blockLength = 0;
+    uint64_t count = 0;
+    std::vector<uint8_t> fingerprints;
+};
+
+#endif
@@ -0,0 +1,492 @@
+#include <string.h>
+#include "cpu_features.h"
+#include "xxh3.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define XXH3_X86
+#endif
+
+#define PRIME32_1           0x9E3779B1U
+#define PRIME32_2           0x85EBCA77U
+#define PRIME32_3           0xC2B2AE3DU
+#define PRIME64_1           0x9E3779B185EBCA87ULL
+#define PRIME64_2           0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3           0x165667B19E3779F9ULL
+#define PRIME64_4           0x85EBCA77C2B2AE63ULL
+#define PRIME64_5           0x27D4EB2F165667C5ULL
+#define PRIME_MX1           0x165667919E3779F9ULL
+#define PRIME_MX2           0x9FB21C651E98DF25ULL
+
+#define SECRET_LEN          192
+#define STRIPES_PER_BLOCK   ((SECRET_LEN - XXH3_STRIPE_LEN) / 8)
+#define SCRAMBLE_OFFSET     (SECRET_LEN - XXH3_STRIPE_LEN)
+#define LASTACC_OFFSET      (SECRET_LEN - XXH3_STRIPE_LEN - 7)
+#define MERGEACCS_OFFSET    11
+#define MIDSIZE_MAX         240
+#define MIDSIZE_LASTOFFSET  (136 - 17)
+
+static const uint8_t kSecret[SECRET_LEN] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+    0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+    0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+    0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+    0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+    0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+    0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+    0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+    0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+typedef void (*AccumulateFn)(uint64_t *acc, const uint8_t *data, size_t stripes, const uint8_t *secret);
+typedef void (*ScrambleFn)(uint64_t *acc, const uint8_t *secret);
+
+static inline uint32_t readLE32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t readLE64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t mul128Fold64(uint64_t a, uint64_t b)
+{
+    __uint128_t product = (__uint128_t)a * b;
+    return (uint64_t)product ^ (uint64_t)(product >> 64);
+}
+
+static inline uint64_t xxh64Avalanche(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+static inline uint64_t xxh3Avalanche(uint64_t h)
+{
+    h ^= h >> 37;
+    h *= PRIME_MX1;
+    h ^= h >> 32;
+    return h;
+}
+
+static inline uint64_t rrmxmx(uint64_t h, uint64_t len)
+{
+    h ^= rotl64(h, 49) ^ rotl64(h, 24);
+    h *= PRIME_MX2;
+    h ^= (h >> 35) + len;
+    h *= PRIME_MX2;
+    return h ^ (h >> 28);
+}
+
+static inline uint64_t mix16B(const uint8_t *in, const uint8_t *secret)
+{
+    return mul128Fold64(readLE64(in) ^ readLE64(secret), readLE64(in + 8) ^ readLE64(secret + 8));
+}
+
+static uint64_t hashShort(const uint8_t *in, size_t len)
+{
+    const uint8_t *s = kSecret;
+
+    if (len == 0)
+        return xxh64Avalanche(readLE64(s + 56) ^ readLE64(s + 64));
+    if (len <= 3) {
+        uint32_t combined = ((uint32_t)in[0] << 16) | ((uint32_t)in[len >> 1] << 24) |
+                            (uint32_t)in[len - 1] | ((uint32_t)len << 8);
+        uint64_t bitflip = readLE32(s) ^ readLE32(s + 4);
+        return xxh64Avalanche((uint64_t)combined ^ bitflip);
+    }
+    if (len <= 8) {
+        uint64_t bitflip = readLE64(s + 8) ^ readLE64(s + 16);
+        uint64_t input64 = readLE32(in + len - 4) + ((uint64_t)readLE32(in) << 32);
+        return rrmxmx(input64 ^ bitflip, len);
+    }
+    if (len <= 16) {
+        uint64_t lo = readLE64(in) ^ (readLE64(s + 24) ^ readLE64(s + 32));
+        uint64_t hi = readLE64(in + len - 8) ^ (readLE64(s + 40) ^ readLE64(s + 48));
+        uint64_t acc = len + __builtin_bswap64(lo) + hi + mul128Fold64(lo, hi);
+        return xxh3Avalanche(acc);
+    }
+    if (len <= 128) {
+        uint64_t acc = len * PRIME64_1;
+        if (len > 32) {
+            if (len > 64) {
+                if (len > 96) {
+                    acc += mix16B(in + 48, s + 96);
+                    acc += mix16B(in + len - 64, s + 112);
+                }
+                acc += mix16B(in + 32, s + 64);
+                acc += mix16B(in + len - 48, s + 80);
+            }
+            acc += mix16B(in + 16, s + 32);
+            acc += mix16B(in + len - 32, s + 48);
+        }
+        acc += mix16B(in, s);
+        acc += mix16B(in + len - 16, s + 16);
+        return xxh3Avalanche(acc);
+    }
+
+    // 129 to 240 bytes
+    uint64_t acc = len * PRIME64_1;
+    size_t rounds = len / 16;
+    for (size_t i = 0; i < 8; i++)
+        acc += mix16B(in + 16 * i, s + 16 * i);
+    acc = xxh3Avalanche(acc);
+    for (size_t i = 8; i < rounds; i++)
+        acc += mix16B(in + 16 * i, s + 16 * (i - 8) + 3);
+    acc += mix16B(in + len - 16, s + MIDSIZE_LASTOFFSET);
+    return xxh3Avalanche(acc);
+}
+
+static void accumulateScalar(uint64_t *acc, const uint8_t *data, size_t stripes, const uint8_t *secret)
+{
+    for (size_t n = 0; n < stripes; n++) {
+        for (int i = 0; i < 8; i++) {
+            uint64_t data_val = readLE64(data + 8 * i);
+            uint64_t data_key = data_val ^ readLE64(secret + 8 * i);
+            acc[i ^ 1] += data_val;
+            acc[i] += (data_key & 0xFFFFFFFFULL) * (data_key >> 32);
+        }
+        data += XXH3_STRIPE_LEN;
+        secret += 8;
+    }
+}
+
+static void scrambleScalar(uint64_t *acc, const uint8_t *secret)
+{
+    for (int i = 0; i < 8; i++) {
+        uint64_t a = acc[i];
+        a ^= a >> 47;
+        a ^= readLE64(secret + 8 * i);
+        a *= PRIME32_1;
+        acc[i] = a;
+    }
+}
+
+#ifdef XXH3_X86
+__attribute__((target("sse2")))
+static void accumulateSse2(uint64_t *acc, const uint8_t *data, size_t stripes, const uint8_t *secret)
+{
+    __m128i a[4];
+    for (int i = 0; i < 4; i++)
+        a[i] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(acc) + i);
+    for (size_t n = 0; n < stripes; n++) {
+        for (int i = 0; i < 4; i++) {
+            __m128i data_vec = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data) + i);
+            __m128i key_vec = _mm_loadu_si128(reinterpret_cast<const __m128i *>(secret) + i);
+            __m128i data_key = _mm_xor_si128(data_vec, key_vec);
+            __m128i data_key_lo = _mm_shuffle_epi32(data_key, _MM_SHUFFLE(0, 3, 0, 1));
+            __m128i product = _mm_mul_epu32(data_key, data_key_lo);
+            __m128i data_swap = _mm_shuffle_epi32(data_vec, _MM_SHUFFLE(1, 0, 3, 2));
+            a[i] = _mm_add_epi64(a[i], _mm_add_epi64(product, data_swap));
+        }
+        data += XXH3_STRIPE_LEN;
+        secret += 8;
+    }
+    for (int i = 0; i < 4; i++)
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(acc) + i, a[i]);
+}
+
+__attribute__((target("sse2")))
+static void scrambleSse2(uint64_t *acc, const uint8_t *secret)
+{
+    const __m128i prime = _mm_set1_epi32((int)PRIME32_1);
+    for (int i = 0; i < 4; i++) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(acc) + i);
+        a = _mm_xor_si128(a, _mm_srli_epi64(a, 47));
+        a = _mm_xor_si128(a, _mm_loadu_si128(reinterpret_cast<const __m128i *>(secret) + i));
+        __m128i a_hi = _mm_shuffle_epi32(a, _MM_SHUFFLE(0, 3, 0, 1));
+        __m128i prod_lo = _mm_mul_epu32(a, prime);
+        __m128i prod_hi = _mm_mul_epu32(a_hi, prime);
+        a = _mm_add_epi64(prod_lo, _mm_slli_epi64(prod_hi, 32));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(acc) + i, a);
+    }
+}
+
+__attribute__((target("avx2")))
+static void accumulateAvx2(uint64_t *acc, const uint8_t *data, size_t stripes, const uint8_t *secret)
+{
+    __m256i a0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(acc));
+    __m256i a1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(acc) + 1);
+    for (size_t n = 0; n < stripes; n++) {
+        __m256i d0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data));
+        __m256i d1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data) + 1);
+        __m256i k0 = _mm256_xor_si256(d0, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(secret)));
+        __m256i k1 = _mm256_xor_si256(d1, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(secret) + 1));
+        __m256i p0 = _mm256_mul_epu32(k0, _mm256_srli_epi64(k0, 32));
+        __m256i p1 = _mm256_mul_epu32(k1, _mm256_srli_epi64(k1, 32));
+        a0 = _mm256_add_epi64(a0, _mm256_add_epi64(p0, _mm256_shuffle_epi32(d0, _MM_SHUFFLE(1, 0, 3, 2))));
+        a1 = _mm256_add_epi64(a1, _mm256_add_epi64(p1, _mm256_shuffle_epi32(d1, _MM_SHUFFLE(1, 0, 3, 2))));
+        data += XXH3_STRIPE_LEN;
+        secret += 8;
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(acc), a0);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(acc) + 1, a1);
+}
+
+__attribute__((target("avx2")))
+static void scrambleAvx2(uint64_t *acc, const uint8_t *secret)
+{
+    const __m256i prime = _mm256_set1_epi32((int)PRIME32_1);
+    for (int i = 0; i < 2; i++) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(acc) + i);
+        a = _mm256_xor_si256(a, _mm256_srli_epi64(a, 47));
+        a = _mm256_xor_si256(a, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(secret) + i));
+        __m256i prod_lo = _mm256_mul_epu32(a, prime);
+        __m256i prod_hi = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), prime);
+        a = _mm256_add_epi64(prod_lo, _mm256_slli_epi64(prod_hi, 32));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(acc) + i, a);
+    }
+}
+
+// GCC 12 warns about _mm512_undefined_epi32() inside its own intrinsics
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+__attribute__((target("avx512f,avx512bw")))
+static void accumulateAvx512(uint64_t *acc, const uint8_t *data, size_t stripes, const uint8_t *secret)
+{
+    // One stripe is exactly one zmm register
+    __m512i a = _mm512_loadu_si512(acc);
+    for (size_t n = 0; n < stripes; n++) {
+        __m512i d = _mm512_loadu_si512(data);
+        __m512i k = _mm512_xor_si512(d, _mm512_loadu_si512(secret));
+        __m512i p = _mm512_mul_epu32(k, _mm512_srli_epi64(k, 32));
+        a = _mm512_add_epi64(a, _mm512_add_epi64(p, _mm512_shuffle_epi32(d, (_MM_PERM_ENUM)_MM_SHUFFLE(1, 0, 3, 2))));
+        data += XXH3_STRIPE_LEN;
+        secret += 8;
+    }
+    _mm512_storeu_si512(acc, a);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void scrambleAvx512(uint64_t *acc, const uint8_t *secret)
+{
+    const __m512i prime = _mm512_set1_epi32((int)PRIME32_1);
+    __m512i a = _mm512_loadu_si512(acc);
+    // a ^ (a >> 47) ^ key in a single ternary logic op
+    a = _mm512_ternarylogic_epi32(a, _mm512_srli_epi64(a, 47), _mm512_loadu_si512(secret), 0x96);
+    __m512i prod_lo = _mm512_mul_epu32(a, prime);
+    __m512i prod_hi = _mm512_mul_epu32(_mm512_srli_epi64(a, 32), prime);
+    _mm512_storeu_si512(acc, _mm512_add_epi64(prod_lo, _mm512_slli_epi64(prod_hi, 32)));
+}
+#pragma GCC diagnostic pop
+#endif
+
+static Xxh3Kernel currentKernel = XXH3_KERNEL_AUTO;
+static AccumulateFn accumulate = accumulateScalar;
+static ScrambleFn scramble = scrambleScalar;
+
+static void selectKernel(void)
+{
+    if (currentKernel == XXH3_KERNEL_AUTO)
+        xxh3SetKernel(XXH3_KERNEL_AUTO);
+}
+
+bool xxh3SetKernel(Xxh3Kernel kernel)
+{
+#ifdef XXH3_X86
+    const CpuFeatures &cpu = cpuFeatures();
+    if (kernel == XXH3_KERNEL_AUTO)
+        kernel = cpu.avx512 ? XXH3_KERNEL_AVX512 : cpu.avx2 ? XXH3_KERNEL_AVX2 : XXH3_KERNEL_SSE2;
+
+    switch (kernel) {
+    case XXH3_KERNEL_AVX512:
+        if (!cpu.avx512)
+            return false;
+        accumulate = accumulateAvx512;
+        scramble = scrambleAvx512;
+        break;
+    case XXH3_KERNEL_AVX2:
+        if (!cpu.avx2)
+            return false;
+        accumulate = accumulateAvx2;
+        scramble = scrambleAvx2;
+        break;
+    case XXH3_KERNEL_SSE2:
+        accumulate = accumulateSse2;
+        scramble = scrambleSse2;
+        break;
+    default:
+        kernel = XXH3_KERNEL_SCALAR;
+        accumulate = accumulateScalar;
+        scramble = scrambleScalar;
+        break;
+    }
+#else
+    if (kernel != XXH3_KERNEL_AUTO && kernel != XXH3_KERNEL_SCALAR)
+        return false;
+    kernel = XXH3_KERNEL_SCALAR;
+#endif
+    currentKernel = kernel;
+    return true;
+}
+
+Xxh3Kernel xxh3GetKernel(void)
+{
+    selectKernel();
+    return currentKernel;
+}
+
+const char *xxh3KernelName(Xxh3Kernel kernel)
+{
+    switch (kernel) {
+    case XXH3_KERNEL_SCALAR:
+        return "scalar";
+    case XXH3_KERNEL_SSE2:
+        return "sse2";
+    case XXH3_KERNEL_AVX2:
+        return "avx2";
+    case XXH3_KERNEL_AVX512:
+        return "avx512";
+    default:
+        return "auto";
+    }
+}
+
+static const uint64_t kInitAcc[8] = {
+    PRIME32_3, PRIME64_1, PRIME64_2, PRIME64_3, PRIME64_4, PRIME32_2, PRIME64_5, PRIME32_1
+};
+
+/* Feeds whole stripes, scrambling at every block boundary. Callers only pass
+ * stripes that are followed by at least one more input byte, which is exactly
+ * the set of stripes the one-shot algorithm accumulates before its last stripe.
+ */
+static void consumeStripes(uint64_t *acc, size_t *stripes_in_block, const uint8_t *data, size_t stripes)
+{
+    while (stripes > 0) {
+        size_t n = STRIPES_PER_BLOCK - *stripes_in_block;
+        if (n > stripes)
+            n = stripes;
+        accumulate(acc, data, n, kSecret + *stripes_in_block * 8);
+        *stripes_in_block += n;
+        data += n * XXH3_STRIPE_LEN;
+        stripes -= n;
+        if (*stripes_in_block == STRIPES_PER_BLOCK) {
+            scramble(acc, kSecret + SCRAMBLE_OFFSET);
+            *stripes_in_block = 0;
+        }
+    }
+}
+
+static uint64_t finishLong(uint64_t *acc, const uint8_t *last_stripe, uint64_t len)
+{
+    accumulate(acc, last_stripe, 1, kSecret + LASTACC_OFFSET);
+    uint64_t result = len * PRIME64_1;
+    for (int i = 0; i < 4; i++)
+        result += mul128Fold64(acc[2 * i] ^ readLE64(kSecret + MERGEACCS_OFFSET + 16 * i),
+                               acc[2 * i + 1] ^ readLE64(kSecret + MERGEACCS_OFFSET + 16 * i + 8));
+    return xxh3Avalanche(result);
+}
+
+uint64_t xxh3_64(const void *data, size_t len)
+{
+    const uint8_t *in = static_cast<const uint8_t *>(data);
+    if (len <= MIDSIZE_MAX)
+        return hashShort(in, len);
+
+    selectKernel();
+    uint64_t acc[8];
+    size_t stripes_in_block = 0;
+    memcpy(acc, kInitAcc, sizeof(acc));
+    consumeStripes(acc, &stripes_in_block, in, (len - 1) / XXH3_STRIPE_LEN);
+    return finishLong(acc, in + len - XXH3_STRIPE_LEN, len);
+}
+
+void Xxh3State::init(void)
+{
+    selectKernel();
+    memcpy(acc, kInitAcc, sizeof(acc));
+    totalLen = 0;
+    bufferedLen = 0;
+    stripesInBlock = 0;
+    longInput = false;
+}
+
+void Xxh3State::update(const void *data, size_t len)
+{
+    const uint8_t *in = static_cast<const uint8_t *>(data);
+
+    totalLen += len;
+    if (!longInput) {
+        // Keep everything until the input is known to take the long path
+        size_t n = XXH3_BUFFER_LEN - bufferedLen;
+        if (n > len)
+            n = len;
+        memcpy(buffer + bufferedLen, in, n);
+        bufferedLen += n;
+        in += n;
+        len -= n;
+        if (len == 0)
+            return;
+        longInput = true;
+        consumeStripes(acc, &stripesInBlock, buffer, XXH3_BUFFER_LEN / XXH3_STRIPE_LEN);
+        memcpy(lastStripe, buffer + XXH3_BUFFER_LEN - XXH3_STRIPE_LEN, XXH3_STRIPE_LEN);
+        bufferedLen = 0;
+    }
+
+    if (bufferedLen > 0) {
+        size_t n = XXH3_STRIPE_LEN - bufferedLen;
+        if (n > len)
+            n = len;
+        memcpy(buffer + bufferedLen, in, n);
+        bufferedLen += n;
+        in += n;
+        len -= n;
+        if (len == 0)
+            return;
+        consumeStripes(acc, &stripesInBlock, buffer, 1);
+        memcpy(lastStripe, buffer, XXH3_STRIPE_LEN);
+        bufferedLen = 0;
+    }
+
+    // Bulk of a large update goes straight from the caller's buffer
+    if (len > XXH3_STRIPE_LEN) {
+        size_t stripes = (len - 1) / XXH3_STRIPE_LEN;
+        consumeStripes(acc, &stripesInBlock, in, stripes);
+        memcpy(lastStripe, in + (stripes - 1) * XXH3_STRIPE_LEN, XXH3_STRIPE_LEN);
+        in += stripes * XXH3_STRIPE_LEN;
+        len -= stripes * XXH3_STRIPE_LEN;
+    }
+    memcpy(buffer, in, len);
+    bufferedLen = len;
+}
+
+uint64_t Xxh3State::digest(void)
+{
+    if (!longInput)
+        return xxh3_64(buffer, bufferedLen);
+
+    // The last stripe is the final 64 input bytes, partly from the previous stripe
+    uint8_t tail[XXH3_STRIPE_LEN];
+    size_t keep = XXH3_STRIPE_LEN - bufferedLen;
+    memcpy(tail, lastStripe + bufferedLen, keep);
+    memcpy(tail + keep, buffer, bufferedLen);
+    uint64_t a[8];
+    memcpy(a, acc, sizeof(a));
+    return finishLong(a, tail, totalLen);
+}
+
+void Xxh3State::final(uint8_t out[XXH3_DIGEST_LEN])
+{
+    uint64_t h = digest();
+    for (int i = 0; i < XXH3_DIGEST_LEN; i++)
+        out[i] = (uint8_t)(h >> (56 - 8 * i));
+}
@@ -0,0 +1,46 @@
+#ifndef _XXH3_H
+#define _XXH3_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define XXH3_DIGEST_LEN     8
+#define XXH3_STRIPE_LEN     64
+#define XXH3_BUFFER_LEN     256
+
+/* XXH3 64-bit with the default secret and seed 0, the same value
+ * `xxhsum -H3' prints. Long inputs run through a stripe accumulator that
+ * is dispatched at runtime to a scalar, SSE2, AVX2 or AVX-512 kernel.
+ */
+enum Xxh3Kernel {
+    XXH3_KERNEL_AUTO = 0,
+    XXH3_KERNEL_SCALAR,
+    XXH3_KERNEL_SSE2,
+    XXH3_KERNEL_AVX2,
+    XXH3_KERNEL_AVX512
+};
+
+// Not thread safe, pick a kernel before any worker starts hashing
+bool xxh3SetKernel(Xxh3Kernel kernel);
+Xxh3Kernel xxh3GetKernel(void);
+const char *xxh3KernelName(Xxh3Kernel kernel);
+
+uint64_t xxh3_64(const void *data, size_t len);
+
+struct Xxh3State {
+    uint64_t acc[8];
+    uint64_t totalLen;
+    size_t bufferedLen;
+    size_t stripesInBlock;
+    bool longInput;
+    uint8_t buffer[XXH3_BUFFER_LEN];
+    uint8_t lastStripe[XXH3_STRIPE_LEN];
+
+    void init(void);
+    void update(const void *data, size_t len);
+    uint64_t digest(void);
+    // Canonical big-endian form, as printed in hex by xxhsum
+    void final(uint8_t digest[XXH3_DIGEST_LEN]);
+};
+
+#endif